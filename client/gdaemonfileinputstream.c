@@ -52,6 +52,7 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/mman.h>
 
 #include <glib.h>
 #include <glib/gstdio.h>
@@ -63,9 +64,21 @@
 #include "gvfsdaemondbus.h"
 #include <gvfsdaemonprotocol.h>
 #include <gvfsfileinfo.h>
+#include <gsysutils.h>
 
 #define MAX_READ_SIZE (4*1024*1024)
 
+/* Once this many reads have happened without a seek in between we
+   consider the access sequential and keep extra READ requests in
+   flight so the daemon works while the application processes data. */
+#define READ_AHEAD_MIN_SEQUENTIAL 2
+#define READ_AHEAD_MAX_REQUESTS 4
+#define READ_AHEAD_BUFFER_SIZE (64*1024)
+
+/* Size of the ring for the shared memory transfer mode, which is set
+   up together with read-ahead, that is for sequential reads */
+#define SHM_RING_SIZE (1024*1024)
+
 typedef enum {
   INPUT_STATE_IN_REPLY_HEADER,
   INPUT_STATE_IN_BLOCK
@@ -85,7 +98,8 @@ typedef enum {
   READ_STATE_HANDLE_INPUT_BLOCK,
   READ_STATE_SKIP_BLOCK,
   READ_STATE_HANDLE_HEADER,
-  READ_STATE_READ_BLOCK
+  READ_STATE_READ_BLOCK,
+  READ_STATE_READ_AHEAD_BLOCK
 } ReadState;
 
 typedef struct {
@@ -189,11 +203,17 @@ typedef struct {
   gboolean io_cancelled;
 } IOOperationData;
 
+/* Data that was read from the socket but not yet handed out to the
+   application, either because it arrived while doing something else
+   (like a query_info) or because the application reads in smaller
+   chunks than the daemon sends. */
 typedef struct {
   char *data;
+  gsize size;
+  gsize start;
   gsize len;
   int seek_generation;
-} PreRead;
+} ReadAheadBuffer;
 
 typedef StateOp (*state_machine_iterator) (GDaemonFileInputStream *file,
 					   IOOperationData *io_op,
@@ -210,7 +230,23 @@ struct _GDaemonFileInputStream {
   guint32 seq_nr;
   goffset current_offset;
 
-  GList *pre_reads;
+  ReadAheadBuffer read_ahead;
+  guint32 read_ahead_seq_nrs[READ_AHEAD_MAX_REQUESTS];
+  guint n_read_ahead_seq_nrs;
+  guint sequential_reads;
+  gboolean read_ahead_eof;
+  GError *read_ahead_error;
+
+  /* Shared memory transfer mode */
+  char *shm;
+  gsize shm_size;
+  gboolean shm_tried;
+  guint32 shm_pos;
+  /* Not yet consumed part of the last shm block */
+  char *shm_block;
+  gsize shm_block_len;
+  guint32 shm_block_pos;
+  int shm_block_seek_generation;
   
   InputState input_state;
   gsize input_block_size;
@@ -286,10 +322,178 @@ G_DEFINE_TYPE (GDaemonFileInputStream, g_daemon_file_input_stream,
 	       G_TYPE_FILE_INPUT_STREAM)
 
 static void
-pre_read_free (PreRead *pre)
+read_ahead_buffer_clear (ReadAheadBuffer *buffer)
+{
+  buffer->start = 0;
+  buffer->len = 0;
+}
+
+/* Make sure there is room for at least @size more bytes */
+static void
+read_ahead_buffer_reserve (ReadAheadBuffer *buffer,
+			   gsize size)
+{
+  char *data;
+  gsize new_size, first;
+
+  if (buffer->size - buffer->len >= size)
+    return;
+
+  new_size = MAX (buffer->size, READ_AHEAD_BUFFER_SIZE);
+  while (new_size - buffer->len < size)
+    new_size *= 2;
+
+  /* Linearize the contents into the new buffer */
+  data = g_malloc (new_size);
+  first = MIN (buffer->len, buffer->size - buffer->start);
+  if (first > 0)
+    memcpy (data, buffer->data + buffer->start, first);
+  if (buffer->len > first)
+    memcpy (data + first, buffer->data, buffer->len - first);
+
+  g_free (buffer->data);
+  buffer->data = data;
+  buffer->size = new_size;
+  buffer->start = 0;
+}
+
+/* Returns the contiguous free space after the buffered data */
+static char *
+read_ahead_buffer_get_space (ReadAheadBuffer *buffer,
+			     gsize *size)
+{
+  gsize end;
+
+  end = (buffer->start + buffer->len) % MAX (buffer->size, 1);
+  if (end < buffer->start || buffer->len == buffer->size)
+    *size = buffer->size - buffer->len;
+  else
+    *size = buffer->size - end;
+  
+  return buffer->data + end;
+}
+
+static void
+read_ahead_buffer_commit (ReadAheadBuffer *buffer,
+			  gsize size)
+{
+  g_assert (buffer->len + size <= buffer->size);
+  buffer->len += size;
+}
+
+static gsize
+read_ahead_buffer_consume (ReadAheadBuffer *buffer,
+			   char *dest,
+			   gsize size)
 {
-  g_free (pre->data);
-  g_free (pre);
+  gsize len, chunk;
+
+  len = MIN (size, buffer->len);
+  chunk = MIN (len, buffer->size - buffer->start);
+  memcpy (dest, buffer->data + buffer->start, chunk);
+  if (len > chunk)
+    memcpy (dest + chunk, buffer->data, len - chunk);
+
+  buffer->start = (buffer->start + len) % buffer->size;
+  buffer->len -= len;
+  if (buffer->len == 0)
+    buffer->start = 0;
+
+  return len;
+}
+
+/* Called for every reply with a seq_nr, returns TRUE if it was the
+   answer to one of the READ requests we have outstanding */
+static gboolean
+read_ahead_reply_received (GDaemonFileInputStream *file,
+			   guint32 seq_nr)
+{
+  guint i;
+
+  for (i = 0; i < file->n_read_ahead_seq_nrs; i++)
+    {
+      if (file->read_ahead_seq_nrs[i] == seq_nr)
+	{
+	  file->n_read_ahead_seq_nrs--;
+	  memmove (&file->read_ahead_seq_nrs[i],
+		   &file->read_ahead_seq_nrs[i + 1],
+		   (file->n_read_ahead_seq_nrs - i) * sizeof (guint32));
+	  return TRUE;
+	}
+    }
+  return FALSE;
+}
+
+static void
+shm_publish_consumed (GDaemonFileInputStream *file)
+{
+  GVfsDaemonSocketProtocolShmHeader *header;
+
+  header = (GVfsDaemonSocketProtocolShmHeader *)file->shm;
+  if (file->shm_block_len > 0)
+    g_atomic_int_set (&header->consumed, file->shm_block_pos);
+  else
+    g_atomic_int_set (&header->consumed, file->shm_pos);
+}
+
+/* Called for a SHM_DATA reply, returns where the data is and moves our
+   position in the ring past it */
+static char *
+shm_get_block (GDaemonFileInputStream *file,
+	       gsize size,
+	       guint32 *pos)
+{
+  guint32 ring_size, start;
+
+  ring_size = file->shm_size - G_VFS_DAEMON_SOCKET_PROTOCOL_SHM_HEADER_SIZE;
+  start = _g_vfs_shm_block_start (file->shm_pos, ring_size, size);
+  file->shm_pos = start + size;
+  if (pos)
+    *pos = start;
+  
+  return file->shm + G_VFS_DAEMON_SOCKET_PROTOCOL_SHM_HEADER_SIZE +
+    (start & (ring_size - 1));
+}
+
+/* Skip a SHM_DATA block we're not interested in */
+static void
+shm_skip_block (GDaemonFileInputStream *file,
+		gsize size)
+{
+  shm_get_block (file, size, NULL);
+  shm_publish_consumed (file);
+}
+
+static gsize
+shm_block_consume (GDaemonFileInputStream *file,
+		   char *dest,
+		   gsize size)
+{
+  gsize len;
+
+  len = MIN (size, file->shm_block_len);
+  memcpy (dest, file->shm_block, len);
+  file->shm_block += len;
+  file->shm_block_len -= len;
+  file->shm_block_pos += len;
+  shm_publish_consumed (file);
+  
+  return len;
+}
+
+static void
+read_ahead_reset (GDaemonFileInputStream *file)
+{
+  read_ahead_buffer_clear (&file->read_ahead);
+  if (file->shm_block_len > 0)
+    {
+      file->shm_block_len = 0;
+      shm_publish_consumed (file);
+    }
+  file->n_read_ahead_seq_nrs = 0;
+  file->sequential_reads = 0;
+  file->read_ahead_eof = FALSE;
+  g_clear_error (&file->read_ahead_error);
 }
 
 static void
@@ -315,13 +519,11 @@ g_daemon_file_input_stream_finalize (GObject *object)
   if (file->data_stream)
     g_object_unref (file->data_stream);
 
-  while (file->pre_reads)
-    {
-      PreRead *pre = file->pre_reads->data;
-      file->pre_reads = g_list_delete_link (file->pre_reads,
-					    file->pre_reads);
-      pre_read_free (pre);
-    }
+  g_free (file->read_ahead.data);
+  if (file->read_ahead_error)
+    g_error_free (file->read_ahead_error);
+  if (file->shm)
+    munmap (file->shm, file->shm_size);
   
   g_string_free (file->input_buffer, TRUE);
   g_string_free (file->output_buffer, TRUE);
@@ -417,6 +619,78 @@ append_request (GDaemonFileInputStream *stream, guint32 command,
 		       (char *)&cmd, G_VFS_DAEMON_SOCKET_PROTOCOL_REQUEST_SIZE);
 }
 
+static void
+append_read_request (GDaemonFileInputStream *stream,
+		     gsize size)
+{
+  guint32 seq_nr;
+
+  g_assert (stream->n_read_ahead_seq_nrs < READ_AHEAD_MAX_REQUESTS);
+  
+  append_request (stream, G_VFS_DAEMON_SOCKET_PROTOCOL_REQUEST_READ,
+		  size, 0, 0, &seq_nr);
+  stream->read_ahead_seq_nrs[stream->n_read_ahead_seq_nrs++] = seq_nr;
+}
+
+/* Queue extra READ requests for sequential readers so that the next
+   blocks are already on their way while the current one is consumed */
+static void
+read_ahead_fill (GDaemonFileInputStream *stream,
+		 gsize size)
+{
+  guint window;
+  
+  if (stream->read_ahead_eof ||
+      stream->read_ahead_error != NULL ||
+      stream->sequential_reads < READ_AHEAD_MIN_SEQUENTIAL)
+    return;
+
+  window = MIN (stream->sequential_reads - READ_AHEAD_MIN_SEQUENTIAL + 1,
+		READ_AHEAD_MAX_REQUESTS);
+  
+  while (stream->n_read_ahead_seq_nrs < window)
+    append_read_request (stream, size);
+}
+
+/* Hand the daemon a shared memory region so that it can send read data
+   without copying it through the socket. The request is written
+   directly, as the fd has to go in a separate sendmsg() */
+static void
+shm_setup (GDaemonFileInputStream *file)
+{
+  void *shm;
+  int fd, socket_fd;
+  gsize size;
+
+  if (file->output_buffer->len != 0)
+    return;
+  
+  file->shm_tried = TRUE;
+  
+  size = G_VFS_DAEMON_SOCKET_PROTOCOL_SHM_HEADER_SIZE + SHM_RING_SIZE;
+  fd = _g_shm_create (size, &shm);
+  if (fd == -1)
+    return;
+
+  append_request (file, G_VFS_DAEMON_SOCKET_PROTOCOL_REQUEST_SET_SHM,
+		  size, 0, 1, NULL);
+  socket_fd = g_unix_output_stream_get_fd (G_UNIX_OUTPUT_STREAM (file->command_stream));
+  
+  if (g_output_stream_write_all (file->command_stream,
+				 file->output_buffer->str, file->output_buffer->len,
+				 NULL, NULL, NULL) &&
+      _g_socket_send_fd (socket_fd, fd) == 1)
+    {
+      file->shm = shm;
+      file->shm_size = size;
+    }
+  else
+    munmap (shm, size);
+
+  g_string_truncate (file->output_buffer, 0);
+  close (fd);
+}
+
 static gsize
 get_reply_header_missing_bytes (GString *buffer)
 {
@@ -545,19 +819,22 @@ run_sync_state_machine (GDaemonFileInputStream *file,
 
 /* read cycle:
 
-   if we know of a (partially read) matching outstanding block, read from it
-   create packet, append to outgoing
+   if we have buffered read-ahead data with same seek gen, return it
+   if we know of a (partially read) matching outstanding block, or have
+    a read request outstanding, read from that, otherwise create packet,
+    append to outgoing
+   if the reads are sequential, append more read requests to outgoing
    flush outgoing
    start processing input, looking for a data block with same seek gen,
-    or an error with same seq nr
-   on cancel, send cancel command and go back to loop
+    or an error with the seq nr of an outstanding read
+   on cancel, send cancel command for the oldest read and go back to loop
  */
 
 static StateOp
 iterate_read_state_machine (GDaemonFileInputStream *file, IOOperationData *io_op, ReadOperation *op)
 {
   gsize len;
-  PreRead *pre;
+  char *space;
 
   while (TRUE)
     {
@@ -566,53 +843,64 @@ iterate_read_state_machine (GDaemonFileInputStream *file, IOOperationData *io_op
 	  /* Initial state for read op */
 	case READ_STATE_INIT:
 
-	  while (file->pre_reads)
+	  /* Data is served in the order it arrived: first the rest of a
+	     shm block, then the read-ahead buffer */
+	  if (file->shm_block_len > 0)
 	    {
-	      pre = file->pre_reads->data;
-	      if (file->seek_generation != pre->seek_generation)
+	      if (file->shm_block_seek_generation == file->seek_generation)
 		{
-		  file->pre_reads = g_list_delete_link (file->pre_reads,
-							file->pre_reads);
-		  pre_read_free (pre);
+		  op->ret_val = shm_block_consume (file, op->buffer, op->buffer_size);
+		  op->ret_error = NULL;
+		  return STATE_OP_DONE;
 		}
-	      else
+	      file->shm_block_len = 0;
+	      shm_publish_consumed (file);
+	    }
+	  
+	  if (file->read_ahead.len > 0)
+	    {
+	      if (file->read_ahead.seek_generation == file->seek_generation)
 		{
-		  len = MIN (op->buffer_size, pre->len);
-		  memcpy (op->buffer, pre->data, len);
-		  op->ret_val = len;
+		  op->ret_val = read_ahead_buffer_consume (&file->read_ahead,
+							   op->buffer,
+							   op->buffer_size);
 		  op->ret_error = NULL;
-
-		  if (len < pre->len)
-		    {
-		      memmove (pre->data, pre->data + len, pre->len - len);
-		      pre->len -= len;
-		    }
-		  else
-		    {
-		      file->pre_reads = g_list_delete_link (file->pre_reads,
-							    file->pre_reads);
-		      pre_read_free (pre);
-		    }
-		  
 		  return STATE_OP_DONE;
 		}
+	      read_ahead_buffer_clear (&file->read_ahead);
 	    }
-	  
-	  
-	  /* If we're already reading some data, but we didn't read all, just use that
-	     and don't even send a request */
-	  if (file->input_state == INPUT_STATE_IN_BLOCK &&
-	      file->seek_generation == file->input_block_seek_generation)
+
+	  /* A read-ahead request failed, report it in order */
+	  if (file->read_ahead_error)
 	    {
-	      op->state = READ_STATE_READ_BLOCK;
-	      io_op->io_buffer = op->buffer;
-	      io_op->io_size = MIN (op->buffer_size, file->input_block_size);
-	      io_op->io_allow_cancel = TRUE; /* Allow cancel before we sent request */
-	      return STATE_OP_READ;
+	      op->ret_val = -1;
+	      op->ret_error = file->read_ahead_error;
+	      file->read_ahead_error = NULL;
+	      return STATE_OP_DONE;
 	    }
 
-	  append_request (file, G_VFS_DAEMON_SOCKET_PROTOCOL_REQUEST_READ,
-			  op->buffer_size, 0, 0, &op->seq_nr);
+	  file->sequential_reads++;
+
+	  if (!file->shm_tried &&
+	      file->sequential_reads >= READ_AHEAD_MIN_SEQUENTIAL)
+	    shm_setup (file);
+	  
+	  /* If we're already reading some data, but we didn't read all, or
+	     some earlier request is still outstanding just use that and
+	     don't send a request for this read */
+	  if (!(file->input_state == INPUT_STATE_IN_BLOCK &&
+		file->seek_generation == file->input_block_seek_generation) &&
+	      file->n_read_ahead_seq_nrs == 0)
+	    append_read_request (file, op->buffer_size);
+
+	  read_ahead_fill (file, op->buffer_size);
+
+	  if (file->output_buffer->len == 0)
+	    {
+	      op->state = READ_STATE_HANDLE_INPUT;
+	      break;
+	    }
+	  
 	  op->state = READ_STATE_WROTE_COMMAND;
 	  io_op->io_buffer = file->output_buffer->str;
 	  io_op->io_size = file->output_buffer->len;
@@ -647,9 +935,12 @@ iterate_read_state_machine (GDaemonFileInputStream *file, IOOperationData *io_op
 
 	  /* No op */
 	case READ_STATE_HANDLE_INPUT:
-	  if (io_op->cancelled && !op->sent_cancel)
+	  if (io_op->cancelled && !op->sent_cancel &&
+	      file->n_read_ahead_seq_nrs > 0)
 	    {
+	      /* Cancel the oldest request, that is the one we're waiting for */
 	      op->sent_cancel = TRUE;
+	      op->seq_nr = file->read_ahead_seq_nrs[0];
 	      append_request (file, G_VFS_DAEMON_SOCKET_PROTOCOL_REQUEST_CANCEL,
 			      op->seq_nr, 0, 0, NULL);
 	      op->state = READ_STATE_WROTE_COMMAND;
@@ -677,7 +968,23 @@ iterate_read_state_machine (GDaemonFileInputStream *file, IOOperationData *io_op
 	  g_assert (file->input_state == INPUT_STATE_IN_BLOCK);
 	  
 	  if (file->seek_generation ==
-	      file->input_block_seek_generation)
+	      file->input_block_seek_generation &&
+	      file->sequential_reads >= READ_AHEAD_MIN_SEQUENTIAL &&
+	      op->buffer_size < file->input_block_size)
+	    {
+	      /* Small reads of a big block, pull in as much as we can in
+		 one go and hand it out from the read-ahead buffer */
+	      read_ahead_buffer_reserve (&file->read_ahead, READ_AHEAD_BUFFER_SIZE);
+	      file->read_ahead.seek_generation = file->input_block_seek_generation;
+	      space = read_ahead_buffer_get_space (&file->read_ahead, &len);
+	      op->state = READ_STATE_READ_AHEAD_BLOCK;
+	      io_op->io_buffer = space;
+	      io_op->io_size = MIN (len, file->input_block_size);
+	      io_op->io_allow_cancel = FALSE;
+	      return STATE_OP_READ;
+	    }
+	  else if (file->seek_generation ==
+		   file->input_block_seek_generation)
 	    {
 	      op->state = READ_STATE_READ_BLOCK;
 	      io_op->io_buffer = op->buffer;
@@ -747,7 +1054,7 @@ iterate_read_state_machine (GDaemonFileInputStream *file, IOOperationData *io_op
 	    data = decode_reply (file->input_buffer, &reply);
 
 	    if (reply.type == G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_ERROR &&
-		reply.seq_nr == op->seq_nr)
+		read_ahead_reply_received (file, reply.seq_nr))
 	      {
 		op->ret_val = -1;
 		decode_error (&reply, data, &op->ret_error);
@@ -756,6 +1063,7 @@ iterate_read_state_machine (GDaemonFileInputStream *file, IOOperationData *io_op
 	      }
 	    else if (reply.type == G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_DATA)
 	      {
+		read_ahead_reply_received (file, reply.seq_nr);
 		g_string_truncate (file->input_buffer, 0);
 		file->input_state = INPUT_STATE_IN_BLOCK;
 		file->input_block_size = reply.arg1;
@@ -763,6 +1071,26 @@ iterate_read_state_machine (GDaemonFileInputStream *file, IOOperationData *io_op
 		op->state = READ_STATE_HANDLE_INPUT_BLOCK;
 		break;
 	      }
+	    else if (reply.type == G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_SHM_DATA &&
+		     file->shm != NULL)
+	      {
+		read_ahead_reply_received (file, reply.seq_nr);
+		g_string_truncate (file->input_buffer, 0);
+		
+		if (reply.arg2 == file->seek_generation)
+		  {
+		    file->shm_block = shm_get_block (file, reply.arg1, &file->shm_block_pos);
+		    file->shm_block_len = reply.arg1;
+		    file->shm_block_seek_generation = reply.arg2;
+		    op->ret_val = shm_block_consume (file, op->buffer, op->buffer_size);
+		    op->ret_error = NULL;
+		    return STATE_OP_DONE;
+		  }
+		
+		shm_skip_block (file, reply.arg1);
+		op->state = READ_STATE_HANDLE_HEADER;
+		break;
+	      }
 	    /* Ignore other reply types */
 	  }
 
@@ -791,10 +1119,30 @@ iterate_read_state_machine (GDaemonFileInputStream *file, IOOperationData *io_op
 	      if (file->input_block_size == 0)
 		file->input_state = INPUT_STATE_IN_REPLY_HEADER;
 	    }
+	  else if (file->input_block_size == 0)
+	    {
+	      /* Zero sized block means EOF, stop reading ahead */
+	      file->input_state = INPUT_STATE_IN_REPLY_HEADER;
+	      file->read_ahead_eof = TRUE;
+	    }
 	  
 	  op->ret_val = io_op->io_res;
 	  op->ret_error = NULL;
 	  return STATE_OP_DONE;
+
+	  /* Read block data into read-ahead buffer */
+	case READ_STATE_READ_AHEAD_BLOCK:
+	  g_assert (io_op->io_res <= file->input_block_size);
+	  file->input_block_size -= io_op->io_res;
+	  if (file->input_block_size == 0)
+	    file->input_state = INPUT_STATE_IN_REPLY_HEADER;
+	  read_ahead_buffer_commit (&file->read_ahead, io_op->io_res);
+	  
+	  op->ret_val = read_ahead_buffer_consume (&file->read_ahead,
+						   op->buffer,
+						   op->buffer_size);
+	  op->ret_error = NULL;
+	  return STATE_OP_DONE;
 	  
 	default:
 	  g_assert_not_reached ();
@@ -873,14 +1221,8 @@ iterate_close_state_machine (GDaemonFileInputStream *file, IOOperationData *io_o
 	  /* Initial state for read op */
 	case CLOSE_STATE_INIT:
 
-	  /* Clear any pre-read data blocks */
-	  while (file->pre_reads)
-	    {
-	      PreRead *pre = file->pre_reads->data;
-	      file->pre_reads = g_list_delete_link (file->pre_reads,
-						    file->pre_reads);
-	      pre_read_free (pre);
-	    }
+	  /* Clear any read-ahead data */
+	  read_ahead_reset (file);
 	  
 	  append_request (file, G_VFS_DAEMON_SOCKET_PROTOCOL_REQUEST_CLOSE,
 			  0, 0, 0, &op->seq_nr);
@@ -1021,6 +1363,9 @@ iterate_close_state_machine (GDaemonFileInputStream *file, IOOperationData *io_o
 		op->state = CLOSE_STATE_HANDLE_INPUT_BLOCK;
 		break;
 	      }
+	    else if (reply.type == G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_SHM_DATA &&
+		     file->shm != NULL)
+	      shm_skip_block (file, reply.arg1);
 	    else if (reply.type == G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_CLOSED)
 	      {
 		op->ret_val = TRUE;
@@ -1156,14 +1501,9 @@ iterate_seek_state_machine (GDaemonFileInputStream *file, IOOperationData *io_op
 	    file->seek_generation++;
 	  op->sent_seek = TRUE;
 	  
-	  /* Clear any pre-read data blocks */
-	  while (file->pre_reads)
-	    {
-	      PreRead *pre = file->pre_reads->data;
-	      file->pre_reads = g_list_delete_link (file->pre_reads,
-						    file->pre_reads);
-	      pre_read_free (pre);
-	    }
+	  /* Clear any read-ahead data, the rest of the outstanding
+	     reads will be skipped as they have the old seek generation */
+	  read_ahead_reset (file);
 	  
 	  if (io_op->io_res < file->output_buffer->len)
 	    {
@@ -1285,6 +1625,9 @@ iterate_seek_state_machine (GDaemonFileInputStream *file, IOOperationData *io_op
 		op->state = SEEK_STATE_HANDLE_INPUT_BLOCK;
 		break;
 	      }
+	    else if (reply.type == G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_SHM_DATA &&
+		     file->shm != NULL)
+	      shm_skip_block (file, reply.arg1);
 	    else if (reply.type == G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_SEEK_POS)
 	      {
 		op->ret_val = TRUE;
@@ -1447,9 +1790,15 @@ iterate_query_state_machine (GDaemonFileInputStream *file,
 	  if (file->seek_generation ==
 	      file->input_block_seek_generation)
 	    {
+	      /* Keep the data for the next read */
+	      if (file->read_ahead.seek_generation != file->input_block_seek_generation)
+		read_ahead_buffer_clear (&file->read_ahead);
+	      file->read_ahead.seek_generation = file->input_block_seek_generation;
+	      read_ahead_buffer_reserve (&file->read_ahead, file->input_block_size);
+	      
 	      op->state = QUERY_STATE_READ_BLOCK;
-	      io_op->io_buffer = g_malloc (file->input_block_size); 
-	      io_op->io_size = file->input_block_size;
+	      io_op->io_buffer = read_ahead_buffer_get_space (&file->read_ahead, &len);
+	      io_op->io_size = MIN (len, file->input_block_size);
 	      io_op->io_allow_cancel = FALSE;
 	      return STATE_OP_READ;
 	    }
@@ -1484,29 +1833,19 @@ iterate_query_state_machine (GDaemonFileInputStream *file,
 	case QUERY_STATE_READ_BLOCK:
 	  if (io_op->io_cancelled)
 	    {
-	      g_free (io_op->io_buffer);
 	      op->state = QUERY_STATE_HANDLE_INPUT;
 	      break;
 	    }
 	  
 	  if (io_op->io_res > 0)
 	    {
-	      PreRead *pre;
-	      
 	      g_assert (io_op->io_res <= file->input_block_size);
 	      file->input_block_size -= io_op->io_res;
 	      if (file->input_block_size == 0)
 		file->input_state = INPUT_STATE_IN_REPLY_HEADER;
 
-	      pre = g_new (PreRead, 1);
-	      pre->data = io_op->io_buffer;
-	      pre->len = io_op->io_res;
-	      pre->seek_generation = file->input_block_seek_generation;
-
-	      file->pre_reads = g_list_append (file->pre_reads, pre);
+	      read_ahead_buffer_commit (&file->read_ahead, io_op->io_res);
 	    }
-	  else
-	    g_free (io_op->io_buffer);
 	  
 	  op->state = QUERY_STATE_HANDLE_INPUT;
 	  break;
@@ -1553,8 +1892,16 @@ iterate_query_state_machine (GDaemonFileInputStream *file,
 		g_string_truncate (file->input_buffer, 0);
 		return STATE_OP_DONE;
 	      }
+	    else if (reply.type == G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_ERROR &&
+		     read_ahead_reply_received (file, reply.seq_nr))
+	      {
+		/* Failed read-ahead, report on the next read */
+		if (file->read_ahead_error == NULL)
+		  decode_error (&reply, data, &file->read_ahead_error);
+	      }
 	    else if (reply.type == G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_DATA)
 	      {
+		read_ahead_reply_received (file, reply.seq_nr);
 		g_string_truncate (file->input_buffer, 0);
 		file->input_state = INPUT_STATE_IN_BLOCK;
 		file->input_block_size = reply.arg1;
@@ -1562,6 +1909,36 @@ iterate_query_state_machine (GDaemonFileInputStream *file,
 		op->state = QUERY_STATE_HANDLE_INPUT_BLOCK;
 		break;
 	      }
+	    else if (reply.type == G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_SHM_DATA &&
+		     file->shm != NULL)
+	      {
+		char *block;
+		gsize space;
+		
+		read_ahead_reply_received (file, reply.seq_nr);
+		block = shm_get_block (file, reply.arg1, NULL);
+		
+		/* Keep the data for the next read */
+		if (reply.arg2 == file->seek_generation)
+		  {
+		    if (file->read_ahead.seek_generation != reply.arg2)
+		      read_ahead_buffer_clear (&file->read_ahead);
+		    file->read_ahead.seek_generation = reply.arg2;
+		    read_ahead_buffer_reserve (&file->read_ahead, reply.arg1);
+		    
+		    len = reply.arg1;
+		    while (len > 0)
+		      {
+			char *dest = read_ahead_buffer_get_space (&file->read_ahead, &space);
+			space = MIN (space, len);
+			memcpy (dest, block, space);
+			read_ahead_buffer_commit (&file->read_ahead, space);
+			block += space;
+			len -= space;
+		      }
+		  }
+		shm_publish_consumed (file);
+	      }
 	    else if (reply.type == G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_INFO)
 	      {
 		op->info = gvfs_file_info_demarshal (data, reply.arg2);
@@ -30,6 +30,7 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/mman.h>
 
 #include <glib.h>
 #include <glib/gstdio.h>
@@ -41,9 +42,15 @@
 #include "gvfsdaemondbus.h"
 #include <gvfsdaemonprotocol.h>
 #include <gvfsfileinfo.h>
+#include <gsysutils.h>
 
 #define MAX_WRITE_SIZE (4*1024*1024)
 
+/* Writes at least this large set up the shared memory transfer mode,
+   writes up to the ring size then go through shared memory */
+#define SHM_MIN_WRITE_SIZE (64*1024)
+#define SHM_RING_SIZE (1024*1024)
+
 typedef enum {
   STATE_OP_DONE,
   STATE_OP_READ,
@@ -71,6 +78,7 @@ typedef struct {
   GError *ret_error;
   
   gboolean sent_cancel;
+  gboolean sent_shm;
   
   guint32 seq_nr;
 } WriteOperation;
@@ -168,7 +176,12 @@ struct _GDaemonFileOutputStream {
   GString *output_buffer;
 
   char *etag;
-  
+
+  /* Shared memory transfer mode */
+  char *shm;
+  gsize shm_size;
+  gboolean shm_tried;
+  gboolean shm_enabled; /* The daemon mapped it */
 };
 
 static gssize     g_daemon_file_output_stream_write             (GOutputStream        *stream,
@@ -251,6 +264,9 @@ g_daemon_file_output_stream_finalize (GObject *object)
   g_string_free (file->output_buffer, TRUE);
 
   g_free (file->etag);
+
+  if (file->shm)
+    munmap (file->shm, file->shm_size);
   
   if (G_OBJECT_CLASS (g_daemon_file_output_stream_parent_class)->finalize)
     (*G_OBJECT_CLASS (g_daemon_file_output_stream_parent_class)->finalize) (object);
@@ -338,6 +354,45 @@ append_request (GDaemonFileOutputStream *stream, guint32 command,
 		       (char *)&cmd, G_VFS_DAEMON_SOCKET_PROTOCOL_REQUEST_SIZE);
 }
 
+/* Hand the daemon a shared memory region that we can place write data
+   in. The request is written directly, as the fd has to go in a
+   separate sendmsg(). */
+static void
+shm_setup (GDaemonFileOutputStream *file)
+{
+  void *shm;
+  int fd, socket_fd;
+  gsize size;
+
+  if (file->output_buffer->len != 0)
+    return;
+  
+  file->shm_tried = TRUE;
+  
+  size = G_VFS_DAEMON_SOCKET_PROTOCOL_SHM_HEADER_SIZE + SHM_RING_SIZE;
+  fd = _g_shm_create (size, &shm);
+  if (fd == -1)
+    return;
+
+  append_request (file, G_VFS_DAEMON_SOCKET_PROTOCOL_REQUEST_SET_SHM,
+		  size, 0, 1, NULL);
+  socket_fd = g_unix_output_stream_get_fd (G_UNIX_OUTPUT_STREAM (file->command_stream));
+  
+  if (g_output_stream_write_all (file->command_stream,
+				 file->output_buffer->str, file->output_buffer->len,
+				 NULL, NULL, NULL) &&
+      _g_socket_send_fd (socket_fd, fd) == 1)
+    {
+      file->shm = shm;
+      file->shm_size = size;
+    }
+  else
+    munmap (shm, size);
+
+  g_string_truncate (file->output_buffer, 0);
+  close (fd);
+}
+
 static gsize
 get_reply_header_missing_bytes (GString *buffer)
 {
@@ -487,8 +542,24 @@ iterate_write_state_machine (GDaemonFileOutputStream *file, IOOperationData *io_
 	{
 	  /* Initial state for read op */
 	case WRITE_STATE_INIT:
-	  append_request (file, G_VFS_DAEMON_SOCKET_PROTOCOL_REQUEST_WRITE,
-			  op->buffer_size, 0, op->buffer_size, &op->seq_nr);
+	  if (file->shm_enabled &&
+	      op->buffer_size <= SHM_RING_SIZE)
+	    {
+	      /* We wait for the reply, so the ring is free to reuse */
+	      memcpy (file->shm + G_VFS_DAEMON_SOCKET_PROTOCOL_SHM_HEADER_SIZE,
+		      op->buffer, op->buffer_size);
+	      append_request (file, G_VFS_DAEMON_SOCKET_PROTOCOL_REQUEST_SHM_WRITE,
+			      op->buffer_size, 0, 0, &op->seq_nr);
+	      op->sent_shm = TRUE;
+	    }
+	  else
+	    {
+	      if (!file->shm_tried &&
+		  op->buffer_size >= SHM_MIN_WRITE_SIZE)
+		shm_setup (file);
+	      append_request (file, G_VFS_DAEMON_SOCKET_PROTOCOL_REQUEST_WRITE,
+			      op->buffer_size, 0, op->buffer_size, &op->seq_nr);
+	    }
 	  op->state = WRITE_STATE_WROTE_COMMAND;
 	  io_op->io_buffer = file->output_buffer->str;
 	  io_op->io_size = file->output_buffer->len;
@@ -499,6 +570,10 @@ iterate_write_state_machine (GDaemonFileOutputStream *file, IOOperationData *io_
 	case WRITE_STATE_WROTE_COMMAND:
 	  if (io_op->io_cancelled)
 	    {
+	      /* Nothing was sent, don't let a later op send a request
+		 pointing to data in the ring that will be overwritten */
+	      if (op->sent_shm)
+		g_string_truncate (file->output_buffer, 0);
 	      op->ret_val = -1;
 	      g_set_error_literal (&op->ret_error,
 				   G_IO_ERROR,
@@ -519,7 +594,7 @@ iterate_write_state_machine (GDaemonFileOutputStream *file, IOOperationData *io_
 	  g_string_truncate (file->output_buffer, 0);
 
 	  op->buffer_pos = 0;
-	  if (op->sent_cancel)
+	  if (op->sent_cancel || op->sent_shm)
 	    op->state = WRITE_STATE_HANDLE_INPUT;
 	  else
 	    op->state = WRITE_STATE_SEND_DATA;
@@ -590,6 +665,9 @@ iterate_write_state_machine (GDaemonFileOutputStream *file, IOOperationData *io_
 	      }
 	    else if (reply.type == G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_WRITTEN)
 	      {
+		if (file->shm != NULL &&
+		    (reply.arg2 & G_VFS_DAEMON_SOCKET_PROTOCOL_WRITTEN_SHM))
+		  file->shm_enabled = TRUE;
 		op->ret_val = reply.arg1;
 		g_string_truncate (file->input_buffer, 0);
 		return STATE_OP_DONE;
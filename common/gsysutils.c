@@ -30,10 +30,12 @@
 #endif
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/mman.h>
 #include <stdio.h>
 #include <string.h>
 #include <strings.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #ifdef HAVE_SYS_UIO_H
 #include <sys/uio.h>
@@ -77,8 +79,10 @@ _g_socket_send_fd (int connection_fd,
 }
 
 /* receive a file descriptor over file descriptor fd */
-int 
-_g_socket_receive_fd (int socket_fd)
+static int
+socket_receive_fd (int       socket_fd,
+		   int       flags,
+		   gboolean *would_block)
 {
   struct msghdr msg;
   struct iovec iov[1];
@@ -96,9 +100,14 @@ _g_socket_receive_fd (int socket_fd)
   msg.msg_control = ccmsg;
   msg.msg_controllen = sizeof (ccmsg);
   
-  rv = recvmsg (socket_fd, &msg, 0);
+  rv = recvmsg (socket_fd, &msg, flags);
   if (rv == -1) 
     {
+      if (would_block && (errno == EAGAIN || errno == EWOULDBLOCK))
+	{
+	  *would_block = TRUE;
+	  return -1;
+	}
       perror ("recvmsg");
       return -1;
     }
@@ -116,6 +125,22 @@ _g_socket_receive_fd (int socket_fd)
   return *(int*)CMSG_DATA(cmsg);
 }
 
+int
+_g_socket_receive_fd (int socket_fd)
+{
+  return socket_receive_fd (socket_fd, 0, NULL);
+}
+
+/* Like _g_socket_receive_fd(), but sets @would_block instead of
+ * waiting when nothing has been sent yet. */
+int
+_g_socket_try_receive_fd (int       socket_fd,
+			  gboolean *would_block)
+{
+  *would_block = FALSE;
+  return socket_receive_fd (socket_fd, MSG_DONTWAIT, would_block);
+}
+
 int
 _g_socket_connect (const char *address,
 		   GError **error)
@@ -179,3 +204,40 @@ _g_socket_connect (const char *address,
 
   return fd;
 }
+
+/* Creates an anonymous shared memory file of @size bytes and maps it.
+ * The size is sealed, so the daemon can map it without risking SIGBUS.
+ * Returns the fd, or -1 if not supported.
+ */
+int
+_g_shm_create (gsize size,
+	       void **mapping)
+{
+#if defined(HAVE_MEMFD_CREATE) && defined(G_VFS_SHM_SEALS)
+  void *shm;
+  int fd;
+
+  fd = memfd_create ("gvfs-stream", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd == -1)
+    return -1;
+
+  if (ftruncate (fd, size) != 0 ||
+      fcntl (fd, F_ADD_SEALS, G_VFS_SHM_SEALS) != 0)
+    {
+      close (fd);
+      return -1;
+    }
+
+  shm = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (shm == MAP_FAILED)
+    {
+      close (fd);
+      return -1;
+    }
+
+  *mapping = shm;
+  return fd;
+#else
+  return -1;
+#endif
+}
@@ -24,14 +24,24 @@
 #define __G_SYS_UTILS_H__
 
 #include <glib.h>
+#include <fcntl.h>
 
 G_BEGIN_DECLS
 
+/* Seals a shared memory fd must carry, see _g_shm_create() */
+#ifdef F_ADD_SEALS
+#define G_VFS_SHM_SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)
+#endif
+
 int _g_socket_send_fd    (int          socket_fd,
 			  int          fd);
 int _g_socket_receive_fd (int          socket_fd);
+int _g_socket_try_receive_fd (int       socket_fd,
+			      gboolean *would_block);
 int _g_socket_connect    (const char  *address,
 			  GError     **error);
+int _g_shm_create        (gsize        size,
+			  void       **mapping);
 
 G_END_DECLS
 
@@ -616,3 +616,22 @@ _g_dbus_append_attribute_info_list (DBusMessageIter         *iter,
   if (!dbus_message_iter_close_container (iter, &array_iter))
     _g_dbus_oom ();
 }
+
+/* Returns the stream position where a shared memory block of @size bytes
+ * written at @pos starts. Blocks are never split over the end of the ring,
+ * instead the rest of the ring is skipped. @ring_size must be a power of
+ * two so positions stay valid when they wrap around.
+ */
+guint32
+_g_vfs_shm_block_start (guint32 pos,
+			guint32 ring_size,
+			guint32 size)
+{
+  guint32 offset;
+
+  offset = pos & (ring_size - 1);
+  if (offset + size > ring_size)
+    pos += ring_size - offset;
+  
+  return pos;
+}
@@ -71,6 +71,7 @@ G_BEGIN_DECLS
 #define G_VFS_DBUS_DAEMON_PATH "/org/gtk/vfs/Daemon"
 #define G_VFS_DBUS_OP_GET_CONNECTION "GetConnection"
 #define G_VFS_DBUS_OP_CANCEL "Cancel"
+#define G_VFS_DBUS_OP_GET_JOB_STATS "GetJobStats"
 
 /* Used by the dbus-proxying implementation of GMoutOperation */
 #define G_VFS_DBUS_MOUNT_OPERATION_INTERFACE "org.gtk.vfs.MountOperation"
@@ -128,6 +129,8 @@ typedef struct {
 #define G_VFS_DAEMON_SOCKET_PROTOCOL_REQUEST_SEEK_SET 4
 #define G_VFS_DAEMON_SOCKET_PROTOCOL_REQUEST_SEEK_END 5
 #define G_VFS_DAEMON_SOCKET_PROTOCOL_REQUEST_QUERY_INFO 6
+#define G_VFS_DAEMON_SOCKET_PROTOCOL_REQUEST_SET_SHM 7
+#define G_VFS_DAEMON_SOCKET_PROTOCOL_REQUEST_SHM_WRITE 8
 
 /*
 read, readahead reply:
@@ -142,6 +145,34 @@ type, code, size, data (size bytes, 2 strings: domain, message)
 info:
 type,    0, size, data 
 
+shm data reply:
+type, seek_generation, size
+
+Shared memory transfer mode:
+
+To avoid copying large payloads through the socket the client can hand
+the channel a shared memory region (a memfd). It sends a SET_SHM request
+with arg1 set to the size of the region and data_len 1, the data byte
+carries the fd as SCM_RIGHTS. SET_SHM gets no reply, and is ignored if the
+channel can't map the region.
+
+The region starts with a GVfsDaemonSocketProtocolShmHeader, followed by
+a ring of (size - G_VFS_DAEMON_SOCKET_PROTOCOL_SHM_HEADER_SIZE) bytes,
+which must be a power of two.
+
+A read channel then places read data directly in the ring and sends a
+SHM_DATA reply instead of DATA. Blocks are stored in reply order at the
+running stream position, except that a block never wraps: if it doesn't
+fit before the end of the ring it starts at the beginning of the ring
+(see _g_vfs_shm_block_start()). The client stores the stream position up
+to which it consumed data in the consumed field of the header, and the
+daemon falls back to normal DATA replies when there is no room.
+
+A write channel that has a region sets G_VFS_DAEMON_SOCKET_PROTOCOL_WRITTEN_SHM
+in arg2 of its WRITTEN replies. The client may then use SHM_WRITE requests
+with arg1 the size and arg2 the offset of the data in the ring. The ring
+must not be reused until the WRITTEN reply for the request arrived.
+
 */
 
 typedef struct {
@@ -159,6 +190,20 @@ typedef struct {
 #define G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_WRITTEN  3
 #define G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_CLOSED   4
 #define G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_INFO     5
+#define G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_SHM_DATA 6
+
+#define G_VFS_DAEMON_SOCKET_PROTOCOL_WRITTEN_SHM 1
+
+typedef struct {
+  volatile gint consumed; /* stream position, written by the reader */
+} GVfsDaemonSocketProtocolShmHeader;
+
+#define G_VFS_DAEMON_SOCKET_PROTOCOL_SHM_HEADER_SIZE 64
+#define G_VFS_DAEMON_SOCKET_PROTOCOL_SHM_MAX_SIZE (64*1024*1024)
+
+guint32    _g_vfs_shm_block_start                (guint32                     pos,
+						  guint32                     ring_size,
+						  guint32                     size);
 
 #define G_FILE_INFO_INNER_TYPE_AS_STRING         \
   DBUS_TYPE_ARRAY_AS_STRING			 \
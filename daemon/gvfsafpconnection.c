@@ -749,6 +749,29 @@ get_request_id (GVfsAfpConnection *afp_connection)
   return priv->request_id++;
 }
 
+/* Used when the server doesn't advertise kRequestQuanta */
+#define DEFAULT_REQUEST_QUANTA (128 * 1024)
+
+/*
+ * g_vfs_afp_connection_get_max_request_size:
+ *
+ * Returns: the largest DSI request the server accepts, including the AFP
+ * command header.
+ */
+guint32
+g_vfs_afp_connection_get_max_request_size (GVfsAfpConnection *afp_connection)
+{
+  GVfsAfpConnectionPrivate *priv;
+
+  g_return_val_if_fail (G_IS_VFS_AFP_CONNECTION (afp_connection), 0);
+
+  priv = afp_connection->priv;
+  if (priv->kRequestQuanta == (guint32)-1 || priv->kRequestQuanta == 0)
+    return DEFAULT_REQUEST_QUANTA;
+
+  return priv->kRequestQuanta;
+}
+
 static void
 run_loop (GVfsAfpConnection *afp_connection)
 {
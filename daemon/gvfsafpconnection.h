@@ -360,6 +360,8 @@ gboolean           g_vfs_afp_connection_close             (GVfsAfpConnection *af
                                                            GCancellable      *cancellable,
                                                            GError            **error);
 
+guint32            g_vfs_afp_connection_get_max_request_size (GVfsAfpConnection *afp_connection);
+
 gboolean           g_vfs_afp_connection_send_command_sync (GVfsAfpConnection *afp_connection,
                                                            GVfsAfpCommand    *afp_command,
                                                            GCancellable      *cancellable,
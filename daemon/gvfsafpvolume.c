@@ -20,6 +20,7 @@
  * Author: Carl-Anton Ingmarsson <ca.ingmarsson@gmail.com>
  */
 
+#include <string.h>
 #include <glib/gi18n.h>
 
 #include "gvfsafpserver.h"
@@ -30,6 +31,31 @@
 
 G_DEFINE_TYPE (GVfsAfpVolume, g_vfs_afp_volume, G_TYPE_OBJECT);
 
+/* How long cached file and directory parameters are used without asking the
+ * server again, other clients can change the volume behind our back */
+#define FILEDIR_CACHE_TTL (10 * G_USEC_PER_SEC)
+#define FILEDIR_CACHE_MAX_ENTRIES 4096
+
+/* Always requested so that cached entries can resolve directory IDs */
+#define FILEDIR_CACHE_ID_BITMAP (AFP_FILEDIR_BITMAP_PARENT_DIR_ID_BIT | \
+                                 AFP_FILEDIR_BITMAP_NODE_ID_BIT)
+
+typedef struct
+{
+  GFileInfo *info;
+  gboolean directory;
+  /* The parameters in info that are still valid */
+  guint16 bitmap;
+  gint64 time;
+} FileDirCacheEntry;
+
+typedef struct
+{
+  char *path;
+  /* Set once the fork was modified */
+  gboolean written;
+} ForkEntry;
+
 struct _GVfsAfpVolumePrivate
 {
   GVfsAfpServer *server;
@@ -37,8 +63,30 @@ struct _GVfsAfpVolumePrivate
 
   guint16 attributes;
   guint16 volume_id;
+
+  /* path -> FileDirCacheEntry */
+  GHashTable *filedir_cache;
+  guint cache_generation;
+  /* fork refnum -> ForkEntry */
+  GHashTable *fork_paths;
 };
 
+static void
+filedir_cache_entry_free (FileDirCacheEntry *entry)
+{
+  g_object_unref (entry->info);
+
+  g_slice_free (FileDirCacheEntry, entry);
+}
+
+static void
+fork_entry_free (ForkEntry *entry)
+{
+  g_free (entry->path);
+
+  g_slice_free (ForkEntry, entry);
+}
+
 static void
 g_vfs_afp_volume_init (GVfsAfpVolume *volume)
 {
@@ -47,12 +95,22 @@ g_vfs_afp_volume_init (GVfsAfpVolume *volume)
   volume->priv = priv = G_TYPE_INSTANCE_GET_PRIVATE (volume, G_VFS_TYPE_AFP_VOLUME,
                                                      GVfsAfpVolumePrivate);
   priv->mounted = FALSE;
+
+  priv->filedir_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                               (GDestroyNotify)filedir_cache_entry_free);
+  priv->cache_generation = 0;
+  priv->fork_paths = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                            NULL, (GDestroyNotify)fork_entry_free);
 }
 
 static void
 g_vfs_afp_volume_finalize (GObject *object)
 {
-  /* TODO: Add deinitalization code here */
+  GVfsAfpVolume *volume = G_VFS_AFP_VOLUME (object);
+  GVfsAfpVolumePrivate *priv = volume->priv;
+
+  g_hash_table_destroy (priv->filedir_cache);
+  g_hash_table_destroy (priv->fork_paths);
 
   G_OBJECT_CLASS (g_vfs_afp_volume_parent_class)->finalize (object);
 }
@@ -169,6 +227,199 @@ g_vfs_afp_volume_get_id (GVfsAfpVolume *volume)
   return priv->volume_id; 
 }
 
+/*
+ * File and directory parameters cache
+ *
+ * Every command addresses files by path from the volume root, and creating
+ * or renaming also needs the ID of the parent directory. Replies to
+ * FPGetFileDirParms and FPEnumerate are cached by path so those lookups
+ * don't each cost a round trip. Commands that modify the volume invalidate
+ * the entries they affect before they are sent, and bump a generation
+ * counter so replies to requests sent earlier are not cached.
+ */
+
+static char *
+filedir_cache_key (GVfsAfpVolume *volume, const char *path)
+{
+  if (volume->priv->attributes & AFP_VOLUME_ATTRIBUTES_BITMAP_CASE_SENSITIVE)
+    return g_strdup (path);
+
+  return g_utf8_casefold (path, -1);
+}
+
+static gboolean
+filedir_cache_is_child (gpointer key, gpointer value, gpointer user_data)
+{
+  const char *parent = user_data;
+  const char *path = key;
+  gsize len;
+
+  len = strlen (parent);
+  if (strncmp (path, parent, len) != 0)
+    return FALSE;
+
+  if (len > 0 && parent[len - 1] == '/')
+    return path[len] != '\0';
+
+  return path[len] == '/';
+}
+
+static gboolean
+filedir_cache_is_expired (gpointer key, gpointer value, gpointer user_data)
+{
+  FileDirCacheEntry *entry = value;
+  gint64 *now = user_data;
+
+  return *now - entry->time > FILEDIR_CACHE_TTL;
+}
+
+static GFileInfo *
+filedir_cache_lookup (GVfsAfpVolume *volume,
+                      const char    *path,
+                      guint16        file_bitmap,
+                      guint16        dir_bitmap)
+{
+  FileDirCacheEntry *entry;
+  char *key;
+  guint16 bitmap;
+
+  key = filedir_cache_key (volume, path);
+  entry = g_hash_table_lookup (volume->priv->filedir_cache, key);
+  g_free (key);
+
+  if (!entry || g_get_monotonic_time () - entry->time > FILEDIR_CACHE_TTL)
+    return NULL;
+
+  bitmap = entry->directory ? dir_bitmap : file_bitmap;
+  if ((entry->bitmap & bitmap) != bitmap)
+    return NULL;
+
+  return g_file_info_dup (entry->info);
+}
+
+static void
+filedir_cache_insert (GVfsAfpVolume *volume,
+                      guint          generation,
+                      const char    *path,
+                      GFileInfo     *info,
+                      gboolean       directory,
+                      guint16        bitmap)
+{
+  GVfsAfpVolumePrivate *priv = volume->priv;
+
+  FileDirCacheEntry *entry, *old_entry;
+  char *key;
+
+  /* The volume was modified while the request was in flight */
+  if (generation != priv->cache_generation)
+    return;
+
+  key = filedir_cache_key (volume, path);
+  old_entry = g_hash_table_lookup (priv->filedir_cache, key);
+
+  /* The server updates the modification date of a directory when entries
+   * are added, removed or renamed in it */
+  if (directory && old_entry &&
+      g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_TIME_MODIFIED) &&
+      g_file_info_has_attribute (old_entry->info, G_FILE_ATTRIBUTE_TIME_MODIFIED) &&
+      g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED) !=
+      g_file_info_get_attribute_uint64 (old_entry->info, G_FILE_ATTRIBUTE_TIME_MODIFIED))
+  {
+    g_hash_table_foreach_remove (priv->filedir_cache, filedir_cache_is_child, key);
+  }
+
+  if (!old_entry &&
+      g_hash_table_size (priv->filedir_cache) >= FILEDIR_CACHE_MAX_ENTRIES)
+  {
+    gint64 now = g_get_monotonic_time ();
+
+    g_hash_table_foreach_remove (priv->filedir_cache, filedir_cache_is_expired, &now);
+    if (g_hash_table_size (priv->filedir_cache) >= FILEDIR_CACHE_MAX_ENTRIES)
+      g_hash_table_remove_all (priv->filedir_cache);
+  }
+
+  entry = g_slice_new (FileDirCacheEntry);
+  /* Callers may strip attributes from their info later, keep our own */
+  entry->info = g_file_info_dup (info);
+  entry->directory = directory;
+  entry->bitmap = bitmap;
+  entry->time = g_get_monotonic_time ();
+
+  g_hash_table_replace (priv->filedir_cache, key, entry);
+}
+
+/* Forgets @path and everything below it. Its parent directory only keeps
+ * its IDs, the rest of its parameters change with its contents. */
+static void
+filedir_cache_invalidate (GVfsAfpVolume *volume, const char *path)
+{
+  GVfsAfpVolumePrivate *priv = volume->priv;
+
+  FileDirCacheEntry *entry;
+  char *key, *parent_key;
+
+  priv->cache_generation++;
+
+  key = filedir_cache_key (volume, path);
+  g_hash_table_remove (priv->filedir_cache, key);
+  g_hash_table_foreach_remove (priv->filedir_cache, filedir_cache_is_child, key);
+
+  parent_key = g_path_get_dirname (key);
+  entry = g_hash_table_lookup (priv->filedir_cache, parent_key);
+  if (entry)
+    entry->bitmap &= FILEDIR_CACHE_ID_BITMAP;
+
+  g_free (parent_key);
+  g_free (key);
+}
+
+/* Called before a fork is modified. Only the first modification needs to
+ * invalidate, the cache is invalidated again when the fork is closed. */
+static void
+filedir_cache_invalidate_fork (GVfsAfpVolume *volume, gint16 fork_refnum)
+{
+  ForkEntry *entry;
+
+  entry = g_hash_table_lookup (volume->priv->fork_paths, GINT_TO_POINTER (fork_refnum));
+  if (entry && !entry->written)
+    {
+      filedir_cache_invalidate (volume, entry->path);
+      entry->written = TRUE;
+    }
+}
+
+/* Remembers which path a request was about so its reply can be cached */
+typedef struct
+{
+  GSimpleAsyncResult *simple;
+  char *path;
+  guint generation;
+} CacheRequest;
+
+static CacheRequest *
+cache_request_new (GVfsAfpVolume      *volume,
+                   GSimpleAsyncResult *simple,
+                   const char         *path)
+{
+  CacheRequest *creq;
+
+  creq = g_slice_new (CacheRequest);
+  creq->simple = simple;
+  creq->path = g_strdup (path);
+  creq->generation = volume->priv->cache_generation;
+
+  return creq;
+}
+
+static void
+cache_request_free (CacheRequest *creq)
+{
+  g_object_unref (creq->simple);
+  g_free (creq->path);
+
+  g_slice_free (CacheRequest, creq);
+}
+
 static void
 get_vol_parms_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
 {
@@ -358,7 +609,8 @@ static void
 open_fork_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
 {
   GVfsAfpConnection *conn = G_VFS_AFP_CONNECTION (source_object);
-  GSimpleAsyncResult *simple = G_SIMPLE_ASYNC_RESULT (user_data);
+  CacheRequest *creq = user_data;
+  GSimpleAsyncResult *simple = creq->simple;
   
   GVfsAfpVolume *volume;
   GVfsAfpVolumePrivate *priv;
@@ -368,6 +620,7 @@ open_fork_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
 
   OpenForkData *data;
   guint16 file_bitmap;
+  ForkEntry *fork_entry;
 
   volume = G_VFS_AFP_VOLUME (g_async_result_get_source_object (G_ASYNC_RESULT (simple)));
   priv = volume->priv;
@@ -418,12 +671,19 @@ open_fork_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
   g_vfs_afp_server_fill_info (priv->server, data->info, reply, FALSE, file_bitmap);
   g_object_unref (reply);
 
+  /* Writes through the fork invalidate the cached parameters of the file */
+  fork_entry = g_slice_new (ForkEntry);
+  fork_entry->path = g_strdup (creq->path);
+  fork_entry->written = FALSE;
+  g_hash_table_insert (priv->fork_paths, GINT_TO_POINTER (data->fork_refnum),
+                       fork_entry);
+
   g_simple_async_result_set_op_res_gpointer (simple, data,
                                              (GDestroyNotify)open_fork_data_free);
 
 done:
   g_simple_async_result_complete (simple);
-  g_object_unref (simple);
+  cache_request_free (creq);
 }
 
 /*
@@ -487,7 +747,8 @@ g_vfs_afp_volume_open_fork (GVfsAfpVolume      *volume,
                                       user_data, g_vfs_afp_volume_open_fork);
   
   g_vfs_afp_connection_send_command (priv->server->conn, comm, NULL,
-                                     open_fork_cb, cancellable, simple);
+                                     open_fork_cb, cancellable,
+                                     cache_request_new (volume, simple, filename));
   g_object_unref (comm);
 }
 
@@ -583,6 +844,7 @@ g_vfs_afp_volume_close_fork (GVfsAfpVolume       *volume,
   GVfsAfpVolumePrivate *priv;
   GVfsAfpCommand *comm;
   GSimpleAsyncResult *simple;
+  ForkEntry *fork_entry;
 
   g_return_if_fail (G_VFS_IS_AFP_VOLUME (volume));
 
@@ -598,6 +860,12 @@ g_vfs_afp_volume_close_fork (GVfsAfpVolume       *volume,
   simple = g_simple_async_result_new (G_OBJECT (volume), callback, user_data,
                                       g_vfs_afp_volume_close_fork);
   
+  /* Drop what was cached while the fork was being written */
+  fork_entry = g_hash_table_lookup (priv->fork_paths, GINT_TO_POINTER (fork_refnum));
+  if (fork_entry && fork_entry->written)
+    filedir_cache_invalidate (volume, fork_entry->path);
+  g_hash_table_remove (priv->fork_paths, GINT_TO_POINTER (fork_refnum));
+
   g_vfs_afp_connection_send_command (priv->server->conn, comm, NULL,
                                      close_fork_cb, cancellable, simple);
   g_object_unref (comm);
@@ -733,6 +1001,8 @@ g_vfs_afp_volume_delete (GVfsAfpVolume       *volume,
 
   simple = g_simple_async_result_new (G_OBJECT (volume), callback,
                                       user_data, g_vfs_afp_volume_delete);
+
+  filedir_cache_invalidate (volume, filename);
   
   g_vfs_afp_connection_send_command (priv->server->conn, comm, NULL,
                                      delete_cb, cancellable, simple);
@@ -888,6 +1158,8 @@ create_file_get_filedir_parms_cb (GObject *source_object, GAsyncResult *res, gpo
   g_vfs_afp_command_put_pathname (comm, basename);
   g_free (basename);
 
+  filedir_cache_invalidate (volume, cfd->filename);
+
   g_vfs_afp_connection_send_command (priv->server->conn, comm, NULL,
                                      create_file_cb, cfd->cancellable, simple);
   g_object_unref (comm);
@@ -1124,6 +1396,9 @@ g_vfs_afp_volume_create_directory (GVfsAfpVolume      *volume,
   g_simple_async_result_set_op_res_gpointer (simple, cdd,
                                              (GDestroyNotify)create_dir_data_free);
 
+  /* Keeps the ID of the parent directory cached */
+  filedir_cache_invalidate (volume, directory);
+
   dirname = g_path_get_dirname (directory);
   g_vfs_afp_volume_get_filedir_parms (volume, dirname, 0,
                                       AFP_DIR_BITMAP_NODE_ID_BIT,
@@ -1256,7 +1531,7 @@ rename_get_filedir_parms_cb (GObject      *source_object,
 
   guint32 dir_id;
   GVfsAfpCommand *comm;
-  char *basename;
+  char *basename, *dirname, *new_path;
 
   info = g_vfs_afp_volume_get_filedir_parms_finish (volume, res, &err);
   if (!info)
@@ -1286,6 +1561,13 @@ rename_get_filedir_parms_cb (GObject      *source_object,
   /* NewName */
   g_vfs_afp_command_put_pathname (comm, rd->new_name);
 
+  filedir_cache_invalidate (volume, rd->filename);
+  dirname = g_path_get_dirname (rd->filename);
+  new_path = g_build_path ("/", dirname, rd->new_name, NULL);
+  filedir_cache_invalidate (volume, new_path);
+  g_free (new_path);
+  g_free (dirname);
+
   g_vfs_afp_connection_send_command (volume->priv->server->conn, comm, NULL,
                                      rename_cb, rd->cancellable, simple);
   g_object_unref (comm);
@@ -1485,6 +1767,9 @@ g_vfs_afp_volume_move_and_rename (GVfsAfpVolume      *volume,
   simple = g_simple_async_result_new (G_OBJECT (volume), callback,
                                       user_data, g_vfs_afp_volume_move_and_rename);
   
+  filedir_cache_invalidate (volume, source);
+  filedir_cache_invalidate (volume, destination);
+
   g_vfs_afp_connection_send_command (priv->server->conn, comm, NULL,
                                      move_and_rename_cb, cancellable, simple);
   g_object_unref (comm);
@@ -1645,6 +1930,8 @@ g_vfs_afp_volume_copy_file (GVfsAfpVolume      *volume,
   simple = g_simple_async_result_new (G_OBJECT (volume), callback,
                                       user_data, g_vfs_afp_volume_copy_file);
 
+  filedir_cache_invalidate (volume, destination);
+
   g_vfs_afp_connection_send_command (priv->server->conn, comm, NULL,
                                      copy_file_cb, cancellable, simple);
   g_object_unref (comm);
@@ -1860,7 +2147,8 @@ static void
 get_filedir_parms_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
 {
   GVfsAfpConnection *conn = G_VFS_AFP_CONNECTION (source_object);
-  GSimpleAsyncResult *simple = G_SIMPLE_ASYNC_RESULT (user_data);
+  CacheRequest *creq = user_data;
+  GSimpleAsyncResult *simple = creq->simple;
   GVfsAfpVolume *volume = G_VFS_AFP_VOLUME (g_async_result_get_source_object (G_ASYNC_RESULT (simple)));
 
   GVfsAfpReply *reply;
@@ -1912,11 +2200,13 @@ get_filedir_parms_cb (GObject *source_object, GAsyncResult *res, gpointer user_d
   
   g_object_unref (reply);
 
+  filedir_cache_insert (volume, creq->generation, creq->path, info, directory, bitmap);
+
   g_simple_async_result_set_op_res_gpointer (simple, info, g_object_unref);
 
 done:
   g_simple_async_result_complete (simple);
-  g_object_unref (simple);
+  cache_request_free (creq);
 }
 
 /*
@@ -1947,10 +2237,26 @@ g_vfs_afp_volume_get_filedir_parms (GVfsAfpVolume       *volume,
   GVfsAfpVolumePrivate *priv;
   GVfsAfpCommand *comm;
   GSimpleAsyncResult *simple;
+  GFileInfo *info;
 
   g_return_if_fail (G_VFS_IS_AFP_VOLUME (volume));
 
   priv = volume->priv;
+
+  simple = g_simple_async_result_new (G_OBJECT (volume), callback, user_data,
+                                      g_vfs_afp_volume_get_filedir_parms);
+
+  info = filedir_cache_lookup (volume, filename, file_bitmap, dir_bitmap);
+  if (info)
+  {
+    g_simple_async_result_set_op_res_gpointer (simple, info, g_object_unref);
+    g_simple_async_result_complete_in_idle (simple);
+    g_object_unref (simple);
+    return;
+  }
+
+  file_bitmap |= FILEDIR_CACHE_ID_BITMAP;
+  dir_bitmap |= FILEDIR_CACHE_ID_BITMAP;
   
   comm = g_vfs_afp_command_new (AFP_COMMAND_GET_FILE_DIR_PARMS);
   /* pad byte */
@@ -1966,13 +2272,9 @@ g_vfs_afp_volume_get_filedir_parms (GVfsAfpVolume       *volume,
   /* PathName */
   g_vfs_afp_command_put_pathname (comm, filename);
 
-  simple = g_simple_async_result_new (G_OBJECT (volume), callback, user_data,
-                                      g_vfs_afp_volume_get_filedir_parms);
-                                      
-
   g_vfs_afp_connection_send_command (priv->server->conn, comm, NULL,
                                      get_filedir_parms_cb, cancellable,
-                                     simple);
+                                     cache_request_new (volume, simple, filename));
   g_object_unref (comm);
 }
 
@@ -2223,6 +2525,8 @@ g_vfs_afp_volume_set_fork_size (GVfsAfpVolume       *volume,
   simple = g_simple_async_result_new (G_OBJECT (volume), callback, user_data,
                                       g_vfs_afp_volume_set_fork_size);
   
+  filedir_cache_invalidate_fork (volume, fork_refnum);
+
   g_vfs_afp_connection_send_command (priv->server->conn, comm, NULL,
                                      set_fork_parms_cb, cancellable, simple);
   g_object_unref (comm);
@@ -2369,6 +2673,8 @@ g_vfs_afp_volume_set_unix_privs (GVfsAfpVolume       *volume,
   simple = g_simple_async_result_new (G_OBJECT (volume), callback,
                                       user_data, g_vfs_afp_volume_set_unix_privs);
 
+  filedir_cache_invalidate (volume, filename);
+
   g_vfs_afp_connection_send_command (priv->server->conn, comm, NULL,
                                      set_unix_privs_cb, cancellable, simple);
   g_object_unref (comm);
@@ -2413,7 +2719,8 @@ static void
 enumerate_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
 {
   GVfsAfpConnection *conn = G_VFS_AFP_CONNECTION (source_object);
-  GSimpleAsyncResult *simple = G_SIMPLE_ASYNC_RESULT (user_data);
+  CacheRequest *creq = user_data;
+  GSimpleAsyncResult *simple = creq->simple;
   
   GVfsAfpVolume *volume = G_VFS_AFP_VOLUME (g_async_result_get_source_object (G_ASYNC_RESULT (simple)));
   GVfsAfpVolumePrivate *priv = volume->priv;
@@ -2494,6 +2801,15 @@ enumerate_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
     g_vfs_afp_server_fill_info (priv->server, info, reply, directory, bitmap);
     g_ptr_array_add (infos, info);
 
+    if (g_file_info_get_name (info))
+    {
+      char *path;
+
+      path = g_build_path ("/", creq->path, g_file_info_get_name (info), NULL);
+      filedir_cache_insert (volume, creq->generation, path, info, directory, bitmap);
+      g_free (path);
+    }
+
     g_vfs_afp_reply_seek (reply, start_pos + struct_length, G_SEEK_SET);
   }
   g_object_unref (reply);
@@ -2503,7 +2819,7 @@ enumerate_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
   
 done:
   g_simple_async_result_complete (simple);
-  g_object_unref (simple);
+  cache_request_free (creq);
 }
 
 /*
@@ -2563,10 +2879,10 @@ g_vfs_afp_volume_enumerate (GVfsAfpVolume       *volume,
   g_vfs_afp_command_put_uint32 (comm, 2);
 
   /* File Bitmap */
-  g_vfs_afp_command_put_uint16 (comm, file_bitmap);
+  g_vfs_afp_command_put_uint16 (comm, file_bitmap | FILEDIR_CACHE_ID_BITMAP);
   
   /* Dir Bitmap */
-  g_vfs_afp_command_put_uint16 (comm, dir_bitmap);
+  g_vfs_afp_command_put_uint16 (comm, dir_bitmap | FILEDIR_CACHE_ID_BITMAP);
 
   /* Req Count */
   g_vfs_afp_command_put_int16 (comm, ENUMERATE_REQ_COUNT);
@@ -2588,7 +2904,8 @@ g_vfs_afp_volume_enumerate (GVfsAfpVolume       *volume,
   g_vfs_afp_command_put_pathname (comm, directory);
   
   g_vfs_afp_connection_send_command (priv->server->conn, comm, NULL,
-                                     enumerate_cb, cancellable, simple);
+                                     enumerate_cb, cancellable,
+                                     cache_request_new (volume, simple, directory));
   g_object_unref (comm);
 }
 
@@ -2727,6 +3044,9 @@ g_vfs_afp_volume_exchange_files (GVfsAfpVolume       *volume,
   simple = g_simple_async_result_new (G_OBJECT (volume), callback, user_data,
                                       g_vfs_afp_volume_exchange_files);
   
+  filedir_cache_invalidate (volume, source);
+  filedir_cache_invalidate (volume, destination);
+
   g_vfs_afp_connection_send_command (priv->server->conn, comm, NULL,
                                      close_replace_exchange_files_cb,
                                      cancellable, simple);
@@ -2864,6 +3184,8 @@ g_vfs_afp_volume_write_to_fork (GVfsAfpVolume       *volume,
   simple = g_simple_async_result_new (G_OBJECT (volume), callback, user_data,
                                       g_vfs_afp_volume_write_to_fork);
   
+  filedir_cache_invalidate_fork (volume, fork_refnum);
+
   g_vfs_afp_connection_send_command (volume->priv->server->conn, comm, NULL,
                                      write_ext_cb, cancellable, simple);
   g_object_unref (comm);
@@ -81,6 +81,10 @@ struct _GVfsBackendPrivate
   char *default_location;
   GMountSpec *mount_spec;
   gboolean block_requests;
+  guint max_concurrent_jobs;
+  GVfsBackendConcurrentOps concurrent_ops;
+  gsize preferred_read_chunk_size;
+  gsize max_read_chunk_size;
 };
 
 
@@ -208,6 +212,8 @@ g_vfs_backend_init (GVfsBackend *backend)
   backend->priv->stable_name = g_strdup ("");
   backend->priv->user_visible = TRUE;
   backend->priv->default_location = g_strdup ("");
+  backend->priv->max_concurrent_jobs = 0;
+  backend->priv->concurrent_ops = G_VFS_BACKEND_CONCURRENT_ALL;
 }
 
 static void
@@ -371,6 +377,78 @@ g_vfs_backend_set_user_visible (GVfsBackend  *backend,
   backend->priv->user_visible = user_visible;
 }
 
+/**
+ * g_vfs_backend_set_max_concurrent_jobs:
+ * @backend: backend
+ * @max_jobs: maximum number of jobs to run at the same time
+ * @ops: the operations that are safe to run concurrently
+ *
+ * Backends whose synchronous operations are thread safe can use this
+ * to let the daemon run up to @max_jobs of the operations in @ops in
+ * parallel. Operations not included in @ops are always run on their own,
+ * after all other jobs for the backend have finished. By default all
+ * operations may run concurrently, backends that can't handle that for
+ * some of them leave those out of @ops.
+ *
+ * The daemon grows its pool of worker threads as needed to honour
+ * @max_jobs. If this function isn't called, the backend gets as many
+ * concurrent jobs as the daemon was started with (see
+ * g_vfs_daemon_set_max_threads()). This should be called when the
+ * backend is constructed.
+ **/
+void
+g_vfs_backend_set_max_concurrent_jobs (GVfsBackend             *backend,
+				       guint                    max_jobs,
+				       GVfsBackendConcurrentOps ops)
+{
+  backend->priv->max_concurrent_jobs = MAX (max_jobs, 1);
+  backend->priv->concurrent_ops = ops;
+}
+
+guint
+g_vfs_backend_get_max_concurrent_jobs (GVfsBackend *backend)
+{
+  return backend->priv->max_concurrent_jobs;
+}
+
+GVfsBackendConcurrentOps
+g_vfs_backend_get_concurrent_ops (GVfsBackend *backend)
+{
+  return backend->priv->concurrent_ops;
+}
+
+/**
+ * g_vfs_backend_set_read_chunk_size:
+ * @backend: backend
+ * @preferred_size: the read size to start with, or 0 for the default
+ * @max_size: the largest read the backend wants, or 0 for the default
+ *
+ * Read channels adapt the size of the reads they pass to the backend
+ * to the measured latency and throughput. Backends that know what
+ * their transport likes (e.g. a fixed protocol maximum, or a slow
+ * device) can use this to set where this starts and where it stops.
+ **/
+void
+g_vfs_backend_set_read_chunk_size (GVfsBackend *backend,
+				   gsize        preferred_size,
+				   gsize        max_size)
+{
+  backend->priv->preferred_read_chunk_size = preferred_size;
+  backend->priv->max_read_chunk_size = max_size;
+}
+
+gsize
+g_vfs_backend_get_preferred_read_chunk_size (GVfsBackend *backend)
+{
+  return backend->priv->preferred_read_chunk_size;
+}
+
+gsize
+g_vfs_backend_get_max_read_chunk_size (GVfsBackend *backend)
+{
+  return backend->priv->max_read_chunk_size;
+}
+
 /**
  * g_vfs_backend_set_default_location:
  * @backend: backend
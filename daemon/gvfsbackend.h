@@ -79,6 +79,20 @@ typedef struct _GVfsJobCreateMonitor    GVfsJobCreateMonitor;
 
 typedef gpointer GVfsBackendHandle;
 
+/* Groups of operations a backend allows the daemon to run in parallel
+ * on its worker threads. Groups that are left out run exclusively, and
+ * so do mount and unmount. */
+typedef enum {
+  G_VFS_BACKEND_CONCURRENT_NONE       = 0,
+  G_VFS_BACKEND_CONCURRENT_READ       = 1 << 0, /* open_for_read, read, seek_on_read, close_read */
+  G_VFS_BACKEND_CONCURRENT_WRITE      = 1 << 1, /* write, seek_on_write, close_write */
+  G_VFS_BACKEND_CONCURRENT_QUERY_INFO = 1 << 2, /* query_info, query_fs_info, query_info_on_* */
+  G_VFS_BACKEND_CONCURRENT_ENUMERATE  = 1 << 3,
+  G_VFS_BACKEND_CONCURRENT_TRANSFER   = 1 << 4, /* copy, move, push, pull */
+  G_VFS_BACKEND_CONCURRENT_OTHER      = 1 << 5, /* everything else, e.g. delete, open_for_write */
+  G_VFS_BACKEND_CONCURRENT_ALL        = 0x3f
+} GVfsBackendConcurrentOps;
+
 struct _GVfsBackend
 {
   GObject parent_instance;
@@ -501,6 +515,17 @@ void        g_vfs_backend_add_auto_info                  (GVfsBackend
 void        g_vfs_backend_set_block_requests             (GVfsBackend           *backend);
 gboolean    g_vfs_backend_get_block_requests             (GVfsBackend           *backend);
 
+void        g_vfs_backend_set_max_concurrent_jobs        (GVfsBackend           *backend,
+							  guint                  max_jobs,
+							  GVfsBackendConcurrentOps ops);
+guint       g_vfs_backend_get_max_concurrent_jobs        (GVfsBackend           *backend);
+void        g_vfs_backend_set_read_chunk_size            (GVfsBackend           *backend,
+							  gsize                  preferred_size,
+							  gsize                  max_size);
+gsize       g_vfs_backend_get_preferred_read_chunk_size  (GVfsBackend           *backend);
+gsize       g_vfs_backend_get_max_read_chunk_size        (GVfsBackend           *backend);
+GVfsBackendConcurrentOps g_vfs_backend_get_concurrent_ops (GVfsBackend          *backend);
+
 gboolean    g_vfs_backend_has_blocking_processes         (GVfsBackend           *backend);
 
 gboolean    g_vfs_backend_unmount_with_operation_finish (GVfsBackend  *backend,
@@ -23,6 +23,7 @@
 #include <config.h>
 
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <glib/gstdio.h>
 #include <glib/gi18n.h>
@@ -113,7 +114,20 @@ typedef enum
   AFP_HANDLE_TYPE_APPEND_TO_FILE
 } AfpHandleType;
 
-typedef struct
+/* Number of FPReadExt/FPWriteExt requests kept in flight per open fork */
+#define AFP_PIPELINE_DEPTH 4
+
+/* Upper bound for a single request, whatever quantum the server advertises */
+#define AFP_MAX_REQUEST_SIZE (1024 * 1024)
+
+/* Size of the FPWriteExt command that precedes the data in a DSI write */
+#define AFP_WRITE_EXT_HEADER_SIZE 20
+
+typedef struct _AfpHandle AfpHandle;
+
+typedef void (*AfpHandleDrainFunc) (AfpHandle *afp_handle, GVfsJob *job);
+
+struct _AfpHandle
 {
   GVfsBackendAfp *backend;
   
@@ -128,7 +142,43 @@ typedef struct
   char *filename;
   char *tmp_filename;
   gboolean make_backup;
-} AfpHandle;
+
+  /* Read-ahead, used if type == AFP_HANDLE_TYPE_READ_FILE */
+  GQueue *read_chunks;
+  guint read_ahead;
+  GVfsJobRead *read_job;
+
+  /* Pipelined writes */
+  guint n_writes;
+  GError *write_error;
+  GVfsJobWrite *write_job;
+  GVfsJob *drain_job;
+  AfpHandleDrainFunc drain_func;
+};
+
+typedef struct
+{
+  /* NULL once the chunk has been dropped from the read-ahead queue */
+  AfpHandle *afp_handle;
+
+  gint64 offset;
+  char *buffer;
+  gsize size;
+
+  gboolean done;
+  gsize bytes_read;
+  gsize pos;
+  GError *error;
+} AfpReadChunk;
+
+typedef struct
+{
+  AfpHandle *afp_handle;
+
+  gint64 offset;
+  char *buffer;
+  gsize size;
+} AfpWriteChunk;
 
 static AfpHandle *
 afp_handle_new (GVfsBackendAfp *backend, gint16 fork_refnum)
@@ -139,18 +189,82 @@ afp_handle_new (GVfsBackendAfp *backend, gint16 fork_refnum)
   afp_handle->backend = backend;
   afp_handle->fork_refnum = fork_refnum;
 
+  afp_handle->read_chunks = g_queue_new ();
+  afp_handle->read_ahead = 1;
+
   return afp_handle;
 }
 
+static void
+read_chunk_free (AfpReadChunk *chunk)
+{
+  g_free (chunk->buffer);
+  if (chunk->error)
+    g_error_free (chunk->error);
+
+  g_slice_free (AfpReadChunk, chunk);
+}
+
+/* Chunks that are still in flight are freed by their callback */
+static void
+afp_handle_drop_read_chunks (AfpHandle *afp_handle)
+{
+  AfpReadChunk *chunk;
+
+  while ((chunk = g_queue_pop_head (afp_handle->read_chunks)))
+  {
+    if (chunk->done)
+      read_chunk_free (chunk);
+    else
+      chunk->afp_handle = NULL;
+  }
+
+  afp_handle->read_ahead = 1;
+}
+
 static void
 afp_handle_free (AfpHandle *afp_handle)
 {
+  afp_handle_drop_read_chunks (afp_handle);
+  g_queue_free (afp_handle->read_chunks);
+
+  if (afp_handle->write_error)
+    g_error_free (afp_handle->write_error);
+
   g_free (afp_handle->filename);
   g_free (afp_handle->tmp_filename);
   
   g_slice_free (AfpHandle, afp_handle);
 }
 
+static gsize
+afp_handle_get_request_size (AfpHandle *afp_handle, gsize header_size)
+{
+  guint32 quanta;
+
+  quanta = g_vfs_afp_connection_get_max_request_size (afp_handle->backend->server->conn);
+  if (quanta <= header_size)
+    return 1024;
+
+  return MIN (quanta - header_size, AFP_MAX_REQUEST_SIZE);
+}
+
+/* Calls @func once all pipelined writes on the fork have completed */
+static void
+afp_handle_drain_writes (AfpHandle          *afp_handle,
+                         GVfsJob            *job,
+                         AfpHandleDrainFunc  func)
+{
+  if (afp_handle->n_writes == 0)
+  {
+    func (afp_handle, job);
+    return;
+  }
+
+  afp_handle->drain_job = job;
+  afp_handle->drain_func = func;
+}
+
 /*
  * Backend code
  */
@@ -657,31 +771,51 @@ try_delete (GVfsBackend *backend,
 }
 
 static void
-write_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
+write_chunk_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
 {
   GVfsAfpVolume *volume = G_VFS_AFP_VOLUME (source_object);
-  GVfsJobWrite *job = G_VFS_JOB_WRITE (user_data);
-  AfpHandle *afp_handle = (AfpHandle *)job->handle;
+  AfpWriteChunk *chunk = user_data;
+  AfpHandle *afp_handle = chunk->afp_handle;
 
   GError *err = NULL;
   gint64 last_written;
-  gsize written_size;
 
-  if (!g_vfs_afp_volume_write_to_fork_finish (volume, res, &last_written, &err))
+  if (g_vfs_afp_volume_write_to_fork_finish (volume, res, &last_written, &err) &&
+      last_written < chunk->offset + (gint64)chunk->size)
+    err = g_error_new_literal (G_IO_ERROR, G_IO_ERROR_FAILED,
+                               _("Not all data could be written to the file"));
+
+  /* Keep the first error, it's reported on the next write or on close */
+  if (err)
   {
-    g_vfs_job_failed_from_error (G_VFS_JOB (job), err);
-    g_error_free (err);
-    return;
+    if (!afp_handle->write_error)
+      afp_handle->write_error = err;
+    else
+      g_error_free (err);
   }
 
-  written_size = last_written - afp_handle->offset;
-  afp_handle->offset = last_written;
+  g_free (chunk->buffer);
+  g_slice_free (AfpWriteChunk, chunk);
+  afp_handle->n_writes--;
 
-  if (afp_handle->type == AFP_HANDLE_TYPE_REPLACE_FILE_DIRECT)
-    afp_handle->size = MAX (last_written, afp_handle->size);
-  
-  g_vfs_job_write_set_written_size (job, written_size); 
-  g_vfs_job_succeeded (G_VFS_JOB (job));
+  if (afp_handle->write_job)
+  {
+    GVfsJobWrite *job = afp_handle->write_job;
+
+    afp_handle->write_job = NULL;
+    if (afp_handle->write_error)
+      g_vfs_job_failed_from_error (G_VFS_JOB (job), afp_handle->write_error);
+    else
+      g_vfs_job_succeeded (G_VFS_JOB (job));
+  }
+
+  if (afp_handle->n_writes == 0 && afp_handle->drain_job)
+  {
+    GVfsJob *job = afp_handle->drain_job;
+
+    afp_handle->drain_job = NULL;
+    afp_handle->drain_func (afp_handle, job);
+  }
 }
 
 static gboolean
@@ -694,9 +828,38 @@ try_write (GVfsBackend *backend,
   GVfsBackendAfp *afp_backend = G_VFS_BACKEND_AFP (backend);
   AfpHandle *afp_handle = (AfpHandle *)handle;
 
+  AfpWriteChunk *chunk;
+
+  if (afp_handle->write_error)
+  {
+    g_vfs_job_failed_from_error (G_VFS_JOB (job), afp_handle->write_error);
+    return TRUE;
+  }
+
+  /* The data is copied so the job can complete while the request is still
+   * in flight, which lets several writes to the fork overlap */
+  chunk = g_slice_new (AfpWriteChunk);
+  chunk->afp_handle = afp_handle;
+  chunk->offset = afp_handle->offset;
+  chunk->size = MIN (buffer_size,
+                     afp_handle_get_request_size (afp_handle, AFP_WRITE_EXT_HEADER_SIZE));
+  chunk->buffer = g_memdup (buffer, chunk->size);
+
   g_vfs_afp_volume_write_to_fork (afp_backend->volume, afp_handle->fork_refnum,
-                                  buffer, buffer_size, afp_handle->offset,
-                                  G_VFS_JOB (job)->cancellable, write_cb, job);
+                                  chunk->buffer, chunk->size, chunk->offset,
+                                  NULL, write_chunk_cb, chunk);
+  afp_handle->n_writes++;
+
+  afp_handle->offset += chunk->size;
+  if (afp_handle->type == AFP_HANDLE_TYPE_REPLACE_FILE_DIRECT)
+    afp_handle->size = MAX (afp_handle->offset, afp_handle->size);
+
+  g_vfs_job_write_set_written_size (job, chunk->size);
+
+  if (afp_handle->n_writes < AFP_PIPELINE_DEPTH)
+    g_vfs_job_succeeded (G_VFS_JOB (job));
+  else
+    afp_handle->write_job = job;
 
   return TRUE;
 }
@@ -745,15 +908,11 @@ seek_on_write_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
   g_vfs_job_succeeded (G_VFS_JOB (job));
 }
 
-static gboolean
-try_seek_on_write (GVfsBackend *backend,
-                   GVfsJobSeekWrite *job,
-                   GVfsBackendHandle handle,
-                   goffset    offset,
-                   GSeekType  type)
+static void
+seek_on_write (AfpHandle *afp_handle, GVfsJob *seek_job)
 {
-  GVfsBackendAfp *afp_backend = G_VFS_BACKEND_AFP (backend);
-  AfpHandle *afp_handle = (AfpHandle *)handle;
+  GVfsBackendAfp *afp_backend = afp_handle->backend;
+  GVfsJobSeekWrite *job = G_VFS_JOB_SEEK_WRITE (seek_job);
 
   if (afp_handle->type == AFP_HANDLE_TYPE_REPLACE_FILE_DIRECT)
   {
@@ -785,6 +944,19 @@ try_seek_on_write (GVfsBackend *backend,
                                      AFP_FILE_BITMAP_EXT_DATA_FORK_LEN_BIT,
                                      G_VFS_JOB (job)->cancellable, seek_on_write_cb, job);
   }
+}
+
+static gboolean
+try_seek_on_write (GVfsBackend *backend,
+                   GVfsJobSeekWrite *job,
+                   GVfsBackendHandle handle,
+                   goffset    offset,
+                   GSeekType  type)
+{
+  AfpHandle *afp_handle = (AfpHandle *)handle;
+
+  /* The fork size from the server is only right once pending writes landed */
+  afp_handle_drain_writes (afp_handle, G_VFS_JOB (job), seek_on_write);
     
   return TRUE;
 }
@@ -799,6 +971,7 @@ seek_on_read_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
   GError *err = NULL;
   GFileInfo *info;
   gsize size;
+  gint64 old_offset;
 
   info = g_vfs_afp_volume_get_fork_parms_finish (volume, res, &err);
   if (!info)
@@ -811,6 +984,7 @@ seek_on_read_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
   size = g_file_info_get_size (info);
   g_object_unref (info);
 
+  old_offset = afp_handle->offset;
   switch (job->seek_type)
   {
     case G_SEEK_CUR:
@@ -829,6 +1003,9 @@ seek_on_read_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
   else if (afp_handle->offset > size)
     afp_handle->offset = size;
 
+  if (afp_handle->offset != old_offset)
+    afp_handle_drop_read_chunks (afp_handle);
+
   g_vfs_job_seek_read_set_offset (job, afp_handle->offset);
   g_vfs_job_succeeded (G_VFS_JOB (job));
 }
@@ -851,27 +1028,107 @@ try_seek_on_read (GVfsBackend *backend,
 }
 
 static void
-read_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
+serve_read (AfpHandle *afp_handle, GVfsJobRead *job)
 {
-  GVfsAfpVolume *volume = G_VFS_AFP_VOLUME (source_object);
-  GVfsJobRead *job = G_VFS_JOB_READ (user_data);
-  AfpHandle *afp_handle = (AfpHandle *)job->handle;
+  AfpReadChunk *chunk;
+  gsize size;
 
-  GError *err = NULL;
-  gsize bytes_read;
+  chunk = g_queue_peek_head (afp_handle->read_chunks);
+  if (!chunk->done)
+  {
+    afp_handle->read_job = job;
+    return;
+  }
 
-  if (!g_vfs_afp_volume_read_from_fork_finish (volume, res, &bytes_read, &err))
+  if (chunk->error)
   {
-    g_vfs_job_failed_from_error (G_VFS_JOB (job), err);
-    g_error_free (err);
+    g_vfs_job_failed_from_error (G_VFS_JOB (job), chunk->error);
+    afp_handle_drop_read_chunks (afp_handle);
     return;
   }
 
-  afp_handle->offset += bytes_read;
-  g_vfs_job_read_set_size (job, bytes_read);
-  
+  size = MIN (job->bytes_requested, chunk->bytes_read - chunk->pos);
+  memcpy (job->buffer, chunk->buffer + chunk->pos, size);
+  chunk->pos += size;
+  afp_handle->offset += size;
+
+  if (chunk->pos == chunk->bytes_read)
+  {
+    g_queue_pop_head (afp_handle->read_chunks);
+
+    /* A short reply means EOF or a locked range, in both cases the chunks
+     * requested after this one are at the wrong offset */
+    if (chunk->bytes_read < chunk->size)
+      afp_handle_drop_read_chunks (afp_handle);
+    else
+      afp_handle->read_ahead = MIN (afp_handle->read_ahead * 2, AFP_PIPELINE_DEPTH);
+
+    read_chunk_free (chunk);
+  }
+
+  g_vfs_job_read_set_size (job, size);
   g_vfs_job_succeeded (G_VFS_JOB (job));
 }
+
+static void
+read_chunk_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  GVfsAfpVolume *volume = G_VFS_AFP_VOLUME (source_object);
+  AfpReadChunk *chunk = user_data;
+  AfpHandle *afp_handle = chunk->afp_handle;
+
+  if (!afp_handle)
+  {
+    read_chunk_free (chunk);
+    return;
+  }
+
+  chunk->done = TRUE;
+  if (!g_vfs_afp_volume_read_from_fork_finish (volume, res, &chunk->bytes_read,
+                                               &chunk->error))
+    chunk->bytes_read = 0;
+
+  /* Replies may arrive out of order, a waiting job is only served from the
+   * chunk at the current offset */
+  if (afp_handle->read_job && chunk == g_queue_peek_head (afp_handle->read_chunks))
+  {
+    GVfsJobRead *job = afp_handle->read_job;
+
+    afp_handle->read_job = NULL;
+    serve_read (afp_handle, job);
+  }
+}
+
+/* Keeps up to read_ahead requests in flight past the current offset, the
+ * window grows while the file is read sequentially */
+static void
+read_ahead (AfpHandle *afp_handle)
+{
+  GVfsBackendAfp *afp_backend = afp_handle->backend;
+
+  AfpReadChunk *chunk;
+  gint64 offset;
+  gsize size;
+
+  chunk = g_queue_peek_tail (afp_handle->read_chunks);
+  offset = chunk ? chunk->offset + chunk->size : afp_handle->offset;
+  size = afp_handle_get_request_size (afp_handle, 0);
+
+  while (g_queue_get_length (afp_handle->read_chunks) < afp_handle->read_ahead)
+  {
+    chunk = g_slice_new0 (AfpReadChunk);
+    chunk->afp_handle = afp_handle;
+    chunk->offset = offset;
+    chunk->size = size;
+    chunk->buffer = g_malloc (size);
+    g_queue_push_tail (afp_handle->read_chunks, chunk);
+
+    g_vfs_afp_volume_read_from_fork (afp_backend->volume, afp_handle->fork_refnum,
+                                     chunk->buffer, chunk->size, chunk->offset,
+                                     NULL, read_chunk_cb, chunk);
+    offset += size;
+  }
+}
   
 static gboolean 
 try_read (GVfsBackend *backend,
@@ -880,12 +1137,11 @@ try_read (GVfsBackend *backend,
           char *buffer,
           gsize bytes_requested)
 {
-  GVfsBackendAfp *afp_backend = G_VFS_BACKEND_AFP (backend);
   AfpHandle *afp_handle = (AfpHandle *)handle;
 
-  g_vfs_afp_volume_read_from_fork (afp_backend->volume, afp_handle->fork_refnum,
-                                   buffer, bytes_requested, afp_handle->offset,
-                                   G_VFS_JOB (job)->cancellable, read_cb, job);
+  read_ahead (afp_handle);
+  serve_read (afp_handle, job);
+
   return TRUE;
 }
 
@@ -1061,13 +1317,26 @@ close_replace_set_fork_size_cb (GObject *source_object, GAsyncResult *res, gpoin
                                    close_write_get_fork_parms_cb, job);
 }
 
-static gboolean
-try_close_write (GVfsBackend *backend,
-                 GVfsJobCloseWrite *job,
-                 GVfsBackendHandle handle)
+static void
+close_write (AfpHandle *afp_handle, GVfsJob *close_job)
 {
-  GVfsBackendAfp *afp_backend = G_VFS_BACKEND_AFP (backend);
-  AfpHandle *afp_handle = (AfpHandle *)handle;
+  GVfsBackendAfp *afp_backend = afp_handle->backend;
+  GVfsJobCloseWrite *job = G_VFS_JOB_CLOSE_WRITE (close_job);
+
+  if (afp_handle->write_error)
+  {
+    g_vfs_job_failed_from_error (G_VFS_JOB (job), afp_handle->write_error);
+
+    /* Leave the original file alone if it was being replaced */
+    g_vfs_afp_volume_close_fork (afp_backend->volume, afp_handle->fork_refnum,
+                                 NULL, NULL, NULL);
+    if (afp_handle->type == AFP_HANDLE_TYPE_REPLACE_FILE_TEMP)
+      g_vfs_afp_volume_delete (afp_backend->volume, afp_handle->tmp_filename,
+                               NULL, NULL, NULL);
+
+    afp_handle_free (afp_handle);
+    return;
+  }
   
   if (afp_handle->type == AFP_HANDLE_TYPE_REPLACE_FILE_TEMP)
   {
@@ -1090,6 +1359,16 @@ try_close_write (GVfsBackend *backend,
                                      G_VFS_JOB (job)->cancellable,
                                      close_write_get_fork_parms_cb, job);
   }
+}
+
+static gboolean
+try_close_write (GVfsBackend *backend,
+                 GVfsJobCloseWrite *job,
+                 GVfsBackendHandle handle)
+{
+  AfpHandle *afp_handle = (AfpHandle *)handle;
+
+  afp_handle_drain_writes (afp_handle, G_VFS_JOB (job), close_write);
   
   return TRUE;
 }
@@ -46,6 +46,9 @@
 
 #define MOUNT_ICON_NAME "drive-removable-media"
 
+/* number of readers of compressed archives kept around after close */
+#define MAX_PARKED_READERS 4
+
 /* #define PRINT_DEBUG  */
 
 #ifdef PRINT_DEBUG
@@ -61,6 +64,8 @@ struct _ArchiveFile {
   char *	name;			/* name of the file inside the archive */
   GFileInfo *	info;			/* file info created from archive_entry */
   GSList *	children;		/* (unordered) list of child files */
+  guint64	index;			/* position of the entry in the archive */
+  gint64	header_offset;		/* file offset of the entry's header */
 };
 
 struct _GVfsBackendArchive
@@ -69,6 +74,9 @@ struct _GVfsBackendArchive
 
   GFile *		file;
   ArchiveFile *		files;		/* the tree of files */
+  gboolean		seekable;	/* entries can be read from header_offset */
+  GMutex		lock;		/* protects parked */
+  GQueue		parked;		/* readers of closed files, most recent first */
 };
 
 G_DEFINE_TYPE (GVfsBackendArchive, g_vfs_backend_archive, G_VFS_TYPE_BACKEND)
@@ -83,6 +91,8 @@ typedef struct {
   GFileInputStream *stream;
   GVfsJob *	    job;
   GError *	    error;
+  goffset	    offset;	/* where to start reading the file */
+  guint64	    next_index;	/* index of the next entry to be read */
   guchar	    data[4096];
 } GVfsArchive;
 
@@ -99,6 +109,12 @@ gvfs_archive_open (struct archive *archive,
   d->stream = g_file_read (d->file,
 			   d->job->cancellable,
 			   &d->error);
+  if (d->stream && d->offset > 0)
+    g_seekable_seek (G_SEEKABLE (d->stream),
+		     d->offset,
+		     G_SEEK_SET,
+		     d->job->cancellable,
+		     &d->error);
   return gvfs_archive_return (d);
 }
 
@@ -208,15 +224,27 @@ gvfs_archive_finish (GVfsArchive *archive)
   g_slice_free (GVfsArchive, archive);
 }
 
-/* NB: assumes an GVfsArchive initialized with ARCHIVE_DATA_INIT */
+/* frees the archive without finishing its job */
+static void
+gvfs_archive_discard (GVfsArchive *archive)
+{
+  archive->job = NULL;
+  g_clear_error (&archive->error);
+  gvfs_archive_finish (archive);
+}
+
+/* Starts reading at @offset, which must be the header of the entry with
+ * index @index or 0 */
 static GVfsArchive *
-gvfs_archive_new (GVfsBackendArchive *ba, GVfsJob *job)
+gvfs_archive_new (GVfsBackendArchive *ba, GVfsJob *job, goffset offset, guint64 index)
 {
   GVfsArchive *d;
   
   d = g_slice_new0 (GVfsArchive);
 
   d->file = ba->file;
+  d->offset = offset;
+  d->next_index = index;
   gvfs_archive_push_job (d, job);
 
   d->archive = archive_read_new ();
@@ -240,6 +268,7 @@ g_vfs_backend_archive_finalize (GObject *object)
   GVfsBackendArchive *archive = G_VFS_BACKEND_ARCHIVE (object);
 
   backend_unmount (archive);
+  g_mutex_clear (&archive->lock);
 
   if (G_OBJECT_CLASS (g_vfs_backend_archive_parent_class)->finalize)
     (*G_OBJECT_CLASS (g_vfs_backend_archive_parent_class)->finalize) (object);
@@ -248,6 +277,15 @@ g_vfs_backend_archive_finalize (GObject *object)
 static void
 g_vfs_backend_archive_init (GVfsBackendArchive *archive)
 {
+  g_mutex_init (&archive->lock);
+  g_queue_init (&archive->parked);
+
+  /* The file tree is read-only once mounted and every open file gets
+   * its own libarchive reader, so lookups and reads can run in parallel */
+  g_vfs_backend_set_max_concurrent_jobs (G_VFS_BACKEND (archive), 4,
+					 G_VFS_BACKEND_CONCURRENT_READ |
+					 G_VFS_BACKEND_CONCURRENT_QUERY_INFO |
+					 G_VFS_BACKEND_CONCURRENT_ENUMERATE);
 }
 
 /*** FILE TREE HANDLING ***/
@@ -356,6 +394,7 @@ archive_file_set_info_from_entry (ArchiveFile *	        file,
   GFileInfo *info = g_file_info_new ();
   GFileType type;
   file->info = info;
+  file->index = entry_index;
 
   DEBUG ("setting up %s (%s)\n", archive_entry_pathname (entry), file->name);
 
@@ -471,8 +510,9 @@ create_file_tree (GVfsBackendArchive *ba, GVfsJob *job)
   struct archive_entry *entry;
   int result;
   guint64 entry_index = 0;
+  gint64 header_offset;
 
-  archive = gvfs_archive_new (ba, job);
+  archive = gvfs_archive_new (ba, job, 0, 0);
 
   g_assert (ba->files != NULL);
 
@@ -487,12 +527,16 @@ create_file_tree (GVfsBackendArchive *ba, GVfsJob *job)
   	    archive_clear_error (archive->archive);
 	  }
   
+          header_offset = archive_read_header_position (archive->archive);
 	  ArchiveFile *file = archive_file_get_from_path (ba->files, 
 	                                                  archive_entry_pathname (entry), 
 							  TRUE);
           /* Don't set info for root */
           if (file != ba->files)
-            archive_file_set_info_from_entry (file, entry, entry_index);
+            {
+              archive_file_set_info_from_entry (file, entry, entry_index);
+              file->header_offset = header_offset;
+            }
 	  archive_read_data_skip (archive->archive);
 	  entry_index++;
 	}
@@ -501,6 +545,26 @@ create_file_tree (GVfsBackendArchive *ba, GVfsJob *job)
 
   if (result == ARCHIVE_FATAL)
     gvfs_archive_set_error_from_errno (archive);
+
+  /* Entries of these formats can be read without anything that precedes
+   * them, so if the header offsets are file offsets we can start reading
+   * right at the entry instead of at the start of the archive. */
+  switch (archive_format (archive->archive) & ARCHIVE_FORMAT_BASE_MASK)
+    {
+      case ARCHIVE_FORMAT_TAR:
+      case ARCHIVE_FORMAT_ZIP:
+      case ARCHIVE_FORMAT_CPIO:
+        ba->seekable = result == ARCHIVE_EOF &&
+                       archive_compression (archive->archive) == ARCHIVE_COMPRESSION_NONE &&
+                       archive->stream != NULL &&
+                       g_seekable_can_seek (G_SEEKABLE (archive->stream));
+        break;
+      default:
+        ba->seekable = FALSE;
+        break;
+    }
+  DEBUG ("archive is %sseekable\n", ba->seekable ? "" : "not ");
+
   fixup_dirs (ba->files);
   
   gvfs_archive_finish (archive);
@@ -603,6 +667,12 @@ do_mount (GVfsBackend *backend,
 static void
 backend_unmount (GVfsBackendArchive *ba)
 {
+  GVfsArchive *archive;
+
+  /* parked readers reference ba->file */
+  while ((archive = g_queue_pop_head (&ba->parked)))
+    gvfs_archive_finish (archive);
+
   if (ba->file)
     {
       g_object_unref (ba->file);
@@ -626,15 +696,70 @@ do_unmount (GVfsBackend *backend,
   g_vfs_job_succeeded (G_VFS_JOB (job));
 }
 
+/* Reads up to the entry with the given index. On success, @entry is set
+ * to it and the archive is ready to read its data. */
+static gboolean
+gvfs_archive_find_entry (GVfsArchive *          archive,
+                         guint64                index,
+                         struct archive_entry **entry)
+{
+  int result;
+
+  do
+    {
+      result = archive_read_next_header (archive->archive, entry);
+      if (result >= ARCHIVE_WARN && result <= ARCHIVE_OK)
+        {
+	  if (result < ARCHIVE_OK) {
+	    DEBUG ("gvfs_archive_find_entry: result = %d, error = '%s'\n", result, archive_error_string (archive->archive));
+	    archive_set_error (archive->archive, ARCHIVE_OK, "No error");
+	    archive_clear_error (archive->archive);
+	  }
+
+          if (archive->next_index++ == index)
+            return TRUE;
+
+          archive_read_data_skip (archive->archive);
+        }
+    }
+  while (result != ARCHIVE_FATAL && result != ARCHIVE_EOF);
+
+  return FALSE;
+}
+
+/* Takes the parked reader that is closest before the entry with @index.
+ * Readers of closed files are kept, so that opening files in archive
+ * order does not decompress the archive from the start every time. */
+static GVfsArchive *
+take_parked_archive (GVfsBackendArchive *ba, guint64 index)
+{
+  GVfsArchive *best = NULL;
+  GList *walk;
+
+  g_mutex_lock (&ba->lock);
+  for (walk = ba->parked.head; walk; walk = walk->next)
+    {
+      GVfsArchive *archive = walk->data;
+
+      if (archive->next_index <= index &&
+          (best == NULL || archive->next_index > best->next_index))
+        best = archive;
+    }
+  if (best)
+    g_queue_remove (&ba->parked, best);
+  g_mutex_unlock (&ba->lock);
+
+  return best;
+}
+
 static void
 do_open_for_read (GVfsBackend *       backend,
 		  GVfsJobOpenForRead *job,
 		  const char *        filename)
 {
   GVfsBackendArchive *ba = G_VFS_BACKEND_ARCHIVE (backend);
-  GVfsArchive *archive;
+  GVfsArchive *archive = NULL;
   struct archive_entry *entry;
-  int result;
   ArchiveFile *file;
   const char *entry_pathname;
 
@@ -655,46 +780,64 @@ do_open_for_read (GVfsBackend *       backend,
 			_("Can't open directory"));
       return;
     }
-  
-  archive = gvfs_archive_new (ba, G_VFS_JOB (job));
 
-  do
+  if (ba->seekable)
     {
-      result = archive_read_next_header (archive->archive, &entry);
-      if (result >= ARCHIVE_WARN && result <= ARCHIVE_OK)
+      archive = gvfs_archive_new (ba, G_VFS_JOB (job), file->header_offset, file->index);
+      if (gvfs_archive_find_entry (archive, file->index, &entry))
         {
-	  if (result < ARCHIVE_OK) {
-	    DEBUG ("do_open_for_read: result = %d, error = '%s'\n", result, archive_error_string (archive->archive));
-	    archive_set_error (archive->archive, ARCHIVE_OK, "No error");
-	    archive_clear_error (archive->archive);
-	  }
-
+          /* make sure we really ended up at the right entry */
           entry_pathname = archive_entry_pathname (entry);
-          /* skip leading garbage if present */
           if (g_str_has_prefix (entry_pathname, "./"))
             entry_pathname += 2;
-          if (g_str_equal (entry_pathname, filename + 1))
+          if (!g_str_equal (entry_pathname, filename + 1))
             {
-              /* SUCCESS */
-              g_vfs_job_open_for_read_set_handle (job, archive);
-              g_vfs_job_open_for_read_set_can_seek (job, FALSE);
-              gvfs_archive_pop_job (archive);
-              return;
+              DEBUG ("expected %s at %"G_GINT64_FORMAT", got %s\n",
+                     filename, file->header_offset, entry_pathname);
+              gvfs_archive_discard (archive);
+              archive = NULL;
+            }
+        }
+      else
+        {
+          gvfs_archive_discard (archive);
+          archive = NULL;
+        }
+    }
+  else
+    {
+      archive = take_parked_archive (ba, file->index);
+      if (archive)
+        {
+          gvfs_archive_push_job (archive, G_VFS_JOB (job));
+          if (!gvfs_archive_find_entry (archive, file->index, &entry))
+            {
+              gvfs_archive_discard (archive);
+              archive = NULL;
             }
-          else
-            archive_read_data_skip (archive->archive);
         }
     }
-  while (result != ARCHIVE_FATAL && result != ARCHIVE_EOF);
 
-  if (!gvfs_archive_in_error (archive))
+  if (archive == NULL)
     {
-      g_set_error_literal (&archive->error,
-			   G_IO_ERROR,
-			   G_IO_ERROR_NOT_FOUND,
-			   _("File doesn't exist"));
+      archive = gvfs_archive_new (ba, G_VFS_JOB (job), 0, 0);
+      if (!gvfs_archive_find_entry (archive, file->index, &entry))
+        {
+          if (!gvfs_archive_in_error (archive))
+            {
+              g_set_error_literal (&archive->error,
+                                   G_IO_ERROR,
+                                   G_IO_ERROR_NOT_FOUND,
+                                   _("File doesn't exist"));
+            }
+          gvfs_archive_finish (archive);
+          return;
+        }
     }
-  gvfs_archive_finish (archive);
+
+  g_vfs_job_open_for_read_set_handle (job, archive);
+  g_vfs_job_open_for_read_set_can_seek (job, FALSE);
+  gvfs_archive_pop_job (archive);
 }
 
 static void
@@ -702,10 +845,27 @@ do_close_read (GVfsBackend *backend,
 	       GVfsJobCloseRead *job,
 	       GVfsBackendHandle handle)
 {
+  GVfsBackendArchive *ba = G_VFS_BACKEND_ARCHIVE (backend);
   GVfsArchive *archive = handle;
+  GVfsArchive *old = NULL;
 
   gvfs_archive_push_job (archive, G_VFS_JOB (job));
-  gvfs_archive_finish (archive);
+  if (ba->seekable)
+    {
+      gvfs_archive_finish (archive);
+      return;
+    }
+
+  gvfs_archive_pop_job (archive);
+
+  g_mutex_lock (&ba->lock);
+  g_queue_push_head (&ba->parked, archive);
+  if (g_queue_get_length (&ba->parked) > MAX_PARKED_READERS)
+    old = g_queue_pop_tail (&ba->parked);
+  g_mutex_unlock (&ba->lock);
+
+  if (old)
+    gvfs_archive_finish (old);
 }
 
 static void
@@ -25,6 +25,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
@@ -37,6 +38,7 @@
 
 /* LibXML2 includes */
 #include <libxml/parser.h>
+#include <libxml/SAX2.h>
 #include <libxml/tree.h>
 #include <libxml/xpath.h>
 #include <libxml/xpathInternals.h>
@@ -50,8 +52,12 @@
 #include "gvfsjobseekread.h"
 #include "gvfsjobopenforwrite.h"
 #include "gvfsjobwrite.h"
+#include "gvfsjobclosewrite.h"
 #include "gvfsjobseekwrite.h"
 #include "gvfsjobsetdisplayname.h"
+#include "gvfsjobcopy.h"
+#include "gvfsjobmove.h"
+#include "gvfsjobpush.h"
 #include "gvfsjobqueryinfo.h"
 #include "gvfsjobqueryfsinfo.h"
 #include "gvfsjobqueryattributes.h"
@@ -66,6 +72,13 @@
 #include "gvfsdnssdresolver.h"
 #endif
 
+/* File infos from PROPFIND replies are kept for query_info, mostly so
+ * that listing a directory and then querying its children costs one
+ * request. GVFS_DAV_INFO_CACHE_TTL sets the lifetime of an entry in
+ * seconds, 0 disables the cache. */
+#define INFO_CACHE_DEFAULT_TTL 10
+#define INFO_CACHE_MAX_ENTRIES 4096
+
 typedef struct _MountAuthData MountAuthData;
 
 static void mount_auth_info_free (MountAuthData *info);
@@ -102,6 +115,12 @@ struct _GVfsBackendDav
 
   MountAuthData auth_info;
 
+  /* path => InfoCacheEntry, all protected by info_cache_lock */
+  GHashTable *info_cache;
+  GMutex      info_cache_lock;
+  gint64      info_cache_ttl;   /* in microseconds, 0 if disabled */
+  guint       info_cache_generation;
+
 #ifdef HAVE_AVAHI
   /* only set if we're handling a [dav|davs]+sd:// mounts */
   GVfsDnsSdResolver *resolver;
@@ -126,15 +145,179 @@ g_vfs_backend_dav_finalize (GObject *object)
 #endif
 
   mount_auth_info_free (&(dav_backend->auth_info));
+
+  g_hash_table_destroy (dav_backend->info_cache);
+  g_mutex_clear (&dav_backend->info_cache_lock);
   
   if (G_OBJECT_CLASS (g_vfs_backend_dav_parent_class)->finalize)
     (*G_OBJECT_CLASS (g_vfs_backend_dav_parent_class)->finalize) (object);
 }
 
+typedef struct {
+
+  GFileInfo *info;
+  gint64     stamp;
+  gboolean   nofollow;
+
+} InfoCacheEntry;
+
+static void
+info_cache_entry_free (InfoCacheEntry *entry)
+{
+  g_object_unref (entry->info);
+  g_slice_free (InfoCacheEntry, entry);
+}
+
 static void
 g_vfs_backend_dav_init (GVfsBackendDav *backend)
 {
+  const char *ttl;
+
   g_vfs_backend_set_user_visible (G_VFS_BACKEND (backend), TRUE);
+
+  backend->info_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                               (GDestroyNotify) info_cache_entry_free);
+  g_mutex_init (&backend->info_cache_lock);
+
+  backend->info_cache_ttl = (gint64) INFO_CACHE_DEFAULT_TTL * G_USEC_PER_SEC;
+  ttl = g_getenv ("GVFS_DAV_INFO_CACHE_TTL");
+  if (ttl != NULL)
+    backend->info_cache_ttl = (gint64) MAX (atoi (ttl), 0) * G_USEC_PER_SEC;
+}
+
+/* ************************************************************************* */
+/* File info cache */
+
+/* Take this before sending the request whose reply gets inserted. If
+ * anything was purged in between the reply may be stale and is dropped. */
+static guint
+info_cache_get_generation (GVfsBackendDav *dav_backend)
+{
+  guint generation;
+
+  g_mutex_lock (&dav_backend->info_cache_lock);
+  generation = dav_backend->info_cache_generation;
+  g_mutex_unlock (&dav_backend->info_cache_lock);
+
+  return generation;
+}
+
+static gboolean
+info_cache_entry_expired (GHashTable *cache, gpointer key, gpointer value, gpointer user_data)
+{
+  InfoCacheEntry *entry = value;
+  gint64         *now = user_data;
+
+  return entry->stamp < *now;
+}
+
+static void
+info_cache_insert (GVfsBackendDav      *dav_backend,
+                   guint                generation,
+                   const char          *path,
+                   GFileQueryInfoFlags  flags,
+                   GFileInfo           *info)
+{
+  InfoCacheEntry *entry;
+  gint64          now;
+
+  if (dav_backend->info_cache_ttl == 0)
+    return;
+
+  g_mutex_lock (&dav_backend->info_cache_lock);
+
+  if (generation == dav_backend->info_cache_generation)
+    {
+      now = g_get_monotonic_time ();
+
+      if (g_hash_table_size (dav_backend->info_cache) >= INFO_CACHE_MAX_ENTRIES)
+        {
+          gint64 oldest = now - dav_backend->info_cache_ttl;
+
+          g_hash_table_foreach_remove (dav_backend->info_cache,
+                                       info_cache_entry_expired, &oldest);
+          if (g_hash_table_size (dav_backend->info_cache) >= INFO_CACHE_MAX_ENTRIES)
+            g_hash_table_remove_all (dav_backend->info_cache);
+        }
+
+      entry = g_slice_new (InfoCacheEntry);
+      entry->info = g_file_info_dup (info);
+      entry->stamp = now;
+      entry->nofollow = (flags & G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS) != 0;
+      g_hash_table_replace (dav_backend->info_cache, g_strdup (path), entry);
+    }
+
+  g_mutex_unlock (&dav_backend->info_cache_lock);
+}
+
+static GFileInfo *
+info_cache_lookup (GVfsBackendDav      *dav_backend,
+                   const char          *path,
+                   GFileQueryInfoFlags  flags)
+{
+  InfoCacheEntry *entry;
+  GFileInfo      *info;
+  gboolean        nofollow;
+
+  if (dav_backend->info_cache_ttl == 0)
+    return NULL;
+
+  nofollow = (flags & G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS) != 0;
+  info = NULL;
+
+  g_mutex_lock (&dav_backend->info_cache_lock);
+
+  entry = g_hash_table_lookup (dav_backend->info_cache, path);
+  if (entry != NULL)
+    {
+      if (g_get_monotonic_time () - entry->stamp > dav_backend->info_cache_ttl)
+        g_hash_table_remove (dav_backend->info_cache, path);
+      else if (entry->nofollow == nofollow)
+        info = g_object_ref (entry->info);
+    }
+
+  g_mutex_unlock (&dav_backend->info_cache_lock);
+
+  return info;
+}
+
+/* Drops @path, its parent, whose times change along with it, and if
+ * @recursive everything below @path */
+static void
+info_cache_purge (GVfsBackendDav *dav_backend,
+                  const char     *path,
+                  gboolean        recursive)
+{
+  GHashTableIter  iter;
+  const char     *key;
+  char           *parent;
+  gsize           len;
+
+  g_mutex_lock (&dav_backend->info_cache_lock);
+
+  dav_backend->info_cache_generation++;
+
+  g_hash_table_remove (dav_backend->info_cache, path);
+
+  parent = g_path_get_dirname (path);
+  g_hash_table_remove (dav_backend->info_cache, parent);
+  g_free (parent);
+
+  if (recursive)
+    {
+      len = strlen (path);
+      if (len > 0 && path[len - 1] == '/')
+        len--;
+
+      g_hash_table_iter_init (&iter, dav_backend->info_cache);
+      while (g_hash_table_iter_next (&iter, (gpointer *) &key, NULL))
+        {
+          if (strncmp (key, path, len) == 0 && key[len] == '/')
+            g_hash_table_iter_remove (&iter);
+        }
+    }
+
+  g_mutex_unlock (&dav_backend->info_cache_lock);
 }
 
 /* ************************************************************************* */
@@ -783,10 +966,10 @@ multistatus_get_response_iter (Multistatus *multistatus, xmlNodeIter *iter)
 }
 
 static gboolean
-multistatus_get_response (xmlNodeIter *resp_iter, MsResponse *response)
+ms_response_init (MsResponse  *response,
+                  Multistatus *multistatus,
+                  xmlNodePtr   resp_node)
 {
-  Multistatus *multistatus;
-  xmlNodePtr   resp_node;
   xmlNodePtr   iter;
   xmlNodePtr   href;
   xmlNodePtr   propstat;
@@ -794,12 +977,6 @@ multistatus_get_response (xmlNodeIter *resp_iter, MsResponse *response)
   const char  *text;
   char        *path;
 
-  multistatus = xml_node_iter_get_user_data (resp_iter);
-  resp_node = xml_node_iter_get_current (resp_iter);
-
-  if (resp_node == NULL)
-    return FALSE;
-
   propstat = NULL;
   href = NULL;
 
@@ -844,7 +1021,22 @@ multistatus_get_response (xmlNodeIter *resp_iter, MsResponse *response)
   response->multistatus = multistatus;
   response->first_propstat = propstat;
 
-  return resp_node != NULL;
+  return TRUE;
+}
+
+static gboolean
+multistatus_get_response (xmlNodeIter *resp_iter, MsResponse *response)
+{
+  Multistatus *multistatus;
+  xmlNodePtr   resp_node;
+
+  multistatus = xml_node_iter_get_user_data (resp_iter);
+  resp_node = xml_node_iter_get_current (resp_iter);
+
+  if (resp_node == NULL)
+    return FALSE;
+
+  return ms_response_init (response, multistatus, resp_node);
 }
 
 static void
@@ -929,6 +1121,182 @@ ms_response_get_propstat (xmlNodeIter *cur_node, MsPropstat *propstat)
   return code;
 }
 
+/* ************************************************************************* */
+/* Streaming multistatus parsing
+ *
+ * For big listings the body is fed to a libxml2 push parser as it
+ * arrives instead of being collected in the message. The tree is built
+ * as usual so the MsResponse helpers above work unchanged, but every
+ * <response> element is handed to the callback and freed as soon as it
+ * is closed, so only the one being parsed is in memory. */
+
+typedef void (*MsResponseFunc) (MsResponse *response, gpointer user_data);
+
+typedef struct _MultistatusParser {
+
+  Multistatus           multistatus;
+
+  xmlSAXHandler         sax;
+  xmlParserCtxtPtr      ctxt;
+  endElementNsSAX2Func  end_element;
+
+  MsResponseFunc        func;
+  gpointer              user_data;
+  guint                 n_responses;
+
+} MultistatusParser;
+
+static void
+multistatus_parser_end_element (void          *ctx,
+                                const xmlChar *localname,
+                                const xmlChar *prefix,
+                                const xmlChar *URI)
+{
+  xmlParserCtxtPtr   ctxt = ctx;
+  MultistatusParser *parser = ctxt->_private;
+  xmlNodePtr         node;
+  xmlNodePtr         root;
+  MsResponse         response;
+
+  node = ctxt->node;
+  parser->end_element (ctx, localname, prefix, URI);
+
+  if (node == NULL || ! node_is_element (node) ||
+      ! node_has_name_ns (node, "response", "DAV:"))
+    return;
+
+  root = xmlDocGetRootElement (ctxt->myDoc);
+  if (root == NULL || node->parent != root ||
+      ! node_has_name_ns (root, "multistatus", "DAV:"))
+    return;
+
+  parser->n_responses++;
+  parser->multistatus.doc = ctxt->myDoc;
+  parser->multistatus.root = root;
+
+  if (ms_response_init (&response, &parser->multistatus, node))
+    {
+      parser->func (&response, parser->user_data);
+      ms_response_clear (&response);
+    }
+
+  xmlUnlinkNode (node);
+  xmlFreeNode (node);
+}
+
+static void
+multistatus_parser_got_chunk (SoupMessage *msg,
+                              SoupBuffer  *chunk,
+                              gpointer     user_data)
+{
+  MultistatusParser *parser = user_data;
+
+  /* Bodies of responses that get requeued (authentication,
+   * redirects) or that are errors are of no interest */
+  if (msg->status_code != SOUP_STATUS_MULTI_STATUS)
+    return;
+
+  /* Redirects replace the message uri, so only look at it once the
+   * body of the final response arrives */
+  if (parser->multistatus.target == NULL)
+    {
+      SoupURI *uri = soup_message_get_uri (msg);
+
+      parser->multistatus.target = soup_uri_copy (uri);
+      parser->multistatus.path = g_uri_unescape_string (uri->path, "/");
+    }
+
+  xmlParseChunk (parser->ctxt, chunk->data, chunk->length, 0);
+}
+
+static void
+multistatus_parser_init (MultistatusParser *parser,
+                         SoupMessage       *msg,
+                         MsResponseFunc     func,
+                         gpointer           user_data)
+{
+  memset (parser, 0, sizeof (MultistatusParser));
+
+  parser->func = func;
+  parser->user_data = user_data;
+
+  xmlSAXVersion (&parser->sax, 2);
+  parser->end_element = parser->sax.endElementNs;
+  parser->sax.endElementNs = multistatus_parser_end_element;
+
+  parser->ctxt = xmlCreatePushParserCtxt (&parser->sax, NULL,
+                                          NULL, 0, "response.xml");
+  parser->ctxt->_private = parser;
+  xmlCtxtUseOptions (parser->ctxt,
+                     XML_PARSE_NONET |
+                     XML_PARSE_NOWARNING |
+                     XML_PARSE_NOBLANKS |
+                     XML_PARSE_NSCLEAN |
+                     XML_PARSE_NOCDATA |
+                     XML_PARSE_COMPACT);
+
+  soup_message_body_set_accumulate (msg->response_body, FALSE);
+  g_signal_connect (msg, "got_chunk",
+                    G_CALLBACK (multistatus_parser_got_chunk), parser);
+}
+
+static gboolean
+multistatus_parser_finish (MultistatusParser *parser,
+                           SoupMessage       *msg,
+                           GError           **error)
+{
+  xmlNodePtr root;
+
+  g_signal_handlers_disconnect_by_func (msg,
+                                        G_CALLBACK (multistatus_parser_got_chunk),
+                                        parser);
+
+  if (!SOUP_STATUS_IS_SUCCESSFUL (msg->status_code))
+    {
+      g_set_error (error, G_IO_ERROR, http_to_gio_error (msg->status_code),
+                   _("HTTP Error: %s"), msg->reason_phrase);
+      return FALSE;
+    }
+
+  xmlParseChunk (parser->ctxt, NULL, 0, 1);
+
+  if (! parser->ctxt->wellFormed || parser->ctxt->myDoc == NULL)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+	                   _("Could not parse response"));
+      return FALSE;
+    }
+
+  root = xmlDocGetRootElement (parser->ctxt->myDoc);
+
+  if (root == NULL || strcmp ((char *) root->name, "multistatus"))
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           _("Unexpected reply from server"));
+      return FALSE;
+    }
+
+  if (parser->n_responses == 0)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+	                   _("Empty response"));
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+multistatus_parser_free (MultistatusParser *parser)
+{
+  if (parser->ctxt->myDoc)
+    xmlFreeDoc (parser->ctxt->myDoc);
+  xmlFreeParserCtxt (parser->ctxt);
+  if (parser->multistatus.target)
+    soup_uri_free (parser->multistatus.target);
+  g_free (parser->multistatus.path);
+}
+
 static GFileType
 parse_resourcetype (xmlNodePtr rt)
 {
@@ -1943,16 +2311,29 @@ do_query_info (GVfsBackend           *backend,
                GFileInfo             *info,
                GFileAttributeMatcher *matcher)
 {
+  GVfsBackendDav *dav_backend = G_VFS_BACKEND_DAV (backend);
   SoupMessage *msg;
   Multistatus  ms;
   xmlNodeIter  iter;
   gboolean     res;
   GError      *error;
+  GFileInfo   *cached;
+  guint        generation;
 
   error   = NULL;
 
   g_debug ("Query info %s\n", filename);
 
+  cached = info_cache_lookup (dav_backend, filename, flags);
+  if (cached)
+    {
+      g_file_info_copy_into (cached, job->file_info);
+      g_object_unref (cached);
+      g_vfs_job_succeeded (G_VFS_JOB (job));
+      return;
+    }
+
+  generation = info_cache_get_generation (dav_backend);
   msg = propfind_request_new (backend, filename, 0, ls_propnames);
 
   if (msg == NULL)
@@ -2001,7 +2382,10 @@ do_query_info (GVfsBackend           *backend,
   g_object_unref (msg);
 
   if (res)
-    g_vfs_job_succeeded (G_VFS_JOB (job));
+    {
+      info_cache_insert (dav_backend, generation, filename, flags, job->file_info);
+      g_vfs_job_succeeded (G_VFS_JOB (job));
+    }
   else
     g_vfs_job_failed (G_VFS_JOB (job),
                       G_IO_ERROR, G_IO_ERROR_FAILED,
@@ -2097,6 +2481,80 @@ do_query_fs_info (GVfsBackend           *backend,
 }
 
 /* *** enumerate *** */
+typedef struct {
+
+  GVfsJobEnumerate    *job;
+  GList               *infos;
+  MultistatusParser   *parser;
+  gboolean             replied;
+
+  GVfsBackendDav      *dav_backend;
+  const char          *filename;
+  GFileQueryInfoFlags  flags;
+  guint                generation;
+
+} EnumerateData;
+
+static void
+enumerate_response (MsResponse *response, gpointer user_data)
+{
+  EnumerateData *data = user_data;
+  GFileInfo     *info;
+  char          *path;
+
+  info = g_file_info_new ();
+  ms_response_to_file_info (response, info);
+
+  if (response->is_target)
+    {
+      info_cache_insert (data->dav_backend, data->generation,
+                         data->filename, data->flags, info);
+      g_object_unref (info);
+      return;
+    }
+
+  path = g_build_filename (data->filename, g_file_info_get_name (info), NULL);
+  info_cache_insert (data->dav_backend, data->generation,
+                     path, data->flags, info);
+  g_free (path);
+
+  data->infos = g_list_prepend (data->infos, info);
+}
+
+/* Runs after the chunk was fed to the parser, sends what it produced */
+static void
+enumerate_got_chunk (SoupMessage *msg,
+                     SoupBuffer  *chunk,
+                     gpointer     user_data)
+{
+  EnumerateData *data = user_data;
+  xmlNodePtr     root;
+
+  /* Reply as soon as the listing is known to be one, so the client
+   * gets the first entries while the rest is still coming in */
+  if (!data->replied &&
+      msg->status_code == SOUP_STATUS_MULTI_STATUS &&
+      data->parser->ctxt->myDoc != NULL)
+    {
+      root = xmlDocGetRootElement (data->parser->ctxt->myDoc);
+      if (root != NULL && strcmp ((char *) root->name, "multistatus") == 0)
+        {
+          g_vfs_job_succeeded (G_VFS_JOB (data->job));
+          data->replied = TRUE;
+        }
+    }
+
+  if (data->infos == NULL)
+    return;
+
+  data->infos = g_list_reverse (data->infos);
+  g_vfs_job_enumerate_add_infos (data->job, data->infos);
+  g_vfs_job_enumerate_flush (data->job);
+  g_list_foreach (data->infos, (GFunc) g_object_unref, NULL);
+  g_list_free (data->infos);
+  data->infos = NULL;
+}
+
 static void
 do_enumerate (GVfsBackend           *backend,
               GVfsJobEnumerate      *job,
@@ -2104,11 +2562,11 @@ do_enumerate (GVfsBackend           *backend,
               GFileAttributeMatcher *matcher,
               GFileQueryInfoFlags    flags)
 {
-  SoupMessage *msg;
-  Multistatus  ms;
-  xmlNodeIter  iter;
-  gboolean     res;
-  GError      *error;
+  SoupMessage       *msg;
+  MultistatusParser  parser;
+  EnumerateData      data;
+  gboolean           res;
+  GError            *error;
  
   error = NULL;
 
@@ -2127,42 +2585,47 @@ do_enumerate (GVfsBackend           *backend,
 
   message_add_redirect_header (msg, flags);
 
+  data.job = job;
+  data.infos = NULL;
+  data.parser = &parser;
+  data.replied = FALSE;
+  data.dav_backend = G_VFS_BACKEND_DAV (backend);
+  data.filename = filename;
+  data.flags = flags;
+  data.generation = info_cache_get_generation (data.dav_backend);
+  multistatus_parser_init (&parser, msg, enumerate_response, &data);
+  g_signal_connect_after (msg, "got_chunk",
+                          G_CALLBACK (enumerate_got_chunk), &data);
+
   g_vfs_backend_dav_send_message (backend, msg);
 
-  res = multistatus_parse (msg, &ms, &error);
+  res = multistatus_parser_finish (&parser, msg, &error);
+  g_signal_handlers_disconnect_by_func (msg, G_CALLBACK (enumerate_got_chunk), &data);
+  /* The end of the document may have completed a last response */
+  if (res || data.replied)
+    enumerate_got_chunk (msg, NULL, &data);
 
-  if (res == FALSE)
+  multistatus_parser_free (&parser);
+  g_object_unref (msg);
+
+  if (res == FALSE && !data.replied)
     {
       g_vfs_job_failed_from_error (G_VFS_JOB (job), error);
       g_error_free (error);
-      g_object_unref (msg);
       return;
     }
 
-  multistatus_get_response_iter (&ms, &iter);
-
-  while (xml_node_iter_next (&iter))
+  /* Once replied, a broken document can only cut the listing short */
+  if (res == FALSE)
     {
-      MsResponse  response;
-      GFileInfo  *info;
-
-      if (! multistatus_get_response (&iter, &response))
-        continue;
-
-      if (response.is_target == FALSE)
-	{
-	  info = g_file_info_new ();
-	  ms_response_to_file_info (&response, info);
-	  g_vfs_job_enumerate_add_info (job, info);
-	}
-
-      ms_response_clear (&response);
+      g_debug ("  enumerate: listing of %s incomplete: %s
+",
+               filename, error->message);
+      g_error_free (error);
     }
+  else if (!data.replied)
+    g_vfs_job_succeeded (G_VFS_JOB (job));
 
-  multistatus_free (&ms);
-  g_object_unref (msg);
-
-  g_vfs_job_succeeded (G_VFS_JOB (job)); /* should that be called earlier? */
   g_vfs_job_enumerate_done (G_VFS_JOB_ENUMERATE (job));
 }
 
@@ -2247,6 +2710,17 @@ try_open_for_read (GVfsBackend        *backend,
 
 
 
+/* The info cache entry of an uploaded file is dropped when the upload
+ * is done, so the stream remembers the file it writes to */
+#define STREAM_FILENAME_KEY "gvfs-backend-dav-filename"
+
+static void
+stream_set_filename (GOutputStream *stream, const char *filename)
+{
+  g_object_set_data_full (G_OBJECT (stream), STREAM_FILENAME_KEY,
+                          g_strdup (filename), g_free);
+}
+
 /* *** create () *** */
 static void
 try_create_tested_existence (SoupSession *session, SoupMessage *msg,
@@ -2275,8 +2749,9 @@ try_create_tested_existence (SoupSession *session, SoupMessage *msg,
    * Doesn't work with apache > 2.2.9
    * soup_message_headers_append (put_msg->request_headers, "If-None-Match", "*");
    */
-  stream = soup_output_stream_new (op_backend->session, put_msg, -1);
+  stream = soup_output_stream_new (op_backend->session_async, put_msg, -1);
   g_object_unref (put_msg);
+  stream_set_filename (stream, G_VFS_JOB_OPEN_FOR_WRITE (job)->filename);
 
   g_vfs_job_open_for_write_set_handle (G_VFS_JOB_OPEN_FOR_WRITE (job), stream);
   g_vfs_job_succeeded (job);
@@ -2317,8 +2792,9 @@ open_for_replace_succeeded (GVfsBackendHttp *op_backend, GVfsJob *job,
   if (etag)
     soup_message_headers_append (put_msg->request_headers, "If-Match", etag);
 
-  stream = soup_output_stream_new (op_backend->session, put_msg, -1);
+  stream = soup_output_stream_new (op_backend->session_async, put_msg, -1);
   g_object_unref (put_msg);
+  stream_set_filename (stream, G_VFS_JOB_OPEN_FOR_WRITE (job)->filename);
 
   g_vfs_job_open_for_write_set_handle (G_VFS_JOB_OPEN_FOR_WRITE (job), stream);
   g_vfs_job_succeeded (job);
@@ -2464,6 +2940,12 @@ close_write_ready (GObject      *source_object,
   res = g_output_stream_close_finish (stream,
                                       result,
                                       &error);
+
+  /* Even a failed PUT may have changed something */
+  info_cache_purge (G_VFS_BACKEND_DAV (G_VFS_JOB_CLOSE_WRITE (job)->backend),
+                    g_object_get_data (G_OBJECT (stream), STREAM_FILENAME_KEY),
+                    FALSE);
+
   if (res == FALSE)
     {
       g_vfs_job_failed_literal (G_VFS_JOB (job),
@@ -2511,6 +2993,7 @@ do_make_directory (GVfsBackend          *backend,
   soup_uri_free (uri);
 
   status = g_vfs_backend_dav_send_message (backend, msg);
+  info_cache_purge (G_VFS_BACKEND_DAV (backend), filename, FALSE);
 
   if (! SOUP_STATUS_IS_SUCCESSFUL (status))
     if (status == SOUP_STATUS_METHOD_NOT_ALLOWED)
@@ -2563,6 +3046,7 @@ do_delete (GVfsBackend   *backend,
   msg = soup_message_new_from_uri (SOUP_METHOD_DELETE, uri);
 
   status = g_vfs_backend_dav_send_message (backend, msg);
+  info_cache_purge (G_VFS_BACKEND_DAV (backend), filename, TRUE);
 
   if (!SOUP_STATUS_IS_SUCCESSFUL (status))
     g_vfs_job_failed_literal (G_VFS_JOB (job),
@@ -2600,6 +3084,8 @@ do_set_display_name (GVfsBackend           *backend,
   message_add_overwrite_header (msg, FALSE);
 
   status = g_vfs_backend_dav_send_message (backend, msg);
+  info_cache_purge (G_VFS_BACKEND_DAV (backend), filename, TRUE);
+  info_cache_purge (G_VFS_BACKEND_DAV (backend), target_path, TRUE);
 
   /*
    * The precondition of SOUP_STATUS_PRECONDITION_FAILED (412) in
@@ -2640,6 +3126,305 @@ do_set_display_name (GVfsBackend           *backend,
   soup_uri_free (source);
 }
 
+/* *** copy () and move () *** */
+
+/* Both are done on the server with COPY and MOVE, checking source and
+ * target first so the errors match what g_file_copy() and g_file_move()
+ * give. Anything the server can't do is left to the generic code. */
+static void
+copy_or_move (GVfsBackend    *backend,
+              GVfsJob        *job,
+              gboolean        is_move,
+              const char     *source,
+              const char     *destination,
+              GFileCopyFlags  flags)
+{
+  SoupMessage *msg;
+  SoupURI     *source_uri;
+  SoupURI     *target_uri;
+  GFileType    source_type;
+  GFileType    target_type;
+  gboolean     res;
+  guint        status;
+  GError      *error;
+
+  error = NULL;
+
+  if (flags & G_FILE_COPY_BACKUP)
+    {
+      g_vfs_job_failed (job,
+                        G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                        _("Operation not supported by backend"));
+      return;
+    }
+
+  source_uri = g_vfs_backend_dav_uri_for_path (backend, source, FALSE);
+  res = stat_location (backend, source_uri, &source_type, NULL, &error);
+  soup_uri_free (source_uri);
+
+  if (res == FALSE)
+    {
+      g_vfs_job_failed_from_error (job, error);
+      g_error_free (error);
+      return;
+    }
+
+  if (source_type == G_FILE_TYPE_DIRECTORY && ! is_move)
+    {
+      g_vfs_job_failed (job,
+                        G_IO_ERROR, G_IO_ERROR_WOULD_RECURSE,
+                        _("Can't recursively copy directory"));
+      return;
+    }
+
+  target_uri = g_vfs_backend_dav_uri_for_path (backend, destination, FALSE);
+  res = stat_location (backend, target_uri, &target_type, NULL, &error);
+  soup_uri_free (target_uri);
+
+  if (res)
+    {
+      if (! (flags & G_FILE_COPY_OVERWRITE))
+        {
+          g_vfs_job_failed (job,
+                            G_IO_ERROR, G_IO_ERROR_EXISTS,
+                            _("Target file already exists"));
+          return;
+        }
+
+      if (target_type == G_FILE_TYPE_DIRECTORY)
+        {
+          if (source_type == G_FILE_TYPE_DIRECTORY)
+            g_vfs_job_failed (job,
+                              G_IO_ERROR, G_IO_ERROR_WOULD_MERGE,
+                              _("Can't move directory over directory"));
+          else
+            g_vfs_job_failed (job,
+                              G_IO_ERROR, G_IO_ERROR_IS_DIRECTORY,
+                              _("File is directory"));
+          return;
+        }
+    }
+  else if (error->code != G_IO_ERROR_NOT_FOUND)
+    {
+      g_vfs_job_failed_from_error (job, error);
+      g_error_free (error);
+      return;
+    }
+  else
+    g_error_free (error);
+
+  source_uri = g_vfs_backend_dav_uri_for_path (backend, source,
+                                               source_type == G_FILE_TYPE_DIRECTORY);
+  target_uri = g_vfs_backend_dav_uri_for_path (backend, destination,
+                                               source_type == G_FILE_TYPE_DIRECTORY);
+
+  msg = soup_message_new_from_uri (is_move ? SOUP_METHOD_MOVE : SOUP_METHOD_COPY,
+                                   source_uri);
+  message_add_destination_header (msg, target_uri);
+  message_add_overwrite_header (msg, (flags & G_FILE_COPY_OVERWRITE) != 0);
+
+  /* The only depth allowed for moving collections */
+  if (source_type == G_FILE_TYPE_DIRECTORY)
+    soup_message_headers_append (msg->request_headers, "Depth", "infinity");
+
+  status = g_vfs_backend_dav_send_message (backend, msg);
+
+  info_cache_purge (G_VFS_BACKEND_DAV (backend), destination, TRUE);
+  if (is_move)
+    info_cache_purge (G_VFS_BACKEND_DAV (backend), source, TRUE);
+
+  /* As in set_display_name, a redirect without a Location header most
+   * likely means the target exists. 502 is what servers answer when
+   * the destination is on another server. */
+  if (SOUP_STATUS_IS_SUCCESSFUL (status))
+    g_vfs_job_succeeded (job);
+  else if (status == SOUP_STATUS_PRECONDITION_FAILED ||
+           SOUP_STATUS_IS_REDIRECTION (status))
+    g_vfs_job_failed (job, G_IO_ERROR,
+                      G_IO_ERROR_EXISTS,
+                      _("Target file already exists"));
+  else if (status == SOUP_STATUS_BAD_GATEWAY)
+    g_vfs_job_failed (job, G_IO_ERROR,
+                      G_IO_ERROR_NOT_SUPPORTED,
+                      _("Operation not supported by backend"));
+  else
+    g_vfs_job_failed (job, G_IO_ERROR,
+                      http_error_code_from_status (status),
+                      "%s", msg->reason_phrase);
+
+  g_object_unref (msg);
+  soup_uri_free (target_uri);
+  soup_uri_free (source_uri);
+}
+
+static void
+do_copy (GVfsBackend           *backend,
+         GVfsJobCopy           *job,
+         const char            *source,
+         const char            *destination,
+         GFileCopyFlags         flags,
+         GFileProgressCallback  progress_callback,
+         gpointer               progress_callback_data)
+{
+  copy_or_move (backend, G_VFS_JOB (job), FALSE,
+                source, destination, flags);
+}
+
+static void
+do_move (GVfsBackend           *backend,
+         GVfsJobMove           *job,
+         const char            *source,
+         const char            *destination,
+         GFileCopyFlags         flags,
+         GFileProgressCallback  progress_callback,
+         gpointer               progress_callback_data)
+{
+  copy_or_move (backend, G_VFS_JOB (job), TRUE,
+                source, destination, flags);
+}
+
+/* *** push () *** */
+
+/* Unlike a stream opened for writing, a local file has a known size.
+ * So it is uploaded straight from a mapping of the file with a
+ * Content-Length, which some servers insist on. */
+typedef struct {
+  goffset               size;
+  goffset               sent;
+  GFileProgressCallback progress_callback;
+  gpointer              progress_callback_data;
+} PushData;
+
+static void
+push_wrote_body_data (SoupMessage *msg,
+                      SoupBuffer  *chunk,
+                      gpointer     user_data)
+{
+  PushData *data = user_data;
+
+  data->sent += chunk->length;
+  if (data->progress_callback)
+    data->progress_callback (data->sent, data->size,
+                             data->progress_callback_data);
+}
+
+static void
+do_push (GVfsBackend           *backend,
+         GVfsJobPush           *job,
+         const char            *destination,
+         const char            *local_path,
+         GFileCopyFlags         flags,
+         gboolean               remove_source,
+         GFileProgressCallback  progress_callback,
+         gpointer               progress_callback_data)
+{
+  SoupMessage *msg;
+  SoupURI     *uri;
+  SoupBuffer  *buffer;
+  GMappedFile *mapped;
+  GFileType    target_type;
+  PushData     data;
+  struct stat  st;
+  gboolean     res;
+  guint        status;
+  GError      *error;
+
+  error = NULL;
+
+  /* Leave backups, links and directories to the generic code */
+  if ((flags & G_FILE_COPY_BACKUP) ||
+      ((flags & G_FILE_COPY_NOFOLLOW_SYMLINKS) ?
+       g_lstat (local_path, &st) : g_stat (local_path, &st)) != 0 ||
+      !S_ISREG (st.st_mode))
+    {
+      g_vfs_job_failed (G_VFS_JOB (job),
+                        G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                        _("Operation not supported by backend"));
+      return;
+    }
+
+  uri = g_vfs_backend_dav_uri_for_path (backend, destination, FALSE);
+  res = stat_location (backend, uri, &target_type, NULL, &error);
+
+  if (res)
+    {
+      if (! (flags & G_FILE_COPY_OVERWRITE))
+        {
+          g_vfs_job_failed (G_VFS_JOB (job),
+                            G_IO_ERROR, G_IO_ERROR_EXISTS,
+                            _("Target file already exists"));
+          soup_uri_free (uri);
+          return;
+        }
+
+      if (target_type == G_FILE_TYPE_DIRECTORY)
+        {
+          g_vfs_job_failed (G_VFS_JOB (job),
+                            G_IO_ERROR, G_IO_ERROR_IS_DIRECTORY,
+                            _("File is directory"));
+          soup_uri_free (uri);
+          return;
+        }
+    }
+  else if (error->code != G_IO_ERROR_NOT_FOUND)
+    {
+      g_vfs_job_failed_from_error (G_VFS_JOB (job), error);
+      g_error_free (error);
+      soup_uri_free (uri);
+      return;
+    }
+  else
+    g_clear_error (&error);
+
+  mapped = g_mapped_file_new (local_path, FALSE, &error);
+  if (mapped == NULL)
+    {
+      g_vfs_job_failed_from_error (G_VFS_JOB (job), error);
+      g_error_free (error);
+      soup_uri_free (uri);
+      return;
+    }
+
+  msg = soup_message_new_from_uri (SOUP_METHOD_PUT, uri);
+  soup_uri_free (uri);
+
+  buffer = soup_buffer_new_with_owner (g_mapped_file_get_contents (mapped),
+                                       g_mapped_file_get_length (mapped),
+                                       g_mapped_file_ref (mapped),
+                                       (GDestroyNotify) g_mapped_file_unref);
+  soup_message_body_append_buffer (msg->request_body, buffer);
+  soup_buffer_free (buffer);
+  soup_message_headers_set_content_length (msg->request_headers,
+                                           g_mapped_file_get_length (mapped));
+  /* Don't send the whole file just to get an authentication challenge */
+  soup_message_headers_set_expectations (msg->request_headers,
+                                         SOUP_EXPECTATION_CONTINUE);
+
+  data.size = g_mapped_file_get_length (mapped);
+  data.sent = 0;
+  data.progress_callback = progress_callback;
+  data.progress_callback_data = progress_callback_data;
+  g_signal_connect (msg, "wrote_body_data",
+                    G_CALLBACK (push_wrote_body_data), &data);
+
+  status = g_vfs_backend_dav_send_message (backend, msg);
+  info_cache_purge (G_VFS_BACKEND_DAV (backend), destination, FALSE);
+
+  g_signal_handlers_disconnect_by_func (msg, G_CALLBACK (push_wrote_body_data), &data);
+
+  if (! SOUP_STATUS_IS_SUCCESSFUL (status))
+    g_vfs_job_failed_literal (G_VFS_JOB (job), G_IO_ERROR,
+                              http_error_code_from_status (status),
+                              msg->reason_phrase);
+  else if (remove_source && g_unlink (local_path) != 0)
+    g_vfs_job_failed_from_errno (G_VFS_JOB (job), errno);
+  else
+    g_vfs_job_succeeded (G_VFS_JOB (job));
+
+  g_object_unref (msg);
+  g_mapped_file_unref (mapped);
+}
+
 /* ************************************************************************* */
 /*  */
 static void
@@ -2667,4 +3452,7 @@ g_vfs_backend_dav_class_init (GVfsBackendDavClass *klass)
   backend_class->make_directory    = do_make_directory;
   backend_class->delete            = do_delete;
   backend_class->set_display_name  = do_set_display_name;
+  backend_class->copy              = do_copy;
+  backend_class->move              = do_move;
+  backend_class->push              = do_push;
 }
@@ -104,6 +104,8 @@ gvfs_backend_ftp_determine_features (GVfsFtpTask *task)
     { "UTF8", G_VFS_FTP_FEATURE_UTF8 },
     { "AUTH TLS", G_VFS_FTP_FEATURE_AUTH_TLS },
     { "AUTH SSL", G_VFS_FTP_FEATURE_AUTH_SSL },
+    { "MLST", G_VFS_FTP_FEATURE_MLST },
+    { "REST STREAM", G_VFS_FTP_FEATURE_REST },
   };
   guint i, j;
   char **reply;
@@ -128,7 +130,11 @@ gvfs_backend_ftp_determine_features (GVfsFtpTask *task)
 
       for (j = 0; j < G_N_ELEMENTS (features); j++)
         {
-          if (g_ascii_strcasecmp (feature, features[j].name) == 0)
+          gsize len = strlen (features[j].name);
+
+          /* some features list their parameters, like "MLST size*;type*;" */
+          if (g_ascii_strncasecmp (feature, features[j].name, len) == 0 &&
+              (feature[len] == '\0' || feature[len] == ' '))
             {
               g_debug ("# feature %s supported\n", features[j].name);
               task->backend->features |= 1 << features[j].enable;
@@ -240,7 +246,10 @@ gvfs_backend_ftp_determine_system (GVfsFtpTask *task)
 static void
 gvfs_backend_ftp_setup_directory_cache (GVfsBackendFtp *ftp)
 {
-  if (ftp->system == G_VFS_FTP_SYSTEM_UNIX)
+  /* MLST support implies MLSD, see RFC 3659 */
+  if (g_vfs_backend_ftp_has_feature (ftp, G_VFS_FTP_FEATURE_MLST))
+    ftp->dir_funcs = &g_vfs_ftp_dir_cache_funcs_mlsd;
+  else if (ftp->system == G_VFS_FTP_SYSTEM_UNIX)
     ftp->dir_funcs = &g_vfs_ftp_dir_cache_funcs_unix;
   else
     ftp->dir_funcs = &g_vfs_ftp_dir_cache_funcs_default;
@@ -380,6 +389,9 @@ g_vfs_backend_ftp_finalize (GObject *object)
   if (ftp->addr)
     g_object_unref (ftp->addr);
 
+  if (ftp->dir_cache)
+    g_vfs_ftp_dir_cache_free (ftp->dir_cache);
+
   /* has been cleared on unmount */
   g_assert (ftp->queue == NULL);
   g_cond_clear (&ftp->cond);
@@ -796,43 +808,91 @@ error_550_parent_not_found (GVfsFtpTask *task, gpointer file)
   g_vfs_ftp_file_free (dir);
 }
 
+/* Sends RETR for @file, starting at @offset if that isn't 0, and opens
+ * the data connection to read it from */
 static void
-do_open_for_read (GVfsBackend *backend,
-                  GVfsJobOpenForRead *job,
-                  const char *filename)
+ftp_task_retrieve (GVfsFtpTask *      task,
+                   const GVfsFtpFile *file,
+                   goffset            offset)
 {
-  GVfsBackendFtp *ftp = G_VFS_BACKEND_FTP (backend);
-  GVfsFtpTask task = G_VFS_FTP_TASK_INIT (ftp, G_VFS_JOB (job));
-  GVfsFtpFile *file;
   static const GVfsFtpErrorFunc open_read_handlers[] = { error_550_is_directory, 
                                                          error_550_permission_or_not_found, 
                                                          NULL };
 
-  g_vfs_ftp_task_setup_data_connection (&task);
-  file = g_vfs_ftp_file_new_from_gvfs (ftp, filename);
+  g_vfs_ftp_task_setup_data_connection (task);
 
-  g_vfs_ftp_task_send_and_check (&task,
+  /* REST must be sent right before RETR */
+  if (offset > 0)
+    g_vfs_ftp_task_send (task,
+                         G_VFS_FTP_PASS_300,
+                         "REST %"G_GOFFSET_FORMAT, offset);
+
+  g_vfs_ftp_task_send_and_check (task,
                                  G_VFS_FTP_PASS_100 | G_VFS_FTP_FAIL_200,
                                  open_read_handlers,
-                                 file,
+                                 (gpointer) file,
                                  NULL,
                                  "RETR %s", g_vfs_ftp_file_get_ftp_path (file));
-  g_vfs_ftp_file_free (file);
 
-  g_vfs_ftp_task_open_data_connection (&task);
+  g_vfs_ftp_task_open_data_connection (task);
+}
+
+typedef struct {
+  GVfsFtpConnection *   conn;           /* NULL after a failed seek */
+  GVfsFtpFile *         file;
+  goffset               offset;
+} FtpReadHandle;
+
+static void
+ftp_read_handle_free (FtpReadHandle *handle)
+{
+  g_vfs_ftp_file_free (handle->file);
+  g_slice_free (FtpReadHandle, handle);
+}
+
+static void
+do_open_for_read (GVfsBackend *backend,
+                  GVfsJobOpenForRead *job,
+                  const char *filename)
+{
+  GVfsBackendFtp *ftp = G_VFS_BACKEND_FTP (backend);
+  GVfsFtpTask task = G_VFS_FTP_TASK_INIT (ftp, G_VFS_JOB (job));
+  GVfsFtpFile *file;
+
+  file = g_vfs_ftp_file_new_from_gvfs (ftp, filename);
+
+  ftp_task_retrieve (&task, file, 0);
 
   if (!g_vfs_ftp_task_is_in_error (&task))
     {
+      FtpReadHandle *handle = g_slice_new0 (FtpReadHandle);
+
       /* don't push the connection back, it's our handle now */
-      GVfsFtpConnection *conn = g_vfs_ftp_task_take_connection (&task);
+      handle->conn = g_vfs_ftp_task_take_connection (&task);
+      handle->file = file;
 
-      g_vfs_job_open_for_read_set_handle (job, conn);
-      g_vfs_job_open_for_read_set_can_seek (job, FALSE);
+      g_vfs_job_open_for_read_set_handle (job, handle);
+      g_vfs_job_open_for_read_set_can_seek (job,
+                                            g_vfs_backend_ftp_has_feature (ftp, G_VFS_FTP_FEATURE_REST));
     }
+  else
+    g_vfs_ftp_file_free (file);
 
   g_vfs_ftp_task_done (&task);
 }
 
+/* Ends the transfer running on @handle's connection and hands the
+ * connection to @task */
+static void
+ftp_read_handle_stop (FtpReadHandle *handle,
+                      GVfsFtpTask *  task)
+{
+  g_vfs_ftp_task_give_connection (task, handle->conn);
+  handle->conn = NULL;
+  g_vfs_ftp_task_close_data_connection (task);
+  g_vfs_ftp_task_receive (task, 0, NULL);
+}
+
 static void
 do_close_read (GVfsBackend *     backend,
                GVfsJobCloseRead *job,
@@ -840,11 +900,11 @@ do_close_read (GVfsBackend *     backend,
 {
   GVfsBackendFtp *ftp = G_VFS_BACKEND_FTP (backend);
   GVfsFtpTask task = G_VFS_FTP_TASK_INIT (ftp, G_VFS_JOB (job));
-  GVfsFtpConnection *conn = handle;
+  FtpReadHandle *read_handle = handle;
 
-  g_vfs_ftp_task_give_connection (&task, conn);
-  g_vfs_ftp_task_close_data_connection (&task);
-  g_vfs_ftp_task_receive (&task, 0, NULL);
+  if (read_handle->conn)
+    ftp_read_handle_stop (read_handle, &task);
+  ftp_read_handle_free (read_handle);
 
   g_vfs_ftp_task_done (&task);
 }
@@ -858,11 +918,19 @@ do_read (GVfsBackend *     backend,
 {
   GVfsBackendFtp *ftp = G_VFS_BACKEND_FTP (backend);
   GVfsFtpTask task = G_VFS_FTP_TASK_INIT (ftp, G_VFS_JOB (job));
-  GVfsFtpConnection *conn = handle;
+  FtpReadHandle *read_handle = handle;
   GInputStream *input;
   gssize n_bytes;
 
-  input = g_io_stream_get_input_stream (g_vfs_ftp_connection_get_data_stream (conn));
+  if (read_handle->conn == NULL)
+    {
+      g_set_error_literal (&task.error, G_IO_ERROR, G_IO_ERROR_CLOSED,
+                           _("Stream is closed"));
+      g_vfs_ftp_task_done (&task);
+      return;
+    }
+
+  input = g_io_stream_get_input_stream (g_vfs_ftp_connection_get_data_stream (read_handle->conn));
   n_bytes = g_input_stream_read (input,
                                  buffer,
                                  bytes_requested,
@@ -870,8 +938,85 @@ do_read (GVfsBackend *     backend,
                                  &task.error);
 
   if (n_bytes >= 0)
-    g_vfs_job_read_set_size (job, n_bytes);
+    {
+      read_handle->offset += n_bytes;
+      g_vfs_job_read_set_size (job, n_bytes);
+    }
+
+  g_vfs_ftp_task_done (&task);
+}
+
+static void
+do_seek_on_read (GVfsBackend *     backend,
+                 GVfsJobSeekRead * job,
+                 GVfsBackendHandle handle,
+                 goffset           offset,
+                 GSeekType         type)
+{
+  GVfsBackendFtp *ftp = G_VFS_BACKEND_FTP (backend);
+  GVfsFtpTask task = G_VFS_FTP_TASK_INIT (ftp, G_VFS_JOB (job));
+  FtpReadHandle *read_handle = handle;
+  GFileInfo *info;
+
+  switch (type)
+    {
+    case G_SEEK_CUR:
+      offset += read_handle->offset;
+      break;
+    case G_SEEK_END:
+      info = g_vfs_ftp_dir_cache_lookup_file (ftp->dir_cache, &task, read_handle->file, TRUE);
+      if (info == NULL)
+        {
+          if (!g_vfs_ftp_task_is_in_error (&task))
+            g_set_error_literal (&task.error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                                 _("Unsupported seek type"));
+          g_vfs_ftp_task_done (&task);
+          return;
+        }
+      offset += g_file_info_get_size (info);
+      g_object_unref (info);
+      break;
+    case G_SEEK_SET:
+      break;
+    default:
+      g_set_error_literal (&task.error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                           _("Unsupported seek type"));
+      g_vfs_ftp_task_done (&task);
+      return;
+    }
+
+  if (offset < 0)
+    {
+      g_set_error_literal (&task.error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                           _("Invalid seek request"));
+      g_vfs_ftp_task_done (&task);
+      return;
+    }
+
+  if (offset != read_handle->offset || read_handle->conn == NULL)
+    {
+      /* There's no way to move a running transfer, so abort it by
+       * closing the data connection and start a new one at offset.
+       * The server usually complains about the aborted transfer. */
+      if (read_handle->conn)
+        {
+          ftp_read_handle_stop (read_handle, &task);
+          g_vfs_ftp_task_clear_error (&task);
+        }
+
+      ftp_task_retrieve (&task, read_handle->file, offset);
+
+      if (g_vfs_ftp_task_is_in_error (&task))
+        {
+          g_vfs_ftp_task_done (&task);
+          return;
+        }
 
+      read_handle->conn = g_vfs_ftp_task_take_connection (&task);
+      read_handle->offset = offset;
+    }
+
+  g_vfs_job_seek_read_set_offset (job, offset);
   g_vfs_ftp_task_done (&task);
 }
 
@@ -1406,6 +1551,7 @@ cancel_cancellable (gpointer cancellable)
 static gssize
 ftp_output_stream_splice (GOutputStream *output,
                           GInputStream *input,
+                          goffset offset,
                           goffset total_size,
                           GFileProgressCallback progress_callback,
                           gpointer progress_callback_data,
@@ -1443,7 +1589,7 @@ ftp_output_stream_splice (GOutputStream *output,
               current = cancellable;
               g_clear_error (error);
               if (progress_callback)
-                progress_callback (bytes_copied, total_size, progress_callback_data);
+                progress_callback (offset + bytes_copied, total_size, progress_callback_data);
               continue;
             }
           else
@@ -1469,7 +1615,7 @@ ftp_output_stream_splice (GOutputStream *output,
                   current = cancellable;
                   g_clear_error (error);
                   if (progress_callback)
-                    progress_callback (bytes_copied, total_size, progress_callback_data);
+                    progress_callback (offset + bytes_copied, total_size, progress_callback_data);
                   continue;
                 }
               else
@@ -1504,7 +1650,7 @@ ftp_output_stream_splice (GOutputStream *output,
       g_object_unref (timer_cancel);
     }
   if (bytes_copied >= 0 && progress_callback)
-    progress_callback (bytes_copied, total_size, progress_callback_data);
+    progress_callback (offset + bytes_copied, total_size, progress_callback_data);
 
   return bytes_copied;
 }
@@ -1568,6 +1714,68 @@ do_pull_improve_error_message (GVfsFtpTask *task,
     }
 }
 
+/* Resumable downloads go to a hidden file next to the destination that
+ * only replaces it when complete. So a file found there is known to be
+ * an earlier download of ours and can be continued. */
+static GFile *
+do_pull_get_partial_file (GFile *dest)
+{
+  GFile *parent, *partial;
+  char *basename, *name;
+
+  parent = g_file_get_parent (dest);
+  if (parent == NULL)
+    return NULL;
+
+  basename = g_file_get_basename (dest);
+  name = g_strdup_printf (".%s.gvfs-ftp-part", basename);
+  partial = g_file_get_child (parent, name);
+  g_free (name);
+  g_free (basename);
+  g_object_unref (parent);
+
+  return partial;
+}
+
+/* Checks whether @partial can be continued for @info: smaller, and
+ * written after the remote file was last changed. Returns the size of
+ * the part that is there or 0 if that isn't the case. */
+static goffset
+do_pull_get_resume_offset (GVfsFtpTask *task,
+                           GFile       *partial,
+                           GFileInfo   *info)
+{
+  GFileInfo *partial_info;
+  GTimeVal remote_mtime, local_mtime;
+  goffset offset = 0;
+
+  if (info == NULL ||
+      g_file_info_get_file_type (info) != G_FILE_TYPE_REGULAR ||
+      !g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_TIME_MODIFIED))
+    return 0;
+
+  partial_info = g_file_query_info (partial,
+                                    G_FILE_ATTRIBUTE_STANDARD_TYPE ","
+                                    G_FILE_ATTRIBUTE_STANDARD_SIZE ","
+                                    G_FILE_ATTRIBUTE_TIME_MODIFIED,
+                                    G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                    task->cancellable, NULL);
+  if (partial_info == NULL)
+    return 0;
+
+  g_file_info_get_modification_time (info, &remote_mtime);
+  g_file_info_get_modification_time (partial_info, &local_mtime);
+
+  if (g_file_info_get_file_type (partial_info) == G_FILE_TYPE_REGULAR &&
+      g_file_info_get_size (partial_info) < g_file_info_get_size (info) &&
+      local_mtime.tv_sec >= remote_mtime.tv_sec)
+    offset = g_file_info_get_size (partial_info);
+
+  g_object_unref (partial_info);
+
+  return offset;
+}
+
 static void
 do_pull (GVfsBackend *         backend,
          GVfsJobPull *         job,
@@ -1578,45 +1786,63 @@ do_pull (GVfsBackend *         backend,
          GFileProgressCallback progress_callback,
          gpointer              progress_callback_data)
 {
-  static const GVfsFtpErrorFunc open_read_handlers[] = { error_550_is_directory,
-                                                         error_550_permission_or_not_found, 
-                                                         NULL };
   GVfsBackendFtp *ftp = G_VFS_BACKEND_FTP (backend);
   GVfsFtpTask task = G_VFS_FTP_TASK_INIT (ftp, G_VFS_JOB (job));
   GVfsFtpFile *src;
   GFile *dest;
+  GFile *partial = NULL;
   GInputStream *input;
   GOutputStream *output;
+  GFileInfo *info = NULL;
   goffset total_size = 0;
+  goffset offset = 0;
   
   src = g_vfs_ftp_file_new_from_gvfs (ftp, source);
   dest = g_file_new_for_path (local_path);
 
-  if (progress_callback)
+  /* Only downloads that would overwrite the destination anyway go
+   * through a partial file that can be continued later */
+  if ((flags & G_FILE_COPY_OVERWRITE) &&
+      !(flags & G_FILE_COPY_BACKUP) &&
+      g_vfs_backend_ftp_has_feature (ftp, G_VFS_FTP_FEATURE_REST))
+    partial = do_pull_get_partial_file (dest);
+
+  if (progress_callback || partial)
     {
-      GFileInfo *info = g_vfs_ftp_dir_cache_lookup_file (ftp->dir_cache, &task, src, TRUE);
+      info = g_vfs_ftp_dir_cache_lookup_file (ftp->dir_cache, &task, src, TRUE);
+      g_vfs_ftp_task_clear_error (&task);
       if (info)
-        {
-          total_size = g_file_info_get_size (info);
-          g_object_unref (info);
-        }
+        total_size = g_file_info_get_size (info);
     }
 
-  g_vfs_ftp_task_setup_data_connection (&task);
-  g_vfs_ftp_task_send_and_check (&task,
-                                 G_VFS_FTP_PASS_100 | G_VFS_FTP_FAIL_200,
-                                 open_read_handlers,
-                                 src,
-                                 NULL,
-                                 "RETR %s", g_vfs_ftp_file_get_ftp_path (src));
-  g_vfs_ftp_task_open_data_connection (&task);
+  if (partial)
+    offset = do_pull_get_resume_offset (&task, partial, info);
+  if (offset > 0)
+    g_debug ("# resuming download of %s at %"G_GOFFSET_FORMAT"\n", source, offset);
+
+  if (info)
+    g_object_unref (info);
+
+  ftp_task_retrieve (&task, src, offset);
   if (g_vfs_ftp_task_is_in_error (&task))
     {
       do_pull_improve_error_message (&task, dest, flags & G_FILE_COPY_OVERWRITE);
       goto out;
     }
 
-  if (flags & G_FILE_COPY_OVERWRITE)
+  if (offset > 0)
+    output = G_OUTPUT_STREAM (g_file_append_to (partial,
+                                                0,
+                                                task.cancellable,
+                                                &task.error));
+  else if (partial)
+    output = G_OUTPUT_STREAM (g_file_replace (partial,
+                                              NULL,
+                                              FALSE,
+                                              G_FILE_CREATE_REPLACE_DESTINATION,
+                                              task.cancellable,
+                                              &task.error));
+  else if (flags & G_FILE_COPY_OVERWRITE)
     output = G_OUTPUT_STREAM (g_file_replace (dest,
                                               NULL,
                                               flags & G_FILE_COPY_BACKUP ? TRUE : FALSE,
@@ -1638,6 +1864,7 @@ do_pull (GVfsBackend *         backend,
   input = g_io_stream_get_input_stream (g_vfs_ftp_connection_get_data_stream (task.conn));
   ftp_output_stream_splice (output,
                             input,
+                            offset,
                             total_size,
                             progress_callback,
                             progress_callback_data,
@@ -1647,6 +1874,23 @@ do_pull (GVfsBackend *         backend,
   g_vfs_ftp_task_receive (&task, 0, NULL);
   g_object_unref (output);
 
+  /* An incomplete partial file is kept for the next attempt */
+  if (g_vfs_ftp_task_is_in_error (&task))
+    goto out;
+
+  if (partial &&
+      !g_file_move (partial,
+                    dest,
+                    G_FILE_COPY_OVERWRITE | G_FILE_COPY_NOFOLLOW_SYMLINKS,
+                    task.cancellable,
+                    NULL,
+                    NULL,
+                    &task.error))
+    {
+      g_file_delete (partial, NULL, NULL);
+      goto out;
+    }
+
   if (remove_source)
     {
       g_vfs_ftp_task_send (&task,
@@ -1655,6 +1899,8 @@ do_pull (GVfsBackend *         backend,
     }
 
 out:
+  if (partial)
+    g_object_unref (partial);
   g_object_unref (dest);
   g_vfs_ftp_file_free (src);
   g_vfs_ftp_task_done (&task);
@@ -1674,6 +1920,7 @@ g_vfs_backend_ftp_class_init (GVfsBackendFtpClass *klass)
   backend_class->open_for_read = do_open_for_read;
   backend_class->close_read = do_close_read;
   backend_class->read = do_read;
+  backend_class->seek_on_read = do_seek_on_read;
   backend_class->create = do_create;
   backend_class->append_to = do_append;
   backend_class->replace = do_replace;
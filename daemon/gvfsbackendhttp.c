@@ -25,6 +25,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
@@ -50,6 +51,9 @@
 #include "gvfsdaemonutils.h"
 
 #include "soup-input-stream.h"
+#include "gvfshttpsegmentedstream.h"
+#include "gvfshttpcache.h"
+#include "gvfshttpcachedstream.h"
 
 
 G_DEFINE_TYPE (GVfsBackendHttp, g_vfs_backend_http, G_VFS_TYPE_BACKEND)
@@ -77,10 +81,22 @@ g_vfs_backend_http_finalize (GObject *object)
 
 #define DEBUG_MAX_BODY_SIZE (100 * 1024 * 1024)
 
+/* Large downloads from servers accepting ranges are split into up to
+ * this many concurrent requests, GVFS_HTTP_SEGMENTS overrides it and
+ * 1 turns it off. */
+#define DEFAULT_SEGMENTS 4
+#define MAX_SEGMENTS 16
+
+/* Downloaded files are kept in an on-disk cache of GVFS_HTTP_CACHE_SIZE
+ * MiB if that is set */
+#define CACHE_ENTRY_KEY "gvfs-backend-http-cache-entry"
+
 static void
 g_vfs_backend_http_init (GVfsBackendHttp *backend)
 {
   const char         *debug;
+  const char         *segments;
+  const char         *cache_size;
   SoupSessionFeature *proxy_resolver;
   SoupSessionFeature *cookie_jar;
   SoupSessionFeature *content_decoder;
@@ -91,8 +107,20 @@ g_vfs_backend_http_init (GVfsBackendHttp *backend)
                                                          "gvfs/" VERSION,
                                                          NULL);
 
+  backend->max_segments = DEFAULT_SEGMENTS;
+  segments = g_getenv ("GVFS_HTTP_SEGMENTS");
+  if (segments)
+    backend->max_segments = CLAMP (atoi (segments), 1, MAX_SEGMENTS);
+
+  cache_size = g_getenv ("GVFS_HTTP_CACHE_SIZE");
+  if (cache_size)
+    backend->cache_size = g_ascii_strtoull (cache_size, NULL, 10) * 1024 * 1024;
+
+  /* Leave room for other requests besides a segmented download */
   backend->session_async = soup_session_async_new_with_options ("user-agent",
                                                                 "gvfs/" VERSION,
+                                                                SOUP_SESSION_MAX_CONNS_PER_HOST,
+                                                                backend->max_segments + 2,
                                                                 NULL);
 
   /* Proxy handling */
@@ -335,7 +363,10 @@ open_for_read_ready (GObject      *source_object,
                      GAsyncResult *result,
                      gpointer      user_data)
 {
+  GVfsBackendHttp *op_backend;
+  GVfsHttpCacheEntry *entry;
   GInputStream *stream;
+  SoupMessage  *msg;
   GVfsJob      *job;
   gboolean      res;
   gboolean      can_seek;
@@ -345,11 +376,35 @@ open_for_read_ready (GObject      *source_object,
   error  = NULL;
   job    = G_VFS_JOB (user_data);
 
+  op_backend = G_VFS_BACKEND_HTTP (G_VFS_JOB_OPEN_FOR_READ (job)->backend);
+  entry = g_object_steal_data (G_OBJECT (stream), CACHE_ENTRY_KEY);
+
   res = soup_input_stream_send_finish (stream,
                                        result,
                                        &error);
   if (res == FALSE)
     {
+      if (entry &&
+          g_error_matches (error, SOUP_HTTP_ERROR, SOUP_STATUS_NOT_MODIFIED))
+        {
+          g_debug ("open_for_read: serving from cache\n");
+          g_error_free (error);
+
+          msg = soup_input_stream_get_message (stream);
+          g_object_unref (stream);
+          stream = g_vfs_http_cached_stream_new (op_backend->session_async,
+                                                 soup_message_get_uri (msg),
+                                                 entry,
+                                                 NULL);
+          g_object_unref (msg);
+          g_vfs_http_cache_entry_unref (entry);
+
+          g_vfs_job_open_for_read_set_can_seek (G_VFS_JOB_OPEN_FOR_READ (job), TRUE);
+          g_vfs_job_open_for_read_set_handle (G_VFS_JOB_OPEN_FOR_READ (job), stream);
+          g_vfs_job_succeeded (job);
+          return;
+        }
+
       g_vfs_job_failed_literal (G_VFS_JOB (job),
                                 error->domain,
                                 error->code,
@@ -357,9 +412,58 @@ open_for_read_ready (GObject      *source_object,
 
       g_error_free (error);
       g_object_unref (stream);
+      if (entry)
+        g_vfs_http_cache_entry_unref (entry);
       return;
     }
 
+  msg = soup_input_stream_get_message (stream);
+
+  if (entry)
+    {
+      const char *etag, *last_modified;
+      goffset size;
+
+      etag = soup_message_headers_get (msg->response_headers, "ETag");
+      last_modified = soup_message_headers_get (msg->response_headers, "Last-Modified");
+      size = soup_message_headers_get_content_length (msg->response_headers);
+
+      if (!g_vfs_http_cached_stream_can_handle (msg))
+        {
+          /* Whatever is cached is stale now */
+          g_vfs_http_cache_entry_reset (entry, NULL, NULL, -1);
+          g_vfs_http_cache_entry_unref (entry);
+          entry = NULL;
+        }
+      else if (!g_vfs_http_cache_entry_matches (entry, etag, last_modified, size))
+        g_vfs_http_cache_entry_reset (entry, etag, last_modified, size);
+    }
+
+  if (op_backend->max_segments > 1 &&
+      g_vfs_http_segmented_stream_can_handle (msg))
+    {
+      GInputStream *segmented;
+
+      g_debug ("open_for_read: segmented download\n");
+      segmented = g_vfs_http_segmented_stream_new (op_backend->session_async,
+                                                   msg,
+                                                   op_backend->max_segments);
+      g_input_stream_close (stream, NULL, NULL);
+      g_object_unref (stream);
+      stream = segmented;
+    }
+
+  if (entry)
+    {
+      stream = g_vfs_http_cached_stream_new (op_backend->session_async,
+                                             soup_message_get_uri (msg),
+                                             entry,
+                                             stream);
+      g_vfs_http_cache_entry_unref (entry);
+    }
+
+  g_object_unref (msg);
+
   can_seek = G_IS_SEEKABLE (stream) && g_seekable_can_seek (G_SEEKABLE (stream));
 
   g_vfs_job_open_for_read_set_can_seek (G_VFS_JOB_OPEN_FOR_READ (job), can_seek);
@@ -385,9 +489,10 @@ http_backend_open_for_read (GVfsBackend *backend,
 			    GVfsJob     *job,
 			    SoupURI     *uri)
 {
-  GVfsBackendHttp *op_backend;
-  GInputStream    *stream;
-  SoupMessage     *msg;
+  GVfsBackendHttp    *op_backend;
+  GVfsHttpCacheEntry *entry;
+  GInputStream       *stream;
+  SoupMessage        *msg;
 
   op_backend = G_VFS_BACKEND_HTTP (backend);
 
@@ -395,9 +500,31 @@ http_backend_open_for_read (GVfsBackend *backend,
 
   soup_message_body_set_accumulate (msg->response_body, FALSE);
 
+  entry = NULL;
+  if (op_backend->cache_size > 0)
+    {
+      char *uri_str;
+
+      uri_str = soup_uri_to_string (uri, FALSE);
+      entry = g_vfs_http_cache_entry_open (uri_str, op_backend->cache_size);
+      g_free (uri_str);
+    }
+
+  /* Revalidate what we have, a 304 means it can be used as is */
+  if (entry && g_vfs_http_cache_entry_get_etag (entry))
+    soup_message_headers_append (msg->request_headers, "If-None-Match",
+                                 g_vfs_http_cache_entry_get_etag (entry));
+  else if (entry && g_vfs_http_cache_entry_get_last_modified (entry))
+    soup_message_headers_append (msg->request_headers, "If-Modified-Since",
+                                 g_vfs_http_cache_entry_get_last_modified (entry));
+
   stream = soup_input_stream_new (op_backend->session_async, msg);
   g_object_unref (msg);
 
+  if (entry)
+    g_object_set_data_full (G_OBJECT (stream), CACHE_ENTRY_KEY, entry,
+                            (GDestroyNotify) g_vfs_http_cache_entry_unref);
+
   soup_input_stream_send_async (stream,
                                 G_PRIORITY_DEFAULT,
                                 job->cancellable,
@@ -53,6 +53,12 @@ struct _GVfsBackendHttp
   SoupSession *session;
 
   SoupSession *session_async;
+
+  /* concurrent ranged GETs per download, 1 for plain downloads */
+  guint        max_segments;
+
+  /* size limit of the download cache in bytes, 0 if disabled */
+  guint64      cache_size;
 };
 
 GType         g_vfs_backend_http_get_type    (void) G_GNUC_CONST;
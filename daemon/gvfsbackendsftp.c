@@ -55,7 +55,10 @@
 #include "gvfsjobqueryinfo.h"
 #include "gvfsjobqueryinforead.h"
 #include "gvfsjobqueryinfowrite.h"
+#include "gvfsjobcopy.h"
 #include "gvfsjobmove.h"
+#include "gvfsjobpush.h"
+#include "gvfsjobpull.h"
 #include "gvfsjobdelete.h"
 #include "gvfsjobqueryfsinfo.h"
 #include "gvfsjobqueryattributes.h"
@@ -63,6 +66,7 @@
 #include "gvfsjobmakedirectory.h"
 #include "gvfsdaemonprotocol.h"
 #include "gvfskeyring.h"
+#include "gvfssftpstatcache.h"
 #include "sftp.h"
 #include "pty_open.h"
 
@@ -78,6 +82,34 @@
 
 #define SFTP_READ_TIMEOUT 40   /* seconds */
 
+/* Read-ahead on read handles, like the OpenSSH sftp client. The number
+ * of outstanding requests can be changed with GVFS_SFTP_READ_AHEAD,
+ * 0 disables read-ahead. */
+#define READ_AHEAD_BLOCK_SIZE 32768
+#define READ_AHEAD_MAX_REQUESTS 64
+#define READ_AHEAD_INITIAL_REQUESTS 4
+
+/* Write-behind on write handles: writes are acknowledged as soon as they
+ * are queued, with at most this many requests or bytes unacknowledged by
+ * the server. GVFS_SFTP_WRITE_BEHIND=0 disables it. */
+#define WRITE_BEHIND_MAX_REQUESTS 32
+#define WRITE_BEHIND_MAX_BYTES (4 * 1024 * 1024)
+
+/* Enumeration: READDIRs kept in flight per directory, and the limit
+ * of STAT/READLINK requests resolving symlinks at the same time */
+#define READ_DIR_AHEAD_REQUESTS 4
+#define READ_DIR_MAX_ENTRY_REQUESTS 64
+
+/* Stat cache for query_info, filled from READDIR and LSTAT/STAT
+ * replies. GVFS_SFTP_STAT_CACHE_TTL sets the lifetime of an entry in
+ * seconds, 0 disables the cache. */
+#define STAT_CACHE_DEFAULT_TTL 10
+#define STAT_CACHE_MAX_ENTRIES 4096
+
+/* In-daemon copy when the server has no copy extension */
+#define COPY_BLOCK_SIZE 32768
+#define COPY_MAX_REQUESTS 64
+
 static GQuark id_q;
 
 typedef enum {
@@ -132,8 +164,33 @@ typedef struct {
   char *tempname;
   guint32 permissions;
   gboolean make_backup;
+
+  /* Read-ahead, only used for read handles */
+  GQueue read_ahead;             /* ReadAheadBlock, ordered by offset */
+  guint read_ahead_window;
+  goffset read_ahead_offset;     /* offset of the next READ to send */
+  gboolean read_ahead_eof;
+  GVfsJob *read_ahead_job;       /* read waiting for the head block */
+
+  /* Write-behind, only used for write handles */
+  guint write_behind_requests;
+  gsize write_behind_bytes;
+  GError *write_behind_error;    /* first deferred write error */
+  GVfsJob *write_behind_job;     /* write or close waiting for acks */
 } SftpHandle;
 
+typedef struct {
+  SftpHandle *handle;            /* NULL if dropped while in flight */
+  goffset offset;
+  guint32 size;
+  guchar *data;
+  guint32 count;
+  guint32 consumed;
+  gboolean done;
+  gboolean eof;
+  GError *error;
+} ReadAheadBlock;
+
 
 typedef struct {
   ReplyCallback callback;
@@ -178,6 +235,15 @@ struct _GVfsBackendSftp
   guint32 reply_size_read;
   guint8 *reply;
   
+  guint read_ahead_max;
+  gboolean write_behind;
+  GVfsSftpStatCache *stat_cache; /* NULL if disabled */
+
+  /* Server extensions from the SSH_FXP_VERSION reply */
+  gboolean ext_posix_rename;
+  gboolean ext_copy_data;
+  gboolean ext_copy_file;
+
   GMountSource *mount_source; /* Only used/set during mount */
   int mount_try;
   gboolean mount_try_again;
@@ -266,6 +332,9 @@ g_vfs_backend_sftp_finalize (GObject *object)
   
   if (backend->error_stream)
     g_object_unref (backend->error_stream);
+
+  if (backend->stat_cache)
+    g_vfs_sftp_stat_cache_free (backend->stat_cache);
   
   if (G_OBJECT_CLASS (g_vfs_backend_sftp_parent_class)->finalize)
     (*G_OBJECT_CLASS (g_vfs_backend_sftp_parent_class)->finalize) (object);
@@ -281,7 +350,84 @@ expected_reply_free (ExpectedReply *reply)
 static void
 g_vfs_backend_sftp_init (GVfsBackendSftp *backend)
 {
+  const char *read_ahead, *stat_cache_ttl;
+  guint ttl;
+  int n;
+
   backend->expected_replies = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify)expected_reply_free);
+
+  backend->read_ahead_max = READ_AHEAD_MAX_REQUESTS;
+  read_ahead = g_getenv ("GVFS_SFTP_READ_AHEAD");
+  if (read_ahead != NULL)
+    {
+      n = atoi (read_ahead);
+      if (n >= 0)
+        backend->read_ahead_max = MIN (n, 1024);
+      else
+        g_warning ("Ignoring invalid GVFS_SFTP_READ_AHEAD value %s", read_ahead);
+    }
+
+  backend->write_behind = g_strcmp0 (g_getenv ("GVFS_SFTP_WRITE_BEHIND"), "0") != 0;
+
+  ttl = STAT_CACHE_DEFAULT_TTL;
+  stat_cache_ttl = g_getenv ("GVFS_SFTP_STAT_CACHE_TTL");
+  if (stat_cache_ttl != NULL)
+    {
+      n = atoi (stat_cache_ttl);
+      if (n >= 0)
+        ttl = n;
+      else
+        g_warning ("Ignoring invalid GVFS_SFTP_STAT_CACHE_TTL value %s", stat_cache_ttl);
+    }
+  if (ttl > 0)
+    backend->stat_cache = g_vfs_sftp_stat_cache_new (ttl, STAT_CACHE_MAX_ENTRIES);
+}
+
+static guint
+stat_cache_generation (GVfsBackendSftp *backend)
+{
+  if (backend->stat_cache == NULL)
+    return 0;
+
+  return g_vfs_sftp_stat_cache_get_generation (backend->stat_cache);
+}
+
+static void
+stat_cache_insert (GVfsBackendSftp *backend,
+                   guint generation,
+                   const char *path,
+                   gboolean follow_symlinks,
+                   GFileInfo *info)
+{
+  if (backend->stat_cache)
+    g_vfs_sftp_stat_cache_insert (backend->stat_cache, generation,
+                                  path, follow_symlinks, info);
+}
+
+/* Call this before sending a request that changes @path. Replies to
+ * earlier requests then won't put the old state back into the cache,
+ * since the server handles requests in order. The parent directory
+ * is purged as well, as its mtime changes when entries are added or
+ * removed. */
+static void
+stat_cache_purge (GVfsBackendSftp *backend,
+                  const char *path,
+                  gboolean recursive,
+                  gboolean parent)
+{
+  char *dirname;
+
+  if (backend->stat_cache == NULL || path == NULL)
+    return;
+
+  g_vfs_sftp_stat_cache_purge (backend->stat_cache, path, recursive);
+
+  if (parent)
+    {
+      dirname = g_path_get_dirname (path);
+      g_vfs_sftp_stat_cache_purge (backend->stat_cache, dirname, FALSE);
+      g_free (dirname);
+    }
 }
 
 static void
@@ -1653,7 +1799,14 @@ do_mount (GVfsBackend *backend,
       extension_data = read_string (reply, NULL);
       if (extension_data)
         {
-          /* TODO: Do something with this */
+          g_debug ("sftp extension: %s (%s)\n", extension_name, extension_data);
+
+          if (strcmp (extension_name, "posix-rename@openssh.com") == 0)
+            op_backend->ext_posix_rename = TRUE;
+          else if (strcmp (extension_name, "copy-data") == 0)
+            op_backend->ext_copy_data = TRUE;
+          else if (strcmp (extension_name, "copy-file") == 0)
+            op_backend->ext_copy_file = TRUE;
         }
       g_free (extension_name);
       g_free (extension_data);
@@ -1695,6 +1848,9 @@ do_mount (GVfsBackend *backend,
   g_vfs_backend_set_display_name (backend, display_name);
   g_free (display_name);
 
+  /* Reads are served from the read-ahead window in blocks of this size */
+  g_vfs_backend_set_read_chunk_size (backend, READ_AHEAD_BLOCK_SIZE, 0);
+
   /* checks for /etc/favicon.png */
   setup_icon (op_backend, job);
   
@@ -2290,13 +2446,19 @@ sftp_handle_new (GDataInputStream *reply)
   handle = g_slice_new0 (SftpHandle);
   handle->raw_handle = read_data_buffer (reply);
   handle->offset = 0;
+  handle->read_ahead_window = READ_AHEAD_INITIAL_REQUESTS;
 
   return handle;
 }
 
+static void read_ahead_drop (SftpHandle *handle);
+
 static void
 sftp_handle_free (SftpHandle *handle)
 {
+  read_ahead_drop (handle);
+  if (handle->write_behind_error)
+    g_error_free (handle->write_behind_error);
   data_buffer_free (handle->raw_handle);
   g_free (handle->filename);
   g_free (handle->tempname);
@@ -2495,6 +2657,204 @@ read_reply (GVfsBackendSftp *backend,
   g_vfs_job_succeeded (job);
 }
 
+static void
+read_ahead_block_free (ReadAheadBlock *block)
+{
+  g_free (block->data);
+  if (block->error)
+    g_error_free (block->error);
+  g_slice_free (ReadAheadBlock, block);
+}
+
+/* Throws away all queued data. Blocks still in flight are
+ * freed when their reply arrives. */
+static void
+read_ahead_drop (SftpHandle *handle)
+{
+  ReadAheadBlock *block;
+
+  while ((block = g_queue_pop_head (&handle->read_ahead)) != NULL)
+    {
+      if (block->done)
+        read_ahead_block_free (block);
+      else
+        block->handle = NULL;
+    }
+
+  handle->read_ahead_eof = FALSE;
+  handle->read_ahead_window = READ_AHEAD_INITIAL_REQUESTS;
+}
+
+/* Copies as much queued data as possible into the waiting read job.
+ * Returns FALSE if there was nothing to give it yet. */
+static gboolean
+read_ahead_serve (SftpHandle *handle)
+{
+  GVfsJobRead *op_job;
+  ReadAheadBlock *block;
+  gsize copied, n;
+
+  op_job = G_VFS_JOB_READ (handle->read_ahead_job);
+  copied = 0;
+  block = NULL;
+
+  while (copied < op_job->bytes_requested &&
+         (block = g_queue_peek_head (&handle->read_ahead)) != NULL &&
+         block->done)
+    {
+      if (block->offset + block->consumed != handle->offset)
+        {
+          /* The server returned a short read earlier, so the rest
+             of the window doesn't line up anymore. Start over. */
+          read_ahead_drop (handle);
+          block = NULL;
+          break;
+        }
+
+      if (block->error != NULL)
+        {
+          if (copied == 0)
+            {
+              g_vfs_job_failed_from_error (G_VFS_JOB (op_job), block->error);
+              g_queue_pop_head (&handle->read_ahead);
+              read_ahead_block_free (block);
+              goto out;
+            }
+          break;
+        }
+
+      if (block->eof)
+        break;
+
+      n = MIN (block->count - block->consumed, op_job->bytes_requested - copied);
+      memcpy (op_job->buffer + copied, block->data + block->consumed, n);
+      copied += n;
+      block->consumed += n;
+      handle->offset += n;
+
+      if (block->consumed == block->count)
+        {
+          g_queue_pop_head (&handle->read_ahead);
+          read_ahead_block_free (block);
+
+          /* Sequential access, open up the window */
+          handle->read_ahead_window = MIN (handle->read_ahead_window * 2,
+                                           READ_AHEAD_MAX_REQUESTS);
+        }
+    }
+
+  if (copied == 0 &&
+      (block == NULL || !block->done || !block->eof))
+    return FALSE;
+
+  g_vfs_job_read_set_size (op_job, copied);
+  g_vfs_job_succeeded (G_VFS_JOB (op_job));
+
+ out:
+  g_object_unref (handle->read_ahead_job);
+  handle->read_ahead_job = NULL;
+  return TRUE;
+}
+
+static void read_ahead_fill (GVfsBackendSftp *backend,
+                             SftpHandle *handle,
+                             GVfsJob *job);
+
+static void
+read_ahead_reply (GVfsBackendSftp *backend,
+                  int reply_type,
+                  GDataInputStream *reply,
+                  guint32 len,
+                  GVfsJob *job,
+                  gpointer user_data)
+{
+  ReadAheadBlock *block = user_data;
+  SftpHandle *handle;
+  GError *error;
+
+  handle = block->handle;
+  if (handle == NULL)
+    {
+      /* Dropped by a seek or close */
+      read_ahead_block_free (block);
+      return;
+    }
+
+  block->done = TRUE;
+
+  if (reply_type == SSH_FXP_STATUS)
+    {
+      error = NULL;
+      if (error_from_status (job, reply, -1, SSH_FX_EOF, &error))
+        {
+          block->eof = TRUE;
+          handle->read_ahead_eof = TRUE;
+        }
+      else
+        block->error = error;
+    }
+  else if (reply_type == SSH_FXP_DATA)
+    {
+      block->count = g_data_input_stream_read_uint32 (reply, NULL, NULL);
+      if (block->count > block->size)
+        block->count = block->size;
+      block->data = g_malloc (block->count);
+      if (!g_input_stream_read_all (G_INPUT_STREAM (reply),
+                                    block->data, block->count,
+                                    NULL, NULL, NULL))
+        {
+          block->count = 0;
+          block->error = g_error_new_literal (G_IO_ERROR, G_IO_ERROR_FAILED,
+                                              _("Invalid reply received"));
+        }
+    }
+  else
+    block->error = g_error_new_literal (G_IO_ERROR, G_IO_ERROR_FAILED,
+                                        _("Invalid reply received"));
+
+  /* A short block makes serve drop the window, so refill it from the
+   * current offset or the waiting read would never be answered */
+  if (handle->read_ahead_job != NULL &&
+      !read_ahead_serve (handle))
+    read_ahead_fill (backend, handle, handle->read_ahead_job);
+}
+
+/* Keeps up to read_ahead_window READs outstanding past the current offset */
+static void
+read_ahead_fill (GVfsBackendSftp *backend,
+                 SftpHandle *handle,
+                 GVfsJob *job)
+{
+  GDataOutputStream *command;
+  ReadAheadBlock *block;
+
+  if (g_queue_is_empty (&handle->read_ahead))
+    {
+      handle->read_ahead_offset = handle->offset;
+      handle->read_ahead_eof = FALSE;
+    }
+
+  while (!handle->read_ahead_eof &&
+         g_queue_get_length (&handle->read_ahead) < MIN (handle->read_ahead_window,
+                                                         backend->read_ahead_max))
+    {
+      block = g_slice_new0 (ReadAheadBlock);
+      block->handle = handle;
+      block->offset = handle->read_ahead_offset;
+      block->size = READ_AHEAD_BLOCK_SIZE;
+
+      command = new_command_stream (backend,
+                                    SSH_FXP_READ);
+      put_data_buffer (command, handle->raw_handle);
+      g_data_output_stream_put_uint64 (command, block->offset, NULL, NULL);
+      g_data_output_stream_put_uint32 (command, block->size, NULL, NULL);
+      queue_command_stream_and_free (backend, command, read_ahead_reply, job, block);
+
+      g_queue_push_tail (&handle->read_ahead, block);
+      handle->read_ahead_offset += block->size;
+    }
+}
+
 static gboolean
 try_read (GVfsBackend *backend,
           GVfsJobRead *job,
@@ -2506,6 +2866,14 @@ try_read (GVfsBackend *backend,
   GVfsBackendSftp *op_backend = G_VFS_BACKEND_SFTP (backend);
   GDataOutputStream *command;
 
+  if (op_backend->read_ahead_max > 0)
+    {
+      handle->read_ahead_job = g_object_ref (job);
+      read_ahead_serve (handle);
+      read_ahead_fill (op_backend, handle, G_VFS_JOB (job));
+      return TRUE;
+    }
+
   command = new_command_stream (op_backend,
                                 SSH_FXP_READ);
   put_data_buffer (command, handle->raw_handle);
@@ -2586,6 +2954,8 @@ try_seek_on_read (GVfsBackend *backend,
   GVfsBackendSftp *op_backend = G_VFS_BACKEND_SFTP (backend);
   GDataOutputStream *command;
 
+  read_ahead_drop (handle);
+
   command = new_command_stream (op_backend,
                                 SSH_FXP_FSTAT);
   put_data_buffer (command, handle->raw_handle);
@@ -2611,6 +2981,22 @@ delete_temp_file (GVfsBackendSftp *backend,
     }
 }
 
+static void
+close_write_purge_cache (GVfsBackendSftp *backend,
+                         SftpHandle *handle)
+{
+  char *backup_name;
+
+  stat_cache_purge (backend, handle->filename, FALSE, TRUE);
+
+  if (handle->make_backup)
+    {
+      backup_name = g_strconcat (handle->filename, "~", NULL);
+      stat_cache_purge (backend, backup_name, FALSE, FALSE);
+      g_free (backup_name);
+    }
+}
+
 static void
 close_moved_tempfile (GVfsBackendSftp *backend,
                       int reply_type,
@@ -2623,6 +3009,9 @@ close_moved_tempfile (GVfsBackendSftp *backend,
   
   handle = user_data;
 
+  /* Renames and removes done while closing are only over now */
+  close_write_purge_cache (backend, handle);
+
   if (reply_type == SSH_FXP_STATUS)
     result_from_status (job, reply, -1, -1);
   else
@@ -2871,6 +3260,28 @@ close_write_fstat_reply (GVfsBackendSftp *backend,
   queue_command_stream_and_free (backend, command, close_write_reply, G_VFS_JOB (job), handle);
 }
 
+static void
+close_write_start (GVfsBackendSftp *backend,
+                   SftpHandle *handle,
+                   GVfsJob *job)
+{
+  GDataOutputStream *command;
+
+  if (handle->write_behind_error)
+    {
+      /* A deferred write failed, treat it like a failed close */
+      delete_temp_file (backend, handle, job);
+      g_vfs_job_failed_from_error (job, handle->write_behind_error);
+      sftp_handle_free (handle);
+      return;
+    }
+
+  command = new_command_stream (backend, SSH_FXP_FSTAT);
+  put_data_buffer (command, handle->raw_handle);
+
+  queue_command_stream_and_free (backend, command, close_write_fstat_reply, job, handle);
+}
+
 static gboolean
 try_close_write (GVfsBackend *backend,
                  GVfsJobCloseWrite *job,
@@ -2878,12 +3289,17 @@ try_close_write (GVfsBackend *backend,
 {
   SftpHandle *handle = _handle;
   GVfsBackendSftp *op_backend = G_VFS_BACKEND_SFTP (backend);
-  GDataOutputStream *command;
 
-  command = new_command_stream (op_backend, SSH_FXP_FSTAT);
-  put_data_buffer (command, handle->raw_handle);
+  close_write_purge_cache (op_backend, handle);
+
+  if (handle->write_behind_requests > 0)
+    {
+      /* Finished by write_behind_reply once everything is on disk */
+      handle->write_behind_job = g_object_ref (job);
+      return TRUE;
+    }
 
-  queue_command_stream_and_free (op_backend, command, close_write_fstat_reply, G_VFS_JOB (job), handle);
+  close_write_start (op_backend, handle, G_VFS_JOB (job));
 
   return TRUE;
 }
@@ -2918,6 +3334,8 @@ try_close_read (GVfsBackend *backend,
   GVfsBackendSftp *op_backend = G_VFS_BACKEND_SFTP (backend);
   GDataOutputStream *command;
 
+  read_ahead_drop (handle);
+
   command = new_command_stream (op_backend, SSH_FXP_CLOSE);
   put_data_buffer (command, handle->raw_handle);
 
@@ -3027,6 +3445,7 @@ create_reply (GVfsBackendSftp *backend,
     }
 
   handle = sftp_handle_new (reply);
+  handle->filename = g_strdup (G_VFS_JOB_OPEN_FOR_WRITE (job)->filename);
   
   g_vfs_job_open_for_write_set_handle (G_VFS_JOB_OPEN_FOR_WRITE (job), handle);
   g_vfs_job_open_for_write_set_can_seek (G_VFS_JOB_OPEN_FOR_WRITE (job), TRUE);
@@ -3042,6 +3461,8 @@ try_create (GVfsBackend *backend,
   GVfsBackendSftp *op_backend = G_VFS_BACKEND_SFTP (backend);
   GDataOutputStream *command;
 
+  stat_cache_purge (op_backend, filename, FALSE, TRUE);
+
   command = new_command_stream (op_backend,
                                 SSH_FXP_OPEN);
   put_string (command, filename);
@@ -3108,6 +3529,7 @@ append_to_reply (GVfsBackendSftp *backend,
     }
 
   handle = sftp_handle_new (reply);
+  handle->filename = g_strdup (G_VFS_JOB_OPEN_FOR_WRITE (job)->filename);
   
   g_vfs_job_open_for_write_set_handle (G_VFS_JOB_OPEN_FOR_WRITE (job), handle);
   g_vfs_job_open_for_write_set_can_seek (G_VFS_JOB_OPEN_FOR_WRITE (job), FALSE);
@@ -3123,6 +3545,8 @@ try_append_to (GVfsBackend *backend,
   GVfsBackendSftp *op_backend = G_VFS_BACKEND_SFTP (backend);
   GDataOutputStream *command;
 
+  stat_cache_purge (op_backend, filename, FALSE, TRUE);
+
   command = new_command_stream (op_backend,
                                 SSH_FXP_OPEN);
   put_string (command, filename);
@@ -3525,6 +3949,8 @@ try_replace (GVfsBackend *backend,
   GVfsBackendSftp *op_backend = G_VFS_BACKEND_SFTP (backend);
   GDataOutputStream *command;
 
+  stat_cache_purge (op_backend, filename, FALSE, TRUE);
+
   command = new_command_stream (op_backend,
                                 SSH_FXP_OPEN);
   put_string (command, filename);
@@ -3560,6 +3986,73 @@ write_reply (GVfsBackendSftp *backend,
                       _("Invalid reply received"));
 }
 
+static gboolean
+write_behind_is_full (SftpHandle *handle)
+{
+  return handle->write_behind_requests >= WRITE_BEHIND_MAX_REQUESTS ||
+    handle->write_behind_bytes >= WRITE_BEHIND_MAX_BYTES;
+}
+
+static void
+write_behind_reply (GVfsBackendSftp *backend,
+                    int reply_type,
+                    GDataInputStream *reply,
+                    guint32 len,
+                    GVfsJob *job,
+                    gpointer user_data)
+{
+  SftpHandle *handle;
+  GError *error;
+  GVfsJob *waiting_job;
+
+  handle = user_data;
+
+  handle->write_behind_requests--;
+  handle->write_behind_bytes -= G_VFS_JOB_WRITE (job)->data_size;
+
+  error = NULL;
+  if (reply_type == SSH_FXP_STATUS)
+    error_from_status (job, reply, -1, -1, &error);
+  else
+    error = g_error_new_literal (G_IO_ERROR, G_IO_ERROR_FAILED,
+                                 _("Invalid reply received"));
+
+  if (error != NULL)
+    {
+      /* Keep the first error, it is reported on the next write or close */
+      if (handle->write_behind_error == NULL)
+        handle->write_behind_error = error;
+      else
+        g_error_free (error);
+    }
+
+  waiting_job = handle->write_behind_job;
+  if (waiting_job == NULL)
+    return;
+
+  if (G_VFS_IS_JOB_CLOSE_WRITE (waiting_job))
+    {
+      if (handle->write_behind_requests > 0)
+        return;
+
+      handle->write_behind_job = NULL;
+      close_write_start (backend, handle, waiting_job);
+    }
+  else
+    {
+      if (handle->write_behind_error == NULL && write_behind_is_full (handle))
+        return;
+
+      handle->write_behind_job = NULL;
+      if (handle->write_behind_error)
+        g_vfs_job_failed_from_error (waiting_job, handle->write_behind_error);
+      else
+        g_vfs_job_succeeded (waiting_job);
+    }
+
+  g_object_unref (waiting_job);
+}
+
 static gboolean
 try_write (GVfsBackend *backend,
            GVfsJobWrite *job,
@@ -3571,6 +4064,42 @@ try_write (GVfsBackend *backend,
   GVfsBackendSftp *op_backend = G_VFS_BACKEND_SFTP (backend);
   GDataOutputStream *command;
 
+  /* The cache entry was purged when the file was opened and is purged
+   * again on close, writes don't need to do it */
+  if (op_backend->write_behind)
+    {
+      if (handle->write_behind_error)
+        {
+          g_vfs_job_failed_from_error (G_VFS_JOB (job), handle->write_behind_error);
+          return TRUE;
+        }
+
+      command = new_command_stream (op_backend,
+                                    SSH_FXP_WRITE);
+      put_data_buffer (command, handle->raw_handle);
+      g_data_output_stream_put_uint64 (command, handle->offset, NULL, NULL);
+      g_data_output_stream_put_uint32 (command, buffer_size, NULL, NULL);
+      g_output_stream_write_all (G_OUTPUT_STREAM (command),
+                                 buffer, buffer_size,
+                                 NULL, NULL, NULL);
+      queue_command_stream_and_free (op_backend, command, write_behind_reply, G_VFS_JOB (job), handle);
+
+      handle->offset += buffer_size;
+      handle->write_behind_requests++;
+      handle->write_behind_bytes += buffer_size;
+
+      g_vfs_job_write_set_written_size (job, buffer_size);
+
+      /* Too much unacknowledged data, hold the client back until
+         the server catches up */
+      if (write_behind_is_full (handle))
+        handle->write_behind_job = g_object_ref (job);
+      else
+        g_vfs_job_succeeded (G_VFS_JOB (job));
+
+      return TRUE;
+    }
+
   command = new_command_stream (op_backend,
                                 SSH_FXP_WRITE);
   put_data_buffer (command, handle->raw_handle);
@@ -3659,6 +4188,14 @@ try_seek_on_write (GVfsBackend *backend,
   GVfsBackendSftp *op_backend = G_VFS_BACKEND_SFTP (backend);
   GDataOutputStream *command;
 
+  if (handle->write_behind_error)
+    {
+      g_vfs_job_failed_from_error (G_VFS_JOB (job), handle->write_behind_error);
+      return TRUE;
+    }
+
+  /* The server handles requests in order, so the FSTAT sees all
+     queued writes */
   command = new_command_stream (op_backend,
                                 SSH_FXP_FSTAT);
   put_data_buffer (command, handle->raw_handle);
@@ -3668,81 +4205,178 @@ try_seek_on_write (GVfsBackend *backend,
   return TRUE;
 }
 
+/* Enumeration keeps a few READDIRs in flight on the handle. Entries
+ * that need a STAT (following a symlink) or a READLINK are queued and
+ * resolved with a bounded number of requests in flight. Each READDIR
+ * reply becomes a batch that is handed to the client as soon as all
+ * its entries are resolved. */
+
 typedef struct {
   DataBuffer *handle;
-  int outstanding_requests;
+  gboolean eof;
+  gboolean handle_closed;
+  guint readdir_requests;        /* READDIRs in flight */
+  guint entry_requests;          /* STAT/READLINKs in flight */
+  guint n_batches;               /* batches not yet sent to the client */
+  GQueue pending;                /* ReadDirEntry waiting for a request */
 } ReadDirData;
 
+typedef struct {
+  GList *infos;
+  guint outstanding;             /* entries still being resolved */
+} ReadDirBatch;
+
+typedef struct {
+  ReadDirBatch *batch;
+  GFileInfo *info;
+  char *abs_name;
+  gboolean need_stat;
+  gboolean need_readlink;
+  guint cache_generation;        /* when the last request was sent */
+} ReadDirEntry;
+
+static void
+read_dir_entry_free (ReadDirEntry *entry)
+{
+  g_object_unref (entry->info);
+  g_free (entry->abs_name);
+  g_slice_free (ReadDirEntry, entry);
+}
+
 static
 void
 read_dir_data_free (ReadDirData *data)
 {
-  data_buffer_free (data->handle);
+  ReadDirEntry *entry;
+
+  /* Only non-empty if the job is dropped early */
+  while ((entry = g_queue_pop_head (&data->pending)) != NULL)
+    read_dir_entry_free (entry);
+
+  if (data->handle)
+    data_buffer_free (data->handle);
   g_slice_free (ReadDirData, data);
 }
 
+static void read_dir_reply (GVfsBackendSftp *backend,
+                            int reply_type,
+                            GDataInputStream *reply,
+                            guint32 len,
+                            GVfsJob *job,
+                            gpointer user_data);
+static void read_dir_process_pending (GVfsBackendSftp *backend,
+                                      GVfsJob *job);
+
 static void
-read_dir_readlink_reply (GVfsBackendSftp *backend,
-                         int reply_type,
-                         GDataInputStream *reply,
-                         guint32 len,
-                         GVfsJob *job,
-                         gpointer user_data)
+read_dir_batch_send (GVfsJob *job,
+                     ReadDirBatch *batch)
 {
-  ReadDirData *data;
-  GFileInfo *info = user_data;
-  char *target;
-
-  data = job->backend_data;
+  ReadDirData *data = job->backend_data;
 
-  if (reply_type == SSH_FXP_NAME)
-    {
-      /* count = */ (void) g_data_input_stream_read_uint32 (reply, NULL, NULL);
-      
-      target = read_string (reply, NULL);
-      if (target)
-        {
-          g_file_info_set_symlink_target (info, target);
-          g_free (target);
-        }
-    }
+  batch->infos = g_list_reverse (batch->infos);
+  g_vfs_job_enumerate_add_infos (G_VFS_JOB_ENUMERATE (job), batch->infos);
+  g_vfs_job_enumerate_flush (G_VFS_JOB_ENUMERATE (job));
+  g_list_free_full (batch->infos, g_object_unref);
+  g_slice_free (ReadDirBatch, batch);
 
-  g_vfs_job_enumerate_add_info (G_VFS_JOB_ENUMERATE (job), info);
-  g_object_unref (info);
-  
-  if (--data->outstanding_requests == 0)
-    g_vfs_job_enumerate_done (G_VFS_JOB_ENUMERATE (job));
+  data->n_batches--;
 }
 
 static void
-read_dir_got_stat_info (GVfsBackendSftp *backend,
-                        GVfsJob *job,
-                        GFileInfo *info)
+read_dir_maybe_done (GVfsBackendSftp *backend,
+                     GVfsJob *job)
 {
-  GVfsJobEnumerate *enum_job;
+  ReadDirData *data = job->backend_data;
   GDataOutputStream *command;
-  ReadDirData *data;
-  char *abs_name;
-  
-  data = job->backend_data;
-  
-  enum_job = G_VFS_JOB_ENUMERATE (job);
 
-  if (g_file_attribute_matcher_matches (enum_job->attribute_matcher,
-                                        G_FILE_ATTRIBUTE_STANDARD_SYMLINK_TARGET))
+  if (!data->eof || data->readdir_requests > 0)
+    return;
+
+  if (!data->handle_closed)
     {
-      data->outstanding_requests++;
+      data->handle_closed = TRUE;
       command = new_command_stream (backend,
-                                    SSH_FXP_READLINK);
-      abs_name = g_build_filename (enum_job->filename, g_file_info_get_name (info), NULL);
-      put_string (command, abs_name);
-      g_free (abs_name);
-      queue_command_stream_and_free (backend, command, read_dir_readlink_reply, G_VFS_JOB (job), g_object_ref (info));
+                                    SSH_FXP_CLOSE);
+      put_data_buffer (command, data->handle);
+      queue_command_stream_and_free (backend, command, NULL, job, NULL);
     }
-  else
-    g_vfs_job_enumerate_add_info (enum_job, info);
+
+  if (data->n_batches == 0 &&
+      data->entry_requests == 0 &&
+      g_queue_is_empty (&data->pending))
+    g_vfs_job_enumerate_done (G_VFS_JOB_ENUMERATE (job));
+}
+
+static void
+read_dir_fill (GVfsBackendSftp *backend,
+               GVfsJob *job)
+{
+  ReadDirData *data = job->backend_data;
+  GDataOutputStream *command;
+
+  while (!data->eof && data->readdir_requests < READ_DIR_AHEAD_REQUESTS)
+    {
+      command = new_command_stream (backend,
+                                    SSH_FXP_READDIR);
+      put_data_buffer (command, data->handle);
+      data->readdir_requests++;
+      queue_command_stream_and_free (backend, command, read_dir_reply, job,
+                                     GUINT_TO_POINTER (stat_cache_generation (backend)));
+    }
+}
+
+static void
+read_dir_entry_done (GVfsBackendSftp *backend,
+                     GVfsJob *job,
+                     ReadDirEntry *entry)
+{
+  ReadDirBatch *batch = entry->batch;
+
+  batch->infos = g_list_prepend (batch->infos, g_object_ref (entry->info));
+  read_dir_entry_free (entry);
+
+  if (--batch->outstanding == 0)
+    read_dir_batch_send (job, batch);
+
+  read_dir_process_pending (backend, job);
+  read_dir_maybe_done (backend, job);
 }
 
+static void
+read_dir_readlink_reply (GVfsBackendSftp *backend,
+                         int reply_type,
+                         GDataInputStream *reply,
+                         guint32 len,
+                         GVfsJob *job,
+                         gpointer user_data)
+{
+  ReadDirData *data;
+  ReadDirEntry *entry = user_data;
+  char *target;
+
+  data = job->backend_data;
+  data->entry_requests--;
+
+  if (reply_type == SSH_FXP_NAME)
+    {
+      /* count = */ (void) g_data_input_stream_read_uint32 (reply, NULL, NULL);
+      
+      target = read_string (reply, NULL);
+      if (target)
+        {
+          g_file_info_set_symlink_target (entry->info, target);
+
+          if (backend->stat_cache)
+            g_vfs_sftp_stat_cache_set_symlink_target (backend->stat_cache,
+                                                      entry->cache_generation,
+                                                      entry->abs_name, target);
+
+          g_free (target);
+        }
+    }
+
+  read_dir_entry_done (backend, job, entry);
+}
 
 static void
 read_dir_symlink_reply (GVfsBackendSftp *backend,
@@ -3754,32 +4388,71 @@ read_dir_symlink_reply (GVfsBackendSftp *backend,
 {
   const char *name;
   GFileInfo *info;
-  GFileInfo *lstat_info;
   ReadDirData *data;
+  ReadDirEntry *entry = user_data;
 
-  lstat_info = user_data;
-  name = g_file_info_get_name (lstat_info);
   data = job->backend_data;
-  
+  data->entry_requests--;
+  entry->need_stat = FALSE;
+
   if (reply_type == SSH_FXP_ATTRS)
     {
+      name = g_file_info_get_name (entry->info);
+
       info = g_file_info_new ();
       g_file_info_set_name (info, name);
       g_file_info_set_is_symlink (info, TRUE);
       
       parse_attributes (backend, info, name, reply, G_VFS_JOB_ENUMERATE (job)->attribute_matcher);
 
-      read_dir_got_stat_info (backend, job, info);
-      
-      g_object_unref (info);
+      stat_cache_insert (backend, entry->cache_generation, entry->abs_name, TRUE, info);
+
+      g_object_unref (entry->info);
+      entry->info = info;
+    }
+  /* else broken symlink, use the lstat info */
+
+  if (entry->need_readlink)
+    {
+      /* Keep it ahead of entries from later batches */
+      g_queue_push_head (&data->pending, entry);
+      read_dir_process_pending (backend, job);
     }
   else
-    read_dir_got_stat_info (backend, job, lstat_info);
+    read_dir_entry_done (backend, job, entry);
+}
 
-  g_object_unref (lstat_info);
-  
-  if (--data->outstanding_requests == 0)
-    g_vfs_job_enumerate_done (G_VFS_JOB_ENUMERATE (job));
+static void
+read_dir_process_pending (GVfsBackendSftp *backend,
+                          GVfsJob *job)
+{
+  ReadDirData *data = job->backend_data;
+  GDataOutputStream *command;
+  ReadDirEntry *entry;
+
+  while (data->entry_requests < READ_DIR_MAX_ENTRY_REQUESTS &&
+         (entry = g_queue_pop_head (&data->pending)) != NULL)
+    {
+      entry->cache_generation = stat_cache_generation (backend);
+      data->entry_requests++;
+
+      if (entry->need_stat)
+        {
+          /* Default (at least for openssh) is for readdir to not follow symlinks.
+             This was a symlink, and follow links was requested, so we need to manually follow it */
+          command = new_command_stream (backend,
+                                        SSH_FXP_STAT);
+          put_string (command, entry->abs_name);
+          queue_command_stream_and_free (backend, command, read_dir_symlink_reply, job, entry);
+        }
+      else
+        {
+          command = new_command_stream (backend,
+                                        SSH_FXP_READLINK);
+          put_string (command, entry->abs_name);
+          queue_command_stream_and_free (backend, command, read_dir_readlink_reply, job, entry);
+        }
+    }
 }
 
 static void
@@ -3793,30 +4466,34 @@ read_dir_reply (GVfsBackendSftp *backend,
   GVfsJobEnumerate *enum_job;
   guint32 count;
   int i;
-  GDataOutputStream *command;
   ReadDirData *data;
+  ReadDirBatch *batch;
+  ReadDirEntry *entry;
+  guint generation;
+  gboolean is_symlink;
 
   data = job->backend_data;
   enum_job = G_VFS_JOB_ENUMERATE (job);
+  generation = GPOINTER_TO_UINT (user_data);
+
+  data->readdir_requests--;
 
   if (reply_type != SSH_FXP_NAME)
     {
       /* Ignore all error, including the expected END OF FILE.
        * Real errors are expected in open_dir anyway */
-
-      /* Close handle */
-
-      command = new_command_stream (backend,
-                                    SSH_FXP_CLOSE);
-      put_data_buffer (command, data->handle);
-      queue_command_stream_and_free (backend, command, NULL, G_VFS_JOB (job), NULL);
-  
-      if (--data->outstanding_requests == 0)
-        g_vfs_job_enumerate_done (enum_job);
-      
+      data->eof = TRUE;
+      read_dir_maybe_done (backend, job);
       return;
     }
 
+  /* Ask for more while this batch is being resolved */
+  read_dir_fill (backend, job);
+
+  batch = g_slice_new0 (ReadDirBatch);
+  batch->outstanding = 1; /* released below */
+  data->n_batches++;
+
   count = g_data_input_stream_read_uint32 (reply, NULL, NULL);
   for (i = 0; i < count; i++)
     {
@@ -3833,33 +4510,51 @@ read_dir_reply (GVfsBackendSftp *backend,
       g_free (longname);
       
       parse_attributes (backend, info, name, reply, enum_job->attribute_matcher);
-      
-      if (g_file_info_get_file_type (info) == G_FILE_TYPE_SYMBOLIC_LINK &&
-          ! (enum_job->flags & G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS))
+
+      if (strcmp (".", name) == 0 ||
+          strcmp ("..", name) == 0)
         {
-          /* Default (at least for openssh) is for readdir to not follow symlinks.
-             This was a symlink, and follow links was requested, so we need to manually follow it */
-          command = new_command_stream (backend,
-                                        SSH_FXP_STAT);
-          abs_name = g_build_filename (enum_job->filename, name, NULL);
-          put_string (command, abs_name);
+          g_object_unref (info);
+          g_free (name);
+          continue;
+        }
+
+      abs_name = g_build_filename (enum_job->filename, name, NULL);
+      is_symlink = g_file_info_get_file_type (info) == G_FILE_TYPE_SYMBOLIC_LINK;
+
+      stat_cache_insert (backend, generation, abs_name, FALSE, info);
+      if (!is_symlink)
+        stat_cache_insert (backend, generation, abs_name, TRUE, info);
+
+      if (is_symlink &&
+          (!(enum_job->flags & G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS) ||
+           g_file_attribute_matcher_matches (enum_job->attribute_matcher,
+                                             G_FILE_ATTRIBUTE_STANDARD_SYMLINK_TARGET)))
+        {
+          entry = g_slice_new0 (ReadDirEntry);
+          entry->batch = batch;
+          entry->info = info;
+          entry->abs_name = abs_name;
+          entry->need_stat = !(enum_job->flags & G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS);
+          entry->need_readlink = g_file_attribute_matcher_matches (enum_job->attribute_matcher,
+                                                                   G_FILE_ATTRIBUTE_STANDARD_SYMLINK_TARGET);
+          batch->outstanding++;
+          g_queue_push_tail (&data->pending, entry);
+        }
+      else
+        {
+          batch->infos = g_list_prepend (batch->infos, info);
           g_free (abs_name);
-          
-          queue_command_stream_and_free (backend, command, read_dir_symlink_reply, G_VFS_JOB (job), g_object_ref (info));
-          data->outstanding_requests ++;
         }
-      else if (strcmp (".", name) != 0 &&
-               strcmp ("..", name) != 0)
-        read_dir_got_stat_info (backend, job, info);
-        
-      g_object_unref (info);
+
       g_free (name);
     }
 
-  command = new_command_stream (backend,
-                                SSH_FXP_READDIR);
-  put_data_buffer (command, data->handle);
-  queue_command_stream_and_free (backend, command, read_dir_reply, G_VFS_JOB (job), NULL);
+  if (--batch->outstanding == 0)
+    read_dir_batch_send (job, batch);
+
+  read_dir_process_pending (backend, job);
+  read_dir_maybe_done (backend, job);
 }
 
 static void
@@ -3894,7 +4589,6 @@ open_dir_reply (GVfsBackendSftp *backend,
                 gpointer user_data)
 {
   GVfsBackendSftp *op_backend = G_VFS_BACKEND_SFTP (backend);
-  GDataOutputStream *command;
   ReadDirData *data;
 
   data = job->backend_data;
@@ -3918,14 +4612,8 @@ open_dir_reply (GVfsBackendSftp *backend,
   g_vfs_job_succeeded (G_VFS_JOB (job));
   
   data->handle = read_data_buffer (reply);
-  
-  command = new_command_stream (op_backend,
-                                SSH_FXP_READDIR);
-  put_data_buffer (command, data->handle);
 
-  data->outstanding_requests = 1;
-  
-  queue_command_stream_and_free (op_backend, command, read_dir_reply, G_VFS_JOB (job), NULL);
+  read_dir_fill (op_backend, job);
 }
 
 static gboolean
@@ -3961,10 +4649,12 @@ query_info_reply (GVfsBackendSftp *backend,
   char *basename;
   int i;
   MultiReply *lstat_reply, *reply;
-  GFileInfo *lstat_info;
+  GFileInfo *info, *lstat_info;
   GVfsJobQueryInfo *op_job;
+  gboolean follow_symlinks;
 
   op_job = G_VFS_JOB_QUERY_INFO (job);
+  follow_symlinks = !(op_job->flags & G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS);
   
   i = 0;
   lstat_reply = &replies[i++];
@@ -3982,13 +4672,16 @@ query_info_reply (GVfsBackendSftp *backend,
       return;
     }
 
+  /* Parse into an info without attribute mask so it can be cached */
+  info = g_file_info_new ();
+
   basename = NULL;
   if (strcmp (op_job->filename, "/") != 0)
     basename = g_path_get_basename (op_job->filename);
 
-  if (op_job->flags & G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS)
+  if (!follow_symlinks)
     {
-      parse_attributes (backend, op_job->file_info, basename,
+      parse_attributes (backend, info, basename,
                         lstat_reply->data, op_job->attribute_matcher);
     }
   else
@@ -3998,7 +4691,7 @@ query_info_reply (GVfsBackendSftp *backend,
 
       if (reply->type == SSH_FXP_ATTRS)
         {
-          parse_attributes (backend, op_job->file_info, basename,
+          parse_attributes (backend, info, basename,
                             reply->data, op_job->attribute_matcher);
 
           
@@ -4006,13 +4699,13 @@ query_info_reply (GVfsBackendSftp *backend,
           parse_attributes (backend, lstat_info, basename,
                             lstat_reply->data, op_job->attribute_matcher);
           if (g_file_info_get_is_symlink (lstat_info))
-            g_file_info_set_is_symlink (op_job->file_info, TRUE);
+            g_file_info_set_is_symlink (info, TRUE);
           g_object_unref (lstat_info);
         }
       else
         {
           /* Broken symlink, use lstat data */
-          parse_attributes (backend, op_job->file_info, basename,
+          parse_attributes (backend, info, basename,
                             lstat_reply->data, op_job->attribute_matcher);
         }
       
@@ -4031,11 +4724,22 @@ query_info_reply (GVfsBackendSftp *backend,
           char *symlink_target;
           
           symlink_target = read_string (reply->data, NULL);
-          g_file_info_set_symlink_target (op_job->file_info, symlink_target);
+          g_file_info_set_symlink_target (info, symlink_target);
           g_free (symlink_target);
         }
     }
 
+  stat_cache_insert (backend, GPOINTER_TO_UINT (user_data),
+                     op_job->filename, follow_symlinks, info);
+  /* Without a symlink stat and lstat are the same */
+  if (!g_file_info_get_is_symlink (info))
+    stat_cache_insert (backend, GPOINTER_TO_UINT (user_data),
+                       op_job->filename, !follow_symlinks, info);
+
+  g_file_info_copy_into (info, op_job->file_info);
+  g_file_info_set_attribute_mask (op_job->file_info, op_job->attribute_matcher);
+  g_object_unref (info);
+
   g_vfs_job_succeeded (G_VFS_JOB (job));
 }
 
@@ -4050,8 +4754,24 @@ try_query_info (GVfsBackend *backend,
   GVfsBackendSftp *op_backend = G_VFS_BACKEND_SFTP (backend);
   GDataOutputStream *commands[3];
   GDataOutputStream *command;
+  GFileInfo *cached;
   int n_commands;
 
+  if (op_backend->stat_cache)
+    {
+      cached = g_vfs_sftp_stat_cache_lookup (op_backend->stat_cache, filename,
+                                             !(flags & G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS),
+                                             matcher);
+      if (cached)
+        {
+          g_file_info_copy_into (cached, info);
+          g_file_info_set_attribute_mask (info, matcher);
+          g_object_unref (cached);
+          g_vfs_job_succeeded (G_VFS_JOB (job));
+          return TRUE;
+        }
+    }
+
   n_commands = 0;
   
   command = commands[n_commands++] =
@@ -4076,7 +4796,8 @@ try_query_info (GVfsBackend *backend,
       put_string (command, filename);
     }
 
-  queue_command_streams_and_free (op_backend, commands, n_commands, query_info_reply, G_VFS_JOB (job), NULL);
+  queue_command_streams_and_free (op_backend, commands, n_commands, query_info_reply, G_VFS_JOB (job),
+                                  GUINT_TO_POINTER (stat_cache_generation (op_backend)));
   
   return TRUE;
 }
@@ -4183,6 +4904,8 @@ move_do_rename (GVfsBackendSftp *backend,
 
   op_job = G_VFS_JOB_MOVE (job);
 
+  stat_cache_purge (backend, op_job->destination, TRUE, FALSE);
+
   command = new_command_stream (backend,
                                 SSH_FXP_RENAME);
   put_string (command, op_job->source);
@@ -4191,6 +4914,48 @@ move_do_rename (GVfsBackendSftp *backend,
   queue_command_stream_and_free (backend, command, move_reply, G_VFS_JOB (job), NULL);
 }
 
+static void
+move_delete_target (GVfsBackendSftp *backend,
+                    GVfsJob *job);
+
+/* posix-rename@openssh.com replaces the destination atomically, so
+ * there is no window where neither file exists */
+static void
+move_posix_rename_reply (GVfsBackendSftp *backend,
+                         int reply_type,
+                         GDataInputStream *reply,
+                         guint32 len,
+                         GVfsJob *job,
+                         gpointer user_data)
+{
+  goffset *file_size;
+  guint32 code;
+
+  if (reply_type != SSH_FXP_STATUS)
+    {
+      g_vfs_job_failed (job, G_IO_ERROR, G_IO_ERROR_FAILED,
+                        _("Invalid reply received"));
+      return;
+    }
+
+  code = read_status_code (reply);
+  if (code == SSH_FX_OP_UNSUPPORTED)
+    {
+      /* Advertised but refused, use the non-atomic way */
+      backend->ext_posix_rename = FALSE;
+      move_delete_target (backend, job);
+      return;
+    }
+
+  if (failure_from_status_code (job, code, G_IO_ERROR_NOT_SUPPORTED, -1))
+    {
+      file_size = job->backend_data;
+      if (file_size != NULL)
+        g_vfs_job_move_progress_callback (*file_size, *file_size, job);
+      g_vfs_job_succeeded (job);
+    }
+}
+
 static void
 move_delete_target_reply (GVfsBackendSftp *backend,
                           int reply_type,
@@ -4289,18 +5054,40 @@ move_lstat_reply (GVfsBackendSftp *backend,
 
   /* TODO: Check flags & G_FILE_COPY_BACKUP */
 
+  stat_cache_purge (backend, op_job->source, TRUE, TRUE);
+  stat_cache_purge (backend, op_job->destination, TRUE, TRUE);
+
   if (destination_exist && (op_job->flags & G_FILE_COPY_OVERWRITE))
     {
-      command = new_command_stream (backend,
-                                    SSH_FXP_REMOVE);
-      put_string (command, op_job->destination);
-      queue_command_stream_and_free (backend, command, move_delete_target_reply, G_VFS_JOB (job), NULL);
+      if (backend->ext_posix_rename)
+        {
+          command = new_command_stream (backend,
+                                        SSH_FXP_EXTENDED);
+          put_string (command, "posix-rename@openssh.com");
+          put_string (command, op_job->source);
+          put_string (command, op_job->destination);
+          queue_command_stream_and_free (backend, command, move_posix_rename_reply, G_VFS_JOB (job), NULL);
+        }
+      else
+        move_delete_target (backend, job);
       return;
     }
 
   move_do_rename (backend, job);
 }
 
+static void
+move_delete_target (GVfsBackendSftp *backend,
+                    GVfsJob *job)
+{
+  GDataOutputStream *command;
+
+  command = new_command_stream (backend,
+                                SSH_FXP_REMOVE);
+  put_string (command, G_VFS_JOB_MOVE (job)->destination);
+  queue_command_stream_and_free (backend, command, move_delete_target_reply, job, NULL);
+}
+
 
 static gboolean
 try_move (GVfsBackend *backend,
@@ -4330,84 +5117,1363 @@ try_move (GVfsBackend *backend,
   return TRUE;
 }
 
-static void
-set_display_name_reply (GVfsBackendSftp *backend,
-                        int reply_type,
-                        GDataInputStream *reply,
-                        guint32 len,
-                        GVfsJob *job,
-                        gpointer user_data)
-{
-  if (reply_type == SSH_FXP_STATUS)
-    result_from_status (job, reply, -1, -1);
-  else
-    g_vfs_job_failed (job, G_IO_ERROR, G_IO_ERROR_FAILED,
-                      _("Invalid reply received"));
-}
+/* Server-side copy. Servers advertising copy-file or copy-data copy
+ * without the data ever leaving the server, otherwise the file is
+ * copied with pipelined READ/WRITE requests between two handles in
+ * the daemon, so the data still never goes through the client.
+ *
+ * Push and pull use the same pipeline with a local file descriptor
+ * in place of one of the handles. */
 
-static gboolean
-try_set_display_name (GVfsBackend *backend,
-                      GVfsJobSetDisplayName *job,
-                      const char *filename,
-                      const char *display_name)
-{
-  GVfsBackendSftp *op_backend = G_VFS_BACKEND_SFTP (backend);
-  GDataOutputStream *command;
-  char *dirname, *basename, *new_name;
+typedef struct {
+  goffset size;
+  guint32 permissions;
+  GFileProgressCallback progress_callback;
+  gpointer progress_callback_data;
+
+  GFileType source_type;
+  gboolean remove_source;
+
+  DataBuffer *read_handle;
+  DataBuffer *write_handle;
+  gboolean dest_exists;
+  char *tempname;                /* replaced copy and push destinations are written here first */
+  guint temp_count;
+  int local_fd;                  /* push source or pull destination */
+  char *local_tempname;          /* pulls are written here first */
+  gboolean local_is_source;
+  goffset read_offset;           /* offset of the next READ to send */
+  goffset bytes_written;
+  guint n_outstanding;
+  gboolean eof;
+  GError *error;                 /* first error, reported after closing */
+} CopyData;
 
-  /* We use the same setting as for local files. Can't really
-   * do better, since there is no way in this version of sftp to find out
-   * the remote charset encoding
-   */
-  
-  dirname = g_path_get_dirname (filename);
-  basename = g_filename_from_utf8 (display_name, -1, NULL, NULL, NULL);
-  if (basename == NULL)
-    basename = g_strdup (display_name);
-  new_name = g_build_filename (dirname, basename, NULL);
-  g_free (dirname);
-  g_free (basename);
+typedef struct {
+  goffset offset;
+  guint32 size;
+} CopyRequest;
 
-  g_vfs_job_set_display_name_set_new_path (job,
-                                           new_name);
-  
-  command = new_command_stream (op_backend,
-                                SSH_FXP_RENAME);
-  put_string (command, filename);
-  put_string (command, new_name);
-  
-  queue_command_stream_and_free (op_backend, command, set_display_name_reply, G_VFS_JOB (job), NULL);
+static CopyData *
+copy_data_new (GFileProgressCallback progress_callback,
+               gpointer progress_callback_data)
+{
+  CopyData *data;
 
-  g_free (new_name);
+  data = g_slice_new0 (CopyData);
+  data->local_fd = -1;
+  data->progress_callback = progress_callback;
+  data->progress_callback_data = progress_callback_data;
 
-  return TRUE;
+  return data;
+}
+
+static void
+copy_data_free (CopyData *data)
+{
+  if (data->local_fd != -1)
+    close (data->local_fd);
+  if (data->read_handle)
+    data_buffer_free (data->read_handle);
+  if (data->write_handle)
+    data_buffer_free (data->write_handle);
+  g_free (data->tempname);
+  if (data->local_tempname)
+    {
+      g_unlink (data->local_tempname);
+      g_free (data->local_tempname);
+    }
+  if (data->error)
+    g_error_free (data->error);
+  g_slice_free (CopyData, data);
 }
 
+/* The remote file a copy or push writes */
+static const char *
+copy_destination (GVfsJob *job)
+{
+  if (G_VFS_IS_JOB_PUSH (job))
+    return G_VFS_JOB_PUSH (job)->destination;
+  return G_VFS_JOB_COPY (job)->destination;
+}
 
 static void
-make_symlink_reply (GVfsBackendSftp *backend,
-                    int reply_type,
-                    GDataInputStream *reply,
-                    guint32 len,
-                    GVfsJob *job,
-                    gpointer user_data)
+copy_set_error (CopyData *data, GError *error)
 {
-  if (reply_type == SSH_FXP_STATUS)
-    result_from_status (job, reply, -1, -1); 
+  if (data->error == NULL)
+    data->error = error;
   else
-    g_vfs_job_failed (job, G_IO_ERROR, G_IO_ERROR_FAILED,
-                      _("Invalid reply received"));
+    g_error_free (error);
 }
 
-static gboolean
-try_make_symlink (GVfsBackend *backend,
-                  GVfsJobMakeSymlink *job,
-                  const char *filename,
-                  const char *symlink_value)
+static void
+copy_progress (CopyData *data, goffset current)
 {
-  GVfsBackendSftp *op_backend = G_VFS_BACKEND_SFTP (backend);
-  GDataOutputStream *command;
-  
+  if (data->progress_callback)
+    data->progress_callback (current, MAX (current, data->size),
+                             data->progress_callback_data);
+}
+
+static void
+copy_set_error_from_errno (CopyData *data, int errsv)
+{
+  copy_set_error (data, g_error_new_literal (G_IO_ERROR,
+                                             g_io_error_from_errno (errsv),
+                                             g_strerror (errsv)));
+}
+
+static void copy_pipeline_fill (GVfsBackendSftp *backend, GVfsJob *job);
+
+static void
+copy_remove_source_reply (GVfsBackendSftp *backend,
+                          int reply_type,
+                          GDataInputStream *reply,
+                          guint32 len,
+                          GVfsJob *job,
+                          gpointer user_data)
+{
+  if (reply_type == SSH_FXP_STATUS)
+    result_from_status (job, reply, -1, -1);
+  else
+    g_vfs_job_failed (job, G_IO_ERROR, G_IO_ERROR_FAILED,
+                      _("Invalid reply received"));
+}
+
+/* Called once all handles are closed */
+static void
+copy_done (GVfsBackendSftp *backend,
+           GVfsJob *job)
+{
+  CopyData *data = job->backend_data;
+  GDataOutputStream *command;
+
+  if (!G_VFS_IS_JOB_PULL (job))
+    stat_cache_purge (backend, copy_destination (job), FALSE, FALSE);
+
+  if (data->local_fd != -1)
+    {
+      if (close (data->local_fd) != 0 && !data->local_is_source)
+        copy_set_error_from_errno (data, errno);
+      data->local_fd = -1;
+    }
+
+  if (data->local_tempname)
+    {
+      if (data->error == NULL &&
+          g_rename (data->local_tempname, G_VFS_JOB_PULL (job)->local_path) != 0)
+        copy_set_error_from_errno (data, errno);
+      if (data->error)
+        g_unlink (data->local_tempname);
+      g_free (data->local_tempname);
+      data->local_tempname = NULL;
+    }
+
+  if (data->error)
+    {
+      g_vfs_job_failed_from_error (job, data->error);
+      return;
+    }
+
+  copy_progress (data, data->bytes_written);
+
+  if (data->remove_source)
+    {
+      if (data->local_is_source)
+        {
+          if (g_unlink (G_VFS_JOB_PUSH (job)->local_path) != 0)
+            {
+              g_vfs_job_failed_from_errno (job, errno);
+              return;
+            }
+        }
+      else
+        {
+          stat_cache_purge (backend, G_VFS_JOB_PULL (job)->source, FALSE, TRUE);
+
+          command = new_command_stream (backend, SSH_FXP_REMOVE);
+          put_string (command, G_VFS_JOB_PULL (job)->source);
+          queue_command_stream_and_free (backend, command, copy_remove_source_reply, job, NULL);
+          return;
+        }
+    }
+
+  g_vfs_job_succeeded (job);
+}
+
+static void copy_commit_temp (GVfsBackendSftp *backend, GVfsJob *job);
+
+static void
+copy_rename_temp_reply (GVfsBackendSftp *backend,
+                        int reply_type,
+                        GDataInputStream *reply,
+                        guint32 len,
+                        GVfsJob *job,
+                        gpointer user_data)
+{
+  CopyData *data = job->backend_data;
+  GError *error;
+  guint32 code;
+
+  if (reply_type != SSH_FXP_STATUS)
+    copy_set_error (data, g_error_new_literal (G_IO_ERROR, G_IO_ERROR_FAILED,
+                                               _("Invalid reply received")));
+  else
+    {
+      code = read_status_code (reply);
+      if (code == SSH_FX_OP_UNSUPPORTED && backend->ext_posix_rename)
+        {
+          backend->ext_posix_rename = FALSE;
+          copy_commit_temp (backend, job);
+          return;
+        }
+
+      error = NULL;
+      if (error_from_status_code (job, code, -1, -1, &error))
+        {
+          g_free (data->tempname);
+          data->tempname = NULL;
+        }
+      else
+        copy_set_error (data, error);
+    }
+
+  copy_commit_temp (backend, job);
+}
+
+static void
+copy_remove_dest_reply (GVfsBackendSftp *backend,
+                        int reply_type,
+                        GDataInputStream *reply,
+                        guint32 len,
+                        GVfsJob *job,
+                        gpointer user_data)
+{
+  CopyData *data = job->backend_data;
+  GDataOutputStream *command;
+  GError *error;
+
+  error = NULL;
+  if (reply_type != SSH_FXP_STATUS)
+    error = g_error_new_literal (G_IO_ERROR, G_IO_ERROR_FAILED,
+                                 _("Invalid reply received"));
+  else
+    error_from_status (job, reply, -1, -1, &error);
+
+  if (error)
+    {
+      copy_set_error (data, error);
+      copy_commit_temp (backend, job);
+      return;
+    }
+
+  command = new_command_stream (backend, SSH_FXP_RENAME);
+  put_string (command, data->tempname);
+  put_string (command, copy_destination (job));
+  queue_command_stream_and_free (backend, command, copy_rename_temp_reply, job, NULL);
+}
+
+/* Moves a finished temporary file over the destination, or removes it
+ * if the copy failed */
+static void
+copy_commit_temp (GVfsBackendSftp *backend,
+                  GVfsJob *job)
+{
+  CopyData *data = job->backend_data;
+  GDataOutputStream *command;
+
+  if (data->tempname == NULL)
+    {
+      copy_done (backend, job);
+      return;
+    }
+
+  if (data->error)
+    {
+      command = new_command_stream (backend, SSH_FXP_REMOVE);
+      put_string (command, data->tempname);
+      queue_command_stream_and_free (backend, command, NULL, job, NULL);
+      g_free (data->tempname);
+      data->tempname = NULL;
+      copy_done (backend, job);
+      return;
+    }
+
+  if (backend->ext_posix_rename)
+    {
+      command = new_command_stream (backend, SSH_FXP_EXTENDED);
+      put_string (command, "posix-rename@openssh.com");
+      put_string (command, data->tempname);
+      put_string (command, copy_destination (job));
+      queue_command_stream_and_free (backend, command, copy_rename_temp_reply, job, NULL);
+    }
+  else
+    {
+      command = new_command_stream (backend, SSH_FXP_REMOVE);
+      put_string (command, copy_destination (job));
+      queue_command_stream_and_free (backend, command, copy_remove_dest_reply, job, NULL);
+    }
+}
+
+static void
+copy_close_reply (GVfsBackendSftp *backend,
+                  int reply_type,
+                  GDataInputStream *reply,
+                  guint32 len,
+                  GVfsJob *job,
+                  gpointer user_data)
+{
+  CopyData *data = job->backend_data;
+  GError *error;
+
+  if (reply_type != SSH_FXP_STATUS)
+    copy_set_error (data, g_error_new_literal (G_IO_ERROR, G_IO_ERROR_FAILED,
+                                               _("Invalid reply received")));
+  else
+    {
+      error = NULL;
+      if (!error_from_status (job, reply, -1, -1, &error))
+        copy_set_error (data, error);
+    }
+
+  if (data->tempname)
+    copy_commit_temp (backend, job);
+  else
+    copy_done (backend, job);
+}
+
+/* Closes whatever handles are open and reports the result once the
+ * destination is closed, since a failed close may mean lost data */
+static void
+copy_finish (GVfsBackendSftp *backend,
+             GVfsJob *job)
+{
+  CopyData *data = job->backend_data;
+  GDataOutputStream *command;
+
+  if (data->read_handle)
+    {
+      command = new_command_stream (backend, SSH_FXP_CLOSE);
+      put_data_buffer (command, data->read_handle);
+      queue_command_stream_and_free (backend, command, NULL, job, NULL);
+    }
+
+  if (data->write_handle)
+    {
+      command = new_command_stream (backend, SSH_FXP_CLOSE);
+      put_data_buffer (command, data->write_handle);
+      queue_command_stream_and_free (backend, command, copy_close_reply, job, NULL);
+    }
+  else
+    copy_done (backend, job);
+}
+
+static void
+copy_pipeline_continue (GVfsBackendSftp *backend,
+                        GVfsJob *job)
+{
+  CopyData *data = job->backend_data;
+
+  if (data->error == NULL && !data->eof)
+    copy_pipeline_fill (backend, job);
+
+  if (data->n_outstanding == 0)
+    copy_finish (backend, job);
+}
+
+static void
+copy_write_reply (GVfsBackendSftp *backend,
+                  int reply_type,
+                  GDataInputStream *reply,
+                  guint32 len,
+                  GVfsJob *job,
+                  gpointer user_data)
+{
+  CopyData *data = job->backend_data;
+  CopyRequest *request = user_data;
+  GError *error;
+
+  data->n_outstanding--;
+
+  if (reply_type != SSH_FXP_STATUS)
+    copy_set_error (data, g_error_new_literal (G_IO_ERROR, G_IO_ERROR_FAILED,
+                                               _("Invalid reply received")));
+  else
+    {
+      error = NULL;
+      if (error_from_status (job, reply, -1, -1, &error))
+        {
+          data->bytes_written += request->size;
+          if (data->error == NULL)
+            copy_progress (data, data->bytes_written);
+        }
+      else
+        copy_set_error (data, error);
+    }
+
+  g_slice_free (CopyRequest, request);
+
+  copy_pipeline_continue (backend, job);
+}
+
+static void
+copy_send_write (GVfsBackendSftp *backend,
+                 GVfsJob *job,
+                 CopyRequest *request,
+                 const guchar *buffer)
+{
+  CopyData *data = job->backend_data;
+  GDataOutputStream *command;
+
+  command = new_command_stream (backend, SSH_FXP_WRITE);
+  put_data_buffer (command, data->write_handle);
+  g_data_output_stream_put_uint64 (command, request->offset, NULL, NULL);
+  g_data_output_stream_put_uint32 (command, request->size, NULL, NULL);
+  g_output_stream_write_all (G_OUTPUT_STREAM (command),
+                             buffer, request->size,
+                             NULL, NULL, NULL);
+
+  data->n_outstanding++;
+  queue_command_stream_and_free (backend, command, copy_write_reply, job, request);
+}
+
+static gboolean
+copy_local_write (CopyData *data,
+                  const guchar *buffer,
+                  gsize count,
+                  goffset offset)
+{
+  gssize res;
+
+  while (count > 0)
+    {
+      res = pwrite (data->local_fd, buffer, count, offset);
+      if (res < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          copy_set_error_from_errno (data, errno);
+          return FALSE;
+        }
+      buffer += res;
+      count -= res;
+      offset += res;
+    }
+
+  return TRUE;
+}
+
+static void copy_read_reply (GVfsBackendSftp *backend,
+                             int reply_type,
+                             GDataInputStream *reply,
+                             guint32 len,
+                             GVfsJob *job,
+                             gpointer user_data);
+
+static void
+copy_send_read (GVfsBackendSftp *backend,
+                GVfsJob *job,
+                goffset offset,
+                guint32 size)
+{
+  CopyData *data = job->backend_data;
+  GDataOutputStream *command;
+  CopyRequest *request;
+
+  request = g_slice_new (CopyRequest);
+  request->offset = offset;
+  request->size = size;
+
+  command = new_command_stream (backend, SSH_FXP_READ);
+  put_data_buffer (command, data->read_handle);
+  g_data_output_stream_put_uint64 (command, offset, NULL, NULL);
+  g_data_output_stream_put_uint32 (command, size, NULL, NULL);
+
+  data->n_outstanding++;
+  queue_command_stream_and_free (backend, command, copy_read_reply, job, request);
+}
+
+static void
+copy_read_reply (GVfsBackendSftp *backend,
+                 int reply_type,
+                 GDataInputStream *reply,
+                 guint32 len,
+                 GVfsJob *job,
+                 gpointer user_data)
+{
+  CopyData *data = job->backend_data;
+  CopyRequest *request = user_data;
+  GError *error;
+  guint32 code, count;
+  guchar *buffer;
+
+  data->n_outstanding--;
+
+  if (reply_type == SSH_FXP_STATUS)
+    {
+      code = read_status_code (reply);
+      error = NULL;
+      if (code == SSH_FX_EOF)
+        data->eof = TRUE;
+      else if (!error_from_status_code (job, code, -1, -1, &error))
+        copy_set_error (data, error);
+    }
+  else if (reply_type != SSH_FXP_DATA)
+    copy_set_error (data, g_error_new_literal (G_IO_ERROR, G_IO_ERROR_FAILED,
+                                               _("Invalid reply received")));
+  else if (data->error == NULL)
+    {
+      count = g_data_input_stream_read_uint32 (reply, NULL, NULL);
+      buffer = g_malloc (count);
+
+      if (count > request->size ||
+          !g_input_stream_read_all (G_INPUT_STREAM (reply),
+                                    buffer, count,
+                                    NULL, NULL, NULL))
+        copy_set_error (data, g_error_new_literal (G_IO_ERROR, G_IO_ERROR_FAILED,
+                                                   _("Invalid reply received")));
+      else if (count == 0)
+        data->eof = TRUE;
+      else
+        {
+          /* Servers may return less than asked for before EOF,
+             fetch the rest of the block before moving on */
+          if (count < request->size)
+            copy_send_read (backend, job,
+                            request->offset + count,
+                            request->size - count);
+
+          if (data->write_handle)
+            {
+              request->size = count;
+              copy_send_write (backend, job, request, buffer);
+              request = NULL;
+            }
+          else if (copy_local_write (data, buffer, count, request->offset))
+            {
+              data->bytes_written += count;
+              copy_progress (data, data->bytes_written);
+            }
+        }
+
+      g_free (buffer);
+    }
+
+  if (request)
+    g_slice_free (CopyRequest, request);
+
+  copy_pipeline_continue (backend, job);
+}
+
+/* Reads the next block of a pushed file and sends it to the server */
+static void
+copy_local_read (GVfsBackendSftp *backend,
+                 GVfsJob *job)
+{
+  CopyData *data = job->backend_data;
+  CopyRequest *request;
+  guchar *buffer;
+  gssize res;
+
+  buffer = g_malloc (COPY_BLOCK_SIZE);
+
+  do
+    res = pread (data->local_fd, buffer, COPY_BLOCK_SIZE, data->read_offset);
+  while (res < 0 && errno == EINTR);
+
+  if (res < 0)
+    copy_set_error_from_errno (data, errno);
+  else if (res == 0)
+    data->eof = TRUE;
+  else
+    {
+      request = g_slice_new (CopyRequest);
+      request->offset = data->read_offset;
+      request->size = res;
+      data->read_offset += res;
+
+      copy_send_write (backend, job, request, buffer);
+    }
+
+  g_free (buffer);
+}
+
+static void
+copy_pipeline_fill (GVfsBackendSftp *backend,
+                    GVfsJob *job)
+{
+  CopyData *data = job->backend_data;
+
+  while (data->n_outstanding < COPY_MAX_REQUESTS)
+    {
+      if (g_vfs_job_is_cancelled (job))
+        {
+          copy_set_error (data, g_error_new_literal (G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                                     _("Operation was cancelled")));
+          return;
+        }
+
+      if (data->read_handle == NULL)
+        {
+          copy_local_read (backend, job);
+          if (data->eof || data->error)
+            return;
+          continue;
+        }
+
+      /* Past the size from lstat only a single READ is kept in flight,
+         it either hits EOF or finds that the file has grown */
+      if (data->read_offset >= data->size && data->n_outstanding > 0)
+        return;
+
+      copy_send_read (backend, job, data->read_offset, COPY_BLOCK_SIZE);
+      data->read_offset += COPY_BLOCK_SIZE;
+    }
+}
+
+static void
+copy_data_reply (GVfsBackendSftp *backend,
+                 int reply_type,
+                 GDataInputStream *reply,
+                 guint32 len,
+                 GVfsJob *job,
+                 gpointer user_data)
+{
+  CopyData *data = job->backend_data;
+  GError *error;
+  guint32 code;
+
+  if (reply_type != SSH_FXP_STATUS)
+    copy_set_error (data, g_error_new_literal (G_IO_ERROR, G_IO_ERROR_FAILED,
+                                               _("Invalid reply received")));
+  else
+    {
+      code = read_status_code (reply);
+      if (code == SSH_FX_OP_UNSUPPORTED)
+        {
+          backend->ext_copy_data = FALSE;
+          copy_pipeline_continue (backend, job);
+          return;
+        }
+
+      error = NULL;
+      if (error_from_status_code (job, code, -1, -1, &error))
+        data->bytes_written = data->size;
+      else
+        copy_set_error (data, error);
+    }
+
+  copy_finish (backend, job);
+}
+
+static gboolean
+copy_handle_from_reply (CopyData *data,
+                        int reply_type,
+                        GDataInputStream *reply,
+                        GVfsJob *job,
+                        DataBuffer **handle)
+{
+  GError *error;
+
+  if (reply_type == SSH_FXP_HANDLE)
+    {
+      *handle = read_data_buffer (reply);
+      return TRUE;
+    }
+
+  error = NULL;
+  if (reply_type == SSH_FXP_STATUS)
+    error_from_status (job, reply, -1, -1, &error);
+  else
+    error = g_error_new_literal (G_IO_ERROR, G_IO_ERROR_FAILED,
+                                 _("Invalid reply received"));
+  copy_set_error (data, error);
+
+  return FALSE;
+}
+
+static void copy_create_temp (GVfsBackendSftp *backend, GVfsJob *job);
+
+static void
+copy_open_dest_reply (GVfsBackendSftp *backend,
+                      int reply_type,
+                      GDataInputStream *reply,
+                      guint32 len,
+                      GVfsJob *job,
+                      gpointer user_data)
+{
+  CopyData *data = job->backend_data;
+  GDataOutputStream *command;
+  GError *error;
+
+  if (data->tempname && reply_type == SSH_FXP_STATUS)
+    {
+      error = NULL;
+      if (error_from_status (job, reply, G_IO_ERROR_EXISTS, -1, &error))
+        /* Open should not return OK */
+        error = g_error_new_literal (G_IO_ERROR, G_IO_ERROR_FAILED,
+                                     _("Invalid reply received"));
+      else if (error->code == G_IO_ERROR_EXISTS)
+        {
+          /* Probably the EXCL flag, try another name */
+          g_error_free (error);
+          copy_create_temp (backend, job);
+          return;
+        }
+
+      /* Not ours, don't remove it */
+      g_free (data->tempname);
+      data->tempname = NULL;
+      copy_set_error (data, error);
+      copy_finish (backend, job);
+      return;
+    }
+
+  if (!copy_handle_from_reply (data, reply_type, reply, job, &data->write_handle))
+    {
+      copy_finish (backend, job);
+      return;
+    }
+
+  /* Pushes read from a local file */
+  if (backend->ext_copy_data && data->read_handle)
+    {
+      command = new_command_stream (backend, SSH_FXP_EXTENDED);
+      put_string (command, "copy-data");
+      put_data_buffer (command, data->read_handle);
+      g_data_output_stream_put_uint64 (command, 0, NULL, NULL); /* read offset */
+      g_data_output_stream_put_uint64 (command, 0, NULL, NULL); /* length, 0 is up to EOF */
+      put_data_buffer (command, data->write_handle);
+      g_data_output_stream_put_uint64 (command, 0, NULL, NULL); /* write offset */
+      queue_command_stream_and_free (backend, command, copy_data_reply, job, NULL);
+      return;
+    }
+
+  copy_pipeline_continue (backend, job);
+}
+
+/* An existing destination is never truncated, the copy is written to a
+ * temporary file that replaces it once complete. Otherwise a destination
+ * linked to the source would lose the data that is being copied, and a
+ * failed copy or push would leave neither the old nor the new file. */
+static void
+copy_create_temp (GVfsBackendSftp *backend,
+                  GVfsJob *job)
+{
+  CopyData *data = job->backend_data;
+  GDataOutputStream *command;
+  char *dirname;
+  char basename[] = ".giosaveXXXXXX";
+
+  g_free (data->tempname);
+  data->tempname = NULL;
+
+  data->temp_count++;
+
+  if (data->temp_count == 100)
+    {
+      copy_set_error (data, g_error_new_literal (G_IO_ERROR, G_IO_ERROR_FAILED,
+                                                 _("Unable to create temporary file")));
+      copy_finish (backend, job);
+      return;
+    }
+
+  dirname = g_path_get_dirname (copy_destination (job));
+  random_text (basename + 8);
+  data->tempname = g_build_filename (dirname, basename, NULL);
+  g_free (dirname);
+
+  command = new_command_stream (backend, SSH_FXP_OPEN);
+  put_string (command, data->tempname);
+  g_data_output_stream_put_uint32 (command, SSH_FXF_WRITE|SSH_FXF_CREAT|SSH_FXF_EXCL, NULL, NULL); /* open flags */
+  g_data_output_stream_put_uint32 (command, SSH_FILEXFER_ATTR_PERMISSIONS, NULL, NULL); /* Attr flags */
+  g_data_output_stream_put_uint32 (command, data->permissions, NULL, NULL);
+
+  queue_command_stream_and_free (backend, command, copy_open_dest_reply, job, NULL);
+}
+
+/* The destination is only opened once we know the source can be read */
+static void
+copy_open_source_reply (GVfsBackendSftp *backend,
+                        int reply_type,
+                        GDataInputStream *reply,
+                        guint32 len,
+                        GVfsJob *job,
+                        gpointer user_data)
+{
+  GVfsJobCopy *op_job = G_VFS_JOB_COPY (job);
+  CopyData *data = job->backend_data;
+  GDataOutputStream *command;
+
+  if (!copy_handle_from_reply (data, reply_type, reply, job, &data->read_handle))
+    {
+      copy_finish (backend, job);
+      return;
+    }
+
+  if (data->dest_exists)
+    {
+      copy_create_temp (backend, job);
+      return;
+    }
+
+  command = new_command_stream (backend, SSH_FXP_OPEN);
+  put_string (command, op_job->destination);
+  g_data_output_stream_put_uint32 (command, SSH_FXF_WRITE|SSH_FXF_CREAT|SSH_FXF_EXCL, NULL, NULL); /* open flags */
+  g_data_output_stream_put_uint32 (command, SSH_FILEXFER_ATTR_PERMISSIONS, NULL, NULL); /* Attr flags */
+  g_data_output_stream_put_uint32 (command, data->permissions, NULL, NULL);
+
+  queue_command_stream_and_free (backend, command, copy_open_dest_reply, job, NULL);
+}
+
+static void
+copy_open (GVfsBackendSftp *backend,
+           GVfsJob *job)
+{
+  GDataOutputStream *command;
+
+  command = new_command_stream (backend, SSH_FXP_OPEN);
+  put_string (command, G_VFS_JOB_COPY (job)->source);
+  g_data_output_stream_put_uint32 (command, SSH_FXF_READ, NULL, NULL); /* open flags */
+  g_data_output_stream_put_uint32 (command, 0, NULL, NULL); /* Attr flags */
+
+  queue_command_stream_and_free (backend, command, copy_open_source_reply, job, NULL);
+}
+
+static void
+copy_file_reply (GVfsBackendSftp *backend,
+                 int reply_type,
+                 GDataInputStream *reply,
+                 guint32 len,
+                 GVfsJob *job,
+                 gpointer user_data)
+{
+  CopyData *data = job->backend_data;
+  guint32 code;
+
+  stat_cache_purge (backend, G_VFS_JOB_COPY (job)->destination, FALSE, FALSE);
+
+  if (reply_type != SSH_FXP_STATUS)
+    {
+      g_vfs_job_failed (job, G_IO_ERROR, G_IO_ERROR_FAILED,
+                        _("Invalid reply received"));
+      return;
+    }
+
+  code = read_status_code (reply);
+  if (code == SSH_FX_OP_UNSUPPORTED)
+    {
+      backend->ext_copy_file = FALSE;
+      copy_open (backend, job);
+      return;
+    }
+
+  if (failure_from_status_code (job, code, -1, -1))
+    {
+      copy_progress (data, data->size);
+      g_vfs_job_succeeded (job);
+    }
+}
+
+static void
+copy_lstat_reply (GVfsBackendSftp *backend,
+                  MultiReply *replies,
+                  int n_replies,
+                  GVfsJob *job,
+                  gpointer user_data)
+{
+  GVfsJobCopy *op_job = G_VFS_JOB_COPY (job);
+  CopyData *data = job->backend_data;
+  GDataOutputStream *command;
+  GFileInfo *info;
+  GFileType source_type;
+  gboolean dest_is_dir;
+
+  if (replies[0].type == SSH_FXP_STATUS)
+    {
+      result_from_status (job, replies[0].data, -1, -1);
+      return;
+    }
+  else if (replies[0].type != SSH_FXP_ATTRS)
+    {
+      g_vfs_job_failed (job,
+                        G_IO_ERROR, G_IO_ERROR_FAILED,
+                        "%s", _("Invalid reply received"));
+      return;
+    }
+
+  info = g_file_info_new ();
+  parse_attributes (backend, info, NULL,
+                    replies[0].data, NULL);
+  source_type = g_file_info_get_file_type (info);
+  data->size = g_file_info_get_size (info);
+  data->permissions = 0644;
+  if (g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_UNIX_MODE))
+    data->permissions = g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_MODE) & 0777;
+  g_object_unref (info);
+
+  if (source_type == G_FILE_TYPE_DIRECTORY)
+    {
+      g_vfs_job_failed (job,
+                        G_IO_ERROR, G_IO_ERROR_WOULD_RECURSE,
+                        _("Can't recursively copy directory"));
+      return;
+    }
+
+  /* Leave copying links as links and backups to the generic code */
+  if ((source_type == G_FILE_TYPE_SYMBOLIC_LINK &&
+       (op_job->flags & G_FILE_COPY_NOFOLLOW_SYMLINKS)) ||
+      (op_job->flags & G_FILE_COPY_BACKUP))
+    {
+      g_vfs_job_failed (job,
+                        G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                        _("Operation not supported by backend"));
+      return;
+    }
+
+  if (replies[1].type == SSH_FXP_ATTRS)
+    {
+      info = g_file_info_new ();
+      parse_attributes (backend, info, NULL,
+                        replies[1].data, NULL);
+      dest_is_dir = g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY;
+      g_object_unref (info);
+
+      data->dest_exists = TRUE;
+
+      if (strcmp (op_job->source, op_job->destination) == 0)
+        {
+          g_vfs_job_failed (job,
+                            G_IO_ERROR,
+                            G_IO_ERROR_EXISTS,
+                            _("Can't copy file over itself"));
+          return;
+        }
+
+      if (!(op_job->flags & G_FILE_COPY_OVERWRITE))
+        {
+          g_vfs_job_failed (job,
+                            G_IO_ERROR,
+                            G_IO_ERROR_EXISTS,
+                            _("Target file already exists"));
+          return;
+        }
+
+      if (dest_is_dir)
+        {
+          g_vfs_job_failed (job,
+                            G_IO_ERROR,
+                            G_IO_ERROR_IS_DIRECTORY,
+                            _("File is directory"));
+          return;
+        }
+    }
+
+  stat_cache_purge (backend, op_job->destination, FALSE, TRUE);
+
+  if (backend->ext_copy_file)
+    {
+      command = new_command_stream (backend, SSH_FXP_EXTENDED);
+      put_string (command, "copy-file");
+      put_string (command, op_job->source);
+      put_string (command, op_job->destination);
+      g_data_output_stream_put_byte (command,
+                                     (op_job->flags & G_FILE_COPY_OVERWRITE) ? 1 : 0,
+                                     NULL, NULL);
+      queue_command_stream_and_free (backend, command, copy_file_reply, job, NULL);
+      return;
+    }
+
+  copy_open (backend, job);
+}
+
+static gboolean
+try_copy (GVfsBackend *backend,
+          GVfsJobCopy *job,
+          const char *source,
+          const char *destination,
+          GFileCopyFlags flags,
+          GFileProgressCallback progress_callback,
+          gpointer progress_callback_data)
+{
+  GVfsBackendSftp *op_backend = G_VFS_BACKEND_SFTP (backend);
+  GDataOutputStream *command;
+  GDataOutputStream *commands[2];
+  CopyData *data;
+
+  data = copy_data_new (progress_callback, progress_callback_data);
+  g_vfs_job_set_backend_data (G_VFS_JOB (job), data, (GDestroyNotify)copy_data_free);
+
+  command = commands[0] =
+    new_command_stream (op_backend,
+                        SSH_FXP_LSTAT);
+  put_string (command, source);
+
+  command = commands[1] =
+    new_command_stream (op_backend,
+                        SSH_FXP_LSTAT);
+  put_string (command, destination);
+
+  queue_command_streams_and_free (op_backend, commands, 2, copy_lstat_reply, G_VFS_JOB (job), NULL);
+
+  return TRUE;
+}
+
+/* Checks a pull or push target the way g_file_copy() does */
+static gboolean
+copy_check_destination (GVfsJob *job,
+                        GFileCopyFlags flags,
+                        GFileType source_type,
+                        gboolean dest_exists,
+                        gboolean dest_is_dir)
+{
+  if (dest_exists)
+    {
+      if (!(flags & G_FILE_COPY_OVERWRITE))
+        {
+          g_vfs_job_failed (job,
+                            G_IO_ERROR,
+                            G_IO_ERROR_EXISTS,
+                            _("Target file already exists"));
+          return FALSE;
+        }
+
+      if (dest_is_dir)
+        {
+          if (source_type == G_FILE_TYPE_DIRECTORY)
+            g_vfs_job_failed (job,
+                              G_IO_ERROR,
+                              G_IO_ERROR_WOULD_MERGE,
+                              _("Can't copy directory over directory"));
+          else
+            g_vfs_job_failed (job,
+                              G_IO_ERROR,
+                              G_IO_ERROR_IS_DIRECTORY,
+                              _("File is directory"));
+          return FALSE;
+        }
+    }
+
+  if (source_type == G_FILE_TYPE_DIRECTORY)
+    {
+      g_vfs_job_failed (job,
+                        G_IO_ERROR, G_IO_ERROR_WOULD_RECURSE,
+                        _("Can't recursively copy directory"));
+      return FALSE;
+    }
+
+  /* Symlinks with NOFOLLOW_SYMLINKS, special files and backups are
+     left to the generic code */
+  if (source_type != G_FILE_TYPE_REGULAR ||
+      (flags & G_FILE_COPY_BACKUP))
+    {
+      g_vfs_job_failed (job,
+                        G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                        _("Operation not supported by backend"));
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+pull_open_reply (GVfsBackendSftp *backend,
+                 int reply_type,
+                 GDataInputStream *reply,
+                 guint32 len,
+                 GVfsJob *job,
+                 gpointer user_data)
+{
+  CopyData *data = job->backend_data;
+  char *dirname;
+
+  if (!copy_handle_from_reply (data, reply_type, reply, job, &data->read_handle))
+    {
+      copy_finish (backend, job);
+      return;
+    }
+
+  /* Written next to the destination and renamed over it when complete,
+     so a failed pull leaves the old file alone */
+  dirname = g_path_get_dirname (G_VFS_JOB_PULL (job)->local_path);
+  data->local_tempname = g_build_filename (dirname, ".giosaveXXXXXX", NULL);
+  g_free (dirname);
+
+  data->local_fd = g_mkstemp_full (data->local_tempname, O_WRONLY, data->permissions);
+  if (data->local_fd == -1)
+    {
+      copy_set_error_from_errno (data, errno);
+      g_free (data->local_tempname);
+      data->local_tempname = NULL;
+      copy_finish (backend, job);
+      return;
+    }
+
+  copy_pipeline_continue (backend, job);
+}
+
+static void
+pull_stat_reply (GVfsBackendSftp *backend,
+                 int reply_type,
+                 GDataInputStream *reply,
+                 guint32 len,
+                 GVfsJob *job,
+                 gpointer user_data)
+{
+  GVfsJobPull *op_job = G_VFS_JOB_PULL (job);
+  CopyData *data = job->backend_data;
+  GDataOutputStream *command;
+  GFileInfo *info;
+  struct stat statbuf;
+  gboolean dest_exists;
+
+  if (reply_type == SSH_FXP_STATUS)
+    {
+      result_from_status (job, reply, -1, -1);
+      return;
+    }
+  else if (reply_type != SSH_FXP_ATTRS)
+    {
+      g_vfs_job_failed (job, G_IO_ERROR, G_IO_ERROR_FAILED,
+                        _("Invalid reply received"));
+      return;
+    }
+
+  info = g_file_info_new ();
+  parse_attributes (backend, info, NULL, reply, NULL);
+  data->source_type = g_file_info_get_file_type (info);
+  data->size = g_file_info_get_size (info);
+  data->permissions = 0666;
+  if (g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_UNIX_MODE))
+    data->permissions = g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_MODE) & 0777;
+  g_object_unref (info);
+
+  dest_exists = g_lstat (op_job->local_path, &statbuf) == 0;
+  if (!copy_check_destination (job, op_job->flags, data->source_type,
+                               dest_exists, dest_exists && S_ISDIR (statbuf.st_mode)))
+    return;
+
+  command = new_command_stream (backend, SSH_FXP_OPEN);
+  put_string (command, op_job->source);
+  g_data_output_stream_put_uint32 (command, SSH_FXF_READ, NULL, NULL); /* open flags */
+  g_data_output_stream_put_uint32 (command, 0, NULL, NULL); /* Attr flags */
+
+  queue_command_stream_and_free (backend, command, pull_open_reply, job, NULL);
+}
+
+static gboolean
+try_pull (GVfsBackend *backend,
+          GVfsJobPull *job,
+          const char *source,
+          const char *local_path,
+          GFileCopyFlags flags,
+          gboolean remove_source,
+          GFileProgressCallback progress_callback,
+          gpointer progress_callback_data)
+{
+  GVfsBackendSftp *op_backend = G_VFS_BACKEND_SFTP (backend);
+  GDataOutputStream *command;
+  CopyData *data;
+
+  data = copy_data_new (progress_callback, progress_callback_data);
+  data->remove_source = remove_source;
+  g_vfs_job_set_backend_data (G_VFS_JOB (job), data, (GDestroyNotify)copy_data_free);
+
+  command = new_command_stream (op_backend,
+                                (flags & G_FILE_COPY_NOFOLLOW_SYMLINKS) ? SSH_FXP_LSTAT : SSH_FXP_STAT);
+  put_string (command, source);
+
+  queue_command_stream_and_free (op_backend, command, pull_stat_reply, G_VFS_JOB (job), NULL);
+
+  return TRUE;
+}
+
+static void
+push_lstat_reply (GVfsBackendSftp *backend,
+                  int reply_type,
+                  GDataInputStream *reply,
+                  guint32 len,
+                  GVfsJob *job,
+                  gpointer user_data)
+{
+  GVfsJobPush *op_job = G_VFS_JOB_PUSH (job);
+  CopyData *data = job->backend_data;
+  GDataOutputStream *command;
+  GFileInfo *info;
+  gboolean dest_exists, dest_is_dir;
+
+  dest_exists = dest_is_dir = FALSE;
+  if (reply_type == SSH_FXP_ATTRS)
+    {
+      dest_exists = TRUE;
+
+      info = g_file_info_new ();
+      parse_attributes (backend, info, NULL, reply, NULL);
+      dest_is_dir = g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY;
+      g_object_unref (info);
+    }
+
+  if (!copy_check_destination (job, op_job->flags, data->source_type,
+                               dest_exists, dest_is_dir))
+    return;
+
+  data->local_fd = g_open (op_job->local_path, O_RDONLY, 0);
+  if (data->local_fd == -1)
+    {
+      g_vfs_job_failed_from_errno (job, errno);
+      return;
+    }
+
+  stat_cache_purge (backend, op_job->destination, FALSE, TRUE);
+
+  data->dest_exists = dest_exists;
+  if (dest_exists)
+    {
+      copy_create_temp (backend, job);
+      return;
+    }
+
+  command = new_command_stream (backend, SSH_FXP_OPEN);
+  put_string (command, op_job->destination);
+  g_data_output_stream_put_uint32 (command, SSH_FXF_WRITE|SSH_FXF_CREAT|SSH_FXF_EXCL, NULL, NULL); /* open flags */
+  g_data_output_stream_put_uint32 (command, SSH_FILEXFER_ATTR_PERMISSIONS, NULL, NULL); /* Attr flags */
+  g_data_output_stream_put_uint32 (command, data->permissions, NULL, NULL);
+
+  queue_command_stream_and_free (backend, command, copy_open_dest_reply, job, NULL);
+}
+
+static gboolean
+try_push (GVfsBackend *backend,
+          GVfsJobPush *job,
+          const char *destination,
+          const char *local_path,
+          GFileCopyFlags flags,
+          gboolean remove_source,
+          GFileProgressCallback progress_callback,
+          gpointer progress_callback_data)
+{
+  GVfsBackendSftp *op_backend = G_VFS_BACKEND_SFTP (backend);
+  GDataOutputStream *command;
+  CopyData *data;
+  struct stat statbuf;
+  int res;
+
+  if (flags & G_FILE_COPY_NOFOLLOW_SYMLINKS)
+    res = g_lstat (local_path, &statbuf);
+  else
+    res = g_stat (local_path, &statbuf);
+
+  if (res != 0)
+    {
+      g_vfs_job_failed_from_errno (G_VFS_JOB (job), errno);
+      return TRUE;
+    }
+
+  data = copy_data_new (progress_callback, progress_callback_data);
+  data->local_is_source = TRUE;
+  data->remove_source = remove_source;
+  data->size = statbuf.st_size;
+  data->permissions = statbuf.st_mode & 0777;
+  if (S_ISDIR (statbuf.st_mode))
+    data->source_type = G_FILE_TYPE_DIRECTORY;
+  else if (S_ISREG (statbuf.st_mode))
+    data->source_type = G_FILE_TYPE_REGULAR;
+  else if (S_ISLNK (statbuf.st_mode))
+    data->source_type = G_FILE_TYPE_SYMBOLIC_LINK;
+  else
+    data->source_type = G_FILE_TYPE_SPECIAL;
+  g_vfs_job_set_backend_data (G_VFS_JOB (job), data, (GDestroyNotify)copy_data_free);
+
+  command = new_command_stream (op_backend, SSH_FXP_LSTAT);
+  put_string (command, destination);
+
+  queue_command_stream_and_free (op_backend, command, push_lstat_reply, G_VFS_JOB (job), NULL);
+
+  return TRUE;
+}
+
+static void
+set_display_name_reply (GVfsBackendSftp *backend,
+                        int reply_type,
+                        GDataInputStream *reply,
+                        guint32 len,
+                        GVfsJob *job,
+                        gpointer user_data)
+{
+  if (reply_type == SSH_FXP_STATUS)
+    result_from_status (job, reply, -1, -1);
+  else
+    g_vfs_job_failed (job, G_IO_ERROR, G_IO_ERROR_FAILED,
+                      _("Invalid reply received"));
+}
+
+static gboolean
+try_set_display_name (GVfsBackend *backend,
+                      GVfsJobSetDisplayName *job,
+                      const char *filename,
+                      const char *display_name)
+{
+  GVfsBackendSftp *op_backend = G_VFS_BACKEND_SFTP (backend);
+  GDataOutputStream *command;
+  char *dirname, *basename, *new_name;
+
+  /* We use the same setting as for local files. Can't really
+   * do better, since there is no way in this version of sftp to find out
+   * the remote charset encoding
+   */
+  
+  dirname = g_path_get_dirname (filename);
+  basename = g_filename_from_utf8 (display_name, -1, NULL, NULL, NULL);
+  if (basename == NULL)
+    basename = g_strdup (display_name);
+  new_name = g_build_filename (dirname, basename, NULL);
+  g_free (dirname);
+  g_free (basename);
+
+  g_vfs_job_set_display_name_set_new_path (job,
+                                           new_name);
+
+  stat_cache_purge (op_backend, filename, TRUE, TRUE);
+  stat_cache_purge (op_backend, new_name, TRUE, FALSE);
+  
+  command = new_command_stream (op_backend,
+                                SSH_FXP_RENAME);
+  put_string (command, filename);
+  put_string (command, new_name);
+  
+  queue_command_stream_and_free (op_backend, command, set_display_name_reply, G_VFS_JOB (job), NULL);
+
+  g_free (new_name);
+
+  return TRUE;
+}
+
+
+static void
+make_symlink_reply (GVfsBackendSftp *backend,
+                    int reply_type,
+                    GDataInputStream *reply,
+                    guint32 len,
+                    GVfsJob *job,
+                    gpointer user_data)
+{
+  if (reply_type == SSH_FXP_STATUS)
+    result_from_status (job, reply, -1, -1); 
+  else
+    g_vfs_job_failed (job, G_IO_ERROR, G_IO_ERROR_FAILED,
+                      _("Invalid reply received"));
+}
+
+static gboolean
+try_make_symlink (GVfsBackend *backend,
+                  GVfsJobMakeSymlink *job,
+                  const char *filename,
+                  const char *symlink_value)
+{
+  GVfsBackendSftp *op_backend = G_VFS_BACKEND_SFTP (backend);
+  GDataOutputStream *command;
+
+  stat_cache_purge (op_backend, filename, FALSE, TRUE);
+  
   command = new_command_stream (op_backend,
                                 SSH_FXP_SYMLINK);
   /* Note: This is the reverse order of how this is documented in
@@ -4480,6 +6546,8 @@ try_make_directory (GVfsBackend *backend,
   GVfsBackendSftp *op_backend = G_VFS_BACKEND_SFTP (backend);
   GDataOutputStream *command;
 
+  stat_cache_purge (op_backend, filename, FALSE, TRUE);
+
   command = new_command_stream (op_backend,
                                 SSH_FXP_MKDIR);
   put_string (command, filename);
@@ -4542,6 +6610,8 @@ delete_lstat_reply (GVfsBackendSftp *backend,
       info = g_file_info_new ();
       parse_attributes (backend, info, NULL, reply, NULL);
 
+      stat_cache_purge (backend, G_VFS_JOB_DELETE (job)->filename, FALSE, TRUE);
+
       if (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY)
         {
           command = new_command_stream (backend,
@@ -4643,6 +6713,8 @@ try_set_attribute (GVfsBackend *backend,
                         _("Invalid attribute type (uint32 expected)"));
     }
 
+  stat_cache_purge (op_backend, filename, FALSE, FALSE);
+
   command = new_command_stream (op_backend,
                                 SSH_FXP_SETSTAT);
   put_string (command, filename);
@@ -4731,7 +6803,10 @@ g_vfs_backend_sftp_class_init (GVfsBackendSftpClass *klass)
   backend_class->try_replace = try_replace;
   backend_class->try_write = try_write;
   backend_class->try_seek_on_write = try_seek_on_write;
+  backend_class->try_copy = try_copy;
   backend_class->try_move = try_move;
+  backend_class->try_push = try_push;
+  backend_class->try_pull = try_pull;
   backend_class->try_make_symlink = try_make_symlink;
   backend_class->try_make_directory = try_make_directory;
   backend_class->try_delete = try_delete;
@@ -47,12 +47,24 @@
 #include "gvfsjobqueryfsinfo.h"
 #include "gvfsjobqueryattributes.h"
 #include "gvfsjobenumerate.h"
+#include "gvfsjobcopy.h"
+#include "gvfsjobpush.h"
+#include "gvfsjobpull.h"
 #include "gvfsdaemonprotocol.h"
 #include "gvfskeyring.h"
 
 #include <libsmbclient.h>
 #include "libsmb-compat.h"
 
+/* size and number of buffers used when copying */
+#define SMB_COPY_BUFFER_SIZE (1024 * 1024)
+#define SMB_COPY_N_BUFFERS 2
+
+/* number of files sent to the client at once when enumerating */
+#define SMB_ENUMERATE_BATCH_SIZE 64
+/* number of extra contexts used to stat files in parallel */
+#define SMB_STAT_CONTEXTS 4
+
 struct _GVfsBackendSmb
 {
   GVfsBackend parent_instance;
@@ -84,6 +96,8 @@ struct _GVfsBackendSmb
   char *cached_domain;
   char *cached_username;
   SMBCSRV *cached_server;
+
+  GAsyncQueue *stat_contexts; /* idle contexts for parallel stats */
 };
 
 
@@ -109,6 +123,15 @@ g_vfs_backend_smb_finalize (GObject *object)
   g_free (backend->domain);
   g_free (backend->path);
   g_free (backend->default_workgroup);
+
+  if (backend->stat_contexts)
+    {
+      SMBCCTX *context;
+
+      while ((context = g_async_queue_try_pop (backend->stat_contexts)) != NULL)
+        smbc_free_context (context, TRUE);
+      g_async_queue_unref (backend->stat_contexts);
+    }
   
   if (G_OBJECT_CLASS (g_vfs_backend_smb_parent_class)->finalize)
     (*G_OBJECT_CLASS (g_vfs_backend_smb_parent_class)->finalize) (object);
@@ -130,6 +153,8 @@ g_vfs_backend_smb_init (GVfsBackendSmb *backend)
     g_free (workgroup);
 
   g_object_unref (settings);
+
+  backend->stat_contexts = g_async_queue_new ();
 }
 
 /**
@@ -555,6 +580,8 @@ do_mount (GVfsBackend *backend,
   g_vfs_backend_set_display_name (backend, display_name);
   g_free (display_name);
   g_vfs_backend_set_icon_name (backend, "folder-remote");
+  /* do_read never reads more than this at a time */
+  g_vfs_backend_set_read_chunk_size (backend, 0, 65534);
 
   smb_mount_spec = g_mount_spec_new ("smb-share");
   g_mount_spec_set (smb_mount_spec, "share", op_backend->share);
@@ -1013,6 +1040,142 @@ open_tmpfile (GVfsBackendSmb *backend,
     }
 }
 
+static gboolean
+write_all (GVfsBackendSmb *backend,
+           SMBCFILE *file,
+           char *buffer,
+           gsize size)
+{
+  smbc_write_fn smbc_write;
+  ssize_t res;
+
+  smbc_write = smbc_getFunctionWrite (backend->smb_context);
+  while (size > 0)
+    {
+      res = smbc_write (backend->smb_context, file, buffer, size);
+      if (res < 0)
+        return FALSE;
+      buffer += res;
+      size -= res;
+    }
+
+  return TRUE;
+}
+
+/* Fills @buffer unless the end of the file is reached */
+static gssize
+read_all (GVfsBackendSmb *backend,
+          SMBCFILE *file,
+          char *buffer,
+          gsize size)
+{
+  smbc_read_fn smbc_read;
+  gsize bytes_read = 0;
+  ssize_t res;
+
+  smbc_read = smbc_getFunctionRead (backend->smb_context);
+  while (bytes_read < size)
+    {
+      res = smbc_read (backend->smb_context, file,
+                       buffer + bytes_read, size - bytes_read);
+      if (res < 0)
+        return -1;
+      if (res == 0)
+        break;
+      bytes_read += res;
+    }
+
+  return bytes_read;
+}
+
+#ifdef HAVE_SAMBA_SPLICE
+typedef struct {
+  GVfsJob *job;
+  goffset size;
+  GFileProgressCallback progress_callback;
+  gpointer progress_callback_data;
+} SpliceData;
+
+static int
+splice_cb (off_t n, void *priv)
+{
+  SpliceData *data = priv;
+
+  if (data->progress_callback)
+    data->progress_callback (n, data->size, data->progress_callback_data);
+
+  return !g_vfs_job_is_cancelled (data->job);
+}
+#endif
+
+/* Copies the contents of @from to @to. If the server supports it, it
+ * copies the data itself, otherwise the data goes through us.
+ * Returns FALSE and sets errno on failure. */
+static gboolean
+copy_contents (GVfsBackendSmb *backend,
+               GVfsJob *job,
+               SMBCFILE *from,
+               SMBCFILE *to,
+               GFileProgressCallback progress_callback,
+               gpointer progress_callback_data)
+{
+  struct stat st;
+  char *buffer;
+  goffset copied;
+  gssize res;
+  smbc_fstat_fn smbc_fstat;
+
+  smbc_fstat = smbc_getFunctionFstat (backend->smb_context);
+  if (smbc_fstat (backend->smb_context, from, &st) == -1)
+    return FALSE;
+
+#ifdef HAVE_SAMBA_SPLICE
+  {
+    smbc_splice_fn smbc_splice;
+    smbc_lseek_fn smbc_lseek;
+    SpliceData data = { job, st.st_size, progress_callback, progress_callback_data };
+
+    smbc_splice = smbc_getFunctionSplice (backend->smb_context);
+    if (smbc_splice (backend->smb_context, from, to, st.st_size,
+                     splice_cb, &data) == st.st_size)
+      return TRUE;
+
+    if (g_vfs_job_is_cancelled (job))
+      {
+        errno = ECANCELED;
+        return FALSE;
+      }
+
+    /* The server can't do it, so start over and copy by hand */
+    smbc_lseek = smbc_getFunctionLseek (backend->smb_context);
+    if (smbc_lseek (backend->smb_context, from, 0, SEEK_SET) == (off_t)-1 ||
+        smbc_lseek (backend->smb_context, to, 0, SEEK_SET) == (off_t)-1)
+      return FALSE;
+  }
+#endif
+
+  buffer = g_malloc (SMB_COPY_BUFFER_SIZE);
+  copied = 0;
+  while ((res = read_all (backend, from, buffer, SMB_COPY_BUFFER_SIZE)) > 0)
+    {
+      if (!write_all (backend, to, buffer, res))
+        break;
+
+      copied += res;
+      if (progress_callback)
+        progress_callback (copied, st.st_size, progress_callback_data);
+
+      if (g_vfs_job_is_cancelled (job))
+        {
+          errno = ECANCELED;
+          break;
+        }
+    }
+  g_free (buffer);
+
+  return res == 0;
+}
+
 static gboolean
 copy_file (GVfsBackendSmb *backend,
 	   GVfsJob *job,
@@ -1020,14 +1183,8 @@ copy_file (GVfsBackendSmb *backend,
 	   const char *to_uri)
 {
   SMBCFILE *from_file, *to_file;
-  char buffer[4096];
-  size_t buffer_size;
-  ssize_t res;
-  char *p;
   gboolean succeeded;
   smbc_open_fn smbc_open;
-  smbc_read_fn smbc_read;
-  smbc_write_fn smbc_write;
   smbc_close_fn smbc_close;
   
 
@@ -1037,8 +1194,6 @@ copy_file (GVfsBackendSmb *backend,
   succeeded = FALSE;
 
   smbc_open = smbc_getFunctionOpen (backend->smb_context);
-  smbc_read = smbc_getFunctionRead (backend->smb_context);
-  smbc_write = smbc_getFunctionWrite (backend->smb_context);
   smbc_close = smbc_getFunctionClose (backend->smb_context);
 
   from_file = smbc_open (backend->smb_context, from_uri,
@@ -1049,32 +1204,10 @@ copy_file (GVfsBackendSmb *backend,
   to_file = smbc_open (backend->smb_context, to_uri,
 		       O_CREAT|O_WRONLY|O_TRUNC, 0666);
   
-  if (from_file == NULL || g_vfs_job_is_cancelled (job))
+  if (to_file == NULL || g_vfs_job_is_cancelled (job))
     goto out;
 
-  while (1)
-    {
-      
-      res = smbc_read (backend->smb_context, from_file,
-					buffer, sizeof(buffer));
-      if (res < 0 || g_vfs_job_is_cancelled (job))
-	goto out;
-      if (res == 0)
-	break; /* Succeeded */
-
-      buffer_size = res;
-      p = buffer;
-      while (buffer_size > 0)
-	{
-	  res = smbc_write (backend->smb_context, to_file,
-					     p, buffer_size);
-	  if (res < 0 || g_vfs_job_is_cancelled (job))
-	    goto out;
-	  buffer_size -= res;
-	  p += res;
-	}
-    }
-  succeeded = TRUE;
+  succeeded = copy_contents (backend, job, from_file, to_file, NULL, NULL);
  
  out: 
   if (to_file)
@@ -1327,6 +1460,88 @@ do_query_info_on_write (GVfsBackend *backend,
 
 }
 
+/* Closes the file of @handle and moves the temporary file, if any, into
+ * place. On failure, the temporary file is removed. */
+static gboolean
+smb_write_handle_finish (GVfsBackendSmb *backend,
+                         SmbWriteHandle *handle,
+                         GError **error)
+{
+  int res, errsv;
+  smbc_close_fn smbc_close;
+  smbc_unlink_fn smbc_unlink;
+  smbc_rename_fn smbc_rename;
+
+  smbc_close = smbc_getFunctionClose (backend->smb_context);
+  smbc_unlink = smbc_getFunctionUnlink (backend->smb_context);
+  smbc_rename = smbc_getFunctionRename (backend->smb_context);
+
+  res = smbc_close (backend->smb_context, handle->file);
+  handle->file = NULL;
+  if (res == -1)
+    {
+      errsv = errno;
+      g_set_error_literal (error, G_IO_ERROR,
+                           g_io_error_from_errno (errsv),
+                           g_strerror (errsv));
+      goto fail;
+    }
+
+  if (handle->tmp_uri == NULL)
+    return TRUE;
+
+  if (handle->backup_uri)
+    {
+      res = smbc_rename (backend->smb_context, handle->uri,
+                         backend->smb_context, handle->backup_uri);
+      if (res == -1)
+        {
+          errsv = errno;
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_CANT_CREATE_BACKUP,
+                       _("Backup file creation failed: %s"), g_strerror (errsv));
+          goto fail;
+        }
+    }
+  else
+    smbc_unlink (backend->smb_context, handle->uri);
+
+  res = smbc_rename (backend->smb_context, handle->tmp_uri,
+                     backend->smb_context, handle->uri);
+  if (res == -1)
+    {
+      errsv = errno;
+      g_set_error_literal (error, G_IO_ERROR,
+                           g_io_error_from_errno (errsv),
+                           g_strerror (errsv));
+      goto fail;
+    }
+
+  return TRUE;
+
+ fail:
+  if (handle->tmp_uri)
+    smbc_unlink (backend->smb_context, handle->tmp_uri);
+  return FALSE;
+}
+
+/* Closes the file of @handle after a failed write, leaving the original
+ * file alone if a temporary file was used */
+static void
+smb_write_handle_abort (GVfsBackendSmb *backend,
+                        SmbWriteHandle *handle)
+{
+  smbc_close_fn smbc_close;
+  smbc_unlink_fn smbc_unlink;
+
+  smbc_close = smbc_getFunctionClose (backend->smb_context);
+  smbc_unlink = smbc_getFunctionUnlink (backend->smb_context);
+
+  smbc_close (backend->smb_context, handle->file);
+  handle->file = NULL;
+  if (handle->tmp_uri)
+    smbc_unlink (backend->smb_context, handle->tmp_uri);
+}
+
 static void
 do_close_write (GVfsBackend *backend,
 		GVfsJobCloseWrite *job,
@@ -1336,59 +1551,19 @@ do_close_write (GVfsBackend *backend,
   SmbWriteHandle *handle = _handle;
   struct stat stat_at_close;
   int stat_res;
-  ssize_t res;
+  GError *error = NULL;
   smbc_fstat_fn smbc_fstat;
-  smbc_close_fn smbc_close;
-  smbc_unlink_fn smbc_unlink;
-  smbc_rename_fn smbc_rename;
 
   smbc_fstat = smbc_getFunctionFstat (op_backend->smb_context);
-  smbc_close = smbc_getFunctionClose (op_backend->smb_context);
-  smbc_unlink = smbc_getFunctionUnlink (op_backend->smb_context);
-  smbc_rename = smbc_getFunctionRename (op_backend->smb_context);
   
   stat_res = smbc_fstat (op_backend->smb_context, handle->file, &stat_at_close);
   
-  res = smbc_close (op_backend->smb_context, handle->file);
-
-  if (res == -1)
+  if (!smb_write_handle_finish (op_backend, handle, &error))
     {
-      g_vfs_job_failed_from_errno (G_VFS_JOB (job), errno);
-      
-      if (handle->tmp_uri)
-    	  smbc_unlink (op_backend->smb_context, handle->tmp_uri);
+      g_vfs_job_failed_from_error (G_VFS_JOB (job), error);
+      g_error_free (error);
       goto out;
     }
-
-  if (handle->tmp_uri)
-    {
-      if (handle->backup_uri)
-	{
-	  res = smbc_rename (op_backend->smb_context, handle->uri,
-						 op_backend->smb_context, handle->backup_uri);
-	  if (res ==  -1)
-	    {
-              int errsv = errno;
-
-          smbc_unlink (op_backend->smb_context, handle->tmp_uri);
-	      g_vfs_job_failed (G_VFS_JOB (job),
-				G_IO_ERROR, G_IO_ERROR_CANT_CREATE_BACKUP,
-				_("Backup file creation failed: %s"), g_strerror (errsv));
-	      goto out;
-	    }
-	}
-      else
-	smbc_unlink (op_backend->smb_context, handle->uri);
-      
-      res = smbc_rename (op_backend->smb_context, handle->tmp_uri,
-					     op_backend->smb_context, handle->uri);
-      if (res ==  -1)
-	{
-	  smbc_unlink (op_backend->smb_context, handle->tmp_uri);
-	  g_vfs_job_failed_from_errno (G_VFS_JOB (job), errno);
-	  goto out;
-	}
-    }
   
   if (stat_res == 0)
     {
@@ -1761,97 +1936,233 @@ do_set_attribute (GVfsBackend *backend,
 }
 
 static void
-do_enumerate (GVfsBackend *backend,
-	      GVfsJobEnumerate *job,
-	      const char *filename,
-	      GFileAttributeMatcher *matcher,
-	      GFileQueryInfoFlags flags)
+enumerate_add_infos (GVfsJobEnumerate *job,
+                     GList *files)
 {
-  GVfsBackendSmb *op_backend = G_VFS_BACKEND_SMB (backend);
+  if (files == NULL)
+    return;
+
+  files = g_list_reverse (files);
+  g_vfs_job_enumerate_add_infos (job, files);
+  g_list_foreach (files, (GFunc)g_object_unref, NULL);
+  g_list_free (files);
+}
+
+#ifdef HAVE_SAMBA_READDIRPLUS2
+/* The attributes come along with the names here, so this needs no
+ * round trips to the server for each file */
+static void
+enumerate_readdirplus (GVfsBackendSmb *backend,
+                       GVfsJobEnumerate *job,
+                       SMBCFILE *dir,
+                       GFileAttributeMatcher *matcher)
+{
+  const struct libsmb_file_info *file_info;
+  struct stat st = {0};
+  GList *files = NULL;
+  guint n_files = 0;
+  GFileInfo *info;
+  smbc_readdirplus2_fn smbc_readdirplus2;
+
+  smbc_readdirplus2 = smbc_getFunctionReaddirPlus2 (backend->smb_context);
+
+  while ((file_info = smbc_readdirplus2 (backend->smb_context, dir, &st)) != NULL)
+    {
+      if ((S_ISREG (st.st_mode) ||
+           S_ISDIR (st.st_mode) ||
+           S_ISLNK (st.st_mode)) &&
+          strcmp (file_info->name, ".") != 0 &&
+          strcmp (file_info->name, "..") != 0)
+        {
+          info = g_file_info_new ();
+          set_info_from_stat (backend, info, &st, file_info->name, matcher);
+          files = g_list_prepend (files, info);
+          if (++n_files == SMB_ENUMERATE_BATCH_SIZE)
+            {
+              enumerate_add_infos (job, files);
+              files = NULL;
+              n_files = 0;
+            }
+        }
+      memset (&st, 0, sizeof (st));
+    }
+
+  enumerate_add_infos (job, files);
+}
+#else
+
+#ifdef HAVE_SAMBA_THREAD_POSIX
+typedef struct {
+  char *name;
+  char *uri;
   struct stat st;
   int res;
-  GError *error;
-  SMBCFILE *dir;
-  char dirents[1024*4];
+  gboolean done;                /* FALSE if no context was available */
+  GAsyncQueue *results;
+} SmbStatRequest;
+
+/* Creates a context for stats, logging in with the credentials that
+ * worked for the mount. It does not use the server cache, that belongs
+ * to the main context. */
+static SMBCCTX *
+create_stat_context (GVfsBackendSmb *backend)
+{
+  SMBCCTX *context;
+  gboolean fallback;
+
+  context = smbc_new_context ();
+  if (context == NULL)
+    return NULL;
+
+  smbc_setOptionUserData (context, backend);
+  smbc_setDebug (context, smbc_getDebug (backend->smb_context));
+  smbc_setFunctionAuthDataWithContext (context, auth_callback);
+  if (backend->default_workgroup != NULL)
+    smbc_setWorkgroup (context, backend->default_workgroup);
+
+  /* same as the main context after mounting */
+  fallback = backend->user != NULL || backend->mount_try > 0;
+  smbc_setOptionUseKerberos (context, 1);
+  smbc_setOptionFallbackAfterKerberos (context, fallback);
+  smbc_setOptionNoAutoAnonymousLogin (context, fallback);
+
+  if (!smbc_init_context (context))
+    {
+      smbc_free_context (context, FALSE);
+      return NULL;
+    }
+
+  return context;
+}
+
+static void
+stat_worker (gpointer data,
+             gpointer user_data)
+{
+  SmbStatRequest *request = data;
+  GVfsBackendSmb *backend = user_data;
+  SMBCCTX *context;
+  smbc_stat_fn smbc_stat;
+
+  /* the pool never runs more threads than SMB_STAT_CONTEXTS, so this
+   * creates no more contexts than that */
+  context = g_async_queue_try_pop (backend->stat_contexts);
+  if (context == NULL)
+    context = create_stat_context (backend);
+
+  if (context != NULL)
+    {
+      smbc_stat = smbc_getFunctionStat (context);
+      request->res = smbc_stat (context, request->uri, &request->st);
+      request->done = TRUE;
+      g_async_queue_push (backend->stat_contexts, context);
+    }
+
+  g_async_queue_push (request->results, request);
+}
+#endif
+
+/* Lists the directory and stats each file unless only names are wanted.
+ * If possible, the stats run in parallel on extra contexts and files
+ * are sent to the client in batches as their stats complete. */
+static void
+enumerate_getdents (GVfsBackendSmb *backend,
+                    GVfsJobEnumerate *job,
+                    SMBCFILE *dir,
+                    GString *uri,
+                    GFileAttributeMatcher *matcher)
+{
+  struct stat st;
+  int res;
+  char *dirents;
   struct smbc_dirent *dirp;
-  GList *files;
+  GList *files = NULL;
+  guint n_files = 0;
   GFileInfo *info;
-  GString *uri;
+  gboolean names_only;
   int uri_start_len;
-  smbc_opendir_fn smbc_opendir;
   smbc_getdents_fn smbc_getdents;
   smbc_stat_fn smbc_stat;
-  smbc_closedir_fn smbc_closedir;
-
-  uri = create_smb_uri_string (op_backend->server, op_backend->share, filename);
-  
-  smbc_opendir = smbc_getFunctionOpendir (op_backend->smb_context);
-  smbc_getdents = smbc_getFunctionGetdents (op_backend->smb_context);
-  smbc_stat = smbc_getFunctionStat (op_backend->smb_context);
-  smbc_closedir = smbc_getFunctionClosedir (op_backend->smb_context);
-  
-  dir = smbc_opendir (op_backend->smb_context, uri->str);
+#ifdef HAVE_SAMBA_THREAD_POSIX
+  GThreadPool *pool = NULL;
+  GAsyncQueue *results;
+  SmbStatRequest *request;
+  guint pending;
+#endif
 
-  if (dir == NULL)
-    {
-      int errsv = errno;
+  smbc_getdents = smbc_getFunctionGetdents (backend->smb_context);
+  smbc_stat = smbc_getFunctionStat (backend->smb_context);
 
-      error = NULL;
-      g_set_error_literal (&error, G_IO_ERROR,
-			   g_io_error_from_errno (errsv),
-			   g_strerror (errsv));
-      goto error;
-    }
+  names_only = matcher == NULL ||
+               g_file_attribute_matcher_matches_only (matcher, G_FILE_ATTRIBUTE_STANDARD_NAME);
 
-  g_vfs_job_succeeded (G_VFS_JOB (job));
+#ifdef HAVE_SAMBA_THREAD_POSIX
+  results = g_async_queue_new ();
+  if (!names_only)
+    pool = g_thread_pool_new (stat_worker, backend, SMB_STAT_CONTEXTS, FALSE, NULL);
+#endif
 
   if (uri->str[uri->len - 1] != '/')
     g_string_append_c (uri, '/');
   uri_start_len = uri->len;
 
+  dirents = g_malloc (64 * 1024);
   while (TRUE)
     {
-      files = NULL;
-      
-      res = smbc_getdents (op_backend->smb_context, dir, (struct smbc_dirent *)dirents, sizeof (dirents));
+      res = smbc_getdents (backend->smb_context, dir, (struct smbc_dirent *)dirents, 64 * 1024);
       if (res <= 0)
 	break;
+#ifdef HAVE_SAMBA_THREAD_POSIX
+      pending = 0;
+#endif
       
       dirp = (struct smbc_dirent *)dirents;
       while (res > 0)
 	{
 	  unsigned int dirlen;
 
-	  /* TODO: Only do stat if required for flags */
-	  
 	  if ((dirp->smbc_type == SMBC_DIR ||
 	       dirp->smbc_type == SMBC_FILE ||
 	       dirp->smbc_type == SMBC_LINK) &&
 	      strcmp (dirp->name, ".") != 0 &&
 	      strcmp (dirp->name, "..") != 0)
 	    {
-	      int stat_res;
 	      g_string_truncate (uri, uri_start_len);
 	      g_string_append_encoded (uri,
 				       dirp->name,
 				       SUB_DELIM_CHARS ":@/");
 
-	      if (matcher == NULL ||
-		  g_file_attribute_matcher_matches_only (matcher, G_FILE_ATTRIBUTE_STANDARD_NAME))
+	      info = NULL;
+	      if (names_only)
 		{
 		  info = g_file_info_new ();
 		  g_file_info_set_name (info, dirp->name);
-		  files = g_list_prepend (files, info);
 		}
-	      else
+#ifdef HAVE_SAMBA_THREAD_POSIX
+	      else if (pool)
 		{
-		  stat_res = smbc_stat (op_backend->smb_context,
-							    uri->str, &st);
-		  if (stat_res == 0)
+		  request = g_slice_new0 (SmbStatRequest);
+		  request->name = g_strdup (dirp->name);
+		  request->uri = g_strdup (uri->str);
+		  request->results = results;
+		  g_thread_pool_push (pool, request, NULL);
+		  pending++;
+		}
+#endif
+	      else if (smbc_stat (backend->smb_context, uri->str, &st) == 0)
+		{
+		  info = g_file_info_new ();
+		  set_info_from_stat (backend, info, &st, dirp->name, matcher);
+		}
+
+	      if (info)
+		{
+		  files = g_list_prepend (files, info);
+		  if (++n_files == SMB_ENUMERATE_BATCH_SIZE)
 		    {
-		      info = g_file_info_new ();
-		      set_info_from_stat (op_backend, info, &st, dirp->name, matcher);
-		      files = g_list_prepend (files, info);
+		      enumerate_add_infos (job, files);
+		      files = NULL;
+		      n_files = 0;
 		    }
 		}
 	    }
@@ -1860,31 +2171,103 @@ do_enumerate (GVfsBackend *backend,
 	  dirp = (struct smbc_dirent *) (((char *)dirp) + dirlen);
 	  res -= dirlen;
 	}
-      
-      if (files)
+
+#ifdef HAVE_SAMBA_THREAD_POSIX
+      for (; pending > 0; pending--)
 	{
-	  files = g_list_reverse (files);
-	  g_vfs_job_enumerate_add_infos (job, files);
-	  g_list_foreach (files, (GFunc)g_object_unref, NULL);
-	  g_list_free (files);
+	  request = g_async_queue_pop (results);
+	  /* no context could be set up, so use ours */
+	  if (!request->done)
+	    request->res = smbc_stat (backend->smb_context, request->uri, &request->st);
+
+	  if (request->res == 0)
+	    {
+	      info = g_file_info_new ();
+	      set_info_from_stat (backend, info, &request->st, request->name, matcher);
+	      files = g_list_prepend (files, info);
+	      if (++n_files == SMB_ENUMERATE_BATCH_SIZE)
+		{
+		  enumerate_add_infos (job, files);
+		  files = NULL;
+		  n_files = 0;
+		}
+	    }
+
+	  g_free (request->name);
+	  g_free (request->uri);
+	  g_slice_free (SmbStatRequest, request);
 	}
-    }
-      
-  res = smbc_closedir (op_backend->smb_context, dir);
+#endif
 
-  g_vfs_job_enumerate_done (job);
+      enumerate_add_infos (job, files);
+      files = NULL;
+      n_files = 0;
+    }
+  g_free (dirents);
 
-  g_string_free (uri, TRUE);
-  return;
-  
- error:
-  g_vfs_job_failed_from_error (G_VFS_JOB (job), error);
-  g_error_free (error);
-  g_string_free (uri, TRUE);
+#ifdef HAVE_SAMBA_THREAD_POSIX
+  if (pool)
+    g_thread_pool_free (pool, FALSE, TRUE);
+  g_async_queue_unref (results);
+#endif
 }
+#endif
 
 static void
-do_set_display_name (GVfsBackend *backend,
+do_enumerate (GVfsBackend *backend,
+	      GVfsJobEnumerate *job,
+	      const char *filename,
+	      GFileAttributeMatcher *matcher,
+	      GFileQueryInfoFlags flags)
+{
+  GVfsBackendSmb *op_backend = G_VFS_BACKEND_SMB (backend);
+  GError *error;
+  SMBCFILE *dir;
+  GString *uri;
+  smbc_opendir_fn smbc_opendir;
+  smbc_closedir_fn smbc_closedir;
+
+  uri = create_smb_uri_string (op_backend->server, op_backend->share, filename);
+  
+  smbc_opendir = smbc_getFunctionOpendir (op_backend->smb_context);
+  smbc_closedir = smbc_getFunctionClosedir (op_backend->smb_context);
+  
+  dir = smbc_opendir (op_backend->smb_context, uri->str);
+
+  if (dir == NULL)
+    {
+      int errsv = errno;
+
+      error = NULL;
+      g_set_error_literal (&error, G_IO_ERROR,
+			   g_io_error_from_errno (errsv),
+			   g_strerror (errsv));
+      goto error;
+    }
+
+  g_vfs_job_succeeded (G_VFS_JOB (job));
+
+#ifdef HAVE_SAMBA_READDIRPLUS2
+  enumerate_readdirplus (op_backend, job, dir, matcher);
+#else
+  enumerate_getdents (op_backend, job, dir, uri, matcher);
+#endif
+      
+  smbc_closedir (op_backend->smb_context, dir);
+
+  g_vfs_job_enumerate_done (job);
+
+  g_string_free (uri, TRUE);
+  return;
+  
+ error:
+  g_vfs_job_failed_from_error (G_VFS_JOB (job), error);
+  g_error_free (error);
+  g_string_free (uri, TRUE);
+}
+
+static void
+do_set_display_name (GVfsBackend *backend,
 		     GVfsJobSetDisplayName *job,
 		     const char *filename,
 		     const char *display_name)
@@ -2148,6 +2531,596 @@ do_move (GVfsBackend *backend,
     g_vfs_job_succeeded (G_VFS_JOB (job));
 }
 
+/* Opens @destination for copying a file there, following @flags. As in
+ * do_replace(), an existing file is only replaced once the copy is
+ * complete, if we can create a temporary file next to it. */
+static SmbWriteHandle *
+open_copy_destination (GVfsBackendSmb *backend,
+                       const char *destination,
+                       GFileCopyFlags flags,
+                       GError **error)
+{
+  SmbWriteHandle *handle;
+  struct stat st;
+  int errsv;
+  smbc_stat_fn smbc_stat;
+  smbc_open_fn smbc_open;
+  smbc_rename_fn smbc_rename;
+
+  smbc_stat = smbc_getFunctionStat (backend->smb_context);
+  smbc_open = smbc_getFunctionOpen (backend->smb_context);
+  smbc_rename = smbc_getFunctionRename (backend->smb_context);
+
+  handle = g_new0 (SmbWriteHandle, 1);
+  handle->uri = create_smb_uri (backend->server, backend->share, destination);
+
+  if (smbc_stat (backend->smb_context, handle->uri, &st) == 0)
+    {
+      if (!(flags & G_FILE_COPY_OVERWRITE))
+        {
+          g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_EXISTS,
+                               _("Target file already exists"));
+          goto error;
+        }
+      if (S_ISDIR (st.st_mode))
+        {
+          g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_IS_DIRECTORY,
+                               _("Can't copy file over directory"));
+          goto error;
+        }
+
+      if (flags & G_FILE_COPY_BACKUP)
+        handle->backup_uri = g_strconcat (handle->uri, "~", NULL);
+
+      handle->file = open_tmpfile (backend, handle->uri, &handle->tmp_uri);
+      if (handle->file == NULL && handle->backup_uri)
+        {
+          if (smbc_rename (backend->smb_context, handle->uri,
+                           backend->smb_context, handle->backup_uri) == -1)
+            {
+              errsv = errno;
+              g_set_error (error, G_IO_ERROR, G_IO_ERROR_CANT_CREATE_BACKUP,
+                           _("Backup file creation failed: %s"), g_strerror (errsv));
+              goto error;
+            }
+          g_free (handle->backup_uri);
+          handle->backup_uri = NULL;
+        }
+    }
+
+  if (handle->file == NULL)
+    {
+      errno = 0;
+      handle->file = smbc_open (backend->smb_context, handle->uri,
+                                O_CREAT|O_WRONLY|
+                                (flags & G_FILE_COPY_OVERWRITE ? O_TRUNC : O_EXCL),
+                                0666);
+      if (handle->file == NULL)
+        {
+          errsv = fixup_open_errno (errno);
+          g_set_error_literal (error, G_IO_ERROR,
+                               g_io_error_from_errno (errsv),
+                               g_strerror (errsv));
+          goto error;
+        }
+    }
+
+  return handle;
+
+ error:
+  smb_write_handle_free (handle);
+  return NULL;
+}
+
+/* Fails with G_IO_ERROR_WOULD_RECURSE for directories, so the client
+ * copies them itself */
+static gboolean
+stat_copy_source (GVfsBackendSmb *backend,
+                  const char *uri,
+                  struct stat *st,
+                  GError **error)
+{
+  smbc_stat_fn smbc_stat;
+  int errsv;
+
+  smbc_stat = smbc_getFunctionStat (backend->smb_context);
+  if (smbc_stat (backend->smb_context, uri, st) == -1)
+    {
+      errsv = errno;
+      g_set_error_literal (error, G_IO_ERROR,
+                           g_io_error_from_errno (errsv),
+                           g_strerror (errsv));
+      return FALSE;
+    }
+
+  if (S_ISDIR (st->st_mode))
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_WOULD_RECURSE,
+                           _("Can't recursively copy directory"));
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+do_copy (GVfsBackend *backend,
+         GVfsJobCopy *job,
+         const char *source,
+         const char *destination,
+         GFileCopyFlags flags,
+         GFileProgressCallback progress_callback,
+         gpointer progress_callback_data)
+{
+  GVfsBackendSmb *op_backend = G_VFS_BACKEND_SMB (backend);
+  SmbWriteHandle *handle = NULL;
+  SMBCFILE *file = NULL;
+  struct stat st;
+  GError *error = NULL;
+  char *uri;
+  int errsv;
+  smbc_open_fn smbc_open;
+  smbc_close_fn smbc_close;
+
+  smbc_open = smbc_getFunctionOpen (op_backend->smb_context);
+  smbc_close = smbc_getFunctionClose (op_backend->smb_context);
+
+  uri = create_smb_uri (op_backend->server, op_backend->share, source);
+  if (!stat_copy_source (op_backend, uri, &st, &error))
+    goto out;
+
+  errno = 0;
+  file = smbc_open (op_backend->smb_context, uri, O_RDONLY, 0);
+  if (file == NULL)
+    {
+      errsv = fixup_open_errno (errno);
+      g_set_error_literal (&error, G_IO_ERROR,
+                           g_io_error_from_errno (errsv),
+                           g_strerror (errsv));
+      goto out;
+    }
+
+  handle = open_copy_destination (op_backend, destination, flags, &error);
+  if (handle == NULL)
+    goto out;
+
+  if (copy_contents (op_backend, G_VFS_JOB (job), file, handle->file,
+                     progress_callback, progress_callback_data))
+    smb_write_handle_finish (op_backend, handle, &error);
+  else
+    {
+      errsv = errno;
+      g_set_error_literal (&error, G_IO_ERROR,
+                           g_io_error_from_errno (errsv),
+                           g_strerror (errsv));
+      smb_write_handle_abort (op_backend, handle);
+    }
+
+ out:
+  if (handle)
+    smb_write_handle_free (handle);
+  if (file)
+    smbc_close (op_backend->smb_context, file);
+  g_free (uri);
+
+  if (error)
+    {
+      g_vfs_job_failed_from_error (G_VFS_JOB (job), error);
+      g_error_free (error);
+    }
+  else
+    g_vfs_job_succeeded (G_VFS_JOB (job));
+}
+
+typedef struct {
+  char *data;
+  gssize size;                  /* bytes in data, 0 at the end, -1 on error */
+} SmbCopyBuffer;
+
+/* Push and pull do the local I/O in a thread of their own, so it overlaps
+ * with the transfer to or from the server. The buffers are passed back
+ * and forth between the two threads. */
+typedef struct {
+  GInputStream *input;          /* file to read for push */
+  GOutputStream *output;        /* file to write for pull */
+  GCancellable *cancellable;
+  GAsyncQueue *empty;           /* buffers to fill */
+  GAsyncQueue *full;            /* buffers to empty */
+  GThread *thread;
+  GError *error;                /* error of the local side */
+  volatile gint failed;         /* set when either side failed */
+} SmbLocalPipe;
+
+static gpointer
+local_pipe_read_thread (gpointer data)
+{
+  SmbLocalPipe *local = data;
+  SmbCopyBuffer *buffer;
+  gsize bytes_read;
+  gssize size;
+
+  do
+    {
+      buffer = g_async_queue_pop (local->empty);
+      if (g_atomic_int_get (&local->failed))
+        size = 0;
+      else if (g_input_stream_read_all (local->input,
+                                        buffer->data,
+                                        SMB_COPY_BUFFER_SIZE,
+                                        &bytes_read,
+                                        local->cancellable,
+                                        &local->error))
+        size = bytes_read;
+      else
+        {
+          g_atomic_int_set (&local->failed, TRUE);
+          size = -1;
+        }
+      buffer->size = size;
+      g_async_queue_push (local->full, buffer);
+    }
+  while (size > 0);
+
+  return NULL;
+}
+
+static gpointer
+local_pipe_write_thread (gpointer data)
+{
+  SmbLocalPipe *local = data;
+  SmbCopyBuffer *buffer;
+  gssize size;
+
+  do
+    {
+      buffer = g_async_queue_pop (local->full);
+      size = buffer->size;
+      if (size > 0 &&
+          !g_atomic_int_get (&local->failed) &&
+          !g_output_stream_write_all (local->output,
+                                      buffer->data,
+                                      size,
+                                      NULL,
+                                      local->cancellable,
+                                      &local->error))
+        g_atomic_int_set (&local->failed, TRUE);
+      g_async_queue_push (local->empty, buffer);
+    }
+  while (size > 0);
+
+  return NULL;
+}
+
+/* Waits for the local side to finish. Its error is reported in @error,
+ * unless that is already set. */
+static void
+local_pipe_free (SmbLocalPipe *local,
+                 GError **error)
+{
+  SmbCopyBuffer *buffer;
+
+  if (local->thread)
+    g_thread_join (local->thread);
+
+  while ((buffer = g_async_queue_try_pop (local->empty)) != NULL ||
+         (buffer = g_async_queue_try_pop (local->full)) != NULL)
+    {
+      g_free (buffer->data);
+      g_slice_free (SmbCopyBuffer, buffer);
+    }
+  g_async_queue_unref (local->empty);
+  g_async_queue_unref (local->full);
+
+  if (local->error)
+    {
+      if (error && *error == NULL)
+        g_propagate_error (error, local->error);
+      else
+        g_error_free (local->error);
+    }
+
+  g_slice_free (SmbLocalPipe, local);
+}
+
+/* Starts reading from @input or writing to @output in a new thread */
+static SmbLocalPipe *
+local_pipe_new (GInputStream *input,
+                GOutputStream *output,
+                GCancellable *cancellable,
+                GError **error)
+{
+  SmbLocalPipe *local;
+  SmbCopyBuffer *buffer;
+  guint i;
+
+  local = g_slice_new0 (SmbLocalPipe);
+  local->input = input;
+  local->output = output;
+  local->cancellable = cancellable;
+  local->empty = g_async_queue_new ();
+  local->full = g_async_queue_new ();
+
+  for (i = 0; i < SMB_COPY_N_BUFFERS; i++)
+    {
+      buffer = g_slice_new0 (SmbCopyBuffer);
+      buffer->data = g_malloc (SMB_COPY_BUFFER_SIZE);
+      g_async_queue_push (local->empty, buffer);
+    }
+
+  local->thread = g_thread_try_new ("smb local io",
+                                    input ? local_pipe_read_thread : local_pipe_write_thread,
+                                    local,
+                                    error);
+  if (local->thread == NULL)
+    {
+      local_pipe_free (local, NULL);
+      return NULL;
+    }
+
+  return local;
+}
+
+static void
+do_push (GVfsBackend *backend,
+         GVfsJobPush *job,
+         const char *destination,
+         const char *local_path,
+         GFileCopyFlags flags,
+         gboolean remove_source,
+         GFileProgressCallback progress_callback,
+         gpointer progress_callback_data)
+{
+  GVfsBackendSmb *op_backend = G_VFS_BACKEND_SMB (backend);
+  GCancellable *cancellable = G_VFS_JOB (job)->cancellable;
+  SmbWriteHandle *handle = NULL;
+  SmbLocalPipe *local;
+  SmbCopyBuffer *buffer;
+  GFileInputStream *input = NULL;
+  GFileInfo *info = NULL;
+  GFile *source;
+  GError *error = NULL;
+  goffset copied = 0;
+  gssize size;
+  int errsv;
+
+  source = g_file_new_for_path (local_path);
+  info = g_file_query_info (source,
+                            G_FILE_ATTRIBUTE_STANDARD_TYPE ","
+                            G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                            G_FILE_QUERY_INFO_NONE,
+                            cancellable,
+                            &error);
+  if (info == NULL)
+    goto out;
+
+  if (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY)
+    {
+      g_set_error_literal (&error, G_IO_ERROR, G_IO_ERROR_WOULD_RECURSE,
+                           _("Can't recursively copy directory"));
+      goto out;
+    }
+
+  input = g_file_read (source, cancellable, &error);
+  if (input == NULL)
+    goto out;
+
+  handle = open_copy_destination (op_backend, destination, flags, &error);
+  if (handle == NULL)
+    goto out;
+
+  local = local_pipe_new (G_INPUT_STREAM (input), NULL, cancellable, &error);
+  if (local == NULL)
+    {
+      smb_write_handle_abort (op_backend, handle);
+      goto out;
+    }
+
+  do
+    {
+      buffer = g_async_queue_pop (local->full);
+      size = buffer->size;
+      if (size > 0 && error == NULL)
+        {
+          if (g_vfs_job_is_cancelled (G_VFS_JOB (job)))
+            g_set_error_literal (&error, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                 _("Operation was cancelled"));
+          else if (!write_all (op_backend, handle->file, buffer->data, size))
+            {
+              errsv = errno;
+              g_set_error_literal (&error, G_IO_ERROR,
+                                   g_io_error_from_errno (errsv),
+                                   g_strerror (errsv));
+            }
+          else
+            {
+              copied += size;
+              if (progress_callback)
+                progress_callback (copied, g_file_info_get_size (info),
+                                   progress_callback_data);
+            }
+
+          if (error)
+            g_atomic_int_set (&local->failed, TRUE);
+        }
+      g_async_queue_push (local->empty, buffer);
+    }
+  while (size > 0);
+  local_pipe_free (local, &error);
+
+  if (error == NULL)
+    smb_write_handle_finish (op_backend, handle, &error);
+  else
+    smb_write_handle_abort (op_backend, handle);
+
+  if (error == NULL && remove_source)
+    g_file_delete (source, cancellable, &error);
+
+ out:
+  if (handle)
+    smb_write_handle_free (handle);
+  if (input)
+    g_object_unref (input);
+  if (info)
+    g_object_unref (info);
+  g_object_unref (source);
+
+  if (error)
+    {
+      g_vfs_job_failed_from_error (G_VFS_JOB (job), error);
+      g_error_free (error);
+    }
+  else
+    g_vfs_job_succeeded (G_VFS_JOB (job));
+}
+
+static void
+do_pull (GVfsBackend *backend,
+         GVfsJobPull *job,
+         const char *source,
+         const char *local_path,
+         GFileCopyFlags flags,
+         gboolean remove_source,
+         GFileProgressCallback progress_callback,
+         gpointer progress_callback_data)
+{
+  GVfsBackendSmb *op_backend = G_VFS_BACKEND_SMB (backend);
+  GCancellable *cancellable = G_VFS_JOB (job)->cancellable;
+  SmbLocalPipe *local;
+  SmbCopyBuffer *buffer;
+  GFileOutputStream *output = NULL;
+  SMBCFILE *file = NULL;
+  GFile *dest = NULL;
+  gboolean dest_existed = FALSE;
+  struct stat st;
+  GError *error = NULL;
+  goffset copied = 0;
+  gssize size;
+  char *uri;
+  int errsv;
+  smbc_open_fn smbc_open;
+  smbc_close_fn smbc_close;
+  smbc_unlink_fn smbc_unlink;
+
+  smbc_open = smbc_getFunctionOpen (op_backend->smb_context);
+  smbc_close = smbc_getFunctionClose (op_backend->smb_context);
+  smbc_unlink = smbc_getFunctionUnlink (op_backend->smb_context);
+
+  uri = create_smb_uri (op_backend->server, op_backend->share, source);
+  if (!stat_copy_source (op_backend, uri, &st, &error))
+    goto out;
+
+  errno = 0;
+  file = smbc_open (op_backend->smb_context, uri, O_RDONLY, 0);
+  if (file == NULL)
+    {
+      errsv = fixup_open_errno (errno);
+      g_set_error_literal (&error, G_IO_ERROR,
+                           g_io_error_from_errno (errsv),
+                           g_strerror (errsv));
+      goto out;
+    }
+
+  dest = g_file_new_for_path (local_path);
+  if (flags & G_FILE_COPY_OVERWRITE)
+    {
+      dest_existed = g_file_query_exists (dest, cancellable);
+      output = g_file_replace (dest,
+                               NULL,
+                               flags & G_FILE_COPY_BACKUP ? TRUE : FALSE,
+                               G_FILE_CREATE_REPLACE_DESTINATION,
+                               cancellable,
+                               &error);
+    }
+  else
+    output = g_file_create (dest, 0, cancellable, &error);
+  if (output == NULL)
+    goto out;
+
+  local = local_pipe_new (NULL, G_OUTPUT_STREAM (output), cancellable, &error);
+  if (local == NULL)
+    goto out;
+
+  do
+    {
+      buffer = g_async_queue_pop (local->empty);
+      if (g_atomic_int_get (&local->failed))
+        size = 0;
+      else if (g_vfs_job_is_cancelled (G_VFS_JOB (job)))
+        {
+          g_set_error_literal (&error, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                               _("Operation was cancelled"));
+          size = -1;
+        }
+      else
+        {
+          size = read_all (op_backend, file, buffer->data, SMB_COPY_BUFFER_SIZE);
+          if (size < 0)
+            {
+              errsv = errno;
+              g_set_error_literal (&error, G_IO_ERROR,
+                                   g_io_error_from_errno (errsv),
+                                   g_strerror (errsv));
+            }
+        }
+      buffer->size = size;
+      g_async_queue_push (local->full, buffer);
+
+      if (size > 0)
+        {
+          copied += size;
+          if (progress_callback)
+            progress_callback (copied, st.st_size, progress_callback_data);
+        }
+    }
+  while (size > 0);
+  local_pipe_free (local, &error);
+
+ out:
+  if (output)
+    {
+      if (error == NULL)
+        g_output_stream_close (G_OUTPUT_STREAM (output), cancellable, &error);
+      else
+        {
+          /* closing with a cancelled cancellable keeps g_file_replace()
+           * from replacing the original file with the partial copy */
+          GCancellable *cancelled = g_cancellable_new ();
+
+          g_cancellable_cancel (cancelled);
+          g_output_stream_close (G_OUTPUT_STREAM (output), cancelled, NULL);
+          g_object_unref (cancelled);
+        }
+      g_object_unref (output);
+
+      /* a file we created ourselves only holds the partial copy, an
+       * existing one is only replaced once the copy is complete */
+      if (error && !dest_existed)
+        g_file_delete (dest, NULL, NULL);
+    }
+  if (dest)
+    g_object_unref (dest);
+  if (file)
+    smbc_close (op_backend->smb_context, file);
+
+  if (error == NULL && remove_source &&
+      smbc_unlink (op_backend->smb_context, uri) == -1)
+    {
+      errsv = errno;
+      g_set_error_literal (&error, G_IO_ERROR,
+                           g_io_error_from_errno (errsv),
+                           g_strerror (errsv));
+    }
+  g_free (uri);
+
+  if (error)
+    {
+      g_vfs_job_failed_from_error (G_VFS_JOB (job), error);
+      g_error_free (error);
+    }
+  else
+    g_vfs_job_succeeded (G_VFS_JOB (job));
+}
+
 static void
 g_vfs_backend_smb_class_init (GVfsBackendSmbClass *klass)
 {
@@ -2177,6 +3150,9 @@ g_vfs_backend_smb_class_init (GVfsBackendSmbClass *klass)
   backend_class->delete = do_delete;
   backend_class->make_directory = do_make_directory;
   backend_class->move = do_move;
+  backend_class->copy = do_copy;
+  backend_class->push = do_push;
+  backend_class->pull = do_pull;
   backend_class->try_query_settable_attributes = try_query_settable_attributes;
   backend_class->set_attribute = do_set_attribute;
 }
@@ -2185,4 +3161,9 @@ void
 g_vfs_smb_daemon_init (void)
 {
   g_set_application_name (_("Windows Shares Filesystem Service"));
+
+#ifdef HAVE_SAMBA_THREAD_POSIX
+  /* enumerating uses contexts in several threads */
+  smbc_thread_posix ();
+#endif
 }
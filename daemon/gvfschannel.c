@@ -28,6 +28,8 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 
 #include <glib.h>
@@ -38,6 +40,7 @@
 #include <gio/gunixoutputstream.h>
 #include <gvfsdaemonprotocol.h>
 #include <gvfsdaemonutils.h>
+#include <gsysutils.h>
 #include <gvfsjobcloseread.h>
 #include <gvfsjobclosewrite.h>
 #include <gvfsfileinfo.h>
@@ -102,6 +105,10 @@ struct _GVfsChannelPrivate
   const char *output_data; /* Owned by job */
   gsize output_data_size;
   gsize output_data_pos;
+
+  /* Shared memory region from SET_SHM */
+  char *shm;
+  gsize shm_size;
 };
 
 static void start_request_reader       (GVfsChannel  *channel);
@@ -141,6 +148,9 @@ g_vfs_channel_finalize (GObject *object)
   if (channel->priv->remote_fd != -1)
     close (channel->priv->remote_fd);
 
+  if (channel->priv->shm)
+    munmap (channel->priv->shm, channel->priv->shm_size);
+
   if (channel->priv->backend)
     g_object_unref (channel->priv->backend);
   
@@ -484,6 +494,110 @@ data_read_cb (GObject *source_object,
 }
   
 
+static void
+setup_shm (GVfsChannel *channel,
+	   int fd,
+	   gsize size)
+{
+  struct stat statbuf;
+  gsize ring_size;
+  void *shm;
+#ifdef G_VFS_SHM_SEALS
+  int seals;
+#endif
+
+  if (channel->priv->shm != NULL ||
+      size <= G_VFS_DAEMON_SOCKET_PROTOCOL_SHM_HEADER_SIZE ||
+      size > G_VFS_DAEMON_SOCKET_PROTOCOL_SHM_MAX_SIZE)
+    return;
+
+  ring_size = size - G_VFS_DAEMON_SOCKET_PROTOCOL_SHM_HEADER_SIZE;
+  if ((ring_size & (ring_size - 1)) != 0)
+    return;
+
+  /* Don't trust the client on the size, or we could get SIGBUS. The
+     seals make sure it can't shrink the file after the check. */
+#ifdef G_VFS_SHM_SEALS
+  seals = fcntl (fd, F_GET_SEALS);
+  if (seals == -1 || (seals & G_VFS_SHM_SEALS) != G_VFS_SHM_SEALS)
+    return;
+#else
+  return;
+#endif
+
+  if (fstat (fd, &statbuf) != 0 ||
+      statbuf.st_size < size)
+    return;
+
+  shm = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (shm == MAP_FAILED)
+    {
+      g_debug ("Failed to map shared memory: %s\n", g_strerror (errno));
+      return;
+    }
+
+  channel->priv->shm = shm;
+  channel->priv->shm_size = size;
+}
+
+static void command_read_cb (GObject *source_object,
+			     GAsyncResult *res,
+			     gpointer user_data);
+static void receive_shm_fd (RequestReader *reader);
+
+static gboolean
+shm_fd_ready_cb (GIOChannel *io,
+		 GIOCondition condition,
+		 gpointer user_data)
+{
+  receive_shm_fd (user_data);
+  return FALSE;
+}
+
+/* The data byte of a SET_SHM request carries the fd, so it has to be
+ * read with recvmsg. That must not block the main loop on a client
+ * that hasn't sent it yet, so wait for the socket to be readable. */
+static void
+receive_shm_fd (RequestReader *reader)
+{
+  GVfsDaemonSocketProtocolRequest *request;
+  GIOChannel *io;
+  gboolean would_block;
+  int socket_fd, fd;
+
+  if (g_cancellable_is_cancelled (reader->cancellable))
+    {
+      g_vfs_channel_connection_closed (reader->channel);
+      request_reader_free (reader);
+      return;
+    }
+
+  socket_fd = g_unix_input_stream_get_fd (G_UNIX_INPUT_STREAM (reader->command_stream));
+  fd = _g_socket_try_receive_fd (socket_fd, &would_block);
+  if (would_block)
+    {
+      io = g_io_channel_unix_new (socket_fd);
+      g_io_add_watch (io, G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+		      shm_fd_ready_cb, reader);
+      g_io_channel_unref (io);
+      return;
+    }
+
+  if (fd != -1)
+    {
+      request = (GVfsDaemonSocketProtocolRequest *)reader->buffer;
+      setup_shm (reader->channel, fd, g_ntohl (request->arg1));
+      close (fd);
+    }
+
+  reader->buffer_size = 0;
+  g_input_stream_read_async (reader->command_stream,
+			     reader->buffer,
+			     G_VFS_DAEMON_SOCKET_PROTOCOL_REQUEST_SIZE,
+			     0, reader->cancellable,
+			     command_read_cb, reader);
+}
+
 static void
 command_read_cb (GObject *source_object,
 		 GAsyncResult *res,
@@ -519,6 +633,13 @@ command_read_cb (GObject *source_object,
   request = (GVfsDaemonSocketProtocolRequest *)reader->buffer;
   data_len  = g_ntohl (request->data_len);
 
+  if (g_ntohl (request->command) == G_VFS_DAEMON_SOCKET_PROTOCOL_REQUEST_SET_SHM &&
+      data_len == 1)
+    {
+      receive_shm_fd (reader);
+      return;
+    }
+
   if (data_len > 0)
     {
       reader->data = g_malloc (data_len);
@@ -719,6 +840,17 @@ g_vfs_channel_steal_remote_fd (GVfsChannel *channel)
   return fd;
 }
 
+/* Returns the shared memory region mapped from a SET_SHM request,
+ * starting with the GVfsDaemonSocketProtocolShmHeader, or %NULL.
+ */
+char *
+g_vfs_channel_get_shm (GVfsChannel *channel,
+		       gsize       *size)
+{
+  *size = channel->priv->shm_size;
+  return channel->priv->shm;
+}
+
 GVfsBackend *
 g_vfs_channel_get_backend (GVfsChannel  *channel)
 {
@@ -83,6 +83,8 @@ void              g_vfs_channel_send_reply         (GVfsChannel
 						    const void                    *data,
 						    gsize                          data_len);
 guint32           g_vfs_channel_get_current_seq_nr (GVfsChannel                   *channel);
+char *            g_vfs_channel_get_shm            (GVfsChannel                   *channel,
+						    gsize                         *size);
 GPid              g_vfs_channel_get_actual_consumer (GVfsChannel                  *channel);
 void              g_vfs_channel_force_close        (GVfsChannel                   *channel);
 /* TODO: i/o priority? */
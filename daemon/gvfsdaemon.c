@@ -40,8 +40,25 @@
 #include <gvfsdaemonprotocol.h>
 #include <gvfsdaemonutils.h>
 #include <gvfsjobmount.h>
+#include <gvfsjobunmount.h>
 #include <gvfsjobopenforread.h>
 #include <gvfsjobopenforwrite.h>
+#include <gvfsjobread.h>
+#include <gvfsjobseekread.h>
+#include <gvfsjobcloseread.h>
+#include <gvfsjobqueryinforead.h>
+#include <gvfsjobwrite.h>
+#include <gvfsjobseekwrite.h>
+#include <gvfsjobclosewrite.h>
+#include <gvfsjobqueryinfowrite.h>
+#include <gvfsjobqueryinfo.h>
+#include <gvfsjobqueryfsinfo.h>
+#include <gvfsjobenumerate.h>
+#include <gvfsjobcopy.h>
+#include <gvfsjobmove.h>
+#include <gvfsjobpush.h>
+#include <gvfsjobpull.h>
+#include <gvfschannel.h>
 #include <gvfsdbusutils.h>
 
 enum {
@@ -54,6 +71,37 @@ typedef struct {
   gpointer data;
 } RegisteredPath;
 
+/* Jobs that a user is typically waiting on (query_info, read) are kept
+ * apart from long running ones (enumerate, copy) so that the latter
+ * can't starve the former of worker threads. */
+typedef enum {
+  JOB_QUEUE_INTERACTIVE,
+  JOB_QUEUE_BULK,
+  N_JOB_QUEUES
+} JobQueue;
+
+typedef struct {
+  GVfsJob *job;
+  GVfsBackend *backend; /* Not owned, kept alive by the job */
+  GVfsBackendConcurrentOps op;
+  JobQueue queue;
+  gint64 queued_time;
+} QueuedJob;
+
+typedef struct {
+  guint running;
+  gboolean exclusive;
+  guint exclusive_waiting;
+} BackendLoad;
+
+typedef struct {
+  guint queued;
+  guint max_queued;
+  guint64 n_run;
+  gint64 total_wait;
+  gint64 max_wait;
+} JobStats;
+
 struct _GVfsDaemon
 {
   GObject parent_instance;
@@ -61,7 +109,19 @@ struct _GVfsDaemon
   GMutex lock;
   gboolean main_daemon;
 
-  GThreadPool *thread_pool;
+  /* Job scheduler, protected by sched_lock */
+  GMutex sched_lock;
+  GCond sched_cond;
+  GQueue job_queues[N_JOB_QUEUES];
+  GHashTable *backend_load;
+  GHashTable *job_stats;
+  gint base_max_threads;
+  gint max_threads;
+  gint n_threads;
+  gint n_idle_threads;
+  gint n_bulk_running;
+  gboolean job_stats_dirty;
+
   DBusConnection *session_bus;
   GHashTable *registered_paths;
   GList *jobs;
@@ -119,7 +179,11 @@ g_vfs_daemon_finalize (GObject *object)
   g_assert (daemon->jobs == NULL);
 
   g_hash_table_destroy (daemon->registered_paths);
+  g_hash_table_destroy (daemon->backend_load);
+  g_hash_table_destroy (daemon->job_stats);
   g_mutex_clear (&daemon->lock);
+  g_mutex_clear (&daemon->sched_lock);
+  g_cond_clear (&daemon->sched_cond);
 
   if (G_OBJECT_CLASS (g_vfs_daemon_parent_class)->finalize)
     (*G_OBJECT_CLASS (g_vfs_daemon_parent_class)->finalize) (object);
@@ -135,28 +199,24 @@ g_vfs_daemon_class_init (GVfsDaemonClass *klass)
   gobject_class->get_property = g_vfs_daemon_get_property;
 }
 
-static void
-job_handler_callback (gpointer       data,
-		      gpointer       user_data)
-{
-  GVfsJob *job = G_VFS_JOB (data);
-
-  g_vfs_job_run (job);
-}
-
 static void
 g_vfs_daemon_init (GVfsDaemon *daemon)
 {
-  gint max_threads = 1; /* TODO: handle max threads */
   DBusError error;
+  int i;
   
   daemon->session_bus = dbus_bus_get (DBUS_BUS_SESSION, NULL);
-  daemon->thread_pool = g_thread_pool_new (job_handler_callback,
-					   daemon,
-					   max_threads,
-					   FALSE, NULL);
-  /* TODO: verify thread_pool != NULL in a nicer way */
-  g_assert (daemon->thread_pool != NULL);
+
+  g_mutex_init (&daemon->sched_lock);
+  g_cond_init (&daemon->sched_cond);
+  for (i = 0; i < N_JOB_QUEUES; i++)
+    g_queue_init (&daemon->job_queues[i]);
+  daemon->backend_load = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+						NULL, g_free);
+  daemon->job_stats = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+					     NULL, g_free);
+  daemon->base_max_threads = 1;
+  daemon->max_threads = 1;
 
   g_mutex_init (&daemon->lock);
 
@@ -284,11 +344,20 @@ g_vfs_daemon_new (gboolean main_daemon, gboolean replace)
   return daemon;
 }
 
+/* Sets the default number of jobs run in parallel. Backends can raise
+ * their own limit with g_vfs_backend_set_max_concurrent_jobs(), the
+ * worker pool grows to match. A negative value means no limit. */
 void
 g_vfs_daemon_set_max_threads (GVfsDaemon                    *daemon,
 			      gint                           max_threads)
 {
-  g_thread_pool_set_max_threads (daemon->thread_pool, max_threads, NULL);
+  if (max_threads < 0)
+    max_threads = G_MAXINT;
+  
+  g_mutex_lock (&daemon->sched_lock);
+  daemon->base_max_threads = MAX (max_threads, 1);
+  daemon->max_threads = daemon->base_max_threads;
+  g_mutex_unlock (&daemon->sched_lock);
 }
 
 static gboolean
@@ -315,12 +384,17 @@ daemon_schedule_exit (GVfsDaemon *daemon)
     daemon->exit_tag = g_timeout_add_seconds (1, exit_at_idle, daemon);
 }
 
+static void         daemon_queue_job       (GVfsDaemon    *daemon,
+					    GVfsJob       *job,
+					    GVfsBackend   *backend);
+static GVfsBackend *job_source_get_backend (GVfsJobSource *job_source);
+
 static void
 job_source_new_job_callback (GVfsJobSource *job_source,
 			     GVfsJob *job,
 			     GVfsDaemon *daemon)
 {
-  g_vfs_daemon_queue_job (daemon, job);
+  daemon_queue_job (daemon, job, job_source_get_backend (job_source));
 }
 
 static void
@@ -445,9 +519,406 @@ job_finished_callback (GVfsJob *job,
   g_object_unref (job);
 }
 
+/*** Job scheduler ***/
+
+static GVfsBackendConcurrentOps
+job_get_concurrent_op (GVfsJob *job)
+{
+  if (G_VFS_IS_JOB_READ (job) ||
+      G_VFS_IS_JOB_SEEK_READ (job) ||
+      G_VFS_IS_JOB_CLOSE_READ (job) ||
+      G_VFS_IS_JOB_OPEN_FOR_READ (job))
+    return G_VFS_BACKEND_CONCURRENT_READ;
+  if (G_VFS_IS_JOB_WRITE (job) ||
+      G_VFS_IS_JOB_SEEK_WRITE (job) ||
+      G_VFS_IS_JOB_CLOSE_WRITE (job))
+    return G_VFS_BACKEND_CONCURRENT_WRITE;
+  if (G_VFS_IS_JOB_QUERY_INFO (job) ||
+      G_VFS_IS_JOB_QUERY_FS_INFO (job) ||
+      G_VFS_IS_JOB_QUERY_INFO_READ (job) ||
+      G_VFS_IS_JOB_QUERY_INFO_WRITE (job))
+    return G_VFS_BACKEND_CONCURRENT_QUERY_INFO;
+  if (G_VFS_IS_JOB_ENUMERATE (job))
+    return G_VFS_BACKEND_CONCURRENT_ENUMERATE;
+  if (G_VFS_IS_JOB_COPY (job) ||
+      G_VFS_IS_JOB_MOVE (job) ||
+      G_VFS_IS_JOB_PUSH (job) ||
+      G_VFS_IS_JOB_PULL (job))
+    return G_VFS_BACKEND_CONCURRENT_TRANSFER;
+  if (G_VFS_IS_JOB_MOUNT (job) ||
+      G_VFS_IS_JOB_UNMOUNT (job))
+    return G_VFS_BACKEND_CONCURRENT_NONE;
+
+  return G_VFS_BACKEND_CONCURRENT_OTHER;
+}
+
+static JobQueue
+job_op_get_queue (GVfsBackendConcurrentOps op)
+{
+  if (op == G_VFS_BACKEND_CONCURRENT_ENUMERATE ||
+      op == G_VFS_BACKEND_CONCURRENT_TRANSFER)
+    return JOB_QUEUE_BULK;
+
+  return JOB_QUEUE_INTERACTIVE;
+}
+
+/* Called with sched_lock held */
+static BackendLoad *
+daemon_get_backend_load (GVfsDaemon *daemon,
+			 GVfsBackend *backend)
+{
+  BackendLoad *load;
+
+  load = g_hash_table_lookup (daemon->backend_load, backend);
+  if (load == NULL)
+    {
+      load = g_new0 (BackendLoad, 1);
+      g_hash_table_insert (daemon->backend_load, backend, load);
+    }
+
+  return load;
+}
+
+/* Called with sched_lock held */
+static JobStats *
+daemon_get_job_stats (GVfsDaemon *daemon,
+		      GVfsJob *job)
+{
+  JobStats *stats;
+  GType type;
+
+  type = G_TYPE_FROM_INSTANCE (job);
+  stats = g_hash_table_lookup (daemon->job_stats, (gpointer)type);
+  if (stats == NULL)
+    {
+      stats = g_new0 (JobStats, 1);
+      g_hash_table_insert (daemon->job_stats, (gpointer)type, stats);
+    }
+
+  return stats;
+}
+
+static gboolean
+queued_job_is_concurrent (QueuedJob *qjob)
+{
+  return qjob->op != G_VFS_BACKEND_CONCURRENT_NONE &&
+    (g_vfs_backend_get_concurrent_ops (qjob->backend) & qjob->op) != 0;
+}
+
+/* Called with sched_lock held */
+static gboolean
+daemon_can_run_job (GVfsDaemon *daemon,
+		    QueuedJob *qjob)
+{
+  BackendLoad *load;
+  guint max_jobs;
+
+  if (qjob->backend == NULL)
+    return TRUE;
+
+  load = daemon_get_backend_load (daemon, qjob->backend);
+
+  if (!queued_job_is_concurrent (qjob))
+    return load->running == 0;
+
+  max_jobs = g_vfs_backend_get_max_concurrent_jobs (qjob->backend);
+  if (max_jobs == 0)
+    max_jobs = daemon->base_max_threads;
+
+  /* Don't starve jobs that need the backend for themselves */
+  return !load->exclusive &&
+    load->exclusive_waiting == 0 &&
+    load->running < max_jobs;
+}
+
+/* Called with sched_lock held. Picks the first job that may run now,
+ * preferring interactive jobs. Bulk jobs never take the last thread
+ * so there is always room for an interactive one. */
+static QueuedJob *
+daemon_pick_job (GVfsDaemon *daemon)
+{
+  GList *l;
+  int i;
+
+  for (i = 0; i < N_JOB_QUEUES; i++)
+    {
+      if (i == JOB_QUEUE_BULK &&
+	  daemon->max_threads > 1 &&
+	  daemon->n_bulk_running >= daemon->max_threads - 1)
+	break;
+
+      for (l = daemon->job_queues[i].head; l != NULL; l = l->next)
+	{
+	  QueuedJob *qjob = l->data;
+
+	  if (daemon_can_run_job (daemon, qjob))
+	    {
+	      g_queue_delete_link (&daemon->job_queues[i], l);
+	      return qjob;
+	    }
+	}
+    }
+
+  return NULL;
+}
+
+/* Called with sched_lock held */
+static void
+daemon_start_job (GVfsDaemon *daemon,
+		  QueuedJob *qjob)
+{
+  JobStats *stats;
+  gint64 wait;
+
+  if (qjob->backend)
+    {
+      BackendLoad *load = daemon_get_backend_load (daemon, qjob->backend);
+
+      load->running++;
+      if (!queued_job_is_concurrent (qjob))
+	{
+	  load->exclusive = TRUE;
+	  load->exclusive_waiting--;
+	}
+    }
+
+  if (qjob->queue == JOB_QUEUE_BULK)
+    daemon->n_bulk_running++;
+
+  wait = g_get_monotonic_time () - qjob->queued_time;
+  stats = daemon_get_job_stats (daemon, qjob->job);
+  stats->queued--;
+  stats->n_run++;
+  stats->total_wait += wait;
+  stats->max_wait = MAX (stats->max_wait, wait);
+  daemon->job_stats_dirty = TRUE;
+
+  g_debug ("Running job %p (%s) after %" G_GINT64_FORMAT " us in queue, %u still queued\n",
+	   qjob->job, g_type_name_from_instance ((gpointer)qjob->job),
+	   wait, stats->queued);
+}
+
+/* Called with sched_lock held */
+static void
+daemon_finish_job (GVfsDaemon *daemon,
+		   QueuedJob *qjob)
+{
+  if (qjob->backend)
+    {
+      BackendLoad *load = daemon_get_backend_load (daemon, qjob->backend);
+
+      load->running--;
+      if (!queued_job_is_concurrent (qjob))
+	load->exclusive = FALSE;
+
+      if (load->running == 0 && load->exclusive_waiting == 0)
+	g_hash_table_remove (daemon->backend_load, qjob->backend);
+    }
+
+  if (qjob->queue == JOB_QUEUE_BULK)
+    daemon->n_bulk_running--;
+}
+
+static void
+log_job_stats (gpointer key,
+	       gpointer value,
+	       gpointer user_data)
+{
+  JobStats *stats = value;
+
+  g_debug ("  %s: %u queued (max %u), %" G_GUINT64_FORMAT " run, "
+	   "wait avg %" G_GINT64_FORMAT " us, max %" G_GINT64_FORMAT " us\n",
+	   g_type_name ((GType)key),
+	   stats->queued, stats->max_queued, stats->n_run,
+	   stats->n_run > 0 ? stats->total_wait / (gint64)stats->n_run : 0,
+	   stats->max_wait);
+}
+
+/* Called with sched_lock held */
+static void
+daemon_log_job_stats (GVfsDaemon *daemon)
+{
+  g_debug ("Job scheduler: %d threads (%d idle, max %d), %u interactive and %u bulk jobs queued\n",
+	   daemon->n_threads, daemon->n_idle_threads, daemon->max_threads,
+	   g_queue_get_length (&daemon->job_queues[JOB_QUEUE_INTERACTIVE]),
+	   g_queue_get_length (&daemon->job_queues[JOB_QUEUE_BULK]));
+  g_hash_table_foreach (daemon->job_stats, log_job_stats, NULL);
+  daemon->job_stats_dirty = FALSE;
+}
+
+/**
+ * g_vfs_daemon_get_job_stats:
+ * @daemon: A #GVfsDaemon.
+ *
+ * Gets the scheduler statistics for each job type that has been
+ * scheduled so far: how many are queued, how many ran and how long
+ * they waited for a worker thread.
+ *
+ * Returns: An array of #GVfsDaemonJobStats. Free with g_array_unref().
+ */
+GArray *
+g_vfs_daemon_get_job_stats (GVfsDaemon *daemon)
+{
+  GArray *array;
+  GHashTableIter iter;
+  gpointer key, value;
+
+  array = g_array_new (FALSE, FALSE, sizeof (GVfsDaemonJobStats));
+
+  g_mutex_lock (&daemon->sched_lock);
+  g_hash_table_iter_init (&iter, daemon->job_stats);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      JobStats *stats = value;
+      GVfsDaemonJobStats entry;
+
+      entry.job_type = (GType)key;
+      entry.queued = stats->queued;
+      entry.max_queued = stats->max_queued;
+      entry.n_run = stats->n_run;
+      entry.total_wait = stats->total_wait;
+      entry.max_wait = stats->max_wait;
+      g_array_append_val (array, entry);
+    }
+  g_mutex_unlock (&daemon->sched_lock);
+
+  return array;
+}
+
+/**
+ * g_vfs_daemon_dump_job_stats:
+ * @daemon: A #GVfsDaemon.
+ *
+ * Logs the queue depth and time spent waiting for a worker thread
+ * for each job type that has been scheduled so far. This is also
+ * done automatically whenever the daemon runs out of work.
+ */
 void
-g_vfs_daemon_queue_job (GVfsDaemon *daemon,
-			GVfsJob *job)
+g_vfs_daemon_dump_job_stats (GVfsDaemon *daemon)
+{
+  g_mutex_lock (&daemon->sched_lock);
+  daemon_log_job_stats (daemon);
+  g_mutex_unlock (&daemon->sched_lock);
+}
+
+static gpointer
+job_worker_thread (gpointer data)
+{
+  GVfsDaemon *daemon = data;
+  QueuedJob *qjob;
+  GVfsJob *job;
+
+  g_mutex_lock (&daemon->sched_lock);
+  while (TRUE)
+    {
+      qjob = daemon_pick_job (daemon);
+      if (qjob == NULL)
+	{
+	  if (daemon->job_stats_dirty &&
+	      daemon->n_idle_threads + 1 == daemon->n_threads)
+	    daemon_log_job_stats (daemon);
+
+	  daemon->n_idle_threads++;
+	  g_cond_wait (&daemon->sched_cond, &daemon->sched_lock);
+	  daemon->n_idle_threads--;
+	  continue;
+	}
+
+      daemon_start_job (daemon, qjob);
+      g_mutex_unlock (&daemon->sched_lock);
+
+      g_vfs_job_run (qjob->job);
+
+      g_mutex_lock (&daemon->sched_lock);
+      daemon_finish_job (daemon, qjob);
+      job = qjob->job;
+      g_slice_free (QueuedJob, qjob);
+
+      /* Finishing a job may unblock others for the same backend */
+      g_cond_broadcast (&daemon->sched_cond);
+
+      /* The last reference may run arbitrary finalizers */
+      g_mutex_unlock (&daemon->sched_lock);
+      g_object_unref (job);
+      g_mutex_lock (&daemon->sched_lock);
+    }
+
+  return NULL;
+}
+
+static void
+daemon_schedule_job (GVfsDaemon *daemon,
+		     GVfsJob *job,
+		     GVfsBackend *backend)
+{
+  QueuedJob *qjob;
+  JobStats *stats;
+  GThread *thread;
+  GError *error;
+
+  qjob = g_slice_new0 (QueuedJob);
+  qjob->job = g_object_ref (job);
+  qjob->backend = backend;
+  qjob->op = job_get_concurrent_op (job);
+  qjob->queue = job_op_get_queue (qjob->op);
+  qjob->queued_time = g_get_monotonic_time ();
+
+  g_mutex_lock (&daemon->sched_lock);
+
+  if (backend)
+    {
+      guint max_jobs = g_vfs_backend_get_max_concurrent_jobs (backend);
+
+      /* Size the pool so the backend can actually use its limit, plus
+       * one thread kept free for interactive jobs */
+      if (max_jobs > 0 && (gint)max_jobs >= daemon->max_threads)
+	daemon->max_threads = max_jobs + 1;
+
+      if (!queued_job_is_concurrent (qjob))
+	daemon_get_backend_load (daemon, backend)->exclusive_waiting++;
+    }
+
+  stats = daemon_get_job_stats (daemon, job);
+  stats->queued++;
+  stats->max_queued = MAX (stats->max_queued, stats->queued);
+
+  g_queue_push_tail (&daemon->job_queues[qjob->queue], qjob);
+
+  if (daemon->n_idle_threads == 0 &&
+      daemon->n_threads < daemon->max_threads)
+    {
+      error = NULL;
+      thread = g_thread_try_new ("gvfs job", job_worker_thread, daemon, &error);
+      if (thread == NULL)
+	{
+	  g_warning ("Failed to start job thread: %s", error->message);
+	  g_error_free (error);
+	}
+      else
+	{
+	  daemon->n_threads++;
+	  g_thread_unref (thread);
+	}
+    }
+
+  g_cond_broadcast (&daemon->sched_cond);
+  g_mutex_unlock (&daemon->sched_lock);
+}
+
+static GVfsBackend *
+job_source_get_backend (GVfsJobSource *job_source)
+{
+  if (G_VFS_IS_BACKEND (job_source))
+    return G_VFS_BACKEND (job_source);
+  if (G_VFS_IS_CHANNEL (job_source))
+    return g_vfs_channel_get_backend (G_VFS_CHANNEL (job_source));
+  return NULL;
+}
+
+static void
+daemon_queue_job (GVfsDaemon *daemon,
+		  GVfsJob *job,
+		  GVfsBackend *backend)
 {
   g_debug ("Queued new job %p (%s)\n", job, g_type_name_from_instance ((gpointer)job));
   
@@ -463,10 +934,17 @@ g_vfs_daemon_queue_job (GVfsDaemon *daemon,
   if (!g_vfs_job_try (job))
     {
       /* Couldn't finish / run async, queue worker thread */
-      g_thread_pool_push (daemon->thread_pool, job, NULL); /* TODO: Check error */
+      daemon_schedule_job (daemon, job, backend);
     }
 }
 
+void
+g_vfs_daemon_queue_job (GVfsDaemon *daemon,
+			GVfsJob *job)
+{
+  daemon_queue_job (daemon, job, NULL);
+}
+
 static void
 new_connection_data_free (void *memory)
 {
@@ -751,6 +1229,69 @@ accept_new_fd_client (GIOChannel  *channel,
   return FALSE;
 }
 
+/* Replies with an array of (job type, queued, max queued, run,
+ * total wait us, max wait us) */
+static void
+daemon_handle_get_job_stats (DBusConnection *conn,
+			     DBusMessage *message,
+			     GVfsDaemon *daemon)
+{
+  DBusMessage *reply;
+  DBusMessageIter iter, array_iter, struct_iter;
+  GArray *stats;
+  guint i;
+
+  reply = dbus_message_new_method_return (message);
+  if (reply == NULL)
+    _g_dbus_oom ();
+
+  dbus_message_iter_init_append (reply, &iter);
+  if (!dbus_message_iter_open_container (&iter,
+					 DBUS_TYPE_ARRAY,
+					 DBUS_STRUCT_BEGIN_CHAR_AS_STRING
+					 DBUS_TYPE_STRING_AS_STRING
+					 DBUS_TYPE_UINT32_AS_STRING
+					 DBUS_TYPE_UINT32_AS_STRING
+					 DBUS_TYPE_UINT64_AS_STRING
+					 DBUS_TYPE_INT64_AS_STRING
+					 DBUS_TYPE_INT64_AS_STRING
+					 DBUS_STRUCT_END_CHAR_AS_STRING,
+					 &array_iter))
+    _g_dbus_oom ();
+
+  stats = g_vfs_daemon_get_job_stats (daemon);
+  for (i = 0; i < stats->len; i++)
+    {
+      GVfsDaemonJobStats *entry = &g_array_index (stats, GVfsDaemonJobStats, i);
+      const char *type_name = g_type_name (entry->job_type);
+      dbus_uint32_t queued = entry->queued;
+      dbus_uint32_t max_queued = entry->max_queued;
+      dbus_uint64_t n_run = entry->n_run;
+      dbus_int64_t total_wait = entry->total_wait;
+      dbus_int64_t max_wait = entry->max_wait;
+
+      if (!dbus_message_iter_open_container (&array_iter,
+					     DBUS_TYPE_STRUCT,
+					     NULL,
+					     &struct_iter) ||
+	  !dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_STRING, &type_name) ||
+	  !dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_UINT32, &queued) ||
+	  !dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_UINT32, &max_queued) ||
+	  !dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_UINT64, &n_run) ||
+	  !dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_INT64, &total_wait) ||
+	  !dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_INT64, &max_wait) ||
+	  !dbus_message_iter_close_container (&array_iter, &struct_iter))
+	_g_dbus_oom ();
+    }
+  g_array_unref (stats);
+
+  if (!dbus_message_iter_close_container (&iter, &array_iter))
+    _g_dbus_oom ();
+
+  dbus_connection_send (conn, reply, NULL);
+  dbus_message_unref (reply);
+}
+
 static void
 daemon_handle_get_connection (DBusConnection *conn,
 			      DBusMessage *message,
@@ -938,6 +1479,14 @@ daemon_message_func (DBusConnection *conn,
       return DBUS_HANDLER_RESULT_HANDLED;
     }
 
+  if (dbus_message_is_method_call (message,
+				   G_VFS_DBUS_DAEMON_INTERFACE,
+				   G_VFS_DBUS_OP_GET_JOB_STATS))
+    {
+      daemon_handle_get_job_stats (conn, message, daemon);
+      return DBUS_HANDLER_RESULT_HANDLED;
+    }
+
   if (dbus_message_is_method_call (message,
 				   G_VFS_DBUS_DAEMON_INTERFACE,
 				   G_VFS_DBUS_OP_CANCEL))
@@ -1081,7 +1630,7 @@ g_vfs_daemon_initiate_mount (GVfsDaemon *daemon,
   g_object_unref (backend);
 
   job = g_vfs_job_mount_new (mount_spec, mount_source, is_automount, request, backend);
-  g_vfs_daemon_queue_job (daemon, job);
+  daemon_queue_job (daemon, job, backend);
   g_object_unref (job);
 }
 
@@ -1118,7 +1667,13 @@ void
 g_vfs_daemon_run_job_in_thread (GVfsDaemon *daemon,
 				GVfsJob    *job)
 {
-  g_thread_pool_push (daemon->thread_pool, job, NULL); /* TODO: Check error */
+  GVfsBackend *backend = NULL;
+
+  /* Unmount must wait for the jobs still running in the backend */
+  if (G_VFS_IS_JOB_UNMOUNT (job))
+    backend = G_VFS_JOB_UNMOUNT (job)->backend;
+
+  daemon_schedule_job (daemon, job, backend);
 }
 
 void
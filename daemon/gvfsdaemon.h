@@ -41,6 +41,15 @@ typedef struct _GVfsDaemon        GVfsDaemon;
 typedef struct _GVfsDaemonClass   GVfsDaemonClass;
 typedef struct _GVfsDaemonPrivate GVfsDaemonPrivate;
 
+typedef struct {
+  GType job_type;
+  guint queued;
+  guint max_queued;
+  guint64 n_run;
+  gint64 total_wait; /* in microseconds */
+  gint64 max_wait;
+} GVfsDaemonJobStats;
+
 struct _GVfsDaemonClass
 {
   GObjectClass parent_class;
@@ -74,6 +83,8 @@ GArray     *g_vfs_daemon_get_blocking_processes (GVfsDaemon             *daemon)
 void        g_vfs_daemon_run_job_in_thread      (GVfsDaemon             *daemon,
 						 GVfsJob                *job);
 void       g_vfs_daemon_close_active_channels (GVfsDaemon                *daemon);
+GArray     *g_vfs_daemon_get_job_stats          (GVfsDaemon             *daemon);
+void        g_vfs_daemon_dump_job_stats         (GVfsDaemon             *daemon);
 
 G_END_DECLS
 
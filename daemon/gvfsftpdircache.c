@@ -21,6 +21,8 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 
 #include <config.h>
@@ -29,26 +31,50 @@
 
 #include "gvfsftpdircache.h"
 
+/* Directory listings are kept for DIR_CACHE_TTL and used as they are
+ * during that time. After that they are stale: lookups still get the
+ * old listing, but it is refetched in the background if a connection is
+ * idle. Listings older than DIR_CACHE_MAX_AGE are refetched right away.
+ * When the listings take more than DIR_CACHE_MAX_SIZE of memory, the
+ * least recently used ones are dropped.
+ *
+ * Changes done through the backend purge the affected directories.
+ * Listings that were requested before a purge could still carry the old
+ * state, so they are not stored if anything was purged meanwhile. */
+
+#define DIR_CACHE_TTL           (30 * G_USEC_PER_SEC)
+#define DIR_CACHE_MAX_AGE       (5 * 60 * G_USEC_PER_SEC)
+#define DIR_CACHE_MAX_SIZE      (8 * 1024 * 1024)
+/* rough memory use of a GFileInfo, only used to approximate sizes */
+#define DIR_CACHE_INFO_SIZE     512
+
 /*** CACHE ENTRY ***/
 
 struct _GVfsFtpDirCacheEntry
 {
+  GVfsFtpFile *         dir;            /* directory this is the listing of */
   GHashTable *          files;          /* GVfsFtpFile => GFileInfo mapping */
-  guint                 stamp;          /* cache's stamp when this entry was created */
+  gint64                time;           /* monotonic time when the listing was requested */
+  gsize                 size;           /* approximate memory use */
+  GList                 link;           /* in the cache's LRU queue */
+  gboolean              refreshing;     /* a background refresh is running */
   volatile int          refcount;       /* need to refount this struct for thread safety */
 };
 
 static GVfsFtpDirCacheEntry *
-g_vfs_ftp_dir_cache_entry_new (guint stamp)
+g_vfs_ftp_dir_cache_entry_new (const GVfsFtpFile *dir)
 {
   GVfsFtpDirCacheEntry *entry;
 
   entry = g_slice_new0 (GVfsFtpDirCacheEntry);
+  entry->dir = g_vfs_ftp_file_copy (dir);
   entry->files = g_hash_table_new_full (g_vfs_ftp_file_hash,
                                         g_vfs_ftp_file_equal,
                                         (GDestroyNotify) g_vfs_ftp_file_free,
                                         g_object_unref);
-  entry->stamp = stamp;
+  entry->time = g_get_monotonic_time ();
+  entry->size = sizeof (GVfsFtpDirCacheEntry);
+  entry->link.data = entry;
   entry->refcount = 1;
 
   return entry;
@@ -69,6 +95,7 @@ g_vfs_ftp_dir_cache_entry_unref (GVfsFtpDirCacheEntry *entry)
     return;
 
   g_hash_table_destroy (entry->files);
+  g_vfs_ftp_file_free (entry->dir);
   g_slice_free (GVfsFtpDirCacheEntry, entry);
 }
 
@@ -89,6 +116,9 @@ g_vfs_ftp_dir_cache_entry_add (GVfsFtpDirCacheEntry *entry, GVfsFtpFile *file, G
   g_return_if_fail (file != NULL);
   g_return_if_fail (G_IS_FILE_INFO (info));
 
+  entry->size += DIR_CACHE_INFO_SIZE +
+                 strlen (g_vfs_ftp_file_get_gvfs_path (file)) +
+                 strlen (g_vfs_ftp_file_get_ftp_path (file));
   g_hash_table_insert (entry->files, file, info);
 }
 
@@ -97,11 +127,31 @@ g_vfs_ftp_dir_cache_entry_add (GVfsFtpDirCacheEntry *entry, GVfsFtpFile *file, G
 struct _GVfsFtpDirCache
 {
   GHashTable *          directories;    /* GVfsFtpFile of directory => GVfsFtpDirCacheEntry mapping */
-  guint                 stamp;          /* used to identify validity of cache when flushing */
-  GMutex                lock;           /* mutex for thread safety of stamp and hash table */
+  GQueue                lru;            /* entries, most recently used first */
+  gsize                 size;           /* approximate memory use of all entries */
+  guint                 generation;     /* incremented on every purge */
+  GMutex                lock;           /* mutex for thread safety of everything here */
   const GVfsFtpDirFuncs *funcs;         /* functions to call */
+
+  /* statistics for debugging */
+  guint                 hits;
+  guint                 stale_hits;
+  guint                 misses;
+  guint                 refreshes;
+  guint                 evictions;
 };
 
+/* must be called with the lock held */
+static void
+g_vfs_ftp_dir_cache_debug_stats (GVfsFtpDirCache *cache)
+{
+  g_debug ("# dir cache: %u dirs, %"G_GSIZE_FORMAT" bytes, "
+           "%u hits, %u stale hits, %u misses, %u refreshes, %u evictions\n",
+           g_hash_table_size (cache->directories), cache->size,
+           cache->hits, cache->stale_hits, cache->misses,
+           cache->refreshes, cache->evictions);
+}
+
 GVfsFtpDirCache *
 g_vfs_ftp_dir_cache_new (const GVfsFtpDirFuncs *funcs)
 {
@@ -114,6 +164,7 @@ g_vfs_ftp_dir_cache_new (const GVfsFtpDirFuncs *funcs)
                                               g_vfs_ftp_file_equal,
                                               (GDestroyNotify) g_vfs_ftp_file_free,
                                               (GDestroyNotify) g_vfs_ftp_dir_cache_entry_unref);
+  g_queue_init (&cache->lru);
   g_mutex_init (&cache->lock);
   cache->funcs = funcs;
 
@@ -125,28 +176,68 @@ g_vfs_ftp_dir_cache_free (GVfsFtpDirCache *cache)
 {
   g_return_if_fail (cache != NULL);
 
+  g_vfs_ftp_dir_cache_debug_stats (cache);
+
   g_hash_table_destroy (cache->directories);
   g_mutex_clear (&cache->lock);
   g_slice_free (GVfsFtpDirCache, cache);
 }
 
-static GVfsFtpDirCacheEntry *
-g_vfs_ftp_dir_cache_lookup_entry (GVfsFtpDirCache *  cache,
-                                  GVfsFtpTask *      task,
-                                  const GVfsFtpFile *dir,
-                                  guint              stamp)
+/* must be called with the lock held */
+static void
+g_vfs_ftp_dir_cache_remove (GVfsFtpDirCache *     cache,
+                            GVfsFtpDirCacheEntry *entry)
 {
-  GVfsFtpDirCacheEntry *entry;
+  g_queue_unlink (&cache->lru, &entry->link);
+  cache->size -= entry->size;
+  g_hash_table_remove (cache->directories, entry->dir);
+}
+
+/* Stores @entry unless something was purged after @generation was taken.
+ * If @replace is set, @entry must replace it and nothing else. */
+static void
+g_vfs_ftp_dir_cache_insert (GVfsFtpDirCache *     cache,
+                            GVfsFtpDirCacheEntry *entry,
+                            guint                 generation,
+                            GVfsFtpDirCacheEntry *replace)
+{
+  GVfsFtpDirCacheEntry *old;
 
   g_mutex_lock (&cache->lock);
-  entry = g_hash_table_lookup (cache->directories, dir);
-  if (entry)
-    g_vfs_ftp_dir_cache_entry_ref (entry);
+
+  old = g_hash_table_lookup (cache->directories, entry->dir);
+  if (generation != cache->generation ||
+      (replace != NULL && old != replace))
+    {
+      g_mutex_unlock (&cache->lock);
+      return;
+    }
+
+  if (old)
+    g_vfs_ftp_dir_cache_remove (cache, old);
+
+  g_hash_table_insert (cache->directories,
+                       g_vfs_ftp_file_copy (entry->dir),
+                       g_vfs_ftp_dir_cache_entry_ref (entry));
+  g_queue_push_head_link (&cache->lru, &entry->link);
+  cache->size += entry->size;
+
+  while (cache->size > DIR_CACHE_MAX_SIZE && cache->lru.length > 1)
+    {
+      g_vfs_ftp_dir_cache_remove (cache, g_queue_peek_tail (&cache->lru));
+      cache->evictions++;
+      g_vfs_ftp_dir_cache_debug_stats (cache);
+    }
+
   g_mutex_unlock (&cache->lock);
-  if (entry && entry->stamp < stamp)
-    g_vfs_ftp_dir_cache_entry_unref (entry);
-  else if (entry)
-    return entry;
+}
+
+static GVfsFtpDirCacheEntry *
+g_vfs_ftp_dir_cache_fetch (GVfsFtpDirCache *  cache,
+                           GVfsFtpTask *      task,
+                           const GVfsFtpFile *dir)
+{
+  GVfsFtpDirCacheEntry *entry;
 
   if (g_vfs_ftp_task_send (task,
         	           G_VFS_FTP_PASS_550,
@@ -164,7 +255,7 @@ g_vfs_ftp_dir_cache_lookup_entry (GVfsFtpDirCache *  cache,
   if (g_vfs_ftp_task_is_in_error (task))
     return NULL;
 
-  entry = g_vfs_ftp_dir_cache_entry_new (stamp);
+  entry = g_vfs_ftp_dir_cache_entry_new (dir);
   cache->funcs->process (g_io_stream_get_input_stream (g_vfs_ftp_connection_get_data_stream (task->conn)),
                          g_vfs_ftp_connection_get_debug_id (task->conn),
                          dir,
@@ -178,19 +269,162 @@ g_vfs_ftp_dir_cache_lookup_entry (GVfsFtpDirCache *  cache,
       g_vfs_ftp_dir_cache_entry_unref (entry);
       return NULL;
     }
+
+  return entry;
+}
+
+typedef struct {
+  GVfsFtpDirCache *     cache;
+  GVfsFtpDirCacheEntry *stale;
+  guint                 generation;
+  GVfsFtpTask           task;
+} DirCacheRefresh;
+
+static gpointer
+g_vfs_ftp_dir_cache_refresh_thread (gpointer data)
+{
+  DirCacheRefresh *refresh = data;
+  GVfsFtpDirCache *cache = refresh->cache;
+  GVfsFtpDirCacheEntry *entry;
+
+  g_debug ("# dir cache: refreshing %s\n",
+           g_vfs_ftp_file_get_gvfs_path (refresh->stale->dir));
+
+  entry = g_vfs_ftp_dir_cache_fetch (cache, &refresh->task, refresh->stale->dir);
+  if (entry)
+    {
+      g_vfs_ftp_dir_cache_insert (cache, entry, refresh->generation, refresh->stale);
+      g_vfs_ftp_dir_cache_entry_unref (entry);
+    }
+  g_vfs_ftp_task_done (&refresh->task);
+
   g_mutex_lock (&cache->lock);
-  g_hash_table_insert (cache->directories,
-                       g_vfs_ftp_file_copy (dir),
-                       g_vfs_ftp_dir_cache_entry_ref (entry));
+  refresh->stale->refreshing = FALSE;
+  if (entry)
+    cache->refreshes++;
+  g_mutex_unlock (&cache->lock);
+
+  g_vfs_ftp_dir_cache_entry_unref (refresh->stale);
+  g_object_unref (refresh->task.cancellable);
+  /* the backend owns the cache, so it must outlive us */
+  g_object_unref (refresh->task.backend);
+  g_slice_free (DirCacheRefresh, refresh);
+
+  return NULL;
+}
+
+/* Starts refetching @stale in a thread. This only happens if a connection
+ * is idle, so refreshes never keep jobs from getting a connection. */
+static gboolean
+g_vfs_ftp_dir_cache_refresh (GVfsFtpDirCache *     cache,
+                             GVfsBackendFtp *      ftp,
+                             GVfsFtpDirCacheEntry *stale,
+                             guint                 generation)
+{
+  DirCacheRefresh *refresh;
+  GThread *thread;
+
+  refresh = g_slice_new0 (DirCacheRefresh);
+  refresh->task.backend = ftp;
+  refresh->task.cancellable = g_cancellable_new ();
+
+  if (!g_vfs_ftp_task_acquire_idle_connection (&refresh->task))
+    {
+      g_object_unref (refresh->task.cancellable);
+      g_slice_free (DirCacheRefresh, refresh);
+      return FALSE;
+    }
+
+  refresh->cache = cache;
+  refresh->stale = g_vfs_ftp_dir_cache_entry_ref (stale);
+  refresh->generation = generation;
+  g_object_ref (ftp);
+
+  thread = g_thread_try_new ("ftp dir cache refresh",
+                             g_vfs_ftp_dir_cache_refresh_thread,
+                             refresh,
+                             NULL);
+  if (thread == NULL)
+    {
+      g_vfs_ftp_task_done (&refresh->task);
+      g_object_unref (refresh->task.cancellable);
+      g_object_unref (ftp);
+      g_vfs_ftp_dir_cache_entry_unref (stale);
+      g_slice_free (DirCacheRefresh, refresh);
+      return FALSE;
+    }
+
+  g_thread_unref (thread);
+  return TRUE;
+}
+
+/* Gets the listing of @dir. With @flush, the listing is always fetched
+ * from the server and replaces the cached one. With @cached_only,
+ * nothing is fetched synchronously and %NULL is returned on a miss. */
+static GVfsFtpDirCacheEntry *
+g_vfs_ftp_dir_cache_lookup_entry (GVfsFtpDirCache *  cache,
+                                  GVfsFtpTask *      task,
+                                  const GVfsFtpFile *dir,
+                                  gboolean           flush,
+                                  gboolean           cached_only)
+{
+  GVfsFtpDirCacheEntry *entry;
+  gboolean refresh = FALSE;
+  guint generation;
+  gint64 age;
+
+  g_mutex_lock (&cache->lock);
+  entry = flush ? NULL : g_hash_table_lookup (cache->directories, dir);
+  if (entry)
+    {
+      age = g_get_monotonic_time () - entry->time;
+      if (age < DIR_CACHE_TTL)
+        cache->hits++;
+      else if (age < DIR_CACHE_MAX_AGE)
+        {
+          cache->stale_hits++;
+          if (!entry->refreshing)
+            refresh = entry->refreshing = TRUE;
+        }
+      else
+        entry = NULL;
+    }
+
+  if (entry)
+    {
+      g_vfs_ftp_dir_cache_entry_ref (entry);
+      g_queue_unlink (&cache->lru, &entry->link);
+      g_queue_push_head_link (&cache->lru, &entry->link);
+    }
+  else if (!cached_only)
+    {
+      cache->misses++;
+      g_vfs_ftp_dir_cache_debug_stats (cache);
+    }
+  generation = cache->generation;
   g_mutex_unlock (&cache->lock);
+
+  if (refresh && !g_vfs_ftp_dir_cache_refresh (cache, task->backend, entry, generation))
+    {
+      g_mutex_lock (&cache->lock);
+      entry->refreshing = FALSE;
+      g_mutex_unlock (&cache->lock);
+    }
+
+  if (entry || cached_only)
+    return entry;
+
+  entry = g_vfs_ftp_dir_cache_fetch (cache, task, dir);
+  if (entry)
+    g_vfs_ftp_dir_cache_insert (cache, entry, generation, NULL);
+
   return entry;
 }
 
 static GFileInfo *
 g_vfs_ftp_dir_cache_lookup_file_internal (GVfsFtpDirCache *  cache,
                                           GVfsFtpTask *      task,
-                                          const GVfsFtpFile *file,
-                                          guint              stamp)
+                                          const GVfsFtpFile *file)
 {
   GVfsFtpDirCacheEntry *entry;
   GVfsFtpFile *dir;
@@ -202,21 +436,25 @@ g_vfs_ftp_dir_cache_lookup_file_internal (GVfsFtpDirCache *  cache,
   if (!g_vfs_ftp_file_is_root (file))
     {
       dir = g_vfs_ftp_file_new_parent (file);
-      entry = g_vfs_ftp_dir_cache_lookup_entry (cache, task, dir, stamp);
+      entry = g_vfs_ftp_dir_cache_lookup_entry (cache, task, dir, FALSE,
+                                                cache->funcs->fast_lookup);
       g_vfs_ftp_file_free (dir);
-      if (entry == NULL)
+      if (entry == NULL && !cache->funcs->fast_lookup)
         return NULL;
 
-      info = g_hash_table_lookup (entry->files, file);
-      if (info != NULL)
+      if (entry != NULL)
         {
-          /* NB: the order of ref/unref is important here */
-          g_object_ref (info);
+          info = g_hash_table_lookup (entry->files, file);
+          if (info != NULL)
+            {
+              /* NB: the order of ref/unref is important here */
+              g_object_ref (info);
+              g_vfs_ftp_dir_cache_entry_unref (entry);
+              return info;
+            }
+
           g_vfs_ftp_dir_cache_entry_unref (entry);
-          return info;
         }
-
-      g_vfs_ftp_dir_cache_entry_unref (entry);
     }
 
   if (g_vfs_ftp_task_is_in_error (task))
@@ -229,8 +467,7 @@ static GFileInfo *
 g_vfs_ftp_dir_cache_resolve_symlink (GVfsFtpDirCache *  cache,
                                      GVfsFtpTask *      task,
                                      const GVfsFtpFile *file,
-                                     GFileInfo *        original,
-                                     guint              stamp)
+                                     GFileInfo *        original)
 {
   static const char *copy_attributes[] = {
     G_FILE_ATTRIBUTE_STANDARD_IS_SYMLINK,
@@ -273,7 +510,7 @@ g_vfs_ftp_dir_cache_resolve_symlink (GVfsFtpDirCache *  cache,
           g_vfs_ftp_task_clear_error (task);
           return original;
         }
-      info = g_vfs_ftp_dir_cache_lookup_file_internal (cache, task, link, stamp);
+      info = g_vfs_ftp_dir_cache_lookup_file_internal (cache, task, link);
       if (info == NULL)
         {
           g_vfs_ftp_file_free (link);
@@ -327,10 +564,10 @@ g_vfs_ftp_dir_cache_lookup_file (GVfsFtpDirCache *  cache,
   g_return_val_if_fail (task != NULL, NULL);
   g_return_val_if_fail (file != NULL, NULL);
 
-  info = g_vfs_ftp_dir_cache_lookup_file_internal (cache, task, file, 0);
+  info = g_vfs_ftp_dir_cache_lookup_file_internal (cache, task, file);
 
   if (info != NULL && resolve_symlinks)
-    info = g_vfs_ftp_dir_cache_resolve_symlink (cache, task, file, info, 0);
+    info = g_vfs_ftp_dir_cache_resolve_symlink (cache, task, file, info);
 
   return info;
 }
@@ -345,7 +582,6 @@ g_vfs_ftp_dir_cache_lookup_dir (GVfsFtpDirCache *  cache,
   GVfsFtpDirCacheEntry *entry;
   GHashTableIter iter;
   gpointer file, info;
-  guint stamp;
   GList *result = NULL;
 
   g_return_val_if_fail (cache != NULL, NULL);
@@ -355,17 +591,7 @@ g_vfs_ftp_dir_cache_lookup_dir (GVfsFtpDirCache *  cache,
   if (g_vfs_ftp_task_is_in_error (task))
     return NULL;
 
-  if (flush)
-    {
-      g_mutex_lock (&cache->lock);
-      g_assert (cache->stamp != G_MAXUINT);
-      stamp = ++cache->stamp;
-      g_mutex_unlock (&cache->lock);
-    }
-  else
-    stamp = 0;
-
-  entry = g_vfs_ftp_dir_cache_lookup_entry (cache, task, dir, stamp);
+  entry = g_vfs_ftp_dir_cache_lookup_entry (cache, task, dir, flush, FALSE);
   if (entry == NULL)
     return NULL;
 
@@ -374,7 +600,7 @@ g_vfs_ftp_dir_cache_lookup_dir (GVfsFtpDirCache *  cache,
     {
       g_object_ref (info);
       if (resolve_symlinks)
-        info = g_vfs_ftp_dir_cache_resolve_symlink (cache, task, file, info, stamp);
+        info = g_vfs_ftp_dir_cache_resolve_symlink (cache, task, file, info);
       g_assert (!g_vfs_ftp_task_is_in_error (task));
       result = g_list_prepend (result, info);
     }
@@ -387,11 +613,16 @@ void
 g_vfs_ftp_dir_cache_purge_dir (GVfsFtpDirCache *  cache,
                                const GVfsFtpFile *dir)
 {
+  GVfsFtpDirCacheEntry *entry;
+
   g_return_if_fail (cache != NULL);
   g_return_if_fail (dir != NULL);
 
   g_mutex_lock (&cache->lock);
-  g_hash_table_remove (cache->directories, dir);
+  cache->generation++;
+  entry = g_hash_table_lookup (cache->directories, dir);
+  if (entry)
+    g_vfs_ftp_dir_cache_remove (cache, entry);
   g_mutex_unlock (&cache->lock);
 }
 
@@ -798,16 +1029,262 @@ g_vfs_ftp_dir_cache_funcs_process_default (GInputStream *        stream,
   return g_vfs_ftp_dir_cache_funcs_process (stream, debug_id, dir, entry, FALSE, cancellable, error);
 }
 
+/* MLSD and MLST, RFC 3659
+ *
+ * Every entry is a list of facts followed by the file name, like
+ *   type=file;size=1024;modify=20090101120000; foo.txt
+ * Times are in UTC and everything but the facts we know is ignored.
+ * The "cdir" and "pdir" entries of listings are skipped, but MLST of a
+ * directory may report the directory itself as "cdir".
+ */
+static GFileInfo *
+g_vfs_ftp_dir_cache_funcs_parse_facts (const GVfsFtpFile *file,
+                                       const char *       facts,
+                                       gboolean           is_mlst)
+{
+  GFileInfo *info;
+  GFileType file_type = G_FILE_TYPE_REGULAR;
+  char **split, *symlink = NULL, *name;
+  const char *owner = NULL, *group = NULL;
+  guint32 mode = 0;
+  gboolean has_mode = FALSE;
+  guint64 size = 0;
+  GTimeVal tv = { 0, 0 };
+  guint i;
+
+  split = g_strsplit (facts, ";", -1);
+  for (i = 0; split[i]; i++)
+    {
+      char *value = strchr (split[i], '=');
+
+      if (value == NULL)
+        continue;
+      *value++ = '\0';
+
+      if (g_ascii_strcasecmp (split[i], "type") == 0)
+        {
+          if (is_mlst && g_ascii_strcasecmp (value, "cdir") == 0)
+            file_type = G_FILE_TYPE_DIRECTORY;
+          else if (g_ascii_strcasecmp (value, "cdir") == 0 ||
+                   g_ascii_strcasecmp (value, "pdir") == 0)
+            {
+              g_strfreev (split);
+              return NULL;
+            }
+          else if (g_ascii_strcasecmp (value, "file") == 0)
+            file_type = G_FILE_TYPE_REGULAR;
+          else if (g_ascii_strcasecmp (value, "dir") == 0)
+            file_type = G_FILE_TYPE_DIRECTORY;
+          else if (g_ascii_strncasecmp (value, "OS.unix=slink", 13) == 0)
+            {
+              file_type = G_FILE_TYPE_SYMBOLIC_LINK;
+              if (value[13] == ':' && value[14] != '\0')
+                symlink = value + 14;
+            }
+          else if (g_ascii_strcasecmp (value, "OS.unix=symlink") == 0)
+            file_type = G_FILE_TYPE_SYMBOLIC_LINK;
+          else
+            file_type = G_FILE_TYPE_SPECIAL;
+        }
+      else if (g_ascii_strcasecmp (split[i], "size") == 0)
+        size = g_ascii_strtoull (value, NULL, 10);
+      else if (g_ascii_strcasecmp (split[i], "modify") == 0)
+        {
+          int year, month, day, hour, minute, second;
+
+          if (sscanf (value, "%4d%2d%2d%2d%2d%2d",
+                      &year, &month, &day, &hour, &minute, &second) == 6)
+            {
+              GDateTime *date;
+
+              date = g_date_time_new_utc (year, month, day, hour, minute, second);
+              if (date)
+                {
+                  tv.tv_sec = g_date_time_to_unix (date);
+                  g_date_time_unref (date);
+                }
+            }
+        }
+      else if (g_ascii_strcasecmp (split[i], "UNIX.mode") == 0)
+        {
+          mode = strtoul (value, NULL, 8) & 07777;
+          has_mode = TRUE;
+        }
+      else if (g_ascii_strcasecmp (split[i], "UNIX.owner") == 0 ||
+               (owner == NULL && g_ascii_strcasecmp (split[i], "UNIX.uid") == 0))
+        owner = value;
+      else if (g_ascii_strcasecmp (split[i], "UNIX.group") == 0 ||
+               (group == NULL && g_ascii_strcasecmp (split[i], "UNIX.gid") == 0))
+        group = value;
+    }
+
+  info = g_file_info_new ();
+
+  name = g_path_get_basename (g_vfs_ftp_file_get_gvfs_path (file));
+  g_file_info_set_name (info, name);
+  g_file_info_set_is_hidden (info, name[0] == '.');
+  g_free (name);
+
+  if (file_type == G_FILE_TYPE_SYMBOLIC_LINK)
+    {
+      g_file_info_set_is_symlink (info, TRUE);
+      if (symlink)
+        g_file_info_set_symlink_target (info, symlink);
+    }
+
+  g_file_info_set_size (info, size);
+
+  if (has_mode)
+    {
+      mode |= file_type == G_FILE_TYPE_DIRECTORY ? S_IFDIR :
+              file_type == G_FILE_TYPE_SYMBOLIC_LINK ? S_IFLNK :
+              file_type == G_FILE_TYPE_REGULAR ? S_IFREG : 0;
+      g_file_info_set_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_MODE, mode);
+    }
+  if (owner)
+    g_file_info_set_attribute_string (info, G_FILE_ATTRIBUTE_OWNER_USER, owner);
+  if (group)
+    g_file_info_set_attribute_string (info, G_FILE_ATTRIBUTE_OWNER_GROUP, group);
+
+  gvfs_file_info_populate_default (info,
+                                   g_vfs_ftp_file_get_gvfs_path (file),
+                                   file_type);
+
+  if (tv.tv_sec != 0)
+    g_file_info_set_modification_time (info, &tv);
+
+  g_strfreev (split);
+  return info;
+}
+
+static gboolean
+g_vfs_ftp_dir_cache_funcs_process_mlsd (GInputStream *        stream,
+                                        int                   debug_id,
+                                        const GVfsFtpFile *   dir,
+                                        GVfsFtpDirCacheEntry *entry,
+                                        GCancellable *        cancellable,
+                                        GError **             error)
+{
+  GDataInputStream *data;
+  GFileInfo *info;
+  GVfsFtpFile *file;
+  char *line, *name;
+  gsize length;
+
+  g_assert (error != NULL);
+  g_assert (*error == NULL);
+
+  data = g_data_input_stream_new (stream);
+  g_data_input_stream_set_newline_type (data, G_DATA_STREAM_NEWLINE_TYPE_LF);
+  while ((line = g_data_input_stream_read_line (data, &length, cancellable, error)))
+    {
+      if (length > 0 && line[length - 1] == '\r')
+        line[--length] = '\0';
+
+      g_debug ("<<%2d <<  %s\n", debug_id, line);
+
+      /* the facts end at the first space */
+      name = strchr (line, ' ');
+      if (name == NULL || name[1] == '\0')
+        {
+          g_free (line);
+          continue;
+        }
+      *name++ = '\0';
+
+      /* some servers send full paths */
+      if (strrchr (name, '/'))
+        name = strrchr (name, '/') + 1;
+
+      if (strcmp (name, ".") == 0 || strcmp (name, "..") == 0)
+        {
+          g_free (line);
+          continue;
+        }
+
+      file = g_vfs_ftp_file_new_child (dir, name, NULL);
+      if (file == NULL)
+        {
+          g_debug ("# invalid filename, skipping");
+          g_free (line);
+          continue;
+        }
+
+      info = g_vfs_ftp_dir_cache_funcs_parse_facts (file, line, FALSE);
+      if (info)
+        g_vfs_ftp_dir_cache_entry_add (entry, file, info);
+      else
+        g_vfs_ftp_file_free (file);
+
+      g_free (line);
+    }
+
+  g_object_unref (data);
+  return *error != NULL;
+}
+
+static GFileInfo *
+g_vfs_ftp_dir_cache_funcs_lookup_mlst (GVfsFtpTask *      task,
+                                       const GVfsFtpFile *file)
+{
+  GFileInfo *info = NULL;
+  char **reply, *facts;
+  guint status, i;
+
+  if (g_vfs_ftp_file_is_root (file))
+    return create_root_file_info (task->backend);
+
+  status = g_vfs_ftp_task_send_and_check (task, G_VFS_FTP_PASS_550, NULL, NULL, &reply,
+                                          "MLST %s", g_vfs_ftp_file_get_ftp_path (file));
+  if (status == 0)
+    {
+      /* don't trust the server's MLST, go the long way */
+      g_vfs_ftp_task_clear_error (task);
+      return g_vfs_ftp_dir_cache_funcs_lookup_uncached (task, file);
+    }
+
+  if (status == 550)
+    {
+      g_strfreev (reply);
+      return NULL;
+    }
+
+  /* the facts are on the continuation line starting with a space */
+  for (i = 1; reply[i] && info == NULL; i++)
+    {
+      if (reply[i][0] != ' ')
+        continue;
+
+      facts = reply[i] + 1;
+      if (strchr (facts, ' '))
+        *strchr (facts, ' ') = '\0';
+      info = g_vfs_ftp_dir_cache_funcs_parse_facts (file, facts, TRUE);
+    }
+
+  g_strfreev (reply);
+  return info;
+}
+
 const GVfsFtpDirFuncs g_vfs_ftp_dir_cache_funcs_unix = {
   "LIST -a",
   g_vfs_ftp_dir_cache_funcs_process_unix,
   g_vfs_ftp_dir_cache_funcs_lookup_uncached,
-  g_vfs_ftp_dir_cache_funcs_resolve_default
+  g_vfs_ftp_dir_cache_funcs_resolve_default,
+  FALSE
 };
 
 const GVfsFtpDirFuncs g_vfs_ftp_dir_cache_funcs_default = {
   "LIST",
   g_vfs_ftp_dir_cache_funcs_process_default,
   g_vfs_ftp_dir_cache_funcs_lookup_uncached,
-  g_vfs_ftp_dir_cache_funcs_resolve_default
+  g_vfs_ftp_dir_cache_funcs_resolve_default,
+  FALSE
+};
+
+const GVfsFtpDirFuncs g_vfs_ftp_dir_cache_funcs_mlsd = {
+  "MLSD",
+  g_vfs_ftp_dir_cache_funcs_process_mlsd,
+  g_vfs_ftp_dir_cache_funcs_lookup_mlst,
+  g_vfs_ftp_dir_cache_funcs_resolve_default,
+  TRUE
 };
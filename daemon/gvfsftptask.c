@@ -268,6 +268,36 @@ g_vfs_ftp_task_acquire_connection (GVfsFtpTask *task)
   return task->conn != NULL;
 }
 
+/**
+ * g_vfs_ftp_task_acquire_idle_connection:
+ * @task: a task without an associated connection
+ *
+ * Tries to give @task a connection that is sitting idle in the pool, for
+ * background work that should not compete with jobs. A connection is only
+ * taken if another one stays available for jobs, either idle or by opening
+ * a new one. This function never blocks.
+ *
+ * Returns: %TRUE if @task got a connection, %FALSE otherwise
+ **/
+gboolean
+g_vfs_ftp_task_acquire_idle_connection (GVfsFtpTask *task)
+{
+  GVfsBackendFtp *ftp;
+
+  g_return_val_if_fail (task != NULL, FALSE);
+  g_return_val_if_fail (task->conn == NULL, FALSE);
+
+  ftp = task->backend;
+  g_mutex_lock (&ftp->mutex);
+  if (ftp->queue != NULL &&
+      (g_queue_get_length (ftp->queue) > 1 ||
+       (!g_queue_is_empty (ftp->queue) && ftp->connections < ftp->max_connections)))
+    task->conn = g_queue_pop_head (ftp->queue);
+  g_mutex_unlock (&ftp->mutex);
+
+  return task->conn != NULL;
+}
+
 /**
  * g_vfs_ftp_task_release_connection:
  * @task: a task
@@ -54,6 +54,7 @@ typedef void (* GVfsFtpErrorFunc) (GVfsFtpTask *task, gpointer data);
 
 #define G_VFS_FTP_TASK_INIT(backend,job) { (backend), (job), (job)->cancellable, }
 void                    g_vfs_ftp_task_done                     (GVfsFtpTask *          task);
+gboolean                g_vfs_ftp_task_acquire_idle_connection  (GVfsFtpTask *          task);
 
 #define g_vfs_ftp_task_is_in_error(task) ((task)->error != NULL)
 #define g_vfs_ftp_task_error_matches(task, domain, code) (g_error_matches ((task)->error, (domain), (code)))
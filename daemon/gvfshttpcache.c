@@ -0,0 +1,624 @@
+/* GIO - GLib Input, Output and Streaming Library
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include "gvfshttpcache.h"
+
+/* On-disk cache for downloaded file contents.
+ *
+ * Every URI gets two files named after the SHA1 of the URI in
+ * $XDG_CACHE_HOME/gvfs/http: a sparse "data" file the size of the
+ * remote file and a "meta" key file with the validators (ETag and
+ * Last-Modified) the data belongs to and a bitmap of the blocks that
+ * are present. Blocks are only marked once they were completely
+ * written, so partially downloaded files can be resumed and seeks are
+ * served from whatever is there.
+ *
+ * An entry is held with an exclusive flock() on the data file while it
+ * is in use. If somebody else has it, the cache is simply bypassed.
+ * The meta file is rewritten when the entry is released, so its mtime
+ * tells when the entry was last used; the least recently used entries
+ * are deleted once the data files together exceed the size limit. */
+
+#define META_GROUP "Entry"
+
+struct _GVfsHttpCacheEntry
+{
+  volatile gint ref_count;
+
+  char       *dir;
+  char       *name;
+  char       *uri;
+  int         fd;
+  guint64     cache_size;
+
+  char       *etag;
+  char       *last_modified;
+  goffset     size;
+
+  guint8     *blocks;           /* bitmap */
+  gsize       n_blocks;
+};
+
+static char *
+cache_get_dir (void)
+{
+  return g_build_filename (g_get_user_cache_dir (), "gvfs", "http", NULL);
+}
+
+static char *
+entry_get_path (GVfsHttpCacheEntry *entry,
+                const char         *suffix)
+{
+  char *basename, *path;
+
+  basename = g_strconcat (entry->name, suffix, NULL);
+  path = g_build_filename (entry->dir, basename, NULL);
+  g_free (basename);
+
+  return path;
+}
+
+static void
+entry_set_size (GVfsHttpCacheEntry *entry,
+                goffset             size)
+{
+  entry->size = size;
+  entry->n_blocks = size > 0 ? (size + G_VFS_HTTP_CACHE_BLOCK_SIZE - 1) / G_VFS_HTTP_CACHE_BLOCK_SIZE : 0;
+
+  g_free (entry->blocks);
+  entry->blocks = g_malloc0 ((entry->n_blocks + 7) / 8);
+}
+
+static void
+entry_load (GVfsHttpCacheEntry *entry)
+{
+  GKeyFile *key_file;
+  char *path, *uri, *blocks;
+  guchar *bitmap;
+  gsize len;
+  struct stat st;
+  goffset size;
+
+  path = entry_get_path (entry, ".meta");
+  key_file = g_key_file_new ();
+
+  if (!g_key_file_load_from_file (key_file, path, G_KEY_FILE_NONE, NULL))
+    goto out;
+
+  /* Different URIs with the same hash are too unlikely to care */
+  uri = g_key_file_get_string (key_file, META_GROUP, "URI", NULL);
+  if (g_strcmp0 (uri, entry->uri) != 0)
+    {
+      g_free (uri);
+      goto out;
+    }
+  g_free (uri);
+
+  size = g_key_file_get_int64 (key_file, META_GROUP, "Size", NULL);
+  if (fstat (entry->fd, &st) != 0 || st.st_size != size || size <= 0)
+    goto out;
+
+  blocks = g_key_file_get_string (key_file, META_GROUP, "Blocks", NULL);
+  if (blocks == NULL)
+    goto out;
+  bitmap = g_base64_decode (blocks, &len);
+  g_free (blocks);
+
+  entry_set_size (entry, size);
+  if (len != (entry->n_blocks + 7) / 8)
+    {
+      g_free (bitmap);
+      entry_set_size (entry, -1);
+      goto out;
+    }
+
+  g_free (entry->blocks);
+  entry->blocks = bitmap;
+  entry->etag = g_key_file_get_string (key_file, META_GROUP, "ETag", NULL);
+  entry->last_modified = g_key_file_get_string (key_file, META_GROUP, "Last-Modified", NULL);
+
+ out:
+  g_key_file_free (key_file);
+  g_free (path);
+}
+
+static void
+entry_save (GVfsHttpCacheEntry *entry)
+{
+  GKeyFile *key_file;
+  char *path, *blocks, *data;
+  gsize len;
+
+  path = entry_get_path (entry, ".meta");
+
+  key_file = g_key_file_new ();
+  g_key_file_set_string (key_file, META_GROUP, "URI", entry->uri);
+  if (entry->etag)
+    g_key_file_set_string (key_file, META_GROUP, "ETag", entry->etag);
+  if (entry->last_modified)
+    g_key_file_set_string (key_file, META_GROUP, "Last-Modified", entry->last_modified);
+  g_key_file_set_int64 (key_file, META_GROUP, "Size", entry->size);
+  blocks = g_base64_encode (entry->blocks, (entry->n_blocks + 7) / 8);
+  g_key_file_set_string (key_file, META_GROUP, "Blocks", blocks);
+  g_free (blocks);
+
+  data = g_key_file_to_data (key_file, &len, NULL);
+  if (!g_file_set_contents (path, data, len, NULL))
+    g_debug ("http cache: could not write %s\n", path);
+
+  g_free (data);
+  g_key_file_free (key_file);
+  g_free (path);
+}
+
+typedef struct {
+  char   *name;
+  time_t  mtime;
+  guint64 size;
+} EvictCandidate;
+
+static gint
+evict_candidate_compare (gconstpointer a,
+                         gconstpointer b)
+{
+  const EvictCandidate *ca = a, *cb = b;
+
+  return ca->mtime < cb->mtime ? -1 : ca->mtime > cb->mtime;
+}
+
+static void
+cache_remove_files (const char *dir,
+                    const char *name)
+{
+  char *path;
+
+  path = g_strconcat (dir, G_DIR_SEPARATOR_S, name, ".meta", NULL);
+  g_unlink (path);
+  g_free (path);
+
+  path = g_strconcat (dir, G_DIR_SEPARATOR_S, name, ".data", NULL);
+  g_unlink (path);
+  g_free (path);
+}
+
+/* Deletes least recently used entries until the data files fit into
+ * @cache_size. Entries in use, including @keep, are left alone. */
+static void
+cache_evict (const char *dir,
+             const char *keep,
+             guint64     cache_size)
+{
+  GDir *gdir;
+  const char *basename;
+  GArray *candidates;
+  guint64 total;
+  guint i;
+
+  gdir = g_dir_open (dir, 0, NULL);
+  if (gdir == NULL)
+    return;
+
+  candidates = g_array_new (FALSE, FALSE, sizeof (EvictCandidate));
+  total = 0;
+
+  while ((basename = g_dir_read_name (gdir)) != NULL)
+    {
+      EvictCandidate candidate;
+      struct stat st;
+      char *path;
+
+      if (!g_str_has_suffix (basename, ".data"))
+        continue;
+
+      path = g_build_filename (dir, basename, NULL);
+      if (g_stat (path, &st) != 0)
+        {
+          g_free (path);
+          continue;
+        }
+      g_free (path);
+
+      candidate.name = g_strndup (basename, strlen (basename) - strlen (".data"));
+      candidate.size = (guint64) st.st_blocks * 512;
+      candidate.mtime = 0;
+      total += candidate.size;
+
+      /* Without meta file the entry is useless, evict it first */
+      path = g_strconcat (dir, G_DIR_SEPARATOR_S, candidate.name, ".meta", NULL);
+      if (g_stat (path, &st) == 0)
+        candidate.mtime = st.st_mtime;
+      g_free (path);
+
+      g_array_append_val (candidates, candidate);
+    }
+  g_dir_close (gdir);
+
+  g_array_sort (candidates, evict_candidate_compare);
+
+  for (i = 0; i < candidates->len && total > cache_size; i++)
+    {
+      EvictCandidate *candidate = &g_array_index (candidates, EvictCandidate, i);
+      char *path;
+      int fd;
+
+      if (strcmp (candidate->name, keep) == 0)
+        continue;
+
+      path = g_strconcat (dir, G_DIR_SEPARATOR_S, candidate->name, ".data", NULL);
+      fd = g_open (path, O_RDWR, 0);
+      g_free (path);
+      if (fd == -1)
+        continue;
+
+      if (flock (fd, LOCK_EX | LOCK_NB) == 0)
+        {
+          g_debug ("http cache: evicting %s\n", candidate->name);
+          cache_remove_files (dir, candidate->name);
+          total -= candidate->size;
+        }
+      close (fd);
+    }
+
+  for (i = 0; i < candidates->len; i++)
+    g_free (g_array_index (candidates, EvictCandidate, i).name);
+  g_array_free (candidates, TRUE);
+}
+
+/**
+ * g_vfs_http_cache_entry_open:
+ * @uri: the URI whose contents are cached
+ * @cache_size: maximum size of the whole cache in bytes
+ *
+ * Opens the cache entry for @uri, creating an empty one if there is
+ * none yet. Check the validators of the entry against the server
+ * before using its data.
+ *
+ * Returns: the entry, or %NULL if the cache can't be used right now,
+ *     e.g. because the entry is in use elsewhere
+ **/
+GVfsHttpCacheEntry *
+g_vfs_http_cache_entry_open (const char *uri,
+                             guint64     cache_size)
+{
+  GVfsHttpCacheEntry *entry;
+  char *path;
+
+  g_return_val_if_fail (uri != NULL, NULL);
+
+  entry = g_slice_new0 (GVfsHttpCacheEntry);
+  entry->ref_count = 1;
+  entry->dir = cache_get_dir ();
+  entry->name = g_compute_checksum_for_string (G_CHECKSUM_SHA1, uri, -1);
+  entry->uri = g_strdup (uri);
+  entry->cache_size = cache_size;
+  entry->fd = -1;
+  entry_set_size (entry, -1);
+
+  if (g_mkdir_with_parents (entry->dir, 0700) != 0)
+    goto fail;
+
+  path = entry_get_path (entry, ".data");
+  entry->fd = g_open (path, O_RDWR | O_CREAT, 0600);
+  g_free (path);
+  if (entry->fd == -1)
+    goto fail;
+
+  if (flock (entry->fd, LOCK_EX | LOCK_NB) != 0)
+    {
+      g_debug ("http cache: %s is busy\n", uri);
+      goto fail;
+    }
+
+  entry_load (entry);
+
+  return entry;
+
+ fail:
+  if (entry->fd != -1)
+    close (entry->fd);
+  entry->fd = -1;
+  g_vfs_http_cache_entry_unref (entry);
+  return NULL;
+}
+
+GVfsHttpCacheEntry *
+g_vfs_http_cache_entry_ref (GVfsHttpCacheEntry *entry)
+{
+  g_return_val_if_fail (entry != NULL, NULL);
+
+  g_atomic_int_inc (&entry->ref_count);
+  return entry;
+}
+
+/**
+ * g_vfs_http_cache_entry_unref:
+ * @entry: the entry
+ *
+ * Releases a reference. When the last one goes away the entry is
+ * written back, unlocked, and the cache is trimmed to its size.
+ **/
+void
+g_vfs_http_cache_entry_unref (GVfsHttpCacheEntry *entry)
+{
+  g_return_if_fail (entry != NULL);
+
+  if (!g_atomic_int_dec_and_test (&entry->ref_count))
+    return;
+
+  if (entry->fd != -1)
+    {
+      if (entry->etag == NULL && entry->last_modified == NULL)
+        cache_remove_files (entry->dir, entry->name);
+      else
+        {
+          /* Always rewrite, the mtime is what LRU goes by */
+          entry_save (entry);
+          cache_evict (entry->dir, entry->name, entry->cache_size);
+        }
+
+      close (entry->fd);
+    }
+
+  g_free (entry->dir);
+  g_free (entry->name);
+  g_free (entry->uri);
+  g_free (entry->etag);
+  g_free (entry->last_modified);
+  g_free (entry->blocks);
+  g_slice_free (GVfsHttpCacheEntry, entry);
+}
+
+const char *
+g_vfs_http_cache_entry_get_etag (GVfsHttpCacheEntry *entry)
+{
+  g_return_val_if_fail (entry != NULL, NULL);
+
+  return entry->etag;
+}
+
+const char *
+g_vfs_http_cache_entry_get_last_modified (GVfsHttpCacheEntry *entry)
+{
+  g_return_val_if_fail (entry != NULL, NULL);
+
+  return entry->last_modified;
+}
+
+goffset
+g_vfs_http_cache_entry_get_size (GVfsHttpCacheEntry *entry)
+{
+  g_return_val_if_fail (entry != NULL, -1);
+
+  return entry->size;
+}
+
+/**
+ * g_vfs_http_cache_entry_matches:
+ * @entry: the entry
+ * @etag: the ETag the server sent, or %NULL
+ * @last_modified: the Last-Modified date the server sent, or %NULL
+ * @size: the size of the file on the server
+ *
+ * Checks whether the data in @entry belongs to the file the server
+ * described. The ETag is compared if both sides have one, otherwise
+ * the modification date.
+ *
+ * Returns: %TRUE if the cached data can be used
+ **/
+gboolean
+g_vfs_http_cache_entry_matches (GVfsHttpCacheEntry *entry,
+                                const char         *etag,
+                                const char         *last_modified,
+                                goffset             size)
+{
+  g_return_val_if_fail (entry != NULL, FALSE);
+
+  if (size != entry->size)
+    return FALSE;
+
+  if (etag && entry->etag)
+    return strcmp (etag, entry->etag) == 0;
+
+  if (etag || entry->etag)
+    return FALSE;
+
+  return last_modified && entry->last_modified &&
+    strcmp (last_modified, entry->last_modified) == 0;
+}
+
+/**
+ * g_vfs_http_cache_entry_reset:
+ * @entry: the entry
+ * @etag: the new ETag, or %NULL
+ * @last_modified: the new Last-Modified date, or %NULL
+ * @size: the new size, or -1 to just clear the entry
+ *
+ * Drops all cached data and starts over for the given version of the
+ * file. With neither validator the entry is removed when released.
+ **/
+void
+g_vfs_http_cache_entry_reset (GVfsHttpCacheEntry *entry,
+                              const char         *etag,
+                              const char         *last_modified,
+                              goffset             size)
+{
+  g_return_if_fail (entry != NULL);
+
+  g_free (entry->etag);
+  entry->etag = g_strdup (etag);
+  g_free (entry->last_modified);
+  entry->last_modified = g_strdup (last_modified);
+  entry_set_size (entry, size);
+
+  /* Truncating to 0 first releases the old blocks */
+  if (ftruncate (entry->fd, 0) != 0 ||
+      (size > 0 && ftruncate (entry->fd, size) != 0))
+    {
+      g_debug ("http cache: could not resize %s: %s\n",
+               entry->uri, g_strerror (errno));
+      g_free (entry->etag);
+      entry->etag = NULL;
+      g_free (entry->last_modified);
+      entry->last_modified = NULL;
+      entry_set_size (entry, -1);
+    }
+}
+
+/**
+ * g_vfs_http_cache_entry_has_block:
+ * @entry: the entry
+ * @offset: an offset in the file
+ *
+ * Checks whether the block containing @offset is cached.
+ *
+ * Returns: %TRUE if the block can be read from the cache
+ **/
+gboolean
+g_vfs_http_cache_entry_has_block (GVfsHttpCacheEntry *entry,
+                                  goffset             offset)
+{
+  gsize block;
+
+  g_return_val_if_fail (entry != NULL, FALSE);
+
+  if (offset < 0 || offset >= entry->size)
+    return FALSE;
+
+  block = offset / G_VFS_HTTP_CACHE_BLOCK_SIZE;
+  return (entry->blocks[block / 8] & (1 << (block % 8))) != 0;
+}
+
+/**
+ * g_vfs_http_cache_entry_read:
+ * @entry: the entry
+ * @offset: where to read
+ * @buffer: buffer to read into
+ * @count: number of bytes to read at most
+ * @error: return location for an error
+ *
+ * Reads cached data. The read stops at the end of the block containing
+ * @offset, which must be cached.
+ *
+ * Returns: the number of bytes read or -1 on error
+ **/
+gssize
+g_vfs_http_cache_entry_read (GVfsHttpCacheEntry *entry,
+                             goffset             offset,
+                             void               *buffer,
+                             gsize               count,
+                             GError            **error)
+{
+  goffset block_end;
+  gssize n;
+
+  g_return_val_if_fail (g_vfs_http_cache_entry_has_block (entry, offset), -1);
+
+  block_end = (offset / G_VFS_HTTP_CACHE_BLOCK_SIZE + 1) * G_VFS_HTTP_CACHE_BLOCK_SIZE;
+  count = MIN (count, MIN (block_end, entry->size) - offset);
+
+  do
+    n = pread (entry->fd, buffer, count, offset);
+  while (n == -1 && errno == EINTR);
+
+  if (n == -1)
+    {
+      int errsv = errno;
+
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                   "Error reading cache file: %s", g_strerror (errsv));
+      return -1;
+    }
+
+  return n;
+}
+
+/**
+ * g_vfs_http_cache_entry_write:
+ * @entry: the entry
+ * @run_start: where the download that produced @buffer started
+ * @offset: the offset of @buffer in the file
+ * @buffer: data from the server
+ * @count: size of @buffer
+ *
+ * Stores downloaded data. Blocks are marked as cached once the data
+ * from @run_start up to the end of @buffer covers them completely.
+ * Failures only mean that the data isn't cached, so they are not
+ * reported.
+ **/
+void
+g_vfs_http_cache_entry_write (GVfsHttpCacheEntry *entry,
+                              goffset             run_start,
+                              goffset             offset,
+                              const void         *buffer,
+                              gsize               count)
+{
+  goffset end;
+  gsize first, last, block;
+  gssize n;
+
+  g_return_if_fail (entry != NULL);
+  g_return_if_fail (run_start <= offset);
+
+  if (entry->size <= 0 || offset + count > entry->size)
+    return;
+
+  while (count > 0)
+    {
+      n = pwrite (entry->fd, buffer, count, offset);
+      if (n == -1 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        {
+          /* Most likely the disk is full, stop caching this file */
+          g_debug ("http cache: could not write %s: %s\n",
+                   entry->uri, g_strerror (errno));
+          g_vfs_http_cache_entry_reset (entry, NULL, NULL, -1);
+          return;
+        }
+
+      buffer = (const guint8 *) buffer + n;
+      offset += n;
+      count -= n;
+    }
+
+  end = offset;
+  first = (run_start + G_VFS_HTTP_CACHE_BLOCK_SIZE - 1) / G_VFS_HTTP_CACHE_BLOCK_SIZE;
+  if (end == entry->size)
+    last = entry->n_blocks;
+  else
+    last = end / G_VFS_HTTP_CACHE_BLOCK_SIZE;
+
+  for (block = first; block < last; block++)
+    entry->blocks[block / 8] |= 1 << (block % 8);
+}
@@ -0,0 +1,64 @@
+/* GIO - GLib Input, Output and Streaming Library
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __G_VFS_HTTP_CACHE_H__
+#define __G_VFS_HTTP_CACHE_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define G_VFS_HTTP_CACHE_BLOCK_SIZE (256 * 1024)
+
+typedef struct _GVfsHttpCacheEntry GVfsHttpCacheEntry;
+
+GVfsHttpCacheEntry *    g_vfs_http_cache_entry_open             (const char *           uri,
+                                                                 guint64                cache_size);
+GVfsHttpCacheEntry *    g_vfs_http_cache_entry_ref              (GVfsHttpCacheEntry *   entry);
+void                    g_vfs_http_cache_entry_unref            (GVfsHttpCacheEntry *   entry);
+
+const char *            g_vfs_http_cache_entry_get_etag         (GVfsHttpCacheEntry *   entry);
+const char *            g_vfs_http_cache_entry_get_last_modified(GVfsHttpCacheEntry *   entry);
+goffset                 g_vfs_http_cache_entry_get_size         (GVfsHttpCacheEntry *   entry);
+gboolean                g_vfs_http_cache_entry_matches          (GVfsHttpCacheEntry *   entry,
+                                                                 const char *           etag,
+                                                                 const char *           last_modified,
+                                                                 goffset                size);
+void                    g_vfs_http_cache_entry_reset            (GVfsHttpCacheEntry *   entry,
+                                                                 const char *           etag,
+                                                                 const char *           last_modified,
+                                                                 goffset                size);
+
+gboolean                g_vfs_http_cache_entry_has_block        (GVfsHttpCacheEntry *   entry,
+                                                                 goffset                offset);
+gssize                  g_vfs_http_cache_entry_read             (GVfsHttpCacheEntry *   entry,
+                                                                 goffset                offset,
+                                                                 void *                 buffer,
+                                                                 gsize                  count,
+                                                                 GError **              error);
+void                    g_vfs_http_cache_entry_write            (GVfsHttpCacheEntry *   entry,
+                                                                 goffset                run_start,
+                                                                 goffset                offset,
+                                                                 const void *           buffer,
+                                                                 gsize                  count);
+
+G_END_DECLS
+
+#endif /* __G_VFS_HTTP_CACHE_H__ */
@@ -0,0 +1,622 @@
+/* GIO - GLib Input, Output and Streaming Library
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include <libsoup/soup.h>
+
+#include "gvfshttpcachedstream.h"
+#include "soup-input-stream.h"
+
+/* Reads a file through a GVfsHttpCacheEntry that has been validated
+ * against the server. Blocks present in the cache are read from disk,
+ * everything else comes from the "upstream" stream, a download of the
+ * file from upstream_offset on, and is stored in the cache on the way.
+ *
+ * The upstream is either the stream of the original GET or a ranged GET
+ * started whenever the read position moves to data that isn't cached.
+ * The latter use If-Range, so a file that changed on the server since
+ * it was validated can't mix with the cached data. */
+
+struct _GVfsHttpCachedStream
+{
+  GInputStream parent_instance;
+
+  SoupSession          *session;
+  SoupURI              *uri;
+  GVfsHttpCacheEntry   *entry;
+  char                 *validator;      /* for If-Range */
+  goffset               size;
+  goffset               offset;
+
+  GInputStream         *upstream;
+  goffset               upstream_offset;
+  goffset               run_start;      /* where the upstream started */
+
+  GSimpleAsyncResult   *result;
+  void                 *buffer;
+  gsize                 count;
+  GCancellable         *cancellable;
+};
+
+struct _GVfsHttpCachedStreamClass
+{
+  GInputStreamClass parent_class;
+};
+
+static void g_vfs_http_cached_stream_seekable_iface_init (GSeekableIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (GVfsHttpCachedStream, g_vfs_http_cached_stream, G_TYPE_INPUT_STREAM,
+                         G_IMPLEMENT_INTERFACE (G_TYPE_SEEKABLE,
+                                                g_vfs_http_cached_stream_seekable_iface_init))
+
+static void
+stream_drop_upstream (GVfsHttpCachedStream *stream)
+{
+  if (stream->upstream == NULL)
+    return;
+
+  g_input_stream_close (stream->upstream, NULL, NULL);
+  g_object_unref (stream->upstream);
+  stream->upstream = NULL;
+}
+
+static GInputStream *
+stream_new_upstream (GVfsHttpCachedStream *stream)
+{
+  GInputStream *upstream;
+  SoupMessage *msg;
+  char *range;
+
+  msg = soup_message_new_from_uri (SOUP_METHOD_GET, stream->uri);
+  range = g_strdup_printf ("bytes=%"G_GINT64_FORMAT"-", (gint64) stream->offset);
+  soup_message_headers_append (msg->request_headers, "Range", range);
+  soup_message_headers_append (msg->request_headers, "If-Range", stream->validator);
+  g_free (range);
+
+  soup_message_body_set_accumulate (msg->response_body, FALSE);
+
+  upstream = soup_input_stream_new (stream->session, msg);
+  g_object_unref (msg);
+
+  return upstream;
+}
+
+/* Takes over a freshly sent @upstream if it really starts at the
+ * current offset, otherwise the file changed and the cache is dropped */
+static gboolean
+stream_set_upstream (GVfsHttpCachedStream  *stream,
+                     GInputStream          *upstream,
+                     GError               **error)
+{
+  SoupMessage *msg;
+  guint status;
+
+  msg = soup_input_stream_get_message (upstream);
+  status = msg->status_code;
+  g_object_unref (msg);
+
+  if (status != SOUP_STATUS_PARTIAL_CONTENT)
+    {
+      g_debug ("http cache: file changed on the server (status %u)\n", status);
+      g_vfs_http_cache_entry_reset (stream->entry, NULL, NULL, -1);
+      g_input_stream_close (upstream, NULL, NULL);
+      g_object_unref (upstream);
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           "File changed on the server while reading");
+      return FALSE;
+    }
+
+  stream->upstream = upstream;
+  stream->upstream_offset = stream->offset;
+  stream->run_start = stream->offset;
+  return TRUE;
+}
+
+static gssize
+stream_got_data (GVfsHttpCachedStream  *stream,
+                 gssize                 n,
+                 GError               **error)
+{
+  if (n < 0)
+    return -1;
+
+  if (n == 0)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           "Connection closed before the end of the file");
+      return -1;
+    }
+
+  g_vfs_http_cache_entry_write (stream->entry, stream->run_start,
+                                stream->offset, stream->buffer, n);
+  stream->offset += n;
+  stream->upstream_offset += n;
+
+  return n;
+}
+
+/* Tries to serve a read without the network, returns -2 if the data
+ * has to come from upstream */
+static gssize
+stream_read_cached (GVfsHttpCachedStream  *stream,
+                    void                  *buffer,
+                    gsize                  count,
+                    GError               **error)
+{
+  gssize n;
+
+  if (stream->offset >= stream->size)
+    return 0;
+
+  if (!g_vfs_http_cache_entry_has_block (stream->entry, stream->offset))
+    return -2;
+
+  /* A download paused at another position only holds a connection */
+  if (stream->upstream_offset != stream->offset)
+    stream_drop_upstream (stream);
+
+  n = g_vfs_http_cache_entry_read (stream->entry, stream->offset,
+                                   buffer, count, error);
+  if (n > 0)
+    stream->offset += n;
+
+  return n;
+}
+
+/**
+ * g_vfs_http_cached_stream_can_handle:
+ * @msg: a GET that got its response headers
+ *
+ * Checks whether the response to @msg can be cached. Besides a
+ * validator this needs everything a partially cached file can be
+ * completed with later: byte ranges, a known size and a body that is
+ * not content-encoded.
+ *
+ * Returns: %TRUE if the file can be cached
+ **/
+gboolean
+g_vfs_http_cached_stream_can_handle (SoupMessage *msg)
+{
+  const char *accept_ranges;
+
+  if (msg->status_code != SOUP_STATUS_OK)
+    return FALSE;
+
+  if (soup_message_headers_get (msg->response_headers, "ETag") == NULL &&
+      soup_message_headers_get (msg->response_headers, "Last-Modified") == NULL)
+    return FALSE;
+
+  accept_ranges = soup_message_headers_get (msg->response_headers, "Accept-Ranges");
+  if (accept_ranges == NULL || !soup_header_contains (accept_ranges, "bytes"))
+    return FALSE;
+
+  if (soup_message_headers_get (msg->response_headers, "Content-Encoding") != NULL)
+    return FALSE;
+
+  if (soup_message_headers_get_encoding (msg->response_headers) != SOUP_ENCODING_CONTENT_LENGTH)
+    return FALSE;
+
+  return soup_message_headers_get_content_length (msg->response_headers) > 0;
+}
+
+/**
+ * g_vfs_http_cached_stream_new:
+ * @session: an async #SoupSession
+ * @uri: the URI of the file
+ * @entry: the cache entry, validated against the server
+ * @upstream: a stream reading the file from the start, or %NULL
+ *
+ * Creates a stream reading @uri through @entry. The stream takes
+ * ownership of @upstream.
+ *
+ * Returns: a new #GInputStream
+ **/
+GInputStream *
+g_vfs_http_cached_stream_new (SoupSession        *session,
+                              SoupURI            *uri,
+                              GVfsHttpCacheEntry *entry,
+                              GInputStream       *upstream)
+{
+  GVfsHttpCachedStream *stream;
+  const char *etag;
+
+  g_return_val_if_fail (SOUP_IS_SESSION (session), NULL);
+  g_return_val_if_fail (uri != NULL, NULL);
+  g_return_val_if_fail (entry != NULL, NULL);
+
+  stream = g_object_new (G_VFS_TYPE_HTTP_CACHED_STREAM, NULL);
+
+  stream->session = g_object_ref (session);
+  stream->uri = soup_uri_copy (uri);
+  stream->entry = g_vfs_http_cache_entry_ref (entry);
+  stream->size = g_vfs_http_cache_entry_get_size (entry);
+  stream->upstream = upstream;
+
+  /* If-Range only takes strong entity tags */
+  etag = g_vfs_http_cache_entry_get_etag (entry);
+  if (etag != NULL && !g_str_has_prefix (etag, "W/"))
+    stream->validator = g_strdup (etag);
+  else
+    stream->validator = g_strdup (g_vfs_http_cache_entry_get_last_modified (entry));
+
+  return G_INPUT_STREAM (stream);
+}
+
+static gssize
+g_vfs_http_cached_stream_read (GInputStream  *input,
+                               void          *buffer,
+                               gsize          count,
+                               GCancellable  *cancellable,
+                               GError       **error)
+{
+  GVfsHttpCachedStream *stream = G_VFS_HTTP_CACHED_STREAM (input);
+  GInputStream *upstream;
+  gssize n;
+
+  n = stream_read_cached (stream, buffer, count, error);
+  if (n != -2)
+    return n;
+
+  if (stream->upstream == NULL || stream->upstream_offset != stream->offset)
+    {
+      stream_drop_upstream (stream);
+
+      upstream = stream_new_upstream (stream);
+      if (!soup_input_stream_send (upstream, cancellable, error))
+        {
+          g_object_unref (upstream);
+          return -1;
+        }
+
+      if (!stream_set_upstream (stream, upstream, error))
+        return -1;
+    }
+
+  stream->buffer = buffer;
+  n = g_input_stream_read (stream->upstream, buffer, count, cancellable, error);
+  n = stream_got_data (stream, n, error);
+  stream->buffer = NULL;
+
+  return n;
+}
+
+static void
+stream_complete_read (GVfsHttpCachedStream *stream,
+                      gssize                n,
+                      GError               *error)
+{
+  GSimpleAsyncResult *result;
+
+  result = stream->result;
+  stream->result = NULL;
+  stream->buffer = NULL;
+  stream->count = 0;
+  if (stream->cancellable)
+    g_object_unref (stream->cancellable);
+  stream->cancellable = NULL;
+
+  if (n >= 0)
+    g_simple_async_result_set_op_res_gssize (result, n);
+  else
+    {
+      g_simple_async_result_set_from_error (result, error);
+      g_error_free (error);
+    }
+
+  g_simple_async_result_complete (result);
+  g_object_unref (result);
+}
+
+static void
+upstream_read_ready (GObject      *source_object,
+                     GAsyncResult *result,
+                     gpointer      user_data)
+{
+  GVfsHttpCachedStream *stream = user_data;
+  GError *error = NULL;
+  gssize n;
+
+  n = g_input_stream_read_finish (G_INPUT_STREAM (source_object), result, &error);
+  n = stream_got_data (stream, n, &error);
+  stream_complete_read (stream, n, error);
+}
+
+static void
+stream_read_upstream_async (GVfsHttpCachedStream *stream)
+{
+  g_input_stream_read_async (stream->upstream,
+                             stream->buffer,
+                             stream->count,
+                             G_PRIORITY_DEFAULT,
+                             stream->cancellable,
+                             upstream_read_ready,
+                             stream);
+}
+
+static void
+upstream_send_ready (GObject      *source_object,
+                     GAsyncResult *result,
+                     gpointer      user_data)
+{
+  GVfsHttpCachedStream *stream = user_data;
+  GInputStream *upstream = G_INPUT_STREAM (source_object);
+  GError *error = NULL;
+
+  if (!soup_input_stream_send_finish (upstream, result, &error))
+    {
+      g_object_unref (upstream);
+      stream_complete_read (stream, -1, error);
+      return;
+    }
+
+  if (!stream_set_upstream (stream, upstream, &error))
+    {
+      stream_complete_read (stream, -1, error);
+      return;
+    }
+
+  stream_read_upstream_async (stream);
+}
+
+static void
+g_vfs_http_cached_stream_read_async (GInputStream        *input,
+                                     void                *buffer,
+                                     gsize                count,
+                                     int                  io_priority,
+                                     GCancellable        *cancellable,
+                                     GAsyncReadyCallback  callback,
+                                     gpointer             user_data)
+{
+  GVfsHttpCachedStream *stream = G_VFS_HTTP_CACHED_STREAM (input);
+  GSimpleAsyncResult *result;
+  GError *error = NULL;
+  gssize n;
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, &error))
+    {
+      g_simple_async_report_gerror_in_idle (G_OBJECT (stream),
+                                            callback, user_data,
+                                            error);
+      g_error_free (error);
+      return;
+    }
+
+  result = g_simple_async_result_new (G_OBJECT (stream),
+                                      callback, user_data,
+                                      g_vfs_http_cached_stream_read_async);
+
+  n = stream_read_cached (stream, buffer, count, &error);
+
+  if (n != -2)
+    {
+      if (n >= 0)
+        g_simple_async_result_set_op_res_gssize (result, n);
+      else
+        {
+          g_simple_async_result_set_from_error (result, error);
+          g_error_free (error);
+        }
+      g_simple_async_result_complete_in_idle (result);
+      g_object_unref (result);
+      return;
+    }
+
+  stream->result = result;
+  stream->buffer = buffer;
+  stream->count = count;
+  if (cancellable)
+    stream->cancellable = g_object_ref (cancellable);
+
+  if (stream->upstream == NULL || stream->upstream_offset != stream->offset)
+    {
+      GInputStream *upstream;
+
+      stream_drop_upstream (stream);
+
+      upstream = stream_new_upstream (stream);
+      soup_input_stream_send_async (upstream,
+                                    io_priority,
+                                    cancellable,
+                                    upstream_send_ready,
+                                    stream);
+      return;
+    }
+
+  stream_read_upstream_async (stream);
+}
+
+static gssize
+g_vfs_http_cached_stream_read_finish (GInputStream  *input,
+                                      GAsyncResult  *result,
+                                      GError       **error)
+{
+  GSimpleAsyncResult *simple = G_SIMPLE_ASYNC_RESULT (result);
+
+  g_warn_if_fail (g_simple_async_result_get_source_tag (simple) == g_vfs_http_cached_stream_read_async);
+
+  if (g_simple_async_result_propagate_error (simple, error))
+    return -1;
+
+  return g_simple_async_result_get_op_res_gssize (simple);
+}
+
+static gboolean
+g_vfs_http_cached_stream_close (GInputStream  *input,
+                                GCancellable  *cancellable,
+                                GError       **error)
+{
+  stream_drop_upstream (G_VFS_HTTP_CACHED_STREAM (input));
+  return TRUE;
+}
+
+/* Like the upstream streams this has to be closed in the session's
+ * context, not in a thread */
+static void
+g_vfs_http_cached_stream_close_async (GInputStream        *input,
+                                      int                  io_priority,
+                                      GCancellable        *cancellable,
+                                      GAsyncReadyCallback  callback,
+                                      gpointer             user_data)
+{
+  GSimpleAsyncResult *result;
+
+  result = g_simple_async_result_new (G_OBJECT (input),
+                                      callback, user_data,
+                                      g_vfs_http_cached_stream_close_async);
+
+  g_vfs_http_cached_stream_close (input, cancellable, NULL);
+  g_simple_async_result_set_op_res_gboolean (result, TRUE);
+
+  g_simple_async_result_complete_in_idle (result);
+  g_object_unref (result);
+}
+
+static gboolean
+g_vfs_http_cached_stream_close_finish (GInputStream  *input,
+                                       GAsyncResult  *result,
+                                       GError       **error)
+{
+  return TRUE;
+}
+
+static goffset
+g_vfs_http_cached_stream_tell (GSeekable *seekable)
+{
+  return G_VFS_HTTP_CACHED_STREAM (seekable)->offset;
+}
+
+static gboolean
+g_vfs_http_cached_stream_can_seek (GSeekable *seekable)
+{
+  return TRUE;
+}
+
+/* Seeking only moves the position, the next read decides whether a new
+ * request is needed */
+static gboolean
+g_vfs_http_cached_stream_seek (GSeekable     *seekable,
+                               goffset        offset,
+                               GSeekType      type,
+                               GCancellable  *cancellable,
+                               GError       **error)
+{
+  GVfsHttpCachedStream *stream = G_VFS_HTTP_CACHED_STREAM (seekable);
+
+  switch (type)
+    {
+    case G_SEEK_CUR:
+      offset += stream->offset;
+      break;
+
+    case G_SEEK_END:
+      offset += stream->size;
+      break;
+
+    case G_SEEK_SET:
+      break;
+
+    default:
+      g_return_val_if_reached (FALSE);
+    }
+
+  if (offset < 0 || offset > stream->size)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                           "Invalid seek request");
+      return FALSE;
+    }
+
+  if (!g_input_stream_set_pending (G_INPUT_STREAM (stream), error))
+    return FALSE;
+
+  stream->offset = offset;
+
+  g_input_stream_clear_pending (G_INPUT_STREAM (stream));
+  return TRUE;
+}
+
+static gboolean
+g_vfs_http_cached_stream_can_truncate (GSeekable *seekable)
+{
+  return FALSE;
+}
+
+static gboolean
+g_vfs_http_cached_stream_truncate (GSeekable     *seekable,
+                                   goffset        offset,
+                                   GCancellable  *cancellable,
+                                   GError       **error)
+{
+  g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                       "Truncate not allowed on input stream");
+  return FALSE;
+}
+
+static void
+g_vfs_http_cached_stream_finalize (GObject *object)
+{
+  GVfsHttpCachedStream *stream = G_VFS_HTTP_CACHED_STREAM (object);
+
+  stream_drop_upstream (stream);
+
+  g_vfs_http_cache_entry_unref (stream->entry);
+  g_object_unref (stream->session);
+  soup_uri_free (stream->uri);
+  g_free (stream->validator);
+
+  G_OBJECT_CLASS (g_vfs_http_cached_stream_parent_class)->finalize (object);
+}
+
+static void
+g_vfs_http_cached_stream_init (GVfsHttpCachedStream *stream)
+{
+}
+
+static void
+g_vfs_http_cached_stream_class_init (GVfsHttpCachedStreamClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GInputStreamClass *stream_class = G_INPUT_STREAM_CLASS (klass);
+
+  gobject_class->finalize = g_vfs_http_cached_stream_finalize;
+
+  stream_class->read_fn = g_vfs_http_cached_stream_read;
+  stream_class->close_fn = g_vfs_http_cached_stream_close;
+  stream_class->read_async = g_vfs_http_cached_stream_read_async;
+  stream_class->read_finish = g_vfs_http_cached_stream_read_finish;
+  stream_class->close_async = g_vfs_http_cached_stream_close_async;
+  stream_class->close_finish = g_vfs_http_cached_stream_close_finish;
+}
+
+static void
+g_vfs_http_cached_stream_seekable_iface_init (GSeekableIface *iface)
+{
+  iface->tell = g_vfs_http_cached_stream_tell;
+  iface->can_seek = g_vfs_http_cached_stream_can_seek;
+  iface->seek = g_vfs_http_cached_stream_seek;
+  iface->can_truncate = g_vfs_http_cached_stream_can_truncate;
+  iface->truncate_fn = g_vfs_http_cached_stream_truncate;
+}
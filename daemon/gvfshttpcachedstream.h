@@ -0,0 +1,52 @@
+/* GIO - GLib Input, Output and Streaming Library
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __G_VFS_HTTP_CACHED_STREAM_H__
+#define __G_VFS_HTTP_CACHED_STREAM_H__
+
+#include <gio/gio.h>
+#include <libsoup/soup.h>
+
+#include "gvfshttpcache.h"
+
+G_BEGIN_DECLS
+
+#define G_VFS_TYPE_HTTP_CACHED_STREAM         (g_vfs_http_cached_stream_get_type ())
+#define G_VFS_HTTP_CACHED_STREAM(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), G_VFS_TYPE_HTTP_CACHED_STREAM, GVfsHttpCachedStream))
+#define G_VFS_HTTP_CACHED_STREAM_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST((k), G_VFS_TYPE_HTTP_CACHED_STREAM, GVfsHttpCachedStreamClass))
+#define G_VFS_IS_HTTP_CACHED_STREAM(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), G_VFS_TYPE_HTTP_CACHED_STREAM))
+#define G_VFS_IS_HTTP_CACHED_STREAM_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), G_VFS_TYPE_HTTP_CACHED_STREAM))
+#define G_VFS_HTTP_CACHED_STREAM_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), G_VFS_TYPE_HTTP_CACHED_STREAM, GVfsHttpCachedStreamClass))
+
+typedef struct _GVfsHttpCachedStream        GVfsHttpCachedStream;
+typedef struct _GVfsHttpCachedStreamClass   GVfsHttpCachedStreamClass;
+
+GType           g_vfs_http_cached_stream_get_type       (void) G_GNUC_CONST;
+
+gboolean        g_vfs_http_cached_stream_can_handle     (SoupMessage            *msg);
+
+GInputStream *  g_vfs_http_cached_stream_new            (SoupSession            *session,
+                                                         SoupURI                *uri,
+                                                         GVfsHttpCacheEntry     *entry,
+                                                         GInputStream           *upstream);
+
+G_END_DECLS
+
+#endif /* __G_VFS_HTTP_CACHED_STREAM_H__ */
@@ -0,0 +1,679 @@
+/* GIO - GLib Input, Output and Streaming Library
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include <libsoup/soup.h>
+
+#include "gvfshttpsegmentedstream.h"
+#include "soup-input-stream.h"
+
+/* Downloads a file with several ranged GETs at once and hands the data
+ * out in order. The file is cut into segments of SEGMENT_SIZE and the
+ * ones following the read position are in flight, so at most
+ * max_segments * SEGMENT_SIZE bytes are buffered.
+ *
+ * The number of requests starts at START_SEGMENTS. Whenever that many
+ * segments have finished, the throughput of this round is compared to
+ * the previous one, and one more request is allowed as long as that
+ * still pays off, one less if it got slower.
+ *
+ * Like the soup streams this uses the session's main context, it is
+ * meant for the async GInputStream API. */
+
+#define SEGMENT_SIZE (2 * 1024 * 1024)
+#define START_SEGMENTS 2
+
+/* Smaller files are not worth the extra requests */
+#define MIN_SIZE (8 * SEGMENT_SIZE)
+
+typedef struct _Segment Segment;
+
+struct _Segment {
+  GVfsHttpSegmentedStream *stream;      /* NULL once given up */
+  SoupMessage             *msg;         /* NULL once finished */
+
+  goffset                  start;
+  goffset                  end;         /* exclusive */
+  GByteArray              *data;
+  gsize                    read_pos;
+};
+
+struct _GVfsHttpSegmentedStream
+{
+  GInputStream parent_instance;
+
+  SoupSession         *session;
+  SoupURI             *uri;
+  char                *validator;       /* for If-Range, may be NULL */
+  goffset              size;
+  goffset              offset;
+
+  GQueue               segments;        /* in file order */
+  goffset              next_start;
+  guint                max_segments;
+  guint                limit;
+
+  gint64               round_start;
+  goffset              round_bytes;
+  guint                round_segments;
+  gdouble              last_rate;
+
+  GError              *error;
+
+  GSimpleAsyncResult  *result;
+  guchar              *buffer;
+  gsize                count;
+};
+
+struct _GVfsHttpSegmentedStreamClass
+{
+  GInputStreamClass parent_class;
+};
+
+static void g_vfs_http_segmented_stream_seekable_iface_init (GSeekableIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (GVfsHttpSegmentedStream, g_vfs_http_segmented_stream, G_TYPE_INPUT_STREAM,
+                         G_IMPLEMENT_INTERFACE (G_TYPE_SEEKABLE,
+                                                g_vfs_http_segmented_stream_seekable_iface_init))
+
+static void segment_got_headers (SoupMessage *msg, gpointer user_data);
+static void segment_got_chunk (SoupMessage *msg, SoupBuffer *chunk, gpointer user_data);
+
+static void
+segment_free (Segment *segment)
+{
+  if (segment->data)
+    g_byte_array_free (segment->data, TRUE);
+  g_slice_free (Segment, segment);
+}
+
+/* Detaches @segment from the stream. A request still running is
+ * cancelled if @cancel is set, in any case its callback frees it. */
+static void
+segment_release (Segment  *segment,
+                 gboolean  cancel)
+{
+  SoupSession *session = segment->stream->session;
+
+  segment->stream = NULL;
+
+  if (segment->msg == NULL)
+    {
+      segment_free (segment);
+      return;
+    }
+
+  g_signal_handlers_disconnect_by_func (segment->msg, G_CALLBACK (segment_got_headers), segment);
+  g_signal_handlers_disconnect_by_func (segment->msg, G_CALLBACK (segment_got_chunk), segment);
+  g_byte_array_free (segment->data, TRUE);
+  segment->data = NULL;
+
+  if (cancel)
+    soup_session_cancel_message (session, segment->msg, SOUP_STATUS_CANCELLED);
+}
+
+static void
+stream_release_segments (GVfsHttpSegmentedStream *stream)
+{
+  Segment *segment;
+
+  while ((segment = g_queue_pop_head (&stream->segments)) != NULL)
+    segment_release (segment, TRUE);
+}
+
+static void stream_fill (GVfsHttpSegmentedStream *stream);
+
+static gsize
+stream_copy (GVfsHttpSegmentedStream *stream,
+             guchar                  *buffer,
+             gsize                    count)
+{
+  Segment *segment;
+  gsize n;
+
+  segment = g_queue_peek_head (&stream->segments);
+  if (segment == NULL)
+    return 0;
+
+  n = MIN (segment->data->len - segment->read_pos, count);
+  memcpy (buffer, segment->data->data + segment->read_pos, n);
+  segment->read_pos += n;
+  stream->offset += n;
+
+  if (segment->read_pos == segment->end - segment->start)
+    {
+      g_queue_pop_head (&stream->segments);
+      segment_release (segment, FALSE);
+      stream_fill (stream);
+    }
+
+  return n;
+}
+
+static void
+stream_complete_read (GVfsHttpSegmentedStream *stream)
+{
+  GSimpleAsyncResult *result;
+  gsize n;
+
+  if (stream->result == NULL)
+    return;
+
+  n = stream_copy (stream, stream->buffer, stream->count);
+  if (n == 0 && stream->error == NULL && stream->offset < stream->size)
+    return;
+
+  result = stream->result;
+  stream->result = NULL;
+  stream->buffer = NULL;
+  stream->count = 0;
+
+  if (n > 0 || stream->error == NULL)
+    g_simple_async_result_set_op_res_gssize (result, n);
+  else
+    g_simple_async_result_set_from_error (result, stream->error);
+
+  g_simple_async_result_complete_in_idle (result);
+  g_object_unref (result);
+}
+
+static void
+stream_adjust (GVfsHttpSegmentedStream *stream)
+{
+  gint64 now;
+  gdouble rate;
+
+  if (++stream->round_segments < stream->max_segments)
+    return;
+
+  now = g_get_monotonic_time ();
+  rate = (gdouble) stream->round_bytes / MAX (now - stream->round_start, 1);
+
+  if (stream->last_rate == 0 || rate > stream->last_rate * 1.1)
+    {
+      if (stream->max_segments < stream->limit)
+        stream->max_segments++;
+    }
+  else if (rate < stream->last_rate * 0.9 && stream->max_segments > 1)
+    stream->max_segments--;
+
+  g_debug ("http segments: %.0f KiB/s, now %u requests\n",
+           rate * G_USEC_PER_SEC / 1024, stream->max_segments);
+
+  stream->last_rate = rate;
+  stream->round_start = now;
+  stream->round_bytes = 0;
+  stream->round_segments = 0;
+}
+
+/* A 200 means the range was ignored or If-Range didn't match. Stop
+ * right away instead of downloading the whole file for each segment. */
+static void
+segment_got_headers (SoupMessage *msg,
+                     gpointer     user_data)
+{
+  Segment *segment = user_data;
+  GVfsHttpSegmentedStream *stream = segment->stream;
+
+  if (!SOUP_STATUS_IS_SUCCESSFUL (msg->status_code) ||
+      msg->status_code == SOUP_STATUS_PARTIAL_CONTENT)
+    return;
+
+  if (stream->error == NULL)
+    g_set_error_literal (&stream->error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                         "Server did not send the requested range");
+
+  soup_session_cancel_message (stream->session, msg, SOUP_STATUS_CANCELLED);
+}
+
+static void
+segment_got_chunk (SoupMessage *msg,
+                   SoupBuffer  *chunk,
+                   gpointer     user_data)
+{
+  Segment *segment = user_data;
+  GVfsHttpSegmentedStream *stream = segment->stream;
+  gsize n;
+
+  if (msg->status_code != SOUP_STATUS_PARTIAL_CONTENT)
+    return;
+
+  /* Anything beyond the range is caught when the message finishes */
+  n = MIN (chunk->length, segment->end - segment->start - segment->data->len);
+  g_byte_array_append (segment->data, (const guint8 *) chunk->data, n);
+  stream->round_bytes += n;
+
+  if (segment == g_queue_peek_head (&stream->segments))
+    stream_complete_read (stream);
+}
+
+static void
+segment_finished (SoupSession *session,
+                  SoupMessage *msg,
+                  gpointer     user_data)
+{
+  Segment *segment = user_data;
+  GVfsHttpSegmentedStream *stream = segment->stream;
+
+  segment->msg = NULL;
+
+  if (stream == NULL)
+    {
+      segment_free (segment);
+      return;
+    }
+
+  if (stream->error == NULL)
+    {
+      if (!SOUP_STATUS_IS_SUCCESSFUL (msg->status_code))
+        g_set_error_literal (&stream->error, SOUP_HTTP_ERROR,
+                             msg->status_code, msg->reason_phrase);
+      else if (msg->status_code != SOUP_STATUS_PARTIAL_CONTENT ||
+               segment->data->len != segment->end - segment->start)
+        g_set_error_literal (&stream->error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                             "Server did not send the requested range");
+    }
+
+  stream_adjust (stream);
+  stream_fill (stream);
+  stream_complete_read (stream);
+}
+
+static void
+stream_start_segment (GVfsHttpSegmentedStream *stream)
+{
+  Segment *segment;
+  char *range;
+
+  segment = g_slice_new0 (Segment);
+  segment->stream = stream;
+  segment->start = stream->next_start;
+  segment->end = MIN (segment->start + SEGMENT_SIZE, stream->size);
+  segment->data = g_byte_array_sized_new (segment->end - segment->start);
+  stream->next_start = segment->end;
+
+  segment->msg = soup_message_new_from_uri (SOUP_METHOD_GET, stream->uri);
+  range = g_strdup_printf ("bytes=%"G_GINT64_FORMAT"-%"G_GINT64_FORMAT,
+                           (gint64) segment->start, (gint64) segment->end - 1);
+  soup_message_headers_append (segment->msg->request_headers, "Range", range);
+  g_free (range);
+
+  if (stream->validator)
+    soup_message_headers_append (segment->msg->request_headers, "If-Range",
+                                 stream->validator);
+
+  soup_message_body_set_accumulate (segment->msg->response_body, FALSE);
+  g_signal_connect (segment->msg, "got_headers",
+                    G_CALLBACK (segment_got_headers), segment);
+  g_signal_connect (segment->msg, "got_chunk",
+                    G_CALLBACK (segment_got_chunk), segment);
+
+  g_queue_push_tail (&stream->segments, segment);
+
+  /* The session takes our reference */
+  soup_session_queue_message (stream->session, segment->msg,
+                              segment_finished, segment);
+}
+
+static void
+stream_fill (GVfsHttpSegmentedStream *stream)
+{
+  while (stream->error == NULL &&
+         stream->next_start < stream->size &&
+         g_queue_get_length (&stream->segments) < stream->max_segments)
+    stream_start_segment (stream);
+}
+
+static void
+stream_restart (GVfsHttpSegmentedStream *stream,
+                goffset                  offset)
+{
+  stream_release_segments (stream);
+  g_clear_error (&stream->error);
+
+  stream->offset = offset;
+  stream->next_start = offset;
+  stream->round_start = g_get_monotonic_time ();
+  stream->round_bytes = 0;
+  stream->round_segments = 0;
+
+  stream_fill (stream);
+}
+
+/**
+ * g_vfs_http_segmented_stream_can_handle:
+ * @msg: a GET that got its response headers
+ *
+ * Checks whether the file @msg is fetching can be downloaded in
+ * segments: the server must accept byte ranges, the size must be known
+ * and large enough, and the body must not be content-encoded since
+ * ranges refer to the encoded data.
+ *
+ * Returns: %TRUE if a segmented download makes sense
+ **/
+gboolean
+g_vfs_http_segmented_stream_can_handle (SoupMessage *msg)
+{
+  const char *accept_ranges;
+
+  if (msg->status_code != SOUP_STATUS_OK)
+    return FALSE;
+
+  accept_ranges = soup_message_headers_get (msg->response_headers, "Accept-Ranges");
+  if (accept_ranges == NULL || !soup_header_contains (accept_ranges, "bytes"))
+    return FALSE;
+
+  if (soup_message_headers_get (msg->response_headers, "Content-Encoding") != NULL)
+    return FALSE;
+
+  if (soup_message_headers_get_encoding (msg->response_headers) != SOUP_ENCODING_CONTENT_LENGTH)
+    return FALSE;
+
+  return soup_message_headers_get_content_length (msg->response_headers) >= MIN_SIZE;
+}
+
+/**
+ * g_vfs_http_segmented_stream_new:
+ * @session: an async #SoupSession
+ * @msg: the GET @msg was checked with g_vfs_http_segmented_stream_can_handle()
+ * @max_segments: maximum number of requests running at the same time
+ *
+ * Creates a stream reading the file @msg is fetching with ranged
+ * requests. @msg itself is not used further, cancel it.
+ *
+ * Returns: a new #GInputStream
+ **/
+GInputStream *
+g_vfs_http_segmented_stream_new (SoupSession *session,
+                                 SoupMessage *msg,
+                                 guint        max_segments)
+{
+  GVfsHttpSegmentedStream *stream;
+  const char *etag;
+
+  g_return_val_if_fail (SOUP_IS_SESSION (session), NULL);
+  g_return_val_if_fail (SOUP_IS_MESSAGE (msg), NULL);
+
+  stream = g_object_new (G_VFS_TYPE_HTTP_SEGMENTED_STREAM, NULL);
+
+  stream->session = g_object_ref (session);
+  stream->uri = soup_uri_copy (soup_message_get_uri (msg));
+  stream->size = soup_message_headers_get_content_length (msg->response_headers);
+  stream->limit = MAX (max_segments, 1);
+  stream->max_segments = MIN (START_SEGMENTS, stream->limit);
+
+  /* If-Range only takes strong entity tags */
+  etag = soup_message_headers_get (msg->response_headers, "ETag");
+  if (etag != NULL && !g_str_has_prefix (etag, "W/"))
+    stream->validator = g_strdup (etag);
+  else
+    stream->validator = g_strdup (soup_message_headers_get (msg->response_headers,
+                                                            "Last-Modified"));
+
+  stream_restart (stream, 0);
+
+  return G_INPUT_STREAM (stream);
+}
+
+static gssize
+g_vfs_http_segmented_stream_read (GInputStream  *input,
+                                  void          *buffer,
+                                  gsize          count,
+                                  GCancellable  *cancellable,
+                                  GError       **error)
+{
+  GVfsHttpSegmentedStream *stream = G_VFS_HTTP_SEGMENTED_STREAM (input);
+  GMainContext *context;
+  gsize n;
+
+  context = soup_session_get_async_context (stream->session);
+
+  while (TRUE)
+    {
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        return -1;
+
+      n = stream_copy (stream, buffer, count);
+      if (n > 0)
+        return n;
+
+      if (stream->error)
+        {
+          g_propagate_error (error, g_error_copy (stream->error));
+          return -1;
+        }
+
+      if (stream->offset >= stream->size)
+        return 0;
+
+      g_main_context_iteration (context, TRUE);
+    }
+}
+
+static void
+g_vfs_http_segmented_stream_read_async (GInputStream        *input,
+                                        void                *buffer,
+                                        gsize                count,
+                                        int                  io_priority,
+                                        GCancellable        *cancellable,
+                                        GAsyncReadyCallback  callback,
+                                        gpointer             user_data)
+{
+  GVfsHttpSegmentedStream *stream = G_VFS_HTTP_SEGMENTED_STREAM (input);
+  GSimpleAsyncResult *result;
+  GError *error = NULL;
+
+  result = g_simple_async_result_new (G_OBJECT (stream),
+                                      callback, user_data,
+                                      g_vfs_http_segmented_stream_read_async);
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, &error))
+    {
+      g_simple_async_result_set_from_error (result, error);
+      g_error_free (error);
+      g_simple_async_result_complete_in_idle (result);
+      g_object_unref (result);
+      return;
+    }
+
+  stream->result = result;
+  stream->buffer = buffer;
+  stream->count = count;
+  stream_complete_read (stream);
+}
+
+static gssize
+g_vfs_http_segmented_stream_read_finish (GInputStream  *input,
+                                         GAsyncResult  *result,
+                                         GError       **error)
+{
+  GSimpleAsyncResult *simple = G_SIMPLE_ASYNC_RESULT (result);
+
+  g_warn_if_fail (g_simple_async_result_get_source_tag (simple) == g_vfs_http_segmented_stream_read_async);
+
+  if (g_simple_async_result_propagate_error (simple, error))
+    return -1;
+
+  return g_simple_async_result_get_op_res_gssize (simple);
+}
+
+static gboolean
+g_vfs_http_segmented_stream_close (GInputStream  *input,
+                                   GCancellable  *cancellable,
+                                   GError       **error)
+{
+  stream_release_segments (G_VFS_HTTP_SEGMENTED_STREAM (input));
+  return TRUE;
+}
+
+/* The default implementation would close in a thread, but the
+ * segments must be cancelled in the session's context */
+static void
+g_vfs_http_segmented_stream_close_async (GInputStream        *input,
+                                         int                  io_priority,
+                                         GCancellable        *cancellable,
+                                         GAsyncReadyCallback  callback,
+                                         gpointer             user_data)
+{
+  GSimpleAsyncResult *result;
+
+  result = g_simple_async_result_new (G_OBJECT (input),
+                                      callback, user_data,
+                                      g_vfs_http_segmented_stream_close_async);
+
+  g_vfs_http_segmented_stream_close (input, cancellable, NULL);
+  g_simple_async_result_set_op_res_gboolean (result, TRUE);
+
+  g_simple_async_result_complete_in_idle (result);
+  g_object_unref (result);
+}
+
+static gboolean
+g_vfs_http_segmented_stream_close_finish (GInputStream  *input,
+                                          GAsyncResult  *result,
+                                          GError       **error)
+{
+  return TRUE;
+}
+
+static goffset
+g_vfs_http_segmented_stream_tell (GSeekable *seekable)
+{
+  return G_VFS_HTTP_SEGMENTED_STREAM (seekable)->offset;
+}
+
+static gboolean
+g_vfs_http_segmented_stream_can_seek (GSeekable *seekable)
+{
+  return TRUE;
+}
+
+static gboolean
+g_vfs_http_segmented_stream_seek (GSeekable     *seekable,
+                                  goffset        offset,
+                                  GSeekType      type,
+                                  GCancellable  *cancellable,
+                                  GError       **error)
+{
+  GVfsHttpSegmentedStream *stream = G_VFS_HTTP_SEGMENTED_STREAM (seekable);
+
+  switch (type)
+    {
+    case G_SEEK_CUR:
+      offset += stream->offset;
+      break;
+
+    case G_SEEK_END:
+      offset += stream->size;
+      break;
+
+    case G_SEEK_SET:
+      break;
+
+    default:
+      g_return_val_if_reached (FALSE);
+    }
+
+  if (offset < 0 || offset > stream->size)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                           "Invalid seek request");
+      return FALSE;
+    }
+
+  if (!g_input_stream_set_pending (G_INPUT_STREAM (stream), error))
+    return FALSE;
+
+  if (offset != stream->offset)
+    stream_restart (stream, offset);
+
+  g_input_stream_clear_pending (G_INPUT_STREAM (stream));
+  return TRUE;
+}
+
+static gboolean
+g_vfs_http_segmented_stream_can_truncate (GSeekable *seekable)
+{
+  return FALSE;
+}
+
+static gboolean
+g_vfs_http_segmented_stream_truncate (GSeekable     *seekable,
+                                      goffset        offset,
+                                      GCancellable  *cancellable,
+                                      GError       **error)
+{
+  g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                       "Truncate not allowed on input stream");
+  return FALSE;
+}
+
+static void
+g_vfs_http_segmented_stream_finalize (GObject *object)
+{
+  GVfsHttpSegmentedStream *stream = G_VFS_HTTP_SEGMENTED_STREAM (object);
+
+  stream_release_segments (stream);
+
+  g_object_unref (stream->session);
+  soup_uri_free (stream->uri);
+  g_free (stream->validator);
+  g_clear_error (&stream->error);
+
+  G_OBJECT_CLASS (g_vfs_http_segmented_stream_parent_class)->finalize (object);
+}
+
+static void
+g_vfs_http_segmented_stream_init (GVfsHttpSegmentedStream *stream)
+{
+  g_queue_init (&stream->segments);
+}
+
+static void
+g_vfs_http_segmented_stream_class_init (GVfsHttpSegmentedStreamClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GInputStreamClass *stream_class = G_INPUT_STREAM_CLASS (klass);
+
+  gobject_class->finalize = g_vfs_http_segmented_stream_finalize;
+
+  stream_class->read_fn = g_vfs_http_segmented_stream_read;
+  stream_class->close_fn = g_vfs_http_segmented_stream_close;
+  stream_class->read_async = g_vfs_http_segmented_stream_read_async;
+  stream_class->read_finish = g_vfs_http_segmented_stream_read_finish;
+  stream_class->close_async = g_vfs_http_segmented_stream_close_async;
+  stream_class->close_finish = g_vfs_http_segmented_stream_close_finish;
+}
+
+static void
+g_vfs_http_segmented_stream_seekable_iface_init (GSeekableIface *iface)
+{
+  iface->tell = g_vfs_http_segmented_stream_tell;
+  iface->can_seek = g_vfs_http_segmented_stream_can_seek;
+  iface->seek = g_vfs_http_segmented_stream_seek;
+  iface->can_truncate = g_vfs_http_segmented_stream_can_truncate;
+  iface->truncate_fn = g_vfs_http_segmented_stream_truncate;
+}
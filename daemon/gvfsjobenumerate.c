@@ -220,6 +220,15 @@ g_vfs_job_enumerate_add_infos (GVfsJobEnumerate *job,
     }
 }
 
+/* Sends the infos added so far without waiting for a full message,
+ * for backends that get their listing in batches */
+void
+g_vfs_job_enumerate_flush (GVfsJobEnumerate *job)
+{
+  if (job->building_infos != NULL)
+    send_infos (job);
+}
+
 void
 g_vfs_job_enumerate_done (GVfsJobEnumerate *job)
 {
@@ -71,6 +71,7 @@ void     g_vfs_job_enumerate_add_info   (GVfsJobEnumerate      *job,
 					 GFileInfo             *info);
 void     g_vfs_job_enumerate_add_infos  (GVfsJobEnumerate      *job,
 					 const GList           *info);
+void     g_vfs_job_enumerate_flush      (GVfsJobEnumerate      *job);
 void     g_vfs_job_enumerate_done       (GVfsJobEnumerate      *job);
 
 G_END_DECLS
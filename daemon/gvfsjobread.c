@@ -46,8 +46,9 @@ g_vfs_job_read_finalize (GObject *object)
 
   job = G_VFS_JOB_READ (object);
 
+  if (!job->buffer_is_shm)
+    g_free (job->buffer);
   g_object_unref (job->channel);
-  g_free (job->buffer);
   
   if (G_OBJECT_CLASS (g_vfs_job_read_parent_class)->finalize)
     (*G_OBJECT_CLASS (g_vfs_job_read_parent_class)->finalize) (object);
@@ -85,7 +86,11 @@ g_vfs_job_read_new (GVfsReadChannel *channel,
   job->backend = backend;
   job->channel = g_object_ref (channel);
   job->handle = handle;
-  job->buffer = g_malloc (bytes_requested);
+  /* Let the backend read straight into shared memory if possible */
+  job->buffer = g_vfs_read_channel_reserve_shm (channel, bytes_requested);
+  job->buffer_is_shm = job->buffer != NULL;
+  if (job->buffer == NULL)
+    job->buffer = g_malloc (bytes_requested);
   job->bytes_requested = bytes_requested;
   
   return G_VFS_JOB (job);
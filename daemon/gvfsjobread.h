@@ -47,6 +47,7 @@ struct _GVfsJobRead
   GVfsBackendHandle handle;
   gsize bytes_requested;
   char *buffer;
+  gboolean buffer_is_shm;
   gsize data_count;
 };
 
@@ -47,7 +47,8 @@ g_vfs_job_write_finalize (GObject *object)
   job = G_VFS_JOB_WRITE (object);
 
   g_object_unref (job->channel);
-  g_free (job->data);
+  if (!job->data_is_shm)
+    g_free (job->data);
   
   if (G_OBJECT_CLASS (g_vfs_job_write_parent_class)->finalize)
     (*G_OBJECT_CLASS (g_vfs_job_write_parent_class)->finalize) (object);
@@ -94,6 +95,26 @@ g_vfs_job_write_new (GVfsWriteChannel *channel,
   return G_VFS_JOB (job);
 }
 
+/* Like g_vfs_job_write_new(), but @data points into the shared memory
+ * region of the channel and is only valid until the job has finished.
+ */
+GVfsJob *
+g_vfs_job_write_new_shm (GVfsWriteChannel *channel,
+			 GVfsBackendHandle handle,
+			 char *data,
+			 gsize data_size,
+			 GVfsBackend *backend)
+{
+  GVfsJobWrite *job;
+
+  job = G_VFS_JOB_WRITE (g_vfs_job_write_new (channel, handle,
+					      data, data_size,
+					      backend));
+  job->data_is_shm = TRUE;
+
+  return G_VFS_JOB (job);
+}
+
 /* Might be called on an i/o thwrite */
 static void
 send_reply (GVfsJob *job)
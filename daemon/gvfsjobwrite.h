@@ -47,6 +47,7 @@ struct _GVfsJobWrite
   GVfsBackendHandle handle;
   char *data;
   gsize data_size;
+  gboolean data_is_shm;
   
   gsize written_size;
 };
@@ -63,6 +64,11 @@ GVfsJob *g_vfs_job_write_new              (GVfsWriteChannel  *channel,
 					   char              *data,
 					   gsize              data_size,
 					   GVfsBackend       *backend);
+GVfsJob *g_vfs_job_write_new_shm          (GVfsWriteChannel  *channel,
+					   GVfsBackendHandle  handle,
+					   char              *data,
+					   gsize              data_size,
+					   GVfsBackend       *backend);
 void     g_vfs_job_write_set_written_size (GVfsJobWrite      *job,
 					   gsize              written_size);
 
@@ -41,12 +41,30 @@
 #include <gvfsjobcloseread.h>
 #include <gvfsfileinfo.h>
 
+/* Read sizes are adapted to the backend a bit like TCP slow start:
+ * the size doubles while reads complete quickly or throughput keeps
+ * improving, and halves when a single read takes too long. */
+#define READ_SIZE_MIN           (4 * 1024)
+#define READ_SIZE_DEFAULT       (16 * 1024)
+#define READ_SIZE_MAX           (512 * 1024)
+#define READ_FAST_LATENCY_USEC  (100 * 1000)
+#define READ_SLOW_LATENCY_USEC  (1000 * 1000)
+
 struct _GVfsReadChannel
 {
   GVfsChannel parent_instance;
 
   guint read_count;
   int seek_generation;
+
+  guint32 read_size;
+  guint32 last_request_size;
+  gint64 request_start_time;
+  gdouble throughput; /* bytes per second, smoothed */
+
+  guint32 shm_pos;      /* stream position of the next shm block */
+  char *shm_reserved;   /* buffer handed to the current read job */
+  guint32 shm_reserved_pos;
 };
 
 G_DEFINE_TYPE (GVfsReadChannel, g_vfs_read_channel, G_VFS_TYPE_CHANNEL)
@@ -95,6 +113,30 @@ read_channel_close (GVfsChannel *channel)
 				   g_vfs_channel_get_backend (channel));
 } 
 
+static guint32
+get_max_read_size (GVfsReadChannel *channel)
+{
+  gsize max_size;
+
+  max_size = g_vfs_backend_get_max_read_chunk_size (g_vfs_channel_get_backend (G_VFS_CHANNEL (channel)));
+  if (max_size == 0)
+    max_size = READ_SIZE_MAX;
+
+  return MAX (max_size, READ_SIZE_MIN);
+}
+
+static void
+reset_read_size (GVfsReadChannel *channel)
+{
+  gsize size;
+
+  size = g_vfs_backend_get_preferred_read_chunk_size (g_vfs_channel_get_backend (G_VFS_CHANNEL (channel)));
+  if (size == 0)
+    size = READ_SIZE_DEFAULT;
+
+  channel->read_size = CLAMP (size, READ_SIZE_MIN, get_max_read_size (channel));
+}
+
 /* Always request large chunks. Its very inefficient
    to do network requests for smaller chunks. */
 static guint32
@@ -102,25 +144,62 @@ modify_read_size (GVfsReadChannel *channel,
 		  guint32 requested_size)
 {
   guint32 real_size;
-  
-  if (channel->read_count <= 1)
-    real_size = 16*1024;
-  else if (channel->read_count <= 2)
-    real_size = 32*1024;
-  else
-    real_size = 64*1024;
+
+  if (channel->read_size == 0)
+    reset_read_size (channel);
+
+  real_size = channel->read_size;
   
   if (requested_size > real_size)
     real_size = requested_size;
 
   /* Don't do ridicoulously large requests as this
      is just stupid on the network */
-  if (real_size > 512 * 1024)
-    real_size = 512 * 1024;
+  real_size = MIN (real_size, get_max_read_size (channel));
+
+  channel->last_request_size = real_size;
+  channel->request_start_time = g_get_monotonic_time ();
 
   return real_size;
 }
 
+/* Might be called on an i/o thread, but never concurrently
+   with modify_read_size() as the channel runs one job at a time */
+static void
+update_read_size (GVfsReadChannel *channel,
+		  gsize count)
+{
+  gint64 elapsed;
+  gdouble rate;
+  guint32 old_size;
+
+  /* Only full reads tell us anything about the backend */
+  if (channel->request_start_time == 0 ||
+      count < channel->last_request_size)
+    return;
+
+  elapsed = MAX (g_get_monotonic_time () - channel->request_start_time, 1);
+  channel->request_start_time = 0;
+  rate = (gdouble)count * G_USEC_PER_SEC / elapsed;
+  old_size = channel->read_size;
+
+  if (elapsed > READ_SLOW_LATENCY_USEC)
+    channel->read_size = MAX (channel->read_size / 2, READ_SIZE_MIN);
+  else if (elapsed < READ_FAST_LATENCY_USEC ||
+	   rate > channel->throughput * 1.1)
+    channel->read_size = MIN (channel->read_size * 2, get_max_read_size (channel));
+
+  if (channel->throughput == 0)
+    channel->throughput = rate;
+  else
+    channel->throughput = 0.75 * channel->throughput + 0.25 * rate;
+
+  if (channel->read_size != old_size)
+    g_debug ("read channel %p: read size %"G_GUINT32_FORMAT" -> %"G_GUINT32_FORMAT
+	     " (%"G_GINT64_FORMAT" us for %"G_GSIZE_FORMAT" bytes, %.0f bytes/s)\n",
+	     channel, old_size, channel->read_size, elapsed, count, channel->throughput);
+}
+
 static GVfsJob *
 read_channel_handle_request (GVfsChannel *channel,
 			     guint32 command,
@@ -165,6 +244,9 @@ read_channel_handle_request (GVfsChannel *channel,
       
       read_channel->read_count = 0;
       read_channel->seek_generation++;
+      /* Random access, don't keep reading large chunks */
+      reset_read_size (read_channel);
+      read_channel->request_start_time = 0;
       job = g_vfs_job_seek_read_new (read_channel,
 				     backend_handle,
 				     seek_type,
@@ -272,15 +354,72 @@ g_vfs_read_channel_send_data (GVfsReadChannel  *read_channel,
 
   channel = G_VFS_CHANNEL (read_channel);
 
-  reply.type = g_htonl (G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_DATA);
+  update_read_size (read_channel, count);
+
   reply.seq_nr = g_htonl (g_vfs_channel_get_current_seq_nr (channel));
   reply.arg1 = g_htonl (count);
   reply.arg2 = g_htonl (read_channel->seek_generation);
 
+  if (count > 0 &&
+      g_vfs_read_channel_is_shm_buffer (read_channel, buffer))
+    {
+      /* Data is already in place, only send the header */
+      reply.type = g_htonl (G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_SHM_DATA);
+      read_channel->shm_pos = read_channel->shm_reserved_pos + count;
+      read_channel->shm_reserved = NULL;
+      g_vfs_channel_send_reply (channel, &reply, NULL, 0);
+      return;
+    }
+
+  reply.type = g_htonl (G_VFS_DAEMON_SOCKET_PROTOCOL_REPLY_DATA);
   g_vfs_channel_send_reply (channel, &reply, buffer, count);
 }
 
 
+/* Returns a buffer for @size bytes in the shared memory region of the
+ * channel, or %NULL if there is none or it has no room. Data put there
+ * is sent to the client without copying. Only one buffer can be
+ * reserved at a time, which is fine as a channel runs one job at a time.
+ */
+char *
+g_vfs_read_channel_reserve_shm (GVfsReadChannel *read_channel,
+				gsize            size)
+{
+  GVfsDaemonSocketProtocolShmHeader *header;
+  char *shm;
+  gsize shm_size;
+  guint32 ring_size, start, consumed;
+
+  read_channel->shm_reserved = NULL;
+  
+  shm = g_vfs_channel_get_shm (G_VFS_CHANNEL (read_channel), &shm_size);
+  if (shm == NULL)
+    return NULL;
+
+  header = (GVfsDaemonSocketProtocolShmHeader *)shm;
+  ring_size = shm_size - G_VFS_DAEMON_SOCKET_PROTOCOL_SHM_HEADER_SIZE;
+  if (size == 0 || size > ring_size / 2)
+    return NULL;
+
+  start = _g_vfs_shm_block_start (read_channel->shm_pos, ring_size, size);
+  consumed = g_atomic_int_get (&header->consumed);
+  if ((guint32)(start + size - consumed) > ring_size)
+    return NULL; /* The client is behind, use the socket */
+
+  read_channel->shm_reserved = shm + G_VFS_DAEMON_SOCKET_PROTOCOL_SHM_HEADER_SIZE +
+    (start & (ring_size - 1));
+  read_channel->shm_reserved_pos = start;
+  
+  return read_channel->shm_reserved;
+}
+
+gboolean
+g_vfs_read_channel_is_shm_buffer (GVfsReadChannel *read_channel,
+				  char            *buffer)
+{
+  return buffer != NULL && buffer == read_channel->shm_reserved;
+}
+
 GVfsReadChannel *
 g_vfs_read_channel_new (GVfsBackend *backend,
                         GPid         actual_consumer)
@@ -53,6 +53,10 @@ void            g_vfs_read_channel_send_data          (GVfsReadChannel     *read
 						       char               *buffer,
 						       gsize               count);
 void            g_vfs_read_channel_send_closed        (GVfsReadChannel     *read_channel);
+char *          g_vfs_read_channel_reserve_shm        (GVfsReadChannel     *read_channel,
+						       gsize               size);
+gboolean        g_vfs_read_channel_is_shm_buffer      (GVfsReadChannel     *read_channel,
+						       char               *buffer);
 void            g_vfs_read_channel_send_seek_offset   (GVfsReadChannel     *read_channel,
 						      goffset             offset);
 
@@ -0,0 +1,332 @@
+/* GIO - GLib Input, Output and Streaming Library
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include "gvfssftpstatcache.h"
+
+/* The sftp backend does all its work in the main loop, so unlike the
+ * ftp directory cache this needs no locking.
+ *
+ * Every entry holds up to two infos for a path, the one you get when
+ * not following symlinks (lstat) and the one you get when following
+ * them (stat). Entries expire after a fixed time and the least recently
+ * used ones are evicted when the cache is full.
+ *
+ * Changes done through the backend purge the affected paths. Replies to
+ * requests that were sent before a purge could still carry the old
+ * state, so inserts are tagged with the generation at the time the
+ * request was sent and dropped if anything was purged since. */
+
+typedef struct {
+  char *                path;
+  GFileInfo *           infos[2];       /* indexed by follow_symlinks */
+  gint64                stamps[2];      /* monotonic time of insertion */
+  GList                 link;           /* in the LRU queue */
+} StatCacheEntry;
+
+struct _GVfsSftpStatCache
+{
+  GHashTable *          entries;        /* path => StatCacheEntry */
+  GQueue                lru;            /* most recently used first */
+  gint64                ttl;            /* in microseconds */
+  guint                 max_entries;
+  guint                 generation;
+};
+
+static void
+stat_cache_entry_free (StatCacheEntry *entry)
+{
+  if (entry->infos[0])
+    g_object_unref (entry->infos[0]);
+  if (entry->infos[1])
+    g_object_unref (entry->infos[1]);
+  g_free (entry->path);
+  g_slice_free (StatCacheEntry, entry);
+}
+
+static void
+stat_cache_remove (GVfsSftpStatCache *cache,
+                   StatCacheEntry    *entry)
+{
+  g_queue_unlink (&cache->lru, &entry->link);
+  g_hash_table_remove (cache->entries, entry->path);
+}
+
+/**
+ * g_vfs_sftp_stat_cache_new:
+ * @ttl: time in seconds an entry stays valid
+ * @max_entries: maximum number of paths to keep
+ *
+ * Creates a new stat cache.
+ *
+ * Returns: a new cache, free with g_vfs_sftp_stat_cache_free()
+ **/
+GVfsSftpStatCache *
+g_vfs_sftp_stat_cache_new (guint ttl,
+                           guint max_entries)
+{
+  GVfsSftpStatCache *cache;
+
+  g_return_val_if_fail (max_entries > 0, NULL);
+
+  cache = g_slice_new0 (GVfsSftpStatCache);
+  cache->entries = g_hash_table_new_full (g_str_hash,
+                                          g_str_equal,
+                                          NULL,
+                                          (GDestroyNotify) stat_cache_entry_free);
+  g_queue_init (&cache->lru);
+  cache->ttl = (gint64) ttl * G_USEC_PER_SEC;
+  cache->max_entries = max_entries;
+
+  return cache;
+}
+
+void
+g_vfs_sftp_stat_cache_free (GVfsSftpStatCache *cache)
+{
+  g_return_if_fail (cache != NULL);
+
+  g_hash_table_destroy (cache->entries);
+  g_slice_free (GVfsSftpStatCache, cache);
+}
+
+/**
+ * g_vfs_sftp_stat_cache_get_generation:
+ * @cache: the cache
+ *
+ * Gets the current generation of the cache. Take this when sending a
+ * request whose reply will be inserted into the cache.
+ *
+ * Returns: the generation
+ **/
+guint
+g_vfs_sftp_stat_cache_get_generation (GVfsSftpStatCache *cache)
+{
+  g_return_val_if_fail (cache != NULL, 0);
+
+  return cache->generation;
+}
+
+/**
+ * g_vfs_sftp_stat_cache_lookup:
+ * @cache: the cache
+ * @path: path to look up
+ * @follow_symlinks: whether to look up stat or lstat information
+ * @matcher: the attributes the caller wants
+ *
+ * Looks up cached information for @path. Entries lacking an attribute
+ * that isn't part of the basic stat data, like the symlink target or
+ * the attributes that are only computed when asked for, are treated
+ * as missing when @matcher asks for it.
+ *
+ * Returns: a reference to the cached info or %NULL
+ **/
+GFileInfo *
+g_vfs_sftp_stat_cache_lookup (GVfsSftpStatCache     *cache,
+                              const char            *path,
+                              gboolean               follow_symlinks,
+                              GFileAttributeMatcher *matcher)
+{
+  /* Only set by the backend when the matcher asks for them */
+  static const char *optional_attributes[] = {
+    G_FILE_ATTRIBUTE_STANDARD_ICON,
+    G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME,
+    G_FILE_ATTRIBUTE_STANDARD_EDIT_NAME
+  };
+  StatCacheEntry *entry;
+  GFileInfo *info;
+  guint j;
+  int i;
+
+  g_return_val_if_fail (cache != NULL, NULL);
+  g_return_val_if_fail (path != NULL, NULL);
+
+  entry = g_hash_table_lookup (cache->entries, path);
+  if (entry == NULL)
+    return NULL;
+
+  i = follow_symlinks ? 1 : 0;
+  info = entry->infos[i];
+  if (info == NULL)
+    return NULL;
+
+  if (g_get_monotonic_time () - entry->stamps[i] > cache->ttl)
+    {
+      g_object_unref (info);
+      entry->infos[i] = NULL;
+      if (entry->infos[1 - i] == NULL)
+        stat_cache_remove (cache, entry);
+      return NULL;
+    }
+
+  if (g_file_info_get_is_symlink (info) &&
+      g_file_info_get_symlink_target (info) == NULL &&
+      g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_STANDARD_SYMLINK_TARGET))
+    return NULL;
+
+  for (j = 0; j < G_N_ELEMENTS (optional_attributes); j++)
+    {
+      if (!g_file_info_has_attribute (info, optional_attributes[j]) &&
+          g_file_attribute_matcher_matches (matcher, optional_attributes[j]))
+        return NULL;
+    }
+
+  g_queue_unlink (&cache->lru, &entry->link);
+  g_queue_push_head_link (&cache->lru, &entry->link);
+
+  return g_object_ref (info);
+}
+
+/**
+ * g_vfs_sftp_stat_cache_insert:
+ * @cache: the cache
+ * @generation: the generation when the request for @info was sent
+ * @path: path @info belongs to
+ * @follow_symlinks: whether @info is stat or lstat information
+ * @info: the info to store. The cache keeps a copy.
+ *
+ * Adds information about @path to the cache, unless the cache has been
+ * purged after @generation was taken.
+ **/
+void
+g_vfs_sftp_stat_cache_insert (GVfsSftpStatCache *cache,
+                              guint              generation,
+                              const char        *path,
+                              gboolean           follow_symlinks,
+                              GFileInfo         *info)
+{
+  StatCacheEntry *entry;
+  int i;
+
+  g_return_if_fail (cache != NULL);
+  g_return_if_fail (path != NULL);
+  g_return_if_fail (G_IS_FILE_INFO (info));
+
+  if (generation != cache->generation)
+    return;
+
+  entry = g_hash_table_lookup (cache->entries, path);
+  if (entry == NULL)
+    {
+      entry = g_slice_new0 (StatCacheEntry);
+      entry->path = g_strdup (path);
+      entry->link.data = entry;
+      g_hash_table_insert (cache->entries, entry->path, entry);
+
+      while (g_hash_table_size (cache->entries) > cache->max_entries)
+        stat_cache_remove (cache, g_queue_peek_tail (&cache->lru));
+    }
+  else
+    g_queue_unlink (&cache->lru, &entry->link);
+
+  g_queue_push_head_link (&cache->lru, &entry->link);
+
+  i = follow_symlinks ? 1 : 0;
+  if (entry->infos[i])
+    g_object_unref (entry->infos[i]);
+  entry->infos[i] = g_file_info_dup (info);
+  entry->stamps[i] = g_get_monotonic_time ();
+}
+
+/**
+ * g_vfs_sftp_stat_cache_set_symlink_target:
+ * @cache: the cache
+ * @generation: the generation when the READLINK request was sent
+ * @path: path of the symlink
+ * @target: target of the symlink
+ *
+ * Records the symlink target of @path in the infos already cached.
+ **/
+void
+g_vfs_sftp_stat_cache_set_symlink_target (GVfsSftpStatCache *cache,
+                                          guint              generation,
+                                          const char        *path,
+                                          const char        *target)
+{
+  StatCacheEntry *entry;
+  int i;
+
+  g_return_if_fail (cache != NULL);
+  g_return_if_fail (path != NULL);
+  g_return_if_fail (target != NULL);
+
+  if (generation != cache->generation)
+    return;
+
+  entry = g_hash_table_lookup (cache->entries, path);
+  if (entry == NULL)
+    return;
+
+  for (i = 0; i < 2; i++)
+    {
+      if (entry->infos[i] && g_file_info_get_is_symlink (entry->infos[i]))
+        g_file_info_set_symlink_target (entry->infos[i], target);
+    }
+}
+
+/**
+ * g_vfs_sftp_stat_cache_purge:
+ * @cache: the cache
+ * @path: path that changed
+ * @recursive: whether to also purge everything below @path
+ *
+ * Drops all information about @path. Use @recursive when a directory
+ * was moved or deleted, it has to walk the whole cache.
+ **/
+void
+g_vfs_sftp_stat_cache_purge (GVfsSftpStatCache *cache,
+                             const char        *path,
+                             gboolean           recursive)
+{
+  GHashTableIter iter;
+  StatCacheEntry *entry;
+  gsize len;
+
+  g_return_if_fail (cache != NULL);
+  g_return_if_fail (path != NULL);
+
+  cache->generation++;
+
+  entry = g_hash_table_lookup (cache->entries, path);
+  if (entry)
+    stat_cache_remove (cache, entry);
+
+  if (!recursive)
+    return;
+
+  len = strlen (path);
+  /* "/" is a prefix of everything */
+  if (len > 0 && path[len - 1] == '/')
+    len--;
+
+  g_hash_table_iter_init (&iter, cache->entries);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &entry))
+    {
+      if (strncmp (entry->path, path, len) == 0 &&
+          entry->path[len] == '/')
+        {
+          g_queue_unlink (&cache->lru, &entry->link);
+          g_hash_table_iter_remove (&iter);
+        }
+    }
+}
@@ -0,0 +1,55 @@
+/* GIO - GLib Input, Output and Streaming Library
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __G_VFS_SFTP_STAT_CACHE_H__
+#define __G_VFS_SFTP_STAT_CACHE_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GVfsSftpStatCache GVfsSftpStatCache;
+
+GVfsSftpStatCache *     g_vfs_sftp_stat_cache_new               (guint                  ttl,
+                                                                 guint                  max_entries);
+void                    g_vfs_sftp_stat_cache_free              (GVfsSftpStatCache *    cache);
+
+guint                   g_vfs_sftp_stat_cache_get_generation    (GVfsSftpStatCache *    cache);
+
+GFileInfo *             g_vfs_sftp_stat_cache_lookup            (GVfsSftpStatCache *    cache,
+                                                                 const char *           path,
+                                                                 gboolean               follow_symlinks,
+                                                                 GFileAttributeMatcher *matcher);
+void                    g_vfs_sftp_stat_cache_insert            (GVfsSftpStatCache *    cache,
+                                                                 guint                  generation,
+                                                                 const char *           path,
+                                                                 gboolean               follow_symlinks,
+                                                                 GFileInfo *            info);
+void                    g_vfs_sftp_stat_cache_set_symlink_target(GVfsSftpStatCache *    cache,
+                                                                 guint                  generation,
+                                                                 const char *           path,
+                                                                 const char *           target);
+void                    g_vfs_sftp_stat_cache_purge             (GVfsSftpStatCache *    cache,
+                                                                 const char *           path,
+                                                                 gboolean               recursive);
+
+G_END_DECLS
+
+#endif /* __G_VFS_SFTP_STAT_CACHE_H__ */
@@ -105,6 +105,8 @@ write_channel_handle_request (GVfsChannel *channel,
   GVfsBackend *backend;
   GVfsWriteChannel *write_channel;
   char *attrs;
+  char *shm;
+  gsize shm_size;
 
   write_channel = G_VFS_WRITE_CHANNEL (channel);
   backend_handle = g_vfs_channel_get_backend_handle (channel);
@@ -120,6 +122,21 @@ write_channel_handle_request (GVfsChannel *channel,
 				 backend);
       data = NULL; /* Pass ownership */
       break;
+    case G_VFS_DAEMON_SOCKET_PROTOCOL_REQUEST_SHM_WRITE:
+      shm = g_vfs_channel_get_shm (channel, &shm_size);
+      shm_size -= G_VFS_DAEMON_SOCKET_PROTOCOL_SHM_HEADER_SIZE;
+      if (shm == NULL || arg2 > shm_size || arg1 > shm_size - arg2)
+	{
+	  g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+			       "Invalid shared memory write");
+	  break;
+	}
+      job = g_vfs_job_write_new_shm (write_channel,
+				     backend_handle,
+				     shm + G_VFS_DAEMON_SOCKET_PROTOCOL_SHM_HEADER_SIZE + arg2,
+				     arg1,
+				     backend);
+      break;
     case G_VFS_DAEMON_SOCKET_PROTOCOL_REQUEST_CLOSE:
       job = g_vfs_job_close_write_new (write_channel,
 				       backend_handle,
@@ -205,6 +222,7 @@ g_vfs_write_channel_send_written (GVfsWriteChannel  *write_channel,
 {
   GVfsDaemonSocketProtocolReply reply;
   GVfsChannel *channel;
+  gsize shm_size;
 
   channel = G_VFS_CHANNEL (write_channel);
 
@@ -212,6 +230,8 @@ g_vfs_write_channel_send_written (GVfsWriteChannel  *write_channel,
   reply.seq_nr = g_htonl (g_vfs_channel_get_current_seq_nr (channel));
   reply.arg1 = g_htonl (bytes_written);
   reply.arg2 = 0;
+  if (g_vfs_channel_get_shm (channel, &shm_size) != NULL)
+    reply.arg2 = g_htonl (G_VFS_DAEMON_SOCKET_PROTOCOL_WRITTEN_SHM);
 
   g_vfs_channel_send_reply (channel, &reply, NULL, 0);
 }
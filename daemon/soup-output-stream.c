@@ -32,16 +32,26 @@
 
 G_DEFINE_TYPE (SoupOutputStream, soup_output_stream, G_TYPE_OUTPUT_STREAM)
 
+/* Data that was written but has not gone out to the network yet.
+ * Writes don't complete while more than this is buffered. */
+#define SOUP_OUTPUT_STREAM_MAX_BUFFERED (1024 * 1024)
+/* Largest body kept in memory for servers that refuse chunked requests */
+#define SOUP_OUTPUT_STREAM_MAX_LENGTH_REQUIRED (16 * 1024 * 1024)
+
 typedef void (*SoupOutputStreamCallback) (GOutputStream *);
 
 typedef struct {
   SoupSession *session;
   GMainContext *async_context;
   SoupMessage *msg;
+  gboolean queued;
+  gboolean paused;
   gboolean finished;
+  gboolean closing;
+  gboolean length_required;
 
   goffset size, offset;
-  GByteArray *ba;
+  gsize buffered;
 
   GCancellable *cancellable;
   GSource *cancel_watch;
@@ -49,6 +59,7 @@ typedef struct {
   SoupOutputStreamCallback cancelled_cb;
 
   GSimpleAsyncResult *result;
+  GSimpleAsyncResult *write_result;
 } SoupOutputStreamPrivate;
 #define SOUP_OUTPUT_STREAM_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), SOUP_TYPE_OUTPUT_STREAM, SoupOutputStreamPrivate))
 
@@ -80,19 +91,24 @@ static gboolean soup_output_stream_close_finish (GOutputStream        *stream,
 						 GError              **error);
 
 static void soup_output_stream_finished (SoupMessage *msg, gpointer stream);
+static void soup_output_stream_wrote_body_data (SoupMessage *msg,
+						SoupBuffer  *chunk,
+						gpointer     stream);
 
 static void
 soup_output_stream_finalize (GObject *object)
 {
   SoupOutputStreamPrivate *priv = SOUP_OUTPUT_STREAM_GET_PRIVATE (object);
 
-  g_object_unref (priv->session);
-
   g_signal_handlers_disconnect_by_func (priv->msg, G_CALLBACK (soup_output_stream_finished), object);
-  g_object_unref (priv->msg);
+  g_signal_handlers_disconnect_by_func (priv->msg, G_CALLBACK (soup_output_stream_wrote_body_data), object);
+
+  /* Dropped without being closed, don't leave a half sent request */
+  if (priv->queued && !priv->finished)
+    soup_session_cancel_message (priv->session, priv->msg, SOUP_STATUS_CANCELLED);
 
-  if (priv->ba)
-    g_byte_array_free (priv->ba, TRUE);
+  g_object_unref (priv->session);
+  g_object_unref (priv->msg);
 
   if (G_OBJECT_CLASS (soup_output_stream_parent_class)->finalize)
     (*G_OBJECT_CLASS (soup_output_stream_parent_class)->finalize) (object);
@@ -119,9 +135,6 @@ soup_output_stream_class_init (SoupOutputStreamClass *klass)
 static void
 soup_output_stream_init (SoupOutputStream *stream)
 {
-  SoupOutputStreamPrivate *priv = SOUP_OUTPUT_STREAM_GET_PRIVATE (stream);
-
-  priv->ba = g_byte_array_new ();
 }
 
 
@@ -143,9 +156,18 @@ soup_output_stream_init (SoupOutputStream *stream)
  * that, or closing the stream without having written enough, will
  * result in an error.
  *
- * In some situations, the request will not actually be sent until you
- * call g_output_stream_close(). (In fact, currently this is *always*
- * true.)
+ * The request is sent when the first data is written, and the body
+ * is streamed to the server as it is written, using chunked encoding
+ * if @size is not known. At most %SOUP_OUTPUT_STREAM_MAX_BUFFERED
+ * bytes are kept in memory, writes don't complete until the data went
+ * out. The request asks for "100 Continue", so a server refusing it
+ * (e.g. because of an If-Match header) does so before the body is sent.
+ *
+ * Servers that refuse chunked requests with "411 Length Required" get
+ * the whole body with a Content-Length on close instead. That needs
+ * the body in memory, so writing more than
+ * %SOUP_OUTPUT_STREAM_MAX_LENGTH_REQUIRED bytes to such a server fails
+ * with %G_IO_ERROR_NOT_SUPPORTED.
  *
  * Internally, #SoupOutputStream is implemented using asynchronous
  * I/O, so if you are using the synchronous API (eg,
@@ -191,17 +213,157 @@ soup_output_stream_cancelled (GIOChannel *chan, GIOCondition condition,
   return FALSE;
 }  
 
+static void
+soup_output_stream_queue (GOutputStream *stream)
+{
+  SoupOutputStreamPrivate *priv = SOUP_OUTPUT_STREAM_GET_PRIVATE (stream);
+
+  if (priv->queued)
+    return;
+  priv->queued = TRUE;
+
+  if (priv->size >= 0)
+    soup_message_headers_set_content_length (priv->msg->request_headers, priv->size);
+  else if (priv->length_required)
+    soup_message_headers_set_content_length (priv->msg->request_headers, priv->offset);
+  else
+    soup_message_headers_set_encoding (priv->msg->request_headers, SOUP_ENCODING_CHUNKED);
+  soup_message_headers_set_expectations (priv->msg->request_headers, SOUP_EXPECTATION_CONTINUE);
+
+  /* Let libsoup drop the chunks once they are written */
+  soup_message_body_set_accumulate (priv->msg->request_body, FALSE);
+
+  g_signal_connect (priv->msg, "wrote_body_data",
+		    G_CALLBACK (soup_output_stream_wrote_body_data), stream);
+  g_signal_connect (priv->msg, "finished",
+		    G_CALLBACK (soup_output_stream_finished), stream);
+
+  /* Add an extra ref since soup_session_queue_message steals one */
+  g_object_ref (priv->msg);
+  soup_session_queue_message (priv->session, priv->msg, NULL, NULL);
+}
+
+/* libsoup pauses the message by itself when it runs out of body data */
+static void
+soup_output_stream_unpause (GOutputStream *stream)
+{
+  SoupOutputStreamPrivate *priv = SOUP_OUTPUT_STREAM_GET_PRIVATE (stream);
+
+  if (priv->paused && !priv->finished)
+    {
+      priv->paused = FALSE;
+      soup_session_unpause_message (priv->session, priv->msg);
+    }
+}
+
+static void
+soup_output_stream_append (GOutputStream *stream,
+			   const void    *buffer,
+			   gsize          count)
+{
+  SoupOutputStreamPrivate *priv = SOUP_OUTPUT_STREAM_GET_PRIVATE (stream);
+
+  soup_message_body_append (priv->msg->request_body, SOUP_MEMORY_COPY,
+			    buffer, count);
+  priv->offset += count;
+
+  /* Everything is kept until close in that case */
+  if (priv->length_required)
+    return;
+
+  priv->buffered += count;
+
+  soup_output_stream_queue (stream);
+  soup_output_stream_unpause (stream);
+}
+
+static gboolean
+set_error_if_http_failed (SoupMessage *msg, GError **error);
+
+static gboolean
+soup_output_stream_check_write (GOutputStream  *stream,
+				gsize           count,
+				GError        **error)
+{
+  SoupOutputStreamPrivate *priv = SOUP_OUTPUT_STREAM_GET_PRIVATE (stream);
+
+  if (priv->size >= 0 && priv->offset + count > priv->size)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NO_SPACE,
+			   "Write would exceed caller-defined file size");
+      return FALSE;
+    }
+
+  if (priv->length_required &&
+      priv->offset + count > SOUP_OUTPUT_STREAM_MAX_LENGTH_REQUIRED)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+			   "Server requires the file size in advance, file too large");
+      return FALSE;
+    }
+
+  /* The server may answer before the whole body was sent */
+  if (priv->finished)
+    {
+      if (!set_error_if_http_failed (priv->msg, error))
+	g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_CLOSED,
+			     "Request already finished");
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+soup_output_stream_complete_write (GOutputStream *stream)
+{
+  SoupOutputStreamPrivate *priv = SOUP_OUTPUT_STREAM_GET_PRIVATE (stream);
+  GSimpleAsyncResult *result;
+  GError *error = NULL;
+
+  result = priv->write_result;
+  priv->write_result = NULL;
+
+  if (priv->finished && set_error_if_http_failed (priv->msg, &error))
+    {
+      g_simple_async_result_set_from_error (result, error);
+      g_error_free (error);
+    }
+
+  g_simple_async_result_complete_in_idle (result);
+  g_object_unref (result);
+}
+
+static void
+soup_output_stream_wrote_body_data (SoupMessage *msg,
+				    SoupBuffer  *chunk,
+				    gpointer     stream)
+{
+  SoupOutputStreamPrivate *priv = SOUP_OUTPUT_STREAM_GET_PRIVATE (stream);
+
+  priv->buffered -= MIN (priv->buffered, chunk->length);
+  if (priv->buffered == 0)
+    priv->paused = TRUE;
+
+  if (priv->write_result && priv->buffered <= SOUP_OUTPUT_STREAM_MAX_BUFFERED)
+    soup_output_stream_complete_write (stream);
+}
+
 static void
 soup_output_stream_prepare_for_io (GOutputStream *stream, GCancellable *cancellable)
 {
   SoupOutputStreamPrivate *priv = SOUP_OUTPUT_STREAM_GET_PRIVATE (stream);
   int cancel_fd;
 
-  /* Move the buffer to the SoupMessage */
-  soup_message_body_append (priv->msg->request_body, SOUP_MEMORY_TAKE,
-			    priv->ba->data, priv->ba->len);
-  g_byte_array_free (priv->ba, FALSE);
-  priv->ba = NULL;
+  /* Nothing was written, send an empty body */
+  if (!priv->queued && priv->size < 0)
+    priv->size = 0;
+
+  priv->closing = TRUE;
+
+  soup_message_body_complete (priv->msg->request_body);
+  soup_output_stream_queue (stream);
+  soup_output_stream_unpause (stream);
 
   /* Set up cancellation */
   priv->cancellable = cancellable;
@@ -216,9 +378,6 @@ soup_output_stream_prepare_for_io (GOutputStream *stream, GCancellable *cancella
       g_io_channel_unref (chan);
     }
 
-  /* Add an extra ref since soup_session_queue_message steals one */
-  g_object_ref (priv->msg);
-  soup_session_queue_message (priv->session, priv->msg, NULL, NULL);
 }
 
 static void
@@ -256,14 +415,20 @@ soup_output_stream_write (GOutputStream  *stream,
 {
   SoupOutputStreamPrivate *priv = SOUP_OUTPUT_STREAM_GET_PRIVATE (stream);
 
-  if (priv->size > 0 && priv->offset + count > priv->size) {
-      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NO_SPACE,
-			   "Write would exceed caller-defined file size");
-      return -1;
-  }
+  if (!soup_output_stream_check_write (stream, count, error))
+    return -1;
+
+  soup_output_stream_append (stream, buffer, count);
+
+  while (priv->buffered > SOUP_OUTPUT_STREAM_MAX_BUFFERED &&
+	 !priv->finished &&
+	 !g_cancellable_is_cancelled (cancellable))
+    g_main_context_iteration (priv->async_context, TRUE);
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error) ||
+      (priv->finished && set_error_if_http_failed (priv->msg, error)))
+    return -1;
 
-  g_byte_array_append (priv->ba, buffer, count);
-  priv->offset += count;
   return count;
 }
 
@@ -274,7 +439,7 @@ soup_output_stream_close (GOutputStream  *stream,
 {
   SoupOutputStreamPrivate *priv = SOUP_OUTPUT_STREAM_GET_PRIVATE (stream);
 
-  if (priv->size > 0 && priv->offset != priv->size) {
+  if (priv->size >= 0 && priv->offset != priv->size) {
       g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NO_SPACE,
 			   "File is incomplete");
       return -1;
@@ -299,25 +464,29 @@ soup_output_stream_write_async (GOutputStream       *stream,
 {
   SoupOutputStreamPrivate *priv = SOUP_OUTPUT_STREAM_GET_PRIVATE (stream);
   GSimpleAsyncResult *result;
+  GError *error = NULL;
 
   result = g_simple_async_result_new (G_OBJECT (stream),
 				      callback, user_data,
 				      soup_output_stream_write_async);
 
-  if (priv->size > 0 && priv->offset + count > priv->size)
+  if (!soup_output_stream_check_write (stream, count, &error))
     {
-      GError *error;
-
-      error = g_error_new (G_IO_ERROR, G_IO_ERROR_NO_SPACE,
-			   "Write would exceed caller-defined file size");
       g_simple_async_result_set_from_error (result, error);
       g_error_free (error);
+      g_simple_async_result_complete_in_idle (result);
+      g_object_unref (result);
+      return;
     }
-  else
+
+  g_simple_async_result_set_op_res_gssize (result, count);
+  soup_output_stream_append (stream, buffer, count);
+
+  /* Hold the writer back until the network catches up */
+  if (priv->buffered > SOUP_OUTPUT_STREAM_MAX_BUFFERED)
     {
-      g_byte_array_append (priv->ba, buffer, count);
-      priv->offset += count;
-      g_simple_async_result_set_op_res_gssize (result, count);
+      priv->write_result = result;
+      return;
     }
 
   g_simple_async_result_complete_in_idle (result);
@@ -334,6 +503,9 @@ soup_output_stream_write_finish (GOutputStream  *stream,
 
   simple = G_SIMPLE_ASYNC_RESULT (result);
   g_warn_if_fail (g_simple_async_result_get_source_tag (simple) == soup_output_stream_write_async);
+
+  if (g_simple_async_result_propagate_error (simple, error))
+    return -1;
   
   nwritten = g_simple_async_result_get_op_res_gssize (simple);
   return nwritten;
@@ -366,15 +538,80 @@ close_async_done (GOutputStream *stream)
   g_object_unref (result);
 }
 
+static void
+copy_header (const char *name, const char *value, gpointer headers)
+{
+  soup_message_headers_append (headers, name, value);
+}
+
+/* The server wants a Content-Length, which means having the whole body
+ * before sending it. Moves what was written so far to a new message
+ * that is sent on close. */
+static void
+soup_output_stream_restart_with_length (GOutputStream *stream)
+{
+  SoupOutputStreamPrivate *priv = SOUP_OUTPUT_STREAM_GET_PRIVATE (stream);
+  SoupMessage *msg;
+  SoupBuffer *chunk;
+  goffset offset;
+
+  msg = soup_message_new_from_uri (priv->msg->method,
+				   soup_message_get_uri (priv->msg));
+  soup_message_headers_foreach (priv->msg->request_headers,
+				copy_header, msg->request_headers);
+
+  offset = 0;
+  while ((chunk = soup_message_body_get_chunk (priv->msg->request_body, offset)))
+    {
+      offset += chunk->length;
+      soup_message_body_append_buffer (msg->request_body, chunk);
+      soup_buffer_free (chunk);
+    }
+
+  g_object_unref (priv->msg);
+  priv->msg = msg;
+  priv->length_required = TRUE;
+  priv->queued = FALSE;
+  priv->paused = FALSE;
+  priv->buffered = 0;
+
+  if (priv->write_result)
+    soup_output_stream_complete_write (stream);
+
+  if (priv->closing)
+    {
+      soup_message_body_complete (priv->msg->request_body);
+      soup_output_stream_queue (stream);
+    }
+}
+
 static void
 soup_output_stream_finished (SoupMessage *msg, gpointer stream)
 {
   SoupOutputStreamPrivate *priv = SOUP_OUTPUT_STREAM_GET_PRIVATE (stream);
 
+  g_signal_handlers_disconnect_by_func (priv->msg, G_CALLBACK (soup_output_stream_finished), stream);
+  g_signal_handlers_disconnect_by_func (priv->msg, G_CALLBACK (soup_output_stream_wrote_body_data), stream);
+
+  /* Servers that don't take chunked requests answer 411, before the
+   * body is sent since we asked for "100 Continue" */
+  if (msg->status_code == SOUP_STATUS_LENGTH_REQUIRED &&
+      priv->size < 0 && !priv->length_required &&
+      priv->buffered == priv->offset)
+    {
+      soup_output_stream_restart_with_length (stream);
+      return;
+    }
+
   priv->finished = TRUE;
 
-  g_signal_handlers_disconnect_by_func (priv->msg, G_CALLBACK (soup_output_stream_finished), stream);
-  close_async_done (stream);
+  if (priv->write_result)
+    soup_output_stream_complete_write (stream);
+
+  /* Otherwise the server answered before we were done writing,
+     the next write or close reports it */
+  if (priv->result)
+    close_async_done (stream);
 }
 
 static void
@@ -391,7 +628,7 @@ soup_output_stream_close_async (GOutputStream        *stream,
 				      callback, user_data,
 				      soup_output_stream_close_async);
 
-  if (priv->size > 0 && priv->offset != priv->size)
+  if (priv->size >= 0 && priv->offset != priv->size)
     {
       GError *error;
 
@@ -406,9 +643,10 @@ soup_output_stream_close_async (GOutputStream        *stream,
 
   priv->result = result;
   priv->cancelled_cb = close_async_done;
-  g_signal_connect (priv->msg, "finished",
-		    G_CALLBACK (soup_output_stream_finished), stream);
   soup_output_stream_prepare_for_io (stream, cancellable);
+
+  if (priv->finished && priv->result)
+    close_async_done (stream);
 }
 
 static gboolean
@@ -145,8 +145,18 @@ typedef struct {
   MetaJournalEntry *last_entry;
 
   gboolean journal_valid; /* True if all entries validated on open */
+
+  /* Index of the validated entries, oldest first in each array */
+  GHashTable *key_index; /* JournalIndexKey -> set/setv/unset entries */
+  GHashTable *path_index; /* path -> set/setv/unset entries */
+  GPtrArray *path_ops; /* copy and remove entries */
 } MetaJournal;
 
+typedef struct {
+  const char *path;
+  const char *key;
+} JournalIndexKey;
+
 struct _MetaTree {
   volatile guint ref_count;
   char *filename;
@@ -176,6 +186,7 @@ static MetaJournal *meta_journal_open          (MetaTree    *tree,
 						guint32      tag);
 static void         meta_journal_free          (MetaJournal *journal);
 static void         meta_journal_validate_more (MetaJournal *journal);
+static char        *get_next_arg               (char        *str);
 
 static gpointer
 verify_block_pointer (MetaTree *tree, guint32 pos, guint32 len)
@@ -858,9 +869,32 @@ get_journal_filename (const char *filename, guint32 random_tag)
   return g_strconcat (filename, "-", tag, ".log", NULL);
 }
 
+static guint
+journal_index_key_hash (gconstpointer v)
+{
+  const JournalIndexKey *index_key = v;
+
+  return g_str_hash (index_key->path) * 31 + g_str_hash (index_key->key);
+}
+
+static gboolean
+journal_index_key_equal (gconstpointer a,
+			 gconstpointer b)
+{
+  const JournalIndexKey *key_a = a;
+  const JournalIndexKey *key_b = b;
+
+  return
+    strcmp (key_a->path, key_b->path) == 0 &&
+    strcmp (key_a->key, key_b->key) == 0;
+}
+
 static void
 meta_journal_free (MetaJournal *journal)
 {
+  g_hash_table_destroy (journal->key_index);
+  g_hash_table_destroy (journal->path_index);
+  g_ptr_array_free (journal->path_ops, TRUE);
   g_free (journal->filename);
   munmap(journal->data, journal->len);
   close (journal->fd);
@@ -914,6 +948,52 @@ verify_journal_entry (MetaJournal *journal,
   return (MetaJournalEntry *)(journal->data + offset + entry_len);
 }
 
+/* Add a validated entry to the lookup index, call with writer lock */
+static void
+meta_journal_index_entry (MetaJournal *journal,
+			  MetaJournalEntry *entry)
+{
+  JournalIndexKey lookup, *index_key;
+  GPtrArray *entries;
+
+  switch (entry->entry_type)
+    {
+    case JOURNAL_OP_SET_KEY:
+    case JOURNAL_OP_SETV_KEY:
+    case JOURNAL_OP_UNSET_KEY:
+      lookup.path = entry->path;
+      lookup.key = get_next_arg (entry->path);
+
+      entries = g_hash_table_lookup (journal->key_index, &lookup);
+      if (entries == NULL)
+	{
+	  /* Strings point into the journal mapping */
+	  index_key = g_new (JournalIndexKey, 1);
+	  *index_key = lookup;
+	  entries = g_ptr_array_new ();
+	  g_hash_table_insert (journal->key_index, index_key, entries);
+	}
+      g_ptr_array_add (entries, entry);
+
+      entries = g_hash_table_lookup (journal->path_index, entry->path);
+      if (entries == NULL)
+	{
+	  entries = g_ptr_array_new ();
+	  g_hash_table_insert (journal->path_index, entry->path, entries);
+	}
+      g_ptr_array_add (entries, entry);
+      break;
+
+    case JOURNAL_OP_COPY_PATH:
+    case JOURNAL_OP_REMOVE_PATH:
+      g_ptr_array_add (journal->path_ops, entry);
+      break;
+
+    default:
+      break;
+    }
+}
+
 /* Try to validate more entries, call with writer lock */
 static void
 meta_journal_validate_more (MetaJournal *journal)
@@ -939,6 +1019,8 @@ meta_journal_validate_more (MetaJournal *journal)
 	  break;
 	}
 
+      meta_journal_index_entry (journal, entry);
+
       entry = next_entry;
       i++;
     }
@@ -1182,6 +1264,15 @@ meta_journal_open (MetaTree *tree, const char *filename, gboolean for_write, gui
   journal->first_entry = (MetaJournalEntry *)(data + sizeof (MetaJournalHeader));
   journal->last_entry = journal->first_entry;
   journal->last_entry_num = 0;
+  journal->key_index = g_hash_table_new_full (journal_index_key_hash,
+					      journal_index_key_equal,
+					      g_free,
+					      (GDestroyNotify)g_ptr_array_unref);
+  journal->path_index = g_hash_table_new_full (g_str_hash,
+					       g_str_equal,
+					       NULL,
+					       (GDestroyNotify)g_ptr_array_unref);
+  journal->path_ops = g_ptr_array_new ();
 
   if (memcmp (journal->header->magic, JOURNAL_MAGIC, JOURNAL_MAGIC_LEN) != 0)
     goto err;
@@ -1343,96 +1434,43 @@ meta_journal_iterate (MetaJournal *journal,
   return path_copy;
 }
 
-typedef struct {
-  const char *key;
-  MetaKeyType type;
-  guint64 mtime;
-  gpointer value;
-} PathKeyData;
-
-static gboolean
-journal_iter_key (MetaJournal *journal,
-		  MetaJournalEntryType entry_type,
-		  const char *path,
-		  guint64 mtime,
-		  const char *key,
-		  gpointer value,
-		  char **iter_path,
-		  gpointer user_data)
+/* Newest set, setv or unset of key (any key if NULL) on exactly path,
+   older than limit */
+static MetaJournalEntry *
+journal_index_find_key (MetaJournal *journal,
+			const char *path,
+			const char *key,
+			MetaJournalEntry *limit)
 {
-  PathKeyData *data = user_data;
-
-  if (strcmp (path, *iter_path) != 0)
-    return TRUE; /* No match, continue */
-
-  data->mtime = mtime;
+  JournalIndexKey lookup;
+  GPtrArray *entries;
+  guint i;
 
-  if (data->key == NULL)
-    return FALSE; /* Matched path, not interested in key, stop iterating */
-
-  if (strcmp (data->key, key) != 0)
-    return TRUE; /* No match, continue */
-
-  switch (entry_type)
+  if (key != NULL)
     {
-    case JOURNAL_OP_SET_KEY:
-      data->type = META_KEY_TYPE_STRING;
-      data->value = value;
-      break;
-    case JOURNAL_OP_SETV_KEY:
-      data->type = META_KEY_TYPE_STRINGV;
-      data->value = value;
-      break;
-    case JOURNAL_OP_UNSET_KEY:
-      data->type = META_KEY_TYPE_NONE;
-      data->value = NULL;
-      break;
-    default:
-      /* No other key type should reach this  */
-      g_assert_not_reached ();
+      lookup.path = path;
+      lookup.key = key;
+      entries = g_hash_table_lookup (journal->key_index, &lookup);
     }
-  return FALSE; /* stop iterating */
-}
-
-static gboolean
-journal_iter_path (MetaJournal *journal,
-		   MetaJournalEntryType entry_type,
-		   const char *path,
-		   guint64 mtime,
-		   const char *source_path,
-		   char **iter_path,
-		   gpointer user_data)
-{
-  PathKeyData *data = user_data;
-  char *old_path;
-  const char *remainder;
+  else
+    entries = g_hash_table_lookup (journal->path_index, path);
 
-  /* is this a parent of the iter path */
-  remainder = get_prefix_match (*iter_path, path);
-  if (remainder == NULL)
-    return TRUE; /* Not related, continue */
+  if (entries == NULL)
+    return NULL;
 
-  /* path is affected as a child of this node */
-  if (entry_type == JOURNAL_OP_REMOVE_PATH)
+  for (i = entries->len; i > 0; i--)
     {
-      if (data)
-	{
-	  data->mtime = mtime;
-	  data->type = META_KEY_TYPE_NONE;
-	  data->value = NULL;
-	}
-      return FALSE; /* stop iterating */
+      if ((MetaJournalEntry *)entries->pdata[i-1] < limit)
+	return entries->pdata[i-1];
     }
-  else if (entry_type == JOURNAL_OP_COPY_PATH)
-    {
-      old_path = *iter_path;
-      *iter_path = g_build_filename (source_path, remainder, NULL);
-      g_free (old_path);
-      return TRUE; /* Continue, with new path */
-    }
-  return TRUE;
+
+  return NULL;
 }
 
+/* Same result as walking the journal backwards from the newest entry,
+   following copies and stopping at the first set/unset of the key or
+   removal of the path, but using the index. Returns NULL if the journal
+   has the answer, otherwise the path to look up in the tree. */
 static char *
 meta_journal_reverse_map_path_and_key (MetaJournal *journal,
 				       const char *path,
@@ -1441,20 +1479,95 @@ meta_journal_reverse_map_path_and_key (MetaJournal *journal,
 				       guint64 *mtime,
 				       gpointer *value)
 {
-  PathKeyData data = {NULL};
-  char *res_path;
+  MetaJournalEntry *limit, *key_entry, *path_entry, *op;
+  const char *remainder, *op_remainder;
+  char *iter_path, *old_path;
+  guint i;
 
-  data.key = key;
-  res_path = meta_journal_iterate (journal,
-				   path,
-				   journal_iter_key,
-				   journal_iter_path,
-				   &data);
-  *type = data.type;
+  *type = META_KEY_TYPE_NONE;
   if (mtime)
-    *mtime = data.mtime;
-  *value = data.value;
-  return res_path;
+    *mtime = 0;
+  *value = NULL;
+
+  iter_path = g_strdup (path);
+
+  if (journal == NULL)
+    return iter_path;
+
+  limit = journal->last_entry;
+  i = journal->path_ops->len;
+  while (TRUE)
+    {
+      key_entry = journal_index_find_key (journal, iter_path, key, limit);
+
+      /* Newest copy or remove affecting iter_path that is newer than
+	 key_entry. Older operations only matter after following a
+	 copy, which moves limit down, so the scan never restarts */
+      path_entry = NULL;
+      remainder = NULL;
+      while (i > 0)
+	{
+	  op = journal->path_ops->pdata[i-1];
+	  if (key_entry != NULL && op < key_entry)
+	    break;
+	  i--;
+
+	  op_remainder = get_prefix_match (iter_path, op->path);
+	  if (op_remainder != NULL)
+	    {
+	      path_entry = op;
+	      remainder = op_remainder;
+	      break;
+	    }
+	}
+
+      if (path_entry == NULL)
+	{
+	  if (key_entry == NULL)
+	    return iter_path;
+
+	  g_free (iter_path);
+
+	  if (mtime)
+	    *mtime = GUINT64_FROM_BE (key_entry->mtime);
+
+	  if (key == NULL)
+	    return NULL;
+
+	  switch (key_entry->entry_type)
+	    {
+	    case JOURNAL_OP_SET_KEY:
+	      *type = META_KEY_TYPE_STRING;
+	      *value = get_next_arg (get_next_arg (key_entry->path));
+	      break;
+	    case JOURNAL_OP_SETV_KEY:
+	      *type = META_KEY_TYPE_STRINGV;
+	      *value = get_next_arg (get_next_arg (key_entry->path));
+	      break;
+	    case JOURNAL_OP_UNSET_KEY:
+	      break;
+	    default:
+	      /* No other key type should reach this  */
+	      g_assert_not_reached ();
+	    }
+	  return NULL;
+	}
+
+      if (path_entry->entry_type == JOURNAL_OP_REMOVE_PATH)
+	{
+	  if (mtime)
+	    *mtime = GUINT64_FROM_BE (path_entry->mtime);
+	  g_free (iter_path);
+	  return NULL;
+	}
+
+      /* Copy, continue with the source path from before the copy */
+      old_path = iter_path;
+      iter_path = g_build_filename (get_next_arg (path_entry->path),
+				    remainder, NULL);
+      g_free (old_path);
+      limit = path_entry;
+    }
 }
 
 MetaKeyType